@@ -0,0 +1,514 @@
+/////////////////////////////////////////////////////////////////////////////
+// animation.cpp
+/////////////////////////////////////
+// Keyframe animation: authoring, compression and playback.
+/////////////////////////////////////////////////////////////////////////////
+
+#include "animation.h"
+#include "jobs.h"
+#include <algorithm>
+
+#define ANIM_SMALLEST_RANGE     0.70710678f     // Largest value of a non-largest component
+#define ANIM_SMALLEST_STEPS     32767           // 15 bits
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           MakeRotateUnitAxis
+// Arguments:      Unit axis and angle in radians
+// Returns:        none
+/////////////////////////////////////////////////////////////////////////////
+void Quaternion::MakeRotateUnitAxis(const Vector3 &v,float t)
+{
+    float s = sinf(0.5f*t);
+    x = v.x*s;
+    y = v.y*s;
+    z = v.z*s;
+    w = cosf(0.5f*t);
+}
+
+void Quaternion::Normalize()
+{
+    float len2 = Dot(*this);
+    if(len2 > 0.0f) {
+        float r = 1.0f/sqrtf(len2);
+        x *= r; y *= r; z *= r; w *= r;
+    }
+    else
+        *this = Quaternion();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           ToMatrix
+// Arguments:      Output matrix, translation and scale
+// Returns:        none
+// Side Effects:   m = translate(t) * rotate(this) * scale(s), with this
+//                 taken to be unit length
+/////////////////////////////////////////////////////////////////////////////
+void Quaternion::ToMatrix(Matrix &m,const Vector3 &t,const Vector3 &s) const
+{
+    float xx = x*x, yy = y*y, zz = z*z;
+    float xy = x*y, xz = x*z, yz = y*z;
+    float wx = w*x, wy = w*y, wz = w*z;
+    float *o = m.m_m;
+    o[0]  = (1.0f - 2.0f*(yy+zz))*s.x;
+    o[1]  = 2.0f*(xy+wz)*s.x;
+    o[2]  = 2.0f*(xz-wy)*s.x;
+    o[3]  = 0.0f;
+    o[4]  = 2.0f*(xy-wz)*s.y;
+    o[5]  = (1.0f - 2.0f*(xx+zz))*s.y;
+    o[6]  = 2.0f*(yz+wx)*s.y;
+    o[7]  = 0.0f;
+    o[8]  = 2.0f*(xz+wy)*s.z;
+    o[9]  = 2.0f*(yz-wx)*s.z;
+    o[10] = (1.0f - 2.0f*(xx+yy))*s.z;
+    o[11] = 0.0f;
+    o[12] = t.x;
+    o[13] = t.y;
+    o[14] = t.z;
+    o[15] = 1.0f;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Nlerp
+// Arguments:      Two unit quaternions and the fraction of the way from
+//                 'a' to 'b'
+// Returns:        The normalized linear interpolation, taking the shorter
+//                 way around
+/////////////////////////////////////////////////////////////////////////////
+Quaternion Nlerp(const Quaternion &a,const Quaternion &b,float f)
+{
+    float fb = a.Dot(b) < 0.0f ? -f : f;
+    float fa = 1.0f - f;
+    Quaternion q(a.x*fa + b.x*fb,a.y*fa + b.y*fb,a.z*fa + b.z*fb,a.w*fa + b.w*fb);
+    q.Normalize();
+    return q;
+}
+
+// Linear interpolation of 'count' floats, or Nlerp for rotations
+static void Interpolate(float *out,const float *a,const float *b,float f,int channel)
+{
+    if(channel == ANIM_ROTATION) {
+        Quaternion q = Nlerp(*(const Quaternion*)a,*(const Quaternion*)b,f);
+        memcpy(out,&q,sizeof(q));
+    }
+    else {
+        for(int i = 0; i < 3; i++)
+            out[i] = a[i] + (b[i] - a[i])*f;
+    }
+}
+
+// How far 'a' is from 'b' in the units of the channel's tolerance
+static float ChannelError(const float *a,const float *b,int channel)
+{
+    if(channel == ANIM_ROTATION) {
+        double dot = fabs((double)a[0]*b[0] + (double)a[1]*b[1] + (double)a[2]*b[2] + (double)a[3]*b[3]);
+        return dot >= 1.0 ? 0.0f : (float)(2.0*acos(dot));
+    }
+    float dx = a[0]-b[0], dy = a[1]-b[1], dz = a[2]-b[2];
+    if(channel == ANIM_TRANSLATION)
+        return sqrtf(dx*dx + dy*dy + dz*dz);
+    return std::max(fabsf(dx),std::max(fabsf(dy),fabsf(dz)));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           RawAnimation constructor
+/////////////////////////////////////////////////////////////////////////////
+RawAnimation::RawAnimation()
+{
+    m_Duration = 0.0f;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Create
+// Arguments:      Number of nodes and length in seconds
+// Returns:        none
+/////////////////////////////////////////////////////////////////////////////
+void RawAnimation::Create(int nodeCount,float duration)
+{
+    m_Duration = duration > 0.0f ? duration : 0.0f;
+    m_RestT.assign(nodeCount,Vector3(0,0,0));
+    m_RestS.assign(nodeCount,Vector3(1,1,1));
+    m_RestR.assign(nodeCount,Quaternion());
+    m_Tracks.clear();
+}
+
+void RawAnimation::SetRest(int node,const Vector3 &t,const Quaternion &r,const Vector3 &s)
+{
+    m_RestT[node] = t;
+    m_RestR[node] = r;
+    m_RestR[node].Normalize();
+    m_RestS[node] = s;
+}
+
+RawAnimation::Track *RawAnimation::FindTrack(int node,int channel,bool create)
+{
+    // Keys are usually added a track at a time, so check the last one first
+    for(int i = (int)m_Tracks.size()-1; i >= 0; i--) {
+        if(m_Tracks[i].Node == node && m_Tracks[i].Channel == channel)
+            return &m_Tracks[i];
+    }
+    if(!create)
+        return 0;
+    m_Tracks.push_back(Track());
+    m_Tracks.back().Node = node;
+    m_Tracks.back().Channel = channel;
+    return &m_Tracks.back();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           AddKey
+// Arguments:      Node, channel, time in seconds and the value: 3 floats, or
+//                 4 (x,y,z,w) for a rotation
+// Returns:        none
+/////////////////////////////////////////////////////////////////////////////
+void RawAnimation::AddKey(int node,int channel,float time,const float *value)
+{
+    if(node < 0 || node >= GetNodeCount() || channel < 0 || channel >= ANIM_CHANNEL_COUNT) {
+        printf("RawAnimation: invalid node %d channel %d\n",node,channel);
+        return;
+    }
+    Track *track = FindTrack(node,channel,true);
+    if(!track->Times.empty() && time <= track->Times.back()) {
+        printf("RawAnimation: key at %g is not after %g (node %d channel %d)\n",
+               time,track->Times.back(),node,channel);
+        return;
+    }
+    track->Times.push_back(time);
+    if(channel == ANIM_ROTATION) {
+        Quaternion q(value[0],value[1],value[2],value[3]);
+        q.Normalize();
+        track->Values.insert(track->Values.end(),&q.x,&q.x+4);
+    }
+    else
+        track->Values.insert(track->Values.end(),value,value+3);
+}
+
+int RawAnimation::GetKeyCount() const
+{
+    int keys = 0;
+    for(size_t i = 0; i < m_Tracks.size(); i++)
+        keys += (int)m_Tracks[i].Times.size();
+    return keys;
+}
+
+size_t RawAnimation::GetDataSize() const
+{
+    size_t bytes = 0;
+    for(size_t i = 0; i < m_Tracks.size(); i++)
+        bytes += (m_Tracks[i].Times.size() + m_Tracks[i].Values.size())*sizeof(float);
+    return bytes;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           AnimationClip constructor
+/////////////////////////////////////////////////////////////////////////////
+AnimationClip::AnimationClip()
+{
+    m_Duration = 0.0f;
+}
+
+size_t AnimationClip::GetDataSize() const
+{
+    return m_Tracks.size()*sizeof(Track) + m_Keys.size()*sizeof(Key);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Encode
+// Arguments:      The track, a value (3 floats, 4 for rotations) and the
+//                 key to write it into
+// Returns:        none
+/////////////////////////////////////////////////////////////////////////////
+void AnimationClip::Encode(const Track &track,const float *value,Key &key) const
+{
+    if(track.Channel == ANIM_ROTATION) {
+        // Drop the largest component, making it positive so its sign
+        // needn't be stored (q and -q are the same rotation)
+        int largest = 0;
+        for(int i = 1; i < 4; i++) {
+            if(fabsf(value[i]) > fabsf(value[largest]))
+                largest = i;
+        }
+        float sign = value[largest] < 0.0f ? -1.0f : 1.0f;
+        for(int i = 0, j = 0; i < 4; i++) {
+            if(i == largest)
+                continue;
+            float f = (sign*value[i]/ANIM_SMALLEST_RANGE + 1.0f)*0.5f;
+            int q = (int)lrintf(f*ANIM_SMALLEST_STEPS);
+            q = std::min(std::max(q,0),ANIM_SMALLEST_STEPS);
+            key.Value[j++] = (unsigned short)(q << 1);
+        }
+        key.Value[0] |= largest & 1;
+        key.Value[1] |= largest >> 1;
+    }
+    else {
+        for(int i = 0; i < 3; i++) {
+            int q = track.Step[i] > 0.0f ? (int)lrintf((value[i] - track.Min[i])/track.Step[i]) : 0;
+            key.Value[i] = (unsigned short)std::min(std::max(q,0),0xffff);
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Decode
+// Arguments:      The track, one of its keys and where to put the value
+// Returns:        none
+/////////////////////////////////////////////////////////////////////////////
+void AnimationClip::Decode(const Track &track,const Key &key,float *out) const
+{
+    if(track.Channel == ANIM_ROTATION) {
+        int largest = (key.Value[0] & 1) | ((key.Value[1] & 1) << 1);
+        float sum = 0.0f;
+        for(int i = 0, j = 0; i < 4; i++) {
+            if(i == largest)
+                continue;
+            float f = (key.Value[j++] >> 1)*(1.0f/ANIM_SMALLEST_STEPS);
+            out[i] = (2.0f*f - 1.0f)*ANIM_SMALLEST_RANGE;
+            sum += out[i]*out[i];
+        }
+        out[largest] = sqrtf(std::max(1.0f - sum,0.0f));
+    }
+    else {
+        for(int i = 0; i < 3; i++)
+            out[i] = track.Min[i] + key.Value[i]*track.Step[i];
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Build
+// Arguments:      The authored animation and how much error to allow
+// Returns:        false if it has no nodes
+// Notes:          Each track is quantized first, then reduced greedily:
+//                 starting from a kept key, the segment is stretched as far
+//                 as it can go with every original key it skips still
+//                 within tolerance of the interpolated quantized values.
+//                 Tracks that end up constant at their rest value are
+//                 dropped altogether.
+/////////////////////////////////////////////////////////////////////////////
+bool AnimationClip::Build(const RawAnimation &raw,const AnimTolerance &tolerance)
+{
+    m_Tracks.clear();
+    m_Keys.clear();
+    m_Duration = raw.m_Duration;
+    m_RestT = raw.m_RestT;
+    m_RestR = raw.m_RestR;
+    m_RestS = raw.m_RestS;
+    if(raw.GetNodeCount() == 0)
+        return false;
+
+    // Node order, so playback writes the pose front to back
+    std::vector<int> order(raw.m_Tracks.size());
+    for(size_t i = 0; i < order.size(); i++)
+        order[i] = (int)i;
+    std::sort(order.begin(),order.end(),[&raw](int a,int b) {
+        const RawAnimation::Track &ta = raw.m_Tracks[a], &tb = raw.m_Tracks[b];
+        return ta.Node != tb.Node ? ta.Node < tb.Node : ta.Channel < tb.Channel;
+    });
+
+    std::vector<unsigned short> ticks;
+    std::vector<Key> keys;
+    std::vector<float> decoded;
+    std::vector<int> kept;
+    for(size_t o = 0; o < order.size(); o++) {
+        const RawAnimation::Track &src = raw.m_Tracks[order[o]];
+        int n = (int)src.Times.size();
+        if(n == 0)
+            continue;
+        int comps = src.Channel == ANIM_ROTATION ? 4 : 3;
+        float tol = src.Channel == ANIM_TRANSLATION ? tolerance.Translation :
+                    src.Channel == ANIM_ROTATION ? tolerance.Rotation : tolerance.Scale;
+
+        Track track;
+        track.Node = (unsigned short)src.Node;
+        track.Channel = (unsigned short)src.Channel;
+        for(int c = 0; c < 3; c++) {
+            float lo = 0.0f, hi = 0.0f;
+            if(src.Channel != ANIM_ROTATION) {
+                lo = hi = src.Values[c];
+                for(int k = 1; k < n; k++) {
+                    lo = std::min(lo,src.Values[3*k+c]);
+                    hi = std::max(hi,src.Values[3*k+c]);
+                }
+            }
+            track.Min[c] = lo;
+            track.Step[c] = (hi - lo)/0xffff;
+        }
+
+        // Quantize every key and decode it again
+        ticks.resize(n);
+        keys.resize(n);
+        decoded.resize(4*n);
+        for(int k = 0; k < n; k++) {
+            float t = m_Duration > 0.0f ? src.Times[k]/m_Duration : 0.0f;
+            t = std::min(std::max(t,0.0f),1.0f);
+            ticks[k] = (unsigned short)lrintf(t*ANIM_TIME_STEPS);
+            keys[k].Time = ticks[k];
+            Encode(track,&src.Values[comps*k],keys[k]);
+            Decode(track,keys[k],&decoded[4*k]);
+        }
+
+        // Stretch each segment as far as the tolerance allows
+        kept.clear();
+        kept.push_back(0);
+        int a = 0;
+        while(a < n-1) {
+            int e = a + 1;
+            while(e + 1 < n) {
+                int b = e + 1;
+                bool ok = true;
+                for(int i = a+1; i < b && ok; i++) {
+                    float span = (float)(ticks[b] - ticks[a]);
+                    float f = span > 0.0f ? (ticks[i] - ticks[a])/span : 0.0f;
+                    float v[4];
+                    Interpolate(v,&decoded[4*a],&decoded[4*b],f,src.Channel);
+                    ok = ChannelError(v,&src.Values[comps*i],src.Channel) <= tol;
+                }
+                if(!ok)
+                    break;
+                e = b;
+            }
+            kept.push_back(e);
+            a = e;
+        }
+
+        // Constant tracks need one key, and none at all if that is the rest
+        bool constant = true;
+        for(size_t k = 1; k < kept.size() && constant; k++)
+            constant = memcmp(keys[kept[k]].Value,keys[kept[0]].Value,sizeof(keys[0].Value)) == 0;
+        if(constant) {
+            kept.resize(1);
+            const float *rest = src.Channel == ANIM_TRANSLATION ? &m_RestT[src.Node].x :
+                                src.Channel == ANIM_ROTATION ? &m_RestR[src.Node].x : &m_RestS[src.Node].x;
+            bool atRest = true;
+            for(int k = 0; k < n && atRest; k++)
+                atRest = ChannelError(rest,&src.Values[comps*k],src.Channel) <= tol;
+            if(atRest)
+                continue;
+        }
+
+        track.FirstKey = (unsigned int)m_Keys.size();
+        track.KeyCount = (unsigned int)kept.size();
+        for(size_t k = 0; k < kept.size(); k++)
+            m_Keys.push_back(keys[kept[k]]);
+        m_Tracks.push_back(track);
+    }
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           AnimationPlayer constructor
+/////////////////////////////////////////////////////////////////////////////
+AnimationPlayer::AnimationPlayer()
+{
+    m_Clip = 0;
+    m_Loop = true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           SetClip
+// Arguments:      The clip to play, or 0
+// Returns:        none
+// Side Effects:   Sizes the cursors and pose for it, so sampling never
+//                 allocates
+/////////////////////////////////////////////////////////////////////////////
+void AnimationPlayer::SetClip(const AnimationClip *clip)
+{
+    m_Clip = clip;
+    int tracks = clip ? clip->GetTrackCount() : 0;
+    int nodes = clip ? clip->GetNodeCount() : 0;
+    m_Cursors.assign(tracks,0);
+    m_T.resize(nodes);
+    m_R.resize(nodes);
+    m_S.resize(nodes);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Sample
+// Arguments:      Time in seconds and the node transforms to write
+// Returns:        none
+// Notes:          Each track's cursor remembers the key segment it used
+//                 last, so playing forward only ever steps it on; a jump
+//                 backwards (or a loop) falls back to a binary search.
+/////////////////////////////////////////////////////////////////////////////
+void AnimationPlayer::Sample(float time,Matrix *locals)
+{
+    if(!m_Clip)
+        return;
+    const AnimationClip &clip = *m_Clip;
+
+    float duration = clip.m_Duration;
+    float tick = 0.0f;
+    if(duration > 0.0f) {
+        float t = time;
+        if(m_Loop) {
+            t = fmodf(t,duration);
+            if(t < 0.0f)
+                t += duration;
+        }
+        t = std::min(std::max(t,0.0f),duration);
+        tick = t/duration*ANIM_TIME_STEPS;
+    }
+
+    int nodes = clip.GetNodeCount();
+    std::copy(clip.m_RestT.begin(),clip.m_RestT.end(),m_T.begin());
+    std::copy(clip.m_RestR.begin(),clip.m_RestR.end(),m_R.begin());
+    std::copy(clip.m_RestS.begin(),clip.m_RestS.end(),m_S.begin());
+
+    const AnimationClip::Key *allKeys = clip.m_Keys.empty() ? 0 : &clip.m_Keys[0];
+    for(int i = 0; i < clip.GetTrackCount(); i++) {
+        const AnimationClip::Track &track = clip.m_Tracks[i];
+        const AnimationClip::Key *keys = allKeys + track.FirstKey;
+        unsigned int n = track.KeyCount;
+        float v[4];
+
+        if(n == 1 || tick <= keys[0].Time)
+            clip.Decode(track,keys[0],v);
+        else if(tick >= keys[n-1].Time)
+            clip.Decode(track,keys[n-1],v);
+        else {
+            // Find k with keys[k].Time <= tick < keys[k+1].Time
+            unsigned int k = m_Cursors[i];
+            if(k >= n-1 || keys[k].Time > tick) {
+                unsigned int lo = 0, hi = n-1;
+                while(hi - lo > 1) {
+                    unsigned int mid = (lo + hi)/2;
+                    if(keys[mid].Time <= tick)
+                        lo = mid;
+                    else
+                        hi = mid;
+                }
+                k = lo;
+            }
+            while(keys[k+1].Time <= tick)
+                k++;
+            m_Cursors[i] = k;
+
+            float a[4], b[4];
+            clip.Decode(track,keys[k],a);
+            clip.Decode(track,keys[k+1],b);
+            float f = (tick - keys[k].Time)/(float)(keys[k+1].Time - keys[k].Time);
+            Interpolate(v,a,b,f,track.Channel);
+        }
+
+        switch(track.Channel) {
+            case ANIM_TRANSLATION:  m_T[track.Node] = Vector3(v[0],v[1],v[2]); break;
+            case ANIM_ROTATION:     m_R[track.Node] = Quaternion(v[0],v[1],v[2],v[3]); break;
+            default:                m_S[track.Node] = Vector3(v[0],v[1],v[2]); break;
+        }
+    }
+
+    for(int i = 0; i < nodes; i++)
+        m_R[i].ToMatrix(locals[i],m_T[i],m_S[i]);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           SampleAnimations
+// Arguments:      Players with their times and outputs, and how many
+// Returns:        none
+// Side Effects:   Samples ANIM_GRAIN players per job on the shared pool
+/////////////////////////////////////////////////////////////////////////////
+void SampleAnimations(AnimJob *jobs,int count)
+{
+    ParallelFor(count,ANIM_GRAIN,[jobs](int begin,int end,int) {
+        for(int i = begin; i < end; i++)
+            jobs[i].Player->Sample(jobs[i].Time,jobs[i].Locals);
+    });
+}
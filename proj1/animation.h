@@ -0,0 +1,277 @@
+/////////////////////////////////////////////////////////////////////////////
+// animation.h
+//
+/////////////////////////////////////
+// Classes declared:
+//
+// Quaternion:      A rotation as a unit quaternion.
+//
+// RawAnimation:    Keyframes as authored: per node translation, rotation
+//                  and scale tracks of float keys at arbitrary times, plus
+//                  a rest value for every channel without a track.
+//
+// AnimationClip:   The compressed, read-only form that is played back.
+//                  Built from a RawAnimation by dropping every key that
+//                  interpolation between its neighbours reproduces within
+//                  a tolerance, then quantizing what is left to 8 bytes a
+//                  key.  Shared by every instance playing it.
+//
+// AnimationPlayer: Per instance playback state: a cursor into every track
+//                  (so forward playback never searches) and the scratch
+//                  pose.  Sample() writes the nodes' local Matrix
+//                  transforms directly.
+//
+// AnimJob:         One player, time and output array, for SampleAnimations().
+//
+// Functions declared:
+//
+// SampleAnimations(): Samples a batch of players on the shared job pool.
+//
+// Compressed keys: each key is a 16 bit time (in 1/65535ths of the clip)
+// and three 16 bit values.  Translation and scale are unorm16 within the
+// track's range.  Rotations use "smallest three": the largest quaternion
+// component is dropped (and rebuilt from the unit length), the other three
+// lie in [-1/sqrt(2),1/sqrt(2)] and are stored in 15 bits each, and the low
+// bits of the first two values say which component was dropped.
+//
+// Key reduction is done against the quantized values, so the tolerance
+// bounds the total error at every original key time (as rounded to the
+// time grid): distance for translation, per axis for scale, and angle in
+// radians for rotation.  Rotations are interpolated with normalized lerp,
+// which is what reduction measures.
+//
+// Tracks are sorted by node and their keys stored back to back, so a
+// sample walks both arrays front to back and touches two adjacent keys per
+// track.
+//
+/////////////////////////////////////
+// Common Operations Supported:
+//
+// RawAnimation raw;
+// raw.Create(nodes,duration);
+// raw.AddRotationKey(node,time,q);                // Times increasing
+//
+// AnimationClip clip;
+// clip.Build(raw,AnimTolerance());                // Reduce and quantize
+//
+// AnimationPlayer player;
+// player.SetClip(&clip);
+// player.Sample(time,locals);                     // locals[node] = T*R*S
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSE167_ANIMATION_H_
+#define CSE167_ANIMATION_H_
+
+#include "matrix.h"
+#include <vector>
+
+#define ANIM_TIME_STEPS         65535           // Quantized time units per clip
+#define ANIM_GRAIN              16              // Players per job
+
+// Channels of a node
+enum AnimChannel {
+    ANIM_TRANSLATION,
+    ANIM_ROTATION,
+    ANIM_SCALE,
+    ANIM_CHANNEL_COUNT
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// Quaternion
+//
+struct Quaternion {
+    Quaternion() : x(0.0f), y(0.0f), z(0.0f), w(1.0f) {}
+    Quaternion(float x_,float y_,float z_,float w_) : x(x_), y(y_), z(z_), w(w_) {}
+
+    // 't' radians about the unit vector 'v'
+    void MakeRotateUnitAxis(const Vector3 &v,float t);
+    void Normalize();
+    float Dot(const Quaternion &q) const            {return x*q.x + y*q.y + z*q.z + w*q.w;}
+
+    // m = translate(t) * rotate(this) * scale(s)
+    void ToMatrix(Matrix &m,const Vector3 &t,const Vector3 &s) const;
+
+    float x,y,z,w;
+};
+
+// Normalized lerp along the shorter arc
+Quaternion Nlerp(const Quaternion &a,const Quaternion &b,float f);
+
+/////////////////////////////////////////////////////////////////////////////
+// AnimTolerance
+//
+struct AnimTolerance {
+    AnimTolerance() : Translation(0.001f), Rotation(0.001f), Scale(0.001f) {}
+
+    float Translation;              // Distance
+    float Rotation;                 // Radians
+    float Scale;                    // Absolute, per axis
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// RawAnimation
+//
+class RawAnimation {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    RawAnimation();
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // Starts an empty animation of 'nodeCount' nodes, all at rest at the
+    // identity
+    void Create(int nodeCount,float duration);
+
+    // The value used where a channel has no keys
+    void SetRest(int node,const Vector3 &t,const Quaternion &r,const Vector3 &s);
+
+    // Keys must be added in increasing time order for each channel
+    void AddTranslationKey(int node,float time,const Vector3 &t)   {AddKey(node,ANIM_TRANSLATION,time,&t.x);}
+    void AddRotationKey(int node,float time,const Quaternion &r)   {AddKey(node,ANIM_ROTATION,time,&r.x);}
+    void AddScaleKey(int node,float time,const Vector3 &s)         {AddKey(node,ANIM_SCALE,time,&s.x);}
+    void AddKey(int node,int channel,float time,const float *value);
+
+    // Accessors
+    int GetNodeCount() const                        {return (int)m_RestT.size();}
+    float GetDuration() const                       {return m_Duration;}
+    int GetKeyCount() const;
+    size_t GetDataSize() const;                     // Bytes of key data
+
+private:
+    friend class AnimationClip;
+
+    struct Track {
+        int Node;
+        int Channel;
+        std::vector<float> Times;
+        std::vector<float> Values;  // 3 per key, 4 for rotations
+    };
+    Track *FindTrack(int node,int channel,bool create);
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    float m_Duration;
+    std::vector<Vector3> m_RestT, m_RestS;
+    std::vector<Quaternion> m_RestR;
+    std::vector<Track> m_Tracks;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// AnimationClip
+//
+class AnimationClip {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    AnimationClip();
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // Reduces and quantizes 'raw'.  Returns false if it has no nodes.
+    bool Build(const RawAnimation &raw,const AnimTolerance &tolerance);
+
+    // Accessors
+    int GetNodeCount() const                        {return (int)m_RestT.size();}
+    int GetTrackCount() const                       {return (int)m_Tracks.size();}
+    int GetKeyCount() const                         {return (int)m_Keys.size();}
+    float GetDuration() const                       {return m_Duration;}
+    size_t GetDataSize() const;
+
+private:
+    friend class AnimationPlayer;
+
+    struct Key {
+        unsigned short Time;
+        unsigned short Value[3];
+    };
+    struct Track {
+        unsigned short Node;
+        unsigned short Channel;
+        unsigned int FirstKey;
+        unsigned int KeyCount;
+        float Min[3];               // Dequantization for translation/scale
+        float Step[3];
+    };
+
+    void Decode(const Track &track,const Key &key,float *out) const;
+    void Encode(const Track &track,const float *value,Key &key) const;
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    float m_Duration;
+    std::vector<Vector3> m_RestT, m_RestS;
+    std::vector<Quaternion> m_RestR;
+    std::vector<Track> m_Tracks;    // Sorted by node
+    std::vector<Key> m_Keys;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// AnimationPlayer
+//
+class AnimationPlayer {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    AnimationPlayer();
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // The clip must stay alive while it is set
+    void SetClip(const AnimationClip *clip);
+    const AnimationClip *GetClip() const            {return m_Clip;}
+
+    // Looping playback (the default) wraps the time to the clip, otherwise
+    // it is clamped
+    void SetLooping(bool loop)                      {m_Loop = loop;}
+
+    // Writes the local transform of every node of the clip at 'time'
+    // seconds into locals[0..GetNodeCount()-1]
+    void Sample(float time,Matrix *locals);
+
+private:
+    // Not copyable
+    AnimationPlayer(const AnimationPlayer &);
+    AnimationPlayer &operator=(const AnimationPlayer &);
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    const AnimationClip *m_Clip;
+    bool m_Loop;
+    std::vector<unsigned int> m_Cursors;    // Key segment last used, per track
+    std::vector<Vector3> m_T, m_S;          // Pose being built
+    std::vector<Quaternion> m_R;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// AnimJob
+//
+struct AnimJob {
+    AnimationPlayer *Player;
+    float Time;
+    Matrix *Locals;
+};
+
+// Samples every job, in parallel
+void SampleAnimations(AnimJob *jobs,int count);
+
+#endif
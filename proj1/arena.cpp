@@ -0,0 +1,311 @@
+/////////////////////////////////////////////////////////////////////////////
+// arena.cpp
+/////////////////////////////////////
+// Linear arena and per-frame arena set.
+//
+// This file also replaces the global operator new/delete with versions
+// that count allocations, which is what GetHeapAllocCount() reports.
+/////////////////////////////////////////////////////////////////////////////
+
+#include "arena.h"
+#include <atomic>
+#include <new>
+
+#define ARENA_POISON_FREE       0xDD
+#define ARENA_POISON_ALLOC      0xCD
+#define ARENA_MIN_OVERFLOW      (64<<10)
+
+static std::atomic<unsigned long long> s_HeapAllocs(0);
+
+/////////////////////////////////////////////////////////////////////////////
+// Counting operator new/delete
+/////////////////////////////////////////////////////////////////////////////
+void *operator new(size_t size)
+{
+    s_HeapAllocs++;
+    void *p = malloc(size > 0 ? size : 1);
+    if(!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) throw()
+{
+    free(p);
+}
+
+void operator delete[](void *p) throw()
+{
+    free(p);
+}
+
+// The sized forms C++14 calls when it knows the size
+void operator delete(void *p,size_t) throw()
+{
+    free(p);
+}
+
+void operator delete[](void *p,size_t) throw()
+{
+    free(p);
+}
+
+unsigned long long GetHeapAllocCount()
+{
+    return s_HeapAllocs;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Arena constructor/destructor
+/////////////////////////////////////////////////////////////////////////////
+Arena::Arena()
+{
+    m_Base = 0;
+    m_Size = 0;
+    m_Used = 0;
+    m_HighWater = 0;
+    m_OverflowUsed = 0;
+    m_Overflows = 0;
+}
+
+Arena::~Arena()
+{
+    Free();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Create
+// Arguments:      Size of the main block in bytes
+// Returns:        true if the block was allocated
+/////////////////////////////////////////////////////////////////////////////
+bool Arena::Create(size_t size)
+{
+    Free();
+    m_Base = new(std::nothrow) char[size > 0 ? size : 1];
+    if(!m_Base) {
+        printf("ERROR: Arena can't allocate %u bytes\n",(unsigned int)size);
+        return false;
+    }
+    m_Size = size;
+#ifdef ARENA_POISON
+    memset(m_Base,ARENA_POISON_FREE,m_Size);
+#endif
+    return true;
+}
+
+void Arena::Free()
+{
+    Reset();
+    delete[] m_Base;
+    m_Base = 0;
+    m_Size = 0;
+    m_HighWater = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Alloc
+// Arguments:      Size in bytes and alignment (a power of two)
+// Returns:        Pointer to the memory
+// Notes:          Falls back to an overflow block from the heap if the main
+//                 block is full.
+/////////////////////////////////////////////////////////////////////////////
+void *Arena::Alloc(size_t size,size_t align)
+{
+    size_t start = ((size_t)(m_Base + m_Used) + align-1) & ~(align-1);
+    size_t offset = start - (size_t)m_Base;
+    if(m_Base == 0 || offset + size > m_Size)
+        return AllocOverflow(size,align);
+    m_Used = offset + size;
+#ifdef ARENA_POISON
+    memset(m_Base + offset,ARENA_POISON_ALLOC,size);
+#endif
+    return m_Base + offset;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           AllocOverflow
+// Arguments:      Size in bytes and alignment
+// Returns:        Pointer to the memory
+// Side Effects:   Takes a new heap block when the current overflow block
+//                 doesn't have room.  The first two words of every block
+//                 hold its size and how much of it is used.
+/////////////////////////////////////////////////////////////////////////////
+void *Arena::AllocOverflow(size_t size,size_t align)
+{
+    const size_t header = ARENA_ALIGN;
+    char *block = m_Overflow.empty() ? 0 : m_Overflow.back();
+    size_t blockSize = 0, used = 0;
+    if(block) {
+        blockSize = ((size_t*)block)[0];
+        used = ((size_t*)block)[1];
+    }
+    size_t start = ((size_t)(block + used) + align-1) & ~(align-1);
+    if(!block || start - (size_t)block + size > blockSize) {
+        blockSize = header + size + align;
+        if(blockSize < ARENA_MIN_OVERFLOW)
+            blockSize = ARENA_MIN_OVERFLOW;
+        if(blockSize < m_Size/2)
+            blockSize = m_Size/2;
+        block = new char[blockSize];
+        ((size_t*)block)[0] = blockSize;
+        used = header;
+        m_Overflow.push_back(block);
+        m_Overflows++;
+        start = ((size_t)(block + used) + align-1) & ~(align-1);
+    }
+    size_t end = start - (size_t)block + size;
+    m_OverflowUsed += end - used;
+    ((size_t*)block)[1] = end;
+#ifdef ARENA_POISON
+    memset((char*)start,ARENA_POISON_ALLOC,size);
+#endif
+    return (void*)start;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Reset
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Frees everything, updates the high water mark, and if
+//                 the arena overflowed grows the main block so it won't
+//                 next time.
+/////////////////////////////////////////////////////////////////////////////
+void Arena::Reset()
+{
+    size_t used = m_Used + m_OverflowUsed;
+    if(used > m_HighWater)
+        m_HighWater = used;
+
+#ifdef ARENA_POISON
+    if(m_Base)
+        memset(m_Base,ARENA_POISON_FREE,m_Used);
+#endif
+    m_Used = 0;
+
+    if(!m_Overflow.empty()) {
+        for(size_t i = 0; i < m_Overflow.size(); i++)
+            delete[] m_Overflow[i];
+        m_Overflow.clear();
+        m_OverflowUsed = 0;
+
+        // Grow with some slack so a slowly growing frame doesn't
+        // overflow every time
+        size_t size = m_HighWater + m_HighWater/2;
+        delete[] m_Base;
+        m_Base = new char[size];
+        m_Size = size;
+#ifdef ARENA_POISON
+        memset(m_Base,ARENA_POISON_FREE,m_Size);
+#endif
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           FrameArena constructor/destructor
+// Arguments:      Number of worker threads, and the initial size of the
+//                 main thread and per worker arenas
+/////////////////////////////////////////////////////////////////////////////
+FrameArena::FrameArena(int workerThreads,size_t frameSize,size_t threadSize)
+{
+    Create(workerThreads,frameSize,threadSize);
+}
+
+FrameArena::~FrameArena()
+{
+    for(int b = 0; b < ARENA_BUFFERS; b++) {
+        for(size_t i = 0; i < m_Arenas[b].size(); i++)
+            delete m_Arenas[b][i];
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Create
+// Arguments:      As for the constructor
+// Returns:        none
+// Side Effects:   Frees all the arenas, so nothing allocated from them may
+//                 be used after this
+/////////////////////////////////////////////////////////////////////////////
+void FrameArena::Create(int workerThreads,size_t frameSize,size_t threadSize)
+{
+    for(int b = 0; b < ARENA_BUFFERS; b++) {
+        for(size_t i = 0; i < m_Arenas[b].size(); i++)
+            delete m_Arenas[b][i];
+        m_Arenas[b].clear();
+    }
+    m_Workers = workerThreads > 0 ? workerThreads : 0;
+    m_Current = 0;
+    m_Frame = 0;
+    for(int b = 0; b < ARENA_BUFFERS; b++) {
+        for(int i = 0; i <= m_Workers; i++) {
+            Arena *a = new Arena;
+            a->Create(i == 0 ? frameSize : threadSize);
+            m_Arenas[b].push_back(a);
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           BeginFrame
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Makes the next buffer current and resets all its arenas
+/////////////////////////////////////////////////////////////////////////////
+void FrameArena::BeginFrame()
+{
+    m_Frame++;
+    m_Current = (m_Current+1) % ARENA_BUFFERS;
+    for(size_t i = 0; i < m_Arenas[m_Current].size(); i++)
+        m_Arenas[m_Current][i]->Reset();
+}
+
+size_t FrameArena::GetHighWater() const
+{
+    // The buffers alternate frames, so the worst frame is the larger of
+    // the two buffers' totals
+    size_t most = 0;
+    for(int b = 0; b < ARENA_BUFFERS; b++) {
+        size_t total = 0;
+        for(size_t i = 0; i < m_Arenas[b].size(); i++)
+            total += m_Arenas[b][i]->GetHighWater();
+        if(total > most)
+            most = total;
+    }
+    return most;
+}
+
+int FrameArena::GetOverflows() const
+{
+    int total = 0;
+    for(int b = 0; b < ARENA_BUFFERS; b++) {
+        for(size_t i = 0; i < m_Arenas[b].size(); i++)
+            total += m_Arenas[b][i]->GetOverflows();
+    }
+    return total;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Print
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Prints the size, current use and high water mark of every
+//                 arena in the current buffer
+/////////////////////////////////////////////////////////////////////////////
+void FrameArena::Print() const
+{
+    printf("Frame arenas: frame %u, high water %.1f KB, %d overflow blocks\n",
+           m_Frame,GetHighWater()/1024.0,GetOverflows());
+    const std::vector<Arena*> &set = m_Arenas[m_Current];
+    for(size_t i = 0; i < set.size(); i++) {
+        if(i == 0)
+            printf("  main:      ");
+        else
+            printf("  worker %2d: ",(int)i-1);
+        printf("%8.1f KB used of %8.1f KB, high water %8.1f KB\n",set[i]->GetUsed()/1024.0,
+               set[i]->GetSize()/1024.0,set[i]->GetHighWater()/1024.0);
+    }
+}
@@ -0,0 +1,186 @@
+/////////////////////////////////////////////////////////////////////////////
+// arena.h
+//
+/////////////////////////////////////
+// Classes declared:
+//
+// Arena:      A linear (bump) allocator.  Allocating moves a pointer
+//             forward and everything is freed at once by Reset().  Nothing
+//             in an arena has its destructor run, so only put plain data
+//             in it.
+//
+// FrameArena: The arenas for transient per-frame data.  There is one for
+//             the main thread and one per worker thread, so workers never
+//             contend, and the whole set is double buffered: data written
+//             in frame N stays valid through frame N+1, which is what a
+//             pipelined renderer consuming the previous frame needs.
+//
+// DrawCommand: One object to draw this frame, as recorded into the arena.
+//
+// If an arena runs out it takes overflow blocks from the heap for the rest
+// of the frame, and on the next Reset() grows its main block to the high
+// water mark, so after a frame or two the steady state does no heap
+// allocation at all.  GetHeapAllocCount() counts every operator new (and
+// every arena block) in the program, so that can be checked.
+//
+// When ARENA_POISON is defined (the default in debug builds), freed memory
+// is filled with 0xDD and new allocations with 0xCD, so anything still
+// pointing into a previous frame reads obvious garbage.
+//
+/////////////////////////////////////
+// Common Operations Supported:
+//
+// FrameArena frame(SharedJobPool().GetThreadCount() - 1);
+// frame.Create(workers);                           // Or a global, sized in main()
+// frame.BeginFrame();                              // Once per frame
+// Matrix *m = frame.AllocMatrices(count);          // Main thread
+// ParallelFor(count,grain,[&](int begin,int end,int thread) {
+//     Point3 *p = frame.GetThreadArena(thread).AllocArray<Point3>(n);
+// });
+// frame.Print();                                   // Usage and high water
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSE167_ARENA_H_
+#define CSE167_ARENA_H_
+
+#include "matrix.h"
+#include <vector>
+
+#if defined(_DEBUG) && !defined(ARENA_POISON)
+#define ARENA_POISON
+#endif
+
+#define ARENA_ALIGN             16              // Default alignment, enough for SSE
+#define ARENA_FRAME_SIZE        (1<<20)         // Main thread arena, per buffer
+#define ARENA_THREAD_SIZE       (256<<10)       // Each worker arena, per buffer
+#define ARENA_BUFFERS           2
+
+// Number of operator new calls and arena blocks since the program started
+unsigned long long GetHeapAllocCount();
+
+class Mesh;
+
+/////////////////////////////////////////////////////////////////////////////
+// DrawCommand
+//
+struct DrawCommand {
+    Matrix World;
+    const Mesh *Model;              // 0 for the unit cube
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// Arena
+//
+class Arena {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    Arena();
+    ~Arena();
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    bool Create(size_t size);
+    void Free();
+
+    // Returns 'size' bytes aligned to 'align' (a power of two).  Never
+    // fails unless the heap does.
+    void *Alloc(size_t size,size_t align=ARENA_ALIGN);
+
+    // Uninitialized array of 'count' T's.  T must not need a destructor.
+    template<class T> T *AllocArray(int count)      {return (T*)Alloc(count*sizeof(T),
+                                                        __alignof(T) > ARENA_ALIGN ? __alignof(T) : ARENA_ALIGN);}
+
+    // Frees everything allocated since the last Reset
+    void Reset();
+
+    // Accessors
+    size_t GetSize() const                          {return m_Size;}
+    size_t GetUsed() const                          {return m_Used + m_OverflowUsed;}
+    size_t GetHighWater() const                     {return m_HighWater;}
+    int GetOverflows() const                        {return m_Overflows;}
+
+private:
+    // Not copyable
+    Arena(const Arena &);
+    Arena &operator=(const Arena &);
+
+    void *AllocOverflow(size_t size,size_t align);
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    char *m_Base;
+    size_t m_Size;
+    size_t m_Used;
+    size_t m_HighWater;             // Most used in any one frame
+    std::vector<char*> m_Overflow;  // Heap blocks taken this frame
+    size_t m_OverflowUsed;
+    int m_Overflows;                // Total overflow blocks ever taken
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// FrameArena
+//
+class FrameArena {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    FrameArena(int workerThreads=0,size_t frameSize=ARENA_FRAME_SIZE,size_t threadSize=ARENA_THREAD_SIZE);
+    ~FrameArena();
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // Frees every arena and makes new ones for 'workerThreads' workers.
+    // Lets a global be sized once the job pool exists.
+    void Create(int workerThreads,size_t frameSize=ARENA_FRAME_SIZE,size_t threadSize=ARENA_THREAD_SIZE);
+
+    // Flips to the other buffer and resets it, freeing what was allocated
+    // two frames ago.  Workers must not be allocating while this runs.
+    void BeginFrame();
+
+    // Main thread arena for the current frame
+    Arena &Get()                                    {return *m_Arenas[m_Current][0];}
+    // Arena for job thread 'thread' as ParallelFor numbers them (see
+    // jobs.h): 0 is the calling thread, which gets the main arena
+    Arena &GetThreadArena(int thread)               {return *m_Arenas[m_Current][thread];}
+    int GetWorkerCount() const                      {return m_Workers;}
+
+    // Typed temporary arrays from the main thread arena
+    Matrix *AllocMatrices(int count)                {return Get().AllocArray<Matrix>(count);}
+    Point3 *AllocPoints(int count)                  {return Get().AllocArray<Point3>(count);}
+    DrawCommand *AllocCommands(int count)           {return Get().AllocArray<DrawCommand>(count);}
+
+    // Sum over all arenas of the high water marks and overflow blocks
+    size_t GetHighWater() const;
+    int GetOverflows() const;
+    unsigned int GetFrame() const                   {return m_Frame;}
+
+    void Print() const;
+
+private:
+    // Not copyable
+    FrameArena(const FrameArena &);
+    FrameArena &operator=(const FrameArena &);
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    std::vector<Arena*> m_Arenas[ARENA_BUFFERS];    // [buffer][0 = main, 1.. = workers]
+    int m_Workers;
+    int m_Current;
+    unsigned int m_Frame;
+};
+
+#endif
@@ -0,0 +1,696 @@
+/////////////////////////////////////////////////////////////////////////////
+// bench.cpp
+/////////////////////////////////////
+// Headless benchmark of the CPU side of a frame on procedural scenes.
+//
+// Usage: bench [options]
+//   -objects N       Objects in the scene, 10 to 10000000 (default 10000)
+//   -depth D         Levels in the hierarchy, the root's included (default 4)
+//   -fanout F        Children per object; by default the smallest that
+//                    fits -objects in -depth levels
+//   -frames N        Frames timed (default 20)
+//   -warmup N        Frames run first and not timed (default 2)
+//   -size WxH        Image size for the raster, tex and trace stages
+//                    (default 640x480)
+//   -stages a,b,...  Stages to run (default animate,transform,cull,raster)
+//   -out file        Writes the JSON report there (none by default)
+//   -baseline file   A report from an earlier run to compare against
+//   -tolerance pct   How much slower a stage may get before the
+//                    comparison fails (default 10)
+//
+// The scene is a tree built like the solar system's CTM chain: the root is
+// the sun, and every object orbits its parent, spinning about y, at a
+// smaller scale.  Objects are stored breadth first, so each level follows
+// the one above it and a parent always comes before its children.  A frame
+// is the stages below, each timed on its own:
+//
+//   animate    Each object's local matrix (orbit, spin and scale)
+//   transform  World = parent's world * local, a level at a time
+//   cull       Each object's bounding sphere against the view frustum
+//   raster     Visible cubes through the software rasterizer
+//   trace      Visible cubes ray cast (see raytrace.h), BVH build included
+//   tex_morton Visible cubes rasterized with a trilinear filtered texture
+//              stored in Morton order (see texture.h)
+//   tex_linear The same with the texture stored row after row, so the two
+//              layouts can be compared in one run
+//
+// Stages that work per object run on the job pool (see jobs.h).  The report
+// gives each stage's mean, median, min and max time, its throughput
+// (objects, or rays for trace, per second), and memory: the scene's bytes,
+// the process's peak resident size and the heap allocations per frame.
+//
+// With -baseline the medians are compared stage by stage.  The exit code
+// is 1 if any stage is slower by more than the tolerance, so the run can
+// fail a build.
+/////////////////////////////////////////////////////////////////////////////
+
+#include "../raster.h"
+#include "../raytrace.h"
+#include "../texture.h"
+#include "../arena.h"
+#include "../jobs.h"
+#include "../timer.h"
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#ifdef WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib,"psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+#define BENCH_MIN_OBJECTS       10
+#define BENCH_MAX_OBJECTS       10000000
+#define BENCH_GRAIN             1024        // Objects per job
+#define BENCH_ORBIT             4.0f        // Children's orbit, in the parent's units
+#define BENCH_FOVY              (60.0f*3.14159265f/180.0f)
+#define BENCH_NEAR              1.0f
+#define BENCH_FAR               1000.0f
+#define BENCH_TEXTURE_SIZE      1024        // Texels on a side; levels past the caches
+#define BENCH_TEXTURE_REPEAT    2.0f        // Times the texture wraps across a cube face
+
+enum BenchStage {
+    BENCH_ANIMATE,
+    BENCH_TRANSFORM,
+    BENCH_CULL,
+    BENCH_RASTER,
+    BENCH_TRACE,
+    BENCH_TEX_MORTON,
+    BENCH_TEX_LINEAR,
+    BENCH_STAGES
+};
+
+static const char *s_StageNames[BENCH_STAGES] = {"animate","transform","cull","raster","trace","tex_morton","tex_linear"};
+
+// Cube geometry, as drawCube draws it
+static const Point3 s_CubeVerts[8] = {
+    Point3( 1,-1, 1), Point3( 1,-1,-1), Point3( 1, 1,-1), Point3( 1, 1, 1),
+    Point3(-1,-1, 1), Point3(-1,-1,-1), Point3(-1, 1,-1), Point3(-1, 1, 1)
+};
+static const unsigned int s_CubeIndices[36] = {
+    0,1,2, 0,2,3,   6,5,4, 6,4,7,   1,0,4, 1,4,5,
+    2,1,5, 2,5,6,   3,2,6, 3,6,7,   0,3,7, 0,7,4
+};
+
+// Texture coordinates for the corners: u = x + z/2 and v = y + z/2, so
+// no face has the texture squashed to a line
+static const float s_CubeUVs[16] = {
+    1.5f*BENCH_TEXTURE_REPEAT, -0.5f*BENCH_TEXTURE_REPEAT,  0.5f*BENCH_TEXTURE_REPEAT, -1.5f*BENCH_TEXTURE_REPEAT,
+    0.5f*BENCH_TEXTURE_REPEAT,  0.5f*BENCH_TEXTURE_REPEAT,  1.5f*BENCH_TEXTURE_REPEAT,  1.5f*BENCH_TEXTURE_REPEAT,
+   -0.5f*BENCH_TEXTURE_REPEAT, -0.5f*BENCH_TEXTURE_REPEAT, -1.5f*BENCH_TEXTURE_REPEAT, -1.5f*BENCH_TEXTURE_REPEAT,
+   -1.5f*BENCH_TEXTURE_REPEAT,  0.5f*BENCH_TEXTURE_REPEAT, -0.5f*BENCH_TEXTURE_REPEAT,  1.5f*BENCH_TEXTURE_REPEAT
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// BenchScene: the object tree and the buffers the stages fill
+//
+struct BenchScene {
+    bool Build(int objects,int depth,int fanout);
+    size_t GetBytes() const;
+
+    void Animate(float time);
+    void Transform();
+    int Cull(float aspect);
+    void Raster(Rasterizer &raster,const Matrix &proj,const Texture *texture=0);
+    void Trace(RayScene &scene,RayTracer &tracer,int width,int height);
+
+    int Depth, Fanout;
+    std::vector<int> LevelStart;    // First object of each level, and the end
+    std::vector<int> Parent;        // -1 for the root
+    std::vector<float> Phase;       // Where each object starts on its orbit
+    std::vector<float> Scale;       // Relative to the parent
+    std::vector<Matrix> Local;
+    std::vector<Matrix> World;
+    std::vector<unsigned char> Visible;
+    unsigned int LevelColors[3];
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Build
+// Arguments:      The number of objects, levels and children per object
+//                 (0 for the smallest that fits)
+// Returns:        false if the objects don't fit
+// Notes:          The last level is filled only as far as it needs to be.
+//                 Children shrink with the fanout so a ring of them doesn't
+//                 overlap itself.
+/////////////////////////////////////////////////////////////////////////////
+bool BenchScene::Build(int objects,int depth,int fanout)
+{
+    if(fanout <= 0) {
+        // Smallest fanout whose full tree holds 'objects'
+        fanout = 1;
+        for(;;) {
+            double capacity = 0.0, level = 1.0;
+            for(int d = 0; d < depth && capacity < objects; d++, level *= fanout)
+                capacity += level;
+            if(capacity >= objects || depth <= 1)
+                break;
+            fanout++;
+        }
+    }
+    Depth = depth;
+    Fanout = fanout;
+
+    Parent.clear();
+    LevelStart.clear();
+    Parent.reserve(objects);
+    Parent.push_back(-1);
+    LevelStart.push_back(0);
+    for(int d = 1; d < depth && (int)Parent.size() < objects; d++) {
+        int begin = LevelStart.back(), end = (int)Parent.size();
+        LevelStart.push_back(end);
+        for(int p = begin; p < end && (int)Parent.size() < objects; p++) {
+            for(int c = 0; c < fanout && (int)Parent.size() < objects; c++)
+                Parent.push_back(p);
+        }
+    }
+    LevelStart.push_back((int)Parent.size());
+    if((int)Parent.size() < objects) {
+        printf("bench: %d objects don't fit in %d levels of fanout %d\n",objects,depth,fanout);
+        return false;
+    }
+
+    float childScale = std::min(0.5f,8.0f/fanout);
+    Phase.resize(objects);
+    Scale.resize(objects);
+    Phase[0] = 0.0f;
+    Scale[0] = 1.0f;
+    for(int i = 1; i < objects; i++) {
+        int sibling = (i - LevelStart[1]) % fanout;
+        Phase[i] = 2.0f*3.14159265f*sibling/fanout;
+        Scale[i] = childScale;
+    }
+    Local.resize(objects);
+    World.resize(objects);
+    Visible.resize(objects);
+    LevelColors[0] = RayTracer::PackColor(0.2f,0.8f,0.2f);
+    LevelColors[1] = RayTracer::PackColor(1.0f,1.0f,1.0f);
+    LevelColors[2] = RayTracer::PackColor(0.2f,0.2f,0.9f);
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           GetBytes
+// Arguments:      none
+// Returns:        What the scene's arrays take
+/////////////////////////////////////////////////////////////////////////////
+size_t BenchScene::GetBytes() const
+{
+    return Parent.capacity()*sizeof(int) + LevelStart.capacity()*sizeof(int) +
+           Phase.capacity()*sizeof(float) + Scale.capacity()*sizeof(float) +
+           Local.capacity()*sizeof(Matrix) + World.capacity()*sizeof(Matrix) +
+           Visible.capacity();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Animate
+// Arguments:      The time in seconds
+// Returns:        none
+// Side Effects:   Sets Local: the root is placed in front of the eye and
+//                 tumbles like the sun, and everything else orbits its
+//                 parent at BENCH_ORBIT, bobbing a little off the plane
+/////////////////////////////////////////////////////////////////////////////
+void BenchScene::Animate(float time)
+{
+    Matrix place, tumble;
+    place.MakeTranslate(0,0,-6.0f*BENCH_ORBIT);
+    Vector3 axis(1,1,0);
+    axis.Normalize();
+    tumble.MakeRotateUnitAxis(axis,0.1f*time);
+    Local[0] = Matrix(place*tumble);
+
+    int count = (int)Local.size();
+    ParallelFor(count - 1,BENCH_GRAIN,[&](int begin,int end,int) {
+        for(int i = begin + 1; i < end + 1; i++) {
+            Matrix orbit, offset, spin, size;
+            orbit.MakeRotateY(Phase[i] + 0.5f*time);
+            offset.MakeTranslate(BENCH_ORBIT,0.1f*(i % 5) - 0.2f,0);
+            spin.MakeRotateY(time);
+            size.MakeScale(Scale[i]);
+            Local[i] = Matrix(orbit*offset*spin*size);
+        }
+    });
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Transform
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Sets World down the tree
+// Notes:          A level only reads the one above it, so each level is a
+//                 single parallel loop
+/////////////////////////////////////////////////////////////////////////////
+void BenchScene::Transform()
+{
+    World[0] = Local[0];
+    for(int d = 1; d + 1 < (int)LevelStart.size(); d++) {
+        int first = LevelStart[d];
+        ParallelFor(LevelStart[d + 1] - first,BENCH_GRAIN,[&](int begin,int end,int) {
+            for(int i = first + begin; i < first + end; i++)
+                World[i] = Matrix(World[Parent[i]]*Local[i]);
+        });
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Cull
+// Arguments:      The image's aspect ratio
+// Returns:        The number of objects visible
+// Side Effects:   Sets Visible
+// Notes:          World is eye space here, the camera being the identity.
+//                 Each cube is bounded by a sphere through its corners.
+/////////////////////////////////////////////////////////////////////////////
+int BenchScene::Cull(float aspect)
+{
+    float ky = tanf(0.5f*BENCH_FOVY), kx = ky*aspect;
+    float sx = 1.0f/sqrtf(1.0f + kx*kx), sy = 1.0f/sqrtf(1.0f + ky*ky);
+    int counts[JOBS_MAX_THREADS] = {0};
+    ParallelFor((int)World.size(),BENCH_GRAIN,[&](int begin,int end,int thread) {
+        int visible = 0;
+        for(int i = begin; i < end; i++) {
+            const float *m = World[i].m_m;
+            float scale2 = std::max(m[0]*m[0] + m[1]*m[1] + m[2]*m[2],
+                           std::max(m[4]*m[4] + m[5]*m[5] + m[6]*m[6],m[8]*m[8] + m[9]*m[9] + m[10]*m[10]));
+            float r = sqrtf(3.0f*scale2);
+            float x = m[12], y = m[13], depth = -m[14];
+            bool in = depth > BENCH_NEAR - r && depth < BENCH_FAR + r &&
+                      (fabsf(x) - kx*depth)*sx < r && (fabsf(y) - ky*depth)*sy < r;
+            Visible[i] = in;
+            visible += in;
+        }
+        counts[thread] += visible;
+    });
+    int visible = 0;
+    for(int i = 0; i < JOBS_MAX_THREADS; i++)
+        visible += counts[i];
+    return visible;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Raster
+// Arguments:      The rasterizer, the projection and optionally a texture
+// Returns:        none
+// Side Effects:   Draws every visible cube, colored by its level or
+//                 covered with 'texture'
+/////////////////////////////////////////////////////////////////////////////
+void BenchScene::Raster(Rasterizer &raster,const Matrix &proj,const Texture *texture)
+{
+    raster.GetStats().Reset();
+    raster.Clear(RayTracer::PackColor(0.5f,0.7f,0.9f));
+    raster.SetTexture(texture);
+    for(int d = 0; d + 1 < (int)LevelStart.size(); d++) {
+        for(int i = LevelStart[d]; i < LevelStart[d + 1]; i++) {
+            if(Visible[i])
+                raster.DrawTriangles(Matrix(proj*World[i]),s_CubeVerts,8,s_CubeIndices,12,LevelColors[d % 3],
+                                     texture ? s_CubeUVs : 0);
+        }
+    }
+    raster.SetTexture(0);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           MakeTexture
+// Arguments:      The texture to fill and the layout to store it in
+// Returns:        Whether it could be created
+// Side Effects:   Fills it with BENCH_TEXTURE_SIZE squared texels of a
+//                 checkerboard over a color ramp, the same for either
+//                 layout
+/////////////////////////////////////////////////////////////////////////////
+static bool MakeTexture(Texture &texture,TextureLayout layout)
+{
+    const int n = BENCH_TEXTURE_SIZE;
+    std::vector<unsigned int> texels(n*n);
+    for(int y = 0; y < n; y++) {
+        for(int x = 0; x < n; x++) {
+            float check = ((x >> 4) ^ (y >> 4)) & 1 ? 1.0f : 0.6f;
+            texels[y*n + x] = RayTracer::PackColor(check*x/n,check*y/n,check*0.5f);
+        }
+    }
+    return texture.Create(n,n,&texels[0],layout);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Trace
+// Arguments:      The ray scene and tracer to use, and the image size
+// Returns:        none
+// Side Effects:   Rebuilds 'scene' from the visible cubes and ray casts it
+/////////////////////////////////////////////////////////////////////////////
+void BenchScene::Trace(RayScene &scene,RayTracer &tracer,int width,int height)
+{
+    scene.Clear();
+    for(int i = 0; i < (int)World.size(); i++) {
+        if(Visible[i])
+            scene.AddCube(World[i],LevelColors);
+    }
+    scene.Build();
+    tracer.SetCamera(Matrix(),BENCH_FOVY);
+    tracer.Render(scene,width,height);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// BenchTimes: one stage's times over the timed frames
+//
+struct BenchTimes {
+    BenchTimes()                                    {Enabled = false; Items = MeanMs = MedianMs = MinMs = MaxMs = ItemsPerSecond = 0.0;}
+    void Summarize();
+
+    bool Enabled;
+    std::vector<double> Ms;
+    double Items;                   // Objects (or rays) a frame, averaged
+    double MeanMs, MedianMs, MinMs, MaxMs;
+    double ItemsPerSecond;
+};
+
+void BenchTimes::Summarize()
+{
+    MeanMs = MedianMs = MinMs = MaxMs = ItemsPerSecond = 0.0;
+    if(Ms.empty())
+        return;
+    std::vector<double> sorted(Ms);
+    std::sort(sorted.begin(),sorted.end());
+    size_t n = sorted.size();
+    double total = 0.0;
+    for(size_t i = 0; i < n; i++)
+        total += sorted[i];
+    MeanMs = total/n;
+    MedianMs = n & 1 ? sorted[n/2] : 0.5*(sorted[n/2 - 1] + sorted[n/2]);
+    MinMs = sorted[0];
+    MaxMs = sorted[n - 1];
+    Items /= n;
+    ItemsPerSecond = MeanMs > 0.0 ? Items*1000.0/MeanMs : 0.0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           GetPeakMemory
+// Arguments:      none
+// Returns:        The most memory the process has had resident, in bytes
+/////////////////////////////////////////////////////////////////////////////
+static unsigned long long GetPeakMemory()
+{
+#ifdef WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if(GetProcessMemoryInfo(GetCurrentProcess(),&counters,sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+    return 0;
+#else
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF,&usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss;         // Already bytes
+#else
+    return (unsigned long long)usage.ru_maxrss*1024;
+#endif
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           WriteReport
+// Arguments:      The file, the run's settings and results
+// Returns:        Whether it was written
+// Notes:          ReadBaseline depends on each stage being one line
+/////////////////////////////////////////////////////////////////////////////
+static bool WriteReport(const char *path,const BenchScene &scene,int frames,int width,int height,
+                        const BenchTimes *times,double frameMs,unsigned long long allocs)
+{
+    FILE *f = fopen(path,"w");
+    if(!f) {
+        printf("bench: can't open '%s'\n",path);
+        return false;
+    }
+    fprintf(f,"{\n");
+    fprintf(f,"  \"scene\": {\"objects\": %d, \"depth\": %d, \"fanout\": %d, \"levels\": [",
+            (int)scene.Parent.size(),scene.Depth,scene.Fanout);
+    for(int d = 0; d + 1 < (int)scene.LevelStart.size(); d++)
+        fprintf(f,"%s%d",d ? ", " : "",scene.LevelStart[d + 1] - scene.LevelStart[d]);
+    fprintf(f,"]},\n");
+    fprintf(f,"  \"frames\": %d,\n  \"threads\": %d,\n  \"width\": %d,\n  \"height\": %d,\n",
+            frames,SharedJobPool().GetThreadCount(),width,height);
+    fprintf(f,"  \"stages\": {\n");
+    bool first = true;
+    for(int s = 0; s < BENCH_STAGES; s++) {
+        const BenchTimes &t = times[s];
+        if(!t.Enabled)
+            continue;
+        fprintf(f,"%s    \"%s\": {\"mean_ms\": %.4f, \"median_ms\": %.4f, \"min_ms\": %.4f, \"max_ms\": %.4f, "
+                "\"items\": %.0f, \"items_per_sec\": %.0f}",
+                first ? "" : ",\n",s_StageNames[s],t.MeanMs,t.MedianMs,t.MinMs,t.MaxMs,t.Items,t.ItemsPerSecond);
+        first = false;
+    }
+    fprintf(f,"\n  },\n");
+    fprintf(f,"  \"frame\": {\"mean_ms\": %.4f, \"fps\": %.2f},\n",frameMs,frameMs > 0.0 ? 1000.0/frameMs : 0.0);
+    fprintf(f,"  \"memory\": {\"scene_bytes\": %llu, \"peak_bytes\": %llu, \"heap_allocs_per_frame\": %llu}\n",
+            (unsigned long long)scene.GetBytes(),GetPeakMemory(),allocs);
+    fprintf(f,"}\n");
+    fclose(f);
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           ReadBaseline
+// Arguments:      A report WriteReport wrote, and where to put its stage
+//                 medians (negative for stages it doesn't have) and its
+//                 object count
+// Returns:        Whether it could be read
+// Notes:          Not a JSON parser: it looks for the keys where
+//                 WriteReport puts them
+/////////////////////////////////////////////////////////////////////////////
+static bool ReadBaseline(const char *path,double *medians,int &objects)
+{
+    FILE *f = fopen(path,"r");
+    if(!f) {
+        printf("bench: can't open '%s'\n",path);
+        return false;
+    }
+    std::vector<char> text;
+    char buffer[4096];
+    size_t got;
+    while((got = fread(buffer,1,sizeof(buffer),f)) > 0)
+        text.insert(text.end(),buffer,buffer + got);
+    fclose(f);
+    text.push_back(0);
+
+    const char *p = strstr(&text[0],"\"objects\":");
+    const char *stages = strstr(&text[0],"\"stages\":");
+    if(!p || !stages) {
+        printf("bench: '%s' is not a bench report\n",path);
+        return false;
+    }
+    objects = atoi(p + 10);
+    for(int s = 0; s < BENCH_STAGES; s++) {
+        char key[32];
+        snprintf(key,sizeof(key),"\"%s\":",s_StageNames[s]);
+        const char *stage = strstr(stages,key);
+        const char *median = stage ? strstr(stage,"\"median_ms\":") : 0;
+        medians[s] = median ? atof(median + 12) : -1.0;
+    }
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Compare
+// Arguments:      This run's times, the baseline's medians and the
+//                 percentage a stage may slow down by
+// Returns:        The number of stages that slowed down by more
+/////////////////////////////////////////////////////////////////////////////
+static int Compare(const BenchTimes *times,const double *baseline,double tolerance)
+{
+    int regressions = 0;
+    printf("%-10s %12s %12s %9s\n","stage","baseline ms","median ms","change");
+    for(int s = 0; s < BENCH_STAGES; s++) {
+        if(!times[s].Enabled || baseline[s] < 0.0)
+            continue;
+        double change = baseline[s] > 0.0 ? 100.0*(times[s].MedianMs - baseline[s])/baseline[s] : 0.0;
+        bool regressed = change > tolerance;
+        regressions += regressed;
+        printf("%-10s %12.4f %12.4f %+8.1f%%%s\n",s_StageNames[s],baseline[s],times[s].MedianMs,change,
+               regressed ? "  SLOWER" : "");
+    }
+    return regressions;
+}
+
+static void Usage()
+{
+    printf("Usage: bench [-objects N] [-depth D] [-fanout F] [-frames N] [-warmup N]\n\
+             [-size WxH] [-stages animate,transform,cull,raster,trace,tex_morton,tex_linear]\n\
+             [-out file] [-baseline file] [-tolerance pct]\n\
+Times the CPU side of a frame on a procedural hierarchy of %d to %d objects\n",
+           BENCH_MIN_OBJECTS,BENCH_MAX_OBJECTS);
+}
+
+int main(int argc,char **argv)
+{
+    int objects = 10000, depth = 4, fanout = 0, frames = 20, warmup = 2;
+    int width = 640, height = 480;
+    const char *out = 0, *baseline = 0;
+    double tolerance = 10.0;
+    BenchTimes times[BENCH_STAGES];
+    for(int s = 0; s < BENCH_STAGES; s++)
+        times[s].Enabled = s <= BENCH_RASTER;
+
+    for(int i = 1; i < argc; i++) {
+        const char *arg = argv[i], *value = i + 1 < argc ? argv[i + 1] : 0;
+        if(!value) {
+            Usage();
+            return 1;
+        }
+        i++;
+        if(strcmp(arg,"-objects") == 0)
+            objects = atoi(value);
+        else if(strcmp(arg,"-depth") == 0)
+            depth = atoi(value);
+        else if(strcmp(arg,"-fanout") == 0)
+            fanout = atoi(value);
+        else if(strcmp(arg,"-frames") == 0)
+            frames = atoi(value);
+        else if(strcmp(arg,"-warmup") == 0)
+            warmup = atoi(value);
+        else if(strcmp(arg,"-size") == 0 && sscanf(value,"%dx%d",&width,&height) == 2)
+            ;
+        else if(strcmp(arg,"-stages") == 0) {
+            for(int s = 0; s < BENCH_STAGES; s++) {
+                const char *found = strstr(value,s_StageNames[s]);
+                size_t len = strlen(s_StageNames[s]);
+                times[s].Enabled = found && (found == value || found[-1] == ',') &&
+                                   (found[len] == 0 || found[len] == ',');
+            }
+        }
+        else if(strcmp(arg,"-out") == 0)
+            out = value;
+        else if(strcmp(arg,"-baseline") == 0)
+            baseline = value;
+        else if(strcmp(arg,"-tolerance") == 0)
+            tolerance = atof(value);
+        else {
+            Usage();
+            return 1;
+        }
+    }
+    if(objects < BENCH_MIN_OBJECTS || objects > BENCH_MAX_OBJECTS || depth < 1 || frames < 1 ||
+       warmup < 0 || width < 1 || height < 1) {
+        Usage();
+        return 1;
+    }
+
+    // Read the baseline first, so a bad path fails before the run
+    double medians[BENCH_STAGES];
+    int baselineObjects = 0;
+    if(baseline && !ReadBaseline(baseline,medians,baselineObjects))
+        return 1;
+
+    BenchScene scene;
+    Timer t;
+    if(!scene.Build(objects,depth,fanout))
+        return 1;
+    printf("bench: %d objects, %d levels, fanout %d, built in %.1f ms, %d threads\n",objects,
+           (int)scene.LevelStart.size() - 1,scene.Fanout,t.GetMs(),SharedJobPool().GetThreadCount());
+
+    float aspect = (float)width/height;
+    Matrix proj;
+    proj.MakePerspective(BENCH_FOVY,aspect,BENCH_NEAR,BENCH_FAR);
+    Rasterizer raster(width,height);
+    RayScene rayScene;
+    RayTracer tracer;
+    Texture morton, linear;
+    if((times[BENCH_TEX_MORTON].Enabled && !MakeTexture(morton,TEXTURE_MORTON)) ||
+       (times[BENCH_TEX_LINEAR].Enabled && !MakeTexture(linear,TEXTURE_LINEAR)))
+        return 1;
+
+    double frameMs = 0.0;
+    unsigned long long allocs = 0;
+    for(int frame = 0; frame < warmup + frames; frame++) {
+        bool timed = frame >= warmup;
+        double ms[BENCH_STAGES] = {0}, items[BENCH_STAGES] = {0};
+        unsigned long long heap = GetHeapAllocCount();
+        float time = frame/60.0f;
+        int visible = objects;
+
+        if(times[BENCH_ANIMATE].Enabled) {
+            t.Start();
+            scene.Animate(time);
+            ms[BENCH_ANIMATE] = t.GetMs();
+            items[BENCH_ANIMATE] = objects;
+        }
+        else if(frame == 0)
+            scene.Animate(0.0f);
+        if(times[BENCH_TRANSFORM].Enabled || frame == 0) {
+            t.Start();
+            scene.Transform();
+            ms[BENCH_TRANSFORM] = t.GetMs();
+            items[BENCH_TRANSFORM] = objects;
+        }
+        if(times[BENCH_CULL].Enabled) {
+            t.Start();
+            visible = scene.Cull(aspect);
+            ms[BENCH_CULL] = t.GetMs();
+            items[BENCH_CULL] = objects;
+        }
+        else if(frame == 0)
+            std::fill(scene.Visible.begin(),scene.Visible.end(),1);
+        if(times[BENCH_RASTER].Enabled) {
+            t.Start();
+            scene.Raster(raster,proj);
+            ms[BENCH_RASTER] = t.GetMs();
+            items[BENCH_RASTER] = visible;
+        }
+        if(times[BENCH_TRACE].Enabled) {
+            t.Start();
+            scene.Trace(rayScene,tracer,width,height);
+            ms[BENCH_TRACE] = t.GetMs();
+            items[BENCH_TRACE] = (double)width*height;
+        }
+        if(times[BENCH_TEX_MORTON].Enabled) {
+            t.Start();
+            scene.Raster(raster,proj,&morton);
+            ms[BENCH_TEX_MORTON] = t.GetMs();
+            items[BENCH_TEX_MORTON] = visible;
+        }
+        if(times[BENCH_TEX_LINEAR].Enabled) {
+            t.Start();
+            scene.Raster(raster,proj,&linear);
+            ms[BENCH_TEX_LINEAR] = t.GetMs();
+            items[BENCH_TEX_LINEAR] = visible;
+        }
+
+        if(!timed)
+            continue;
+        allocs += GetHeapAllocCount() - heap;
+        for(int s = 0; s < BENCH_STAGES; s++) {
+            if(!times[s].Enabled)
+                continue;
+            times[s].Ms.push_back(ms[s]);
+            times[s].Items += items[s];
+            frameMs += ms[s];
+        }
+    }
+    frameMs /= frames;
+    allocs /= frames;
+
+    for(int s = 0; s < BENCH_STAGES; s++) {
+        times[s].Summarize();
+        if(times[s].Enabled)
+            printf("  %-10s %10.4f ms median, %10.4f ms mean, %14.0f a second\n",s_StageNames[s],
+                   times[s].MedianMs,times[s].MeanMs,times[s].ItemsPerSecond);
+    }
+    printf("  frame      %10.4f ms mean, peak memory %.1f MB, scene %.1f MB, %llu heap allocations a frame\n",
+           frameMs,GetPeakMemory()/1048576.0,scene.GetBytes()/1048576.0,allocs);
+    if(out) {
+        if(!WriteReport(out,scene,frames,width,height,times,frameMs,allocs))
+            return 1;
+        printf("bench: report written to %s\n",out);
+    }
+
+    if(baseline) {
+        if(baselineObjects != objects)
+            printf("bench: the baseline has %d objects, this run %d\n",baselineObjects,objects);
+        int regressions = Compare(times,medians,tolerance);
+        if(regressions > 0) {
+            printf("bench: %d stages more than %.0f%% slower than %s\n",regressions,tolerance,baseline);
+            return 1;
+        }
+    }
+    return 0;
+}
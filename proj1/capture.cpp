@@ -0,0 +1,581 @@
+/////////////////////////////////////////////////////////////////////////////
+// capture.cpp
+/////////////////////////////////////
+// Frame capture through a ring of PBOs and a background encoder.
+/////////////////////////////////////////////////////////////////////////////
+
+#include "capture.h"
+#include "timer.h"
+#include <algorithm>
+
+#ifdef WIN32
+#define CAPTURE_GET_PROC(name)  wglGetProcAddress(name)
+#else
+#include <GL/glx.h>
+#define CAPTURE_GET_PROC(name)  glXGetProcAddress((const GLubyte*)(name))
+#endif
+
+// OpenGL 1.5 and 2.1 names the 1.1 headers don't have
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER    0x88EB
+#endif
+#ifndef GL_STREAM_READ
+#define GL_STREAM_READ          0x88E1
+#endif
+#ifndef GL_READ_ONLY
+#define GL_READ_ONLY            0x88B8
+#endif
+
+typedef void (APIENTRY *GenBuffersFunc)(GLsizei n,GLuint *buffers);
+typedef void (APIENTRY *DeleteBuffersFunc)(GLsizei n,const GLuint *buffers);
+typedef void (APIENTRY *BindBufferFunc)(GLenum target,GLuint buffer);
+typedef void (APIENTRY *BufferDataFunc)(GLenum target,ptrdiff_t size,const void *data,GLenum usage);
+typedef void *(APIENTRY *MapBufferFunc)(GLenum target,GLenum access);
+typedef GLboolean (APIENTRY *UnmapBufferFunc)(GLenum target);
+
+static GenBuffersFunc s_GenBuffers = 0;
+static DeleteBuffersFunc s_DeleteBuffers = 0;
+static BindBufferFunc s_BindBuffer = 0;
+static BufferDataFunc s_BufferData = 0;
+static MapBufferFunc s_MapBuffer = 0;
+static UnmapBufferFunc s_UnmapBuffer = 0;
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           CaptureStats::Print
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Prints the counters, with per frame averages
+/////////////////////////////////////////////////////////////////////////////
+void CaptureStats::Print() const
+{
+    int frames = Frames > 0 ? Frames : 1, encoded = Encoded > 0 ? Encoded : 1;
+    printf("capture: %d frames (%s), %d written, %.1f MB, %d stalls (%.3f ms), at most %d queued\n",
+           Frames,Buffered ? "PBO ring" : "glReadPixels",Encoded,Megabytes,Stalls,StallMs,MaxQueued);
+    printf("capture: %.3f ms per frame on the GL thread, %.3f ms per frame encoding\n",
+           CaptureMs/frames,EncodeMs/encoded);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           FrameCapture constructor
+/////////////////////////////////////////////////////////////////////////////
+FrameCapture::FrameCapture()
+{
+    m_Active = false;
+    m_Format = CAPTURE_RAW;
+    m_Path[0] = 0;
+    m_NumberBegin = m_NumberEnd = m_NumberWidth = 0;
+    m_NumberZeros = false;
+    m_Raw = 0;
+    m_Buffered = false;
+    memset(m_Buffers,0,sizeof(m_Buffers));
+    memset(m_FrameNumber,0,sizeof(m_FrameNumber));
+    m_Ring = CAPTURE_RING;
+    m_Next = m_InFlight = 0;
+    m_Width = m_Height = 0;
+    m_Frames = 0;
+    m_Stopping = false;
+    m_Stats.Reset();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           FrameCapture destructor
+// Notes:          The GL context may already be gone, so the frames still
+//                 in the ring are dropped and the PBOs left to it.  Frames
+//                 already queued are still written.
+/////////////////////////////////////////////////////////////////////////////
+FrameCapture::~FrameCapture()
+{
+    m_InFlight = 0;
+    m_Buffered = false;
+    Stop();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           LoadBufferFunctions
+// Arguments:      none
+// Returns:        Whether PBOs can be used
+// Notes:          Needs a current context.  Having the entry points is not
+//                 enough (glXGetProcAddress returns one for any name), so
+//                 the version or the extension is checked too.
+/////////////////////////////////////////////////////////////////////////////
+bool FrameCapture::LoadBufferFunctions()
+{
+    const char *version = (const char*)glGetString(GL_VERSION);
+    const char *extensions = (const char*)glGetString(GL_EXTENSIONS);
+    int major = 0, minor = 0;
+    if(version)
+        sscanf(version,"%d.%d",&major,&minor);
+    bool supported = major > 2 || (major == 2 && minor >= 1) ||
+                     (extensions && strstr(extensions,"GL_ARB_pixel_buffer_object"));
+    if(!supported)
+        return false;
+
+    s_GenBuffers = (GenBuffersFunc)CAPTURE_GET_PROC("glGenBuffers");
+    s_DeleteBuffers = (DeleteBuffersFunc)CAPTURE_GET_PROC("glDeleteBuffers");
+    s_BindBuffer = (BindBufferFunc)CAPTURE_GET_PROC("glBindBuffer");
+    s_BufferData = (BufferDataFunc)CAPTURE_GET_PROC("glBufferData");
+    s_MapBuffer = (MapBufferFunc)CAPTURE_GET_PROC("glMapBuffer");
+    s_UnmapBuffer = (UnmapBufferFunc)CAPTURE_GET_PROC("glUnmapBuffer");
+    return s_GenBuffers && s_DeleteBuffers && s_BindBuffer && s_BufferData && s_MapBuffer && s_UnmapBuffer;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           FindNumber
+// Arguments:      A PNG file name pattern, and where to put the span of its
+//                 %d and the number's width and padding
+// Returns:        false if there isn't exactly one conversion, or it is
+//                 anything but %d with an optional 0 flag and width
+// Notes:          The name is built from the pieces, so the pattern is
+//                 never handed to printf
+/////////////////////////////////////////////////////////////////////////////
+static bool FindNumber(const char *path,int &begin,int &end,int &width,bool &zeros)
+{
+    const char *percent = strchr(path,'%');
+    if(!percent)
+        return false;
+    const char *p = percent + 1;
+    zeros = *p == '0';
+    width = 0;
+    while(*p >= '0' && *p <= '9' && width <= CAPTURE_MAX_DIGITS)
+        width = 10*width + (*p++ - '0');
+    if(*p != 'd' || width > CAPTURE_MAX_DIGITS || strchr(p,'%'))
+        return false;
+    begin = (int)(percent - path);
+    end = (int)(p + 1 - path);
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Start
+// Arguments:      Where to write, the format, the number of PBOs and the
+//                 number of frames in the pool
+// Returns:        Whether capturing started
+// Side Effects:   Stops any capture in progress and starts the encoder
+/////////////////////////////////////////////////////////////////////////////
+bool FrameCapture::Start(const char *path,CaptureFormat format,int ring,int queue)
+{
+    Stop();
+    if(strlen(path) >= CAPTURE_MAX_PATH) {
+        printf("FrameCapture::Start: '%s' is longer than %d characters\n",path,CAPTURE_MAX_PATH - 1);
+        return false;
+    }
+    if(format == CAPTURE_PNG && !FindNumber(path,m_NumberBegin,m_NumberEnd,m_NumberWidth,m_NumberZeros)) {
+        printf("FrameCapture::Start: '%s' needs one %%d for the frame number\n",path);
+        return false;
+    }
+    if(format == CAPTURE_RAW) {
+        m_Raw = fopen(path,"wb");
+        if(!m_Raw) {
+            printf("FrameCapture::Start: can't open '%s'\n",path);
+            return false;
+        }
+    }
+    m_Format = format;
+    strncpy(m_Path,path,CAPTURE_MAX_PATH - 1);
+    m_Path[CAPTURE_MAX_PATH - 1] = 0;
+    m_Ring = std::max(1,std::min(ring,CAPTURE_MAX_RING));
+    m_Buffered = LoadBufferFunctions();
+    m_Next = m_InFlight = 0;
+    m_Width = m_Height = 0;
+    m_Frames = 0;
+
+    // The frames keep their pixels from the last capture, so a restart at
+    // the same size allocates nothing
+    m_Pool.resize(std::max(queue,1));
+    m_Free.clear();
+    m_Queue.clear();
+    for(size_t i = 0; i < m_Pool.size(); i++)
+        m_Free.push_back(&m_Pool[i]);
+    m_Stopping = false;
+    m_Stats.Reset();
+    m_Stats.Buffered = m_Buffered;
+    m_Thread = std::thread(&FrameCapture::Run,this);
+    m_Active = true;
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Stop
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Finishes every frame captured so far and joins the
+//                 encoder
+/////////////////////////////////////////////////////////////////////////////
+void FrameCapture::Stop()
+{
+    if(!m_Active)
+        return;
+    while(m_InFlight > 0)
+        ReadOldest();
+    DeleteBuffers();
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        m_Stopping = true;
+    }
+    m_Wake.notify_one();
+    m_Thread.join();
+    if(m_Raw) {
+        if(fclose(m_Raw) != 0)
+            printf("FrameCapture::Stop: error writing '%s'\n",m_Path);
+        m_Raw = 0;
+    }
+    m_Active = false;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           CreateBuffers
+// Arguments:      The frame size
+// Returns:        none
+// Side Effects:   Makes the ring's PBOs, each big enough for one frame
+/////////////////////////////////////////////////////////////////////////////
+void FrameCapture::CreateBuffers(int width,int height)
+{
+    s_GenBuffers(m_Ring,m_Buffers);
+    for(int i = 0; i < m_Ring; i++) {
+        s_BindBuffer(GL_PIXEL_PACK_BUFFER,m_Buffers[i]);
+        s_BufferData(GL_PIXEL_PACK_BUFFER,(ptrdiff_t)4*width*height,0,GL_STREAM_READ);
+    }
+    s_BindBuffer(GL_PIXEL_PACK_BUFFER,0);
+    m_Width = width;
+    m_Height = height;
+    m_Next = 0;
+}
+
+void FrameCapture::DeleteBuffers()
+{
+    if(m_Buffered && m_Width > 0)
+        s_DeleteBuffers(m_Ring,m_Buffers);
+    m_Width = m_Height = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Capture
+// Arguments:      The size of the frame to read, from the lower left
+// Returns:        none
+// Side Effects:   Queues a read of the back buffer.  Once the ring is full
+//                 the oldest read is mapped and handed to the encoder
+//                 first, which can wait for a free frame in the pool.
+/////////////////////////////////////////////////////////////////////////////
+void FrameCapture::Capture(int width,int height)
+{
+    if(!m_Active || width <= 0 || height <= 0)
+        return;
+    Timer timer;
+    if(m_Buffered) {
+        if(width != m_Width || height != m_Height) {
+            while(m_InFlight > 0)
+                ReadOldest();
+            DeleteBuffers();
+            CreateBuffers(width,height);
+        }
+        if(m_InFlight == m_Ring)
+            ReadOldest();
+        s_BindBuffer(GL_PIXEL_PACK_BUFFER,m_Buffers[m_Next]);
+        glReadPixels(0,0,width,height,GL_RGBA,GL_UNSIGNED_BYTE,0);
+        s_BindBuffer(GL_PIXEL_PACK_BUFFER,0);
+        m_FrameNumber[m_Next] = m_Frames;
+        m_Next = (m_Next + 1) % m_Ring;
+        m_InFlight++;
+    }
+    else {
+        Frame *frame = AcquireFrame();
+        frame->Pixels.resize((size_t)4*width*height);
+        frame->Width = width;
+        frame->Height = height;
+        frame->Number = m_Frames;
+        glReadPixels(0,0,width,height,GL_RGBA,GL_UNSIGNED_BYTE,&frame->Pixels[0]);
+        QueueFrame(frame);
+    }
+    m_Frames++;
+
+    std::lock_guard<std::mutex> lock(m_Lock);
+    m_Stats.Frames = m_Frames;
+    m_Stats.CaptureMs += timer.GetMs();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           ReadOldest
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Maps the PBO read longest ago, copies it into a frame
+//                 from the pool and queues that for the encoder
+// Notes:          The copy out is what lets the PBO be read into again
+//                 right away, while the encoder takes its time
+/////////////////////////////////////////////////////////////////////////////
+void FrameCapture::ReadOldest()
+{
+    int slot = (m_Next - m_InFlight + m_Ring) % m_Ring;
+    m_InFlight--;
+    Frame *frame = AcquireFrame();
+    size_t size = (size_t)4*m_Width*m_Height;
+    s_BindBuffer(GL_PIXEL_PACK_BUFFER,m_Buffers[slot]);
+    const void *pixels = s_MapBuffer(GL_PIXEL_PACK_BUFFER,GL_READ_ONLY);
+    if(pixels) {
+        frame->Pixels.resize(size);
+        memcpy(&frame->Pixels[0],pixels,size);
+        s_UnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    s_BindBuffer(GL_PIXEL_PACK_BUFFER,0);
+    if(!pixels) {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        m_Free.push_back(frame);
+        return;
+    }
+    frame->Width = m_Width;
+    frame->Height = m_Height;
+    frame->Number = m_FrameNumber[slot];
+    QueueFrame(frame);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           AcquireFrame
+// Arguments:      none
+// Returns:        A frame from the pool
+// Notes:          This is the back-pressure: with every frame waiting on
+//                 the encoder, the GL thread waits too
+/////////////////////////////////////////////////////////////////////////////
+FrameCapture::Frame *FrameCapture::AcquireFrame()
+{
+    std::unique_lock<std::mutex> lock(m_Lock);
+    if(m_Free.empty()) {
+        Timer timer;
+        m_Stats.Stalls++;
+        m_Freed.wait(lock,[this] {return !m_Free.empty();});
+        m_Stats.StallMs += timer.GetMs();
+    }
+    Frame *frame = m_Free.back();
+    m_Free.pop_back();
+    return frame;
+}
+
+void FrameCapture::QueueFrame(Frame *frame)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        m_Queue.push_back(frame);
+        m_Stats.MaxQueued = std::max(m_Stats.MaxQueued,(int)m_Queue.size());
+    }
+    m_Wake.notify_one();
+}
+
+CaptureStats FrameCapture::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(m_Lock);
+    return m_Stats;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Run
+// Arguments:      none
+// Returns:        none
+// Notes:          The encoder thread.  Writes queued frames in order and
+//                 returns them to the pool, until stopped with the queue
+//                 empty.
+/////////////////////////////////////////////////////////////////////////////
+void FrameCapture::Run()
+{
+    for(;;) {
+        Frame *frame;
+        {
+            std::unique_lock<std::mutex> lock(m_Lock);
+            m_Wake.wait(lock,[this] {return m_Stopping || !m_Queue.empty();});
+            if(m_Queue.empty())
+                return;
+            frame = m_Queue.front();
+            m_Queue.erase(m_Queue.begin());
+        }
+
+        Timer timer;
+        size_t bytes = Encode(*frame);
+        double ms = timer.GetMs();
+        {
+            std::lock_guard<std::mutex> lock(m_Lock);
+            if(bytes) {
+                m_Stats.Encoded++;
+                m_Stats.Megabytes += bytes/(1024.0*1024.0);
+            }
+            m_Stats.EncodeMs += ms;
+            m_Free.push_back(frame);
+        }
+        m_Freed.notify_one();
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Encode
+// Arguments:      A frame
+// Returns:        The bytes written, 0 if it failed
+// Notes:          Encoder thread only
+/////////////////////////////////////////////////////////////////////////////
+size_t FrameCapture::Encode(const Frame &frame)
+{
+    size_t row = (size_t)4*frame.Width;
+    if(m_Format == CAPTURE_RAW) {
+        for(int y = frame.Height - 1; y >= 0; y--) {
+            if(fwrite(&frame.Pixels[y*row],1,row,m_Raw) != row) {
+                printf("FrameCapture: error writing '%s'\n",m_Path);
+                return 0;
+            }
+        }
+        return row*frame.Height;
+    }
+
+    // The pattern around the number, which is at most CAPTURE_MAX_DIGITS
+    // wide, or 11 characters for any int
+    char name[CAPTURE_MAX_PATH + CAPTURE_MAX_DIGITS + 12];
+    snprintf(name,sizeof(name),m_NumberZeros ? "%.*s%0*d%s" : "%.*s%*d%s",m_NumberBegin,m_Path,m_NumberWidth,frame.Number,
+             m_Path + m_NumberEnd);
+    FILE *f = fopen(name,"wb");
+    if(!f) {
+        printf("FrameCapture: can't open '%s'\n",name);
+        return 0;
+    }
+    bool ok = WritePNG(f,&frame.Pixels[0],frame.Width,frame.Height);
+    long size = ftell(f);
+    ok = (fclose(f) == 0) && ok;
+    if(!ok) {
+        printf("FrameCapture: error writing '%s'\n",name);
+        return 0;
+    }
+    return size > 0 ? (size_t)size : 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Crc32
+// Arguments:      A running CRC, and bytes to add to it
+// Returns:        The updated CRC
+// Notes:          PNG's CRC-32, a byte at a time from a table built on
+//                 first use
+/////////////////////////////////////////////////////////////////////////////
+struct CrcTable {
+    CrcTable() {
+        for(unsigned int n = 0; n < 256; n++) {
+            unsigned int c = n;
+            for(int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            Entry[n] = c;
+        }
+    }
+    unsigned int Entry[256];
+};
+
+static unsigned int Crc32(unsigned int crc,const unsigned char *p,size_t n)
+{
+    static const CrcTable table;
+    for(size_t i = 0; i < n; i++)
+        crc = table.Entry[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Adler32
+// Arguments:      A running checksum, and bytes to add to it
+// Returns:        The updated checksum
+// Notes:          zlib's stream checksum.  The sums are reduced every 5552
+//                 bytes, the most that can't overflow 32 bits.
+/////////////////////////////////////////////////////////////////////////////
+static unsigned int Adler32(unsigned int adler,const unsigned char *p,size_t n)
+{
+    unsigned int a = adler & 0xffff, b = adler >> 16;
+    while(n > 0) {
+        size_t run = std::min(n,(size_t)5552);
+        n -= run;
+        while(run--) {
+            a += *p++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+static inline void PutBigEndian(unsigned char *p,unsigned int v)
+{
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           WriteChunk
+// Arguments:      The file, the chunk's four letter type and its data
+// Returns:        Whether it was written
+/////////////////////////////////////////////////////////////////////////////
+static bool WriteChunk(FILE *f,const char *type,const unsigned char *data,size_t size)
+{
+    unsigned char head[8], tail[4];
+    PutBigEndian(head,(unsigned int)size);
+    memcpy(head + 4,type,4);
+    unsigned int crc = Crc32(0xffffffffu,head + 4,4);
+    crc = Crc32(crc,data,size);
+    PutBigEndian(tail,crc ^ 0xffffffffu);
+    return fwrite(head,1,8,f) == 8 && (size == 0 || fwrite(data,1,size,f) == size) &&
+           fwrite(tail,1,4,f) == 4;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           WritePNG
+// Arguments:      The file, and the pixels with their size
+// Returns:        Whether it was written
+// Notes:          The image data is each row, top first, behind a 0 (no
+//                 filter) byte.  That stream is cut into stored deflate
+//                 blocks, behind a zlib header and ahead of its Adler-32,
+//                 and each block goes out as its own IDAT chunk, so nothing
+//                 the size of the image is ever built.
+/////////////////////////////////////////////////////////////////////////////
+bool FrameCapture::WritePNG(FILE *f,const unsigned char *rgba,int width,int height)
+{
+    static const unsigned char signature[8] = {0x89,'P','N','G','\r','\n',0x1a,'\n'};
+    if(width <= 0 || height <= 0)
+        return false;
+    unsigned char header[13];
+    PutBigEndian(header,width);
+    PutBigEndian(header + 4,height);
+    header[8] = 8;                  // Bits per channel
+    header[9] = 6;                  // RGBA
+    header[10] = header[11] = header[12] = 0;
+    bool ok = fwrite(signature,1,8,f) == 8 && WriteChunk(f,"IHDR",header,13);
+
+    size_t row = (size_t)4*width, line = row + 1, total = line*height;
+    std::vector<unsigned char> chunk(2 + 5 + CAPTURE_PNG_BLOCK + 4);
+    unsigned int adler = 1;
+    size_t pos = 0;
+    while(ok && pos < total) {
+        unsigned char *p = &chunk[0];
+        if(pos == 0) {
+            *p++ = 0x78;            // Deflate, 32K window
+            *p++ = 0x01;            // Check bits for the above, no dictionary
+        }
+        size_t n = std::min(total - pos,(size_t)CAPTURE_PNG_BLOCK);
+        bool last = pos + n == total;
+        *p++ = last ? 1 : 0;        // Final block flag, stored type
+        *p++ = (unsigned char)(n & 0xff);
+        *p++ = (unsigned char)(n >> 8);
+        *p++ = (unsigned char)(~n & 0xff);
+        *p++ = (unsigned char)((~n >> 8) & 0xff);
+
+        unsigned char *data = p;
+        size_t end = pos + n;
+        while(pos < end) {
+            size_t y = pos/line, x = pos % line;
+            if(x == 0) {
+                *p++ = 0;
+                pos++;
+                continue;
+            }
+            size_t take = std::min(line - x,end - pos);
+            memcpy(p,rgba + (height - 1 - y)*row + (x - 1),take);
+            p += take;
+            pos += take;
+        }
+        adler = Adler32(adler,data,p - data);
+        if(last) {
+            PutBigEndian(p,adler);
+            p += 4;
+        }
+        ok = WriteChunk(f,"IDAT",&chunk[0],p - &chunk[0]);
+    }
+    return ok && WriteChunk(f,"IEND",0,0);
+}
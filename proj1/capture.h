@@ -0,0 +1,187 @@
+/////////////////////////////////////////////////////////////////////////////
+// capture.h
+//
+/////////////////////////////////////
+// Classes declared:
+//
+// CaptureStats: Counts and timings since the capture started.
+//
+// FrameCapture: Records the frames the GL path draws, without stalling it.
+//               A plain glReadPixels waits for the GPU to finish the frame
+//               and copy it back before the CPU can go on.  Instead each
+//               frame is read into the next of a ring of pixel buffer
+//               objects (PBOs): the read is only queued, and the buffer is
+//               mapped ring-1 frames later, when the copy has long since
+//               finished.  The mapped pixels are copied into a frame from
+//               a fixed pool and handed to an encoder thread, which writes
+//               them out as
+//
+//               CAPTURE_PNG  one PNG per frame, named by a pattern with
+//                            one %d for the frame number, which may have
+//                            a width ("frame%05d.png")
+//               CAPTURE_RAW  every frame appended to one file, top row
+//                            first, as raw RGBA video: play it with
+//                            ffmpeg -f rawvideo -pixel_format rgba
+//                                   -video_size WxH -i capture.rgba
+//
+//               The pool is the bounded queue between the two threads.  If
+//               the encoder falls behind and every frame in it is waiting
+//               to be written, Capture() blocks until one is free, so the
+//               frame rate drops to the encoder's speed instead of frames
+//               being lost or memory growing without limit.  The stalls
+//               are counted in the stats.
+//
+//               The PNGs are written with stored (uncompressed) deflate
+//               blocks, so there is no zlib to link and the encoder keeps
+//               up with the frame rate; they are about as large as the raw
+//               frames, and any PNG reader opens them.
+//
+//               The PBO entry points are loaded at run time.  Without them
+//               (OpenGL before 2.1) frames are read with a plain
+//               glReadPixels, and only the encoding is off the GL thread.
+//
+// Start(), Capture() and Stop() must be called on the thread that owns the
+// GL context, and Stop() before the context goes away.
+//
+/////////////////////////////////////
+// Common Operations Supported:
+//
+// FrameCapture cap;
+// cap.Start("capture.rgba",CAPTURE_RAW);
+// cap.Capture(width,height);                      // Each frame, before the swap
+// cap.Stop();                                     // Writes the frames in flight
+// cap.GetStats().Print();
+// FrameCapture::WritePNG(f,rgba,width,height);
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSE167_CAPTURE_H_
+#define CSE167_CAPTURE_H_
+
+#include "core.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define CAPTURE_RING            3           // PBOs; a frame is mapped this many frames after it is read
+#define CAPTURE_QUEUE           4           // Frames in the pool between the GL and encoder threads
+#define CAPTURE_MAX_RING        8
+#define CAPTURE_MAX_PATH        256
+#define CAPTURE_MAX_DIGITS      10          // Widest %d a PNG pattern may ask for
+#define CAPTURE_PNG_BLOCK       65535       // Most bytes in a stored deflate block
+
+enum CaptureFormat {
+    CAPTURE_PNG,
+    CAPTURE_RAW
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// CaptureStats
+//
+struct CaptureStats {
+    void Reset()                                    {memset(this,0,sizeof(*this));}
+    void Print() const;
+
+    bool Buffered;                  // Reading through PBOs
+    int Frames;                     // Passed to Capture()
+    int Encoded;                    // Written out
+    int Stalls;                     // Times Capture() waited for the encoder
+    int MaxQueued;                  // Most frames waiting for the encoder at once
+    double CaptureMs;               // In Capture(), stalls included
+    double StallMs;
+    double EncodeMs;                // On the encoder thread
+    double Megabytes;               // Written
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// FrameCapture
+//
+class FrameCapture {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    FrameCapture();
+    ~FrameCapture();
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // Starts capturing to 'path' with 'ring' PBOs and 'queue' frames in
+    // the pool.  Returns false (and prints why) if the raw file can't be
+    // opened, or a PNG pattern has anything but one %d (%05d etc.) in it.
+    bool Start(const char *path,CaptureFormat format,int ring=CAPTURE_RING,int queue=CAPTURE_QUEUE);
+
+    // Reads back and writes out the frames still in the ring, waits for
+    // the encoder to finish, and frees the PBOs
+    void Stop();
+    bool IsActive() const                           {return m_Active;}
+
+    // Reads the back buffer's lower left width by height pixels, after the
+    // frame is drawn and before it is swapped.  Does nothing when stopped.
+    void Capture(int width,int height);
+
+    CaptureStats GetStats() const;
+
+    // Writes rows of RGBA8 pixels, bottom row first as glReadPixels
+    // leaves them, as a PNG.  Returns false if writing fails.
+    static bool WritePNG(FILE *f,const unsigned char *rgba,int width,int height);
+
+private:
+    struct Frame {
+        std::vector<unsigned char> Pixels;      // Bottom row first
+        int Width, Height;
+        int Number;
+    };
+
+    bool LoadBufferFunctions();
+    void CreateBuffers(int width,int height);
+    void DeleteBuffers();
+    void ReadOldest();                          // Maps the oldest PBO in flight and queues it
+    Frame *AcquireFrame();                      // Blocks while the pool is empty
+    void QueueFrame(Frame *frame);
+    void Run();
+    size_t Encode(const Frame &frame);          // Returns the bytes written, 0 if it failed
+
+    // Not copyable
+    FrameCapture(const FrameCapture &);
+    FrameCapture &operator=(const FrameCapture &);
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    bool m_Active;
+    CaptureFormat m_Format;
+    char m_Path[CAPTURE_MAX_PATH];
+    int m_NumberBegin, m_NumberEnd;             // Where the %d is in a PNG pattern
+    int m_NumberWidth;
+    bool m_NumberZeros;                         // Pad with zeros rather than spaces
+    FILE *m_Raw;                                // CAPTURE_RAW's file
+
+    // GL thread only
+    bool m_Buffered;
+    GLuint m_Buffers[CAPTURE_MAX_RING];
+    int m_FrameNumber[CAPTURE_MAX_RING];        // Frame read into each PBO
+    int m_Ring;
+    int m_Next;                                 // PBO the next frame is read into
+    int m_InFlight;                             // PBOs read and not yet mapped
+    int m_Width, m_Height;                      // Of the frames in the ring
+    int m_Frames;
+
+    // The pool and the queue, shared with the encoder thread
+    std::vector<Frame> m_Pool;
+    std::vector<Frame*> m_Free;
+    std::vector<Frame*> m_Queue;                // Oldest first
+    bool m_Stopping;
+    mutable std::mutex m_Lock;
+    std::condition_variable m_Wake;             // Something queued, or stopping
+    std::condition_variable m_Freed;            // A frame went back to the pool
+    std::thread m_Thread;
+    CaptureStats m_Stats;
+};
+
+#endif
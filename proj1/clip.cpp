@@ -0,0 +1,170 @@
+/////////////////////////////////////////////////////////////////////////////
+// clip.cpp
+/////////////////////////////////////
+// Outcodes and homogeneous Sutherland-Hodgman clipping.
+/////////////////////////////////////////////////////////////////////////////
+
+#include "clip.h"
+#include "simd.h"
+#include <string.h>
+
+// The planes ClipTriangle() cuts against, in the order it cuts them.  The
+// eye plane goes first so nothing after it sees w near 0.
+static const unsigned int s_ClipPlanes[] = {
+    CLIP_EYE, CLIP_NEAR, CLIP_FAR,
+    CLIP_GUARD_LEFT, CLIP_GUARD_RIGHT, CLIP_GUARD_BOTTOM, CLIP_GUARD_TOP
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           ClipCode
+// Arguments:      A clip space vertex and the guard band
+// Returns:        Its outcode
+// Notes:          Makes exactly the comparisons the SSE path makes, so the
+//                 two agree on every vertex
+/////////////////////////////////////////////////////////////////////////////
+static inline unsigned int ClipCode(const float *v,float guardX,float guardY)
+{
+    float x = v[0], y = v[1], z = v[2], w = v[3];
+    float gx = guardX*w, gy = guardY*w;
+    unsigned int code = 0;
+    if(x < -w)  code |= CLIP_LEFT;
+    if(x > w)   code |= CLIP_RIGHT;
+    if(y < -w)  code |= CLIP_BOTTOM;
+    if(y > w)   code |= CLIP_TOP;
+    if(z < -w)  code |= CLIP_NEAR;
+    if(z > w)   code |= CLIP_FAR;
+    if(x < -gx) code |= CLIP_GUARD_LEFT;
+    if(x > gx)  code |= CLIP_GUARD_RIGHT;
+    if(y < -gy) code |= CLIP_GUARD_BOTTOM;
+    if(y > gy)  code |= CLIP_GUARD_TOP;
+    if(w < CLIP_MIN_W) code |= CLIP_EYE;
+    return code;
+}
+
+#ifdef CSE167_SSE
+static inline __m128 ClipBit(__m128 test,unsigned int bit)
+{
+    return _mm_and_ps(test,_mm_castsi128_ps(_mm_set1_epi32((int)bit)));
+}
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           ComputeClipCodes
+// Arguments:      Clip space vertices (x,y,z,w each), how many, the guard
+//                 band and where to write the outcodes
+// Returns:        none
+// Notes:          Four vertices at a time: they are transposed to x,y,z,w
+//                 registers, every plane is one compare, and the compares
+//                 are masked to their bits and or'ed together.
+/////////////////////////////////////////////////////////////////////////////
+void ComputeClipCodes(const float *clip,int count,float guardX,float guardY,unsigned int *codes)
+{
+    int i = 0;
+#ifdef CSE167_SSE
+    __m128 vgx = _mm_set1_ps(guardX), vgy = _mm_set1_ps(guardY);
+    __m128 minW = _mm_set1_ps(CLIP_MIN_W), sign = _mm_set1_ps(-0.0f);
+    for(; i + 4 <= count; i += 4) {
+        const float *v = clip + 4*i;
+        __m128 x = _mm_loadu_ps(v), y = _mm_loadu_ps(v+4), z = _mm_loadu_ps(v+8), w = _mm_loadu_ps(v+12);
+        _MM_TRANSPOSE4_PS(x,y,z,w);
+        __m128 nw = _mm_xor_ps(w,sign);
+        __m128 gx = _mm_mul_ps(vgx,w), gy = _mm_mul_ps(vgy,w);
+        __m128 ngx = _mm_xor_ps(gx,sign), ngy = _mm_xor_ps(gy,sign);
+
+        __m128 code = ClipBit(_mm_cmplt_ps(x,nw),CLIP_LEFT);
+        code = _mm_or_ps(code,ClipBit(_mm_cmpgt_ps(x,w),CLIP_RIGHT));
+        code = _mm_or_ps(code,ClipBit(_mm_cmplt_ps(y,nw),CLIP_BOTTOM));
+        code = _mm_or_ps(code,ClipBit(_mm_cmpgt_ps(y,w),CLIP_TOP));
+        code = _mm_or_ps(code,ClipBit(_mm_cmplt_ps(z,nw),CLIP_NEAR));
+        code = _mm_or_ps(code,ClipBit(_mm_cmpgt_ps(z,w),CLIP_FAR));
+        code = _mm_or_ps(code,ClipBit(_mm_cmplt_ps(x,ngx),CLIP_GUARD_LEFT));
+        code = _mm_or_ps(code,ClipBit(_mm_cmpgt_ps(x,gx),CLIP_GUARD_RIGHT));
+        code = _mm_or_ps(code,ClipBit(_mm_cmplt_ps(y,ngy),CLIP_GUARD_BOTTOM));
+        code = _mm_or_ps(code,ClipBit(_mm_cmpgt_ps(y,gy),CLIP_GUARD_TOP));
+        code = _mm_or_ps(code,ClipBit(_mm_cmplt_ps(w,minW),CLIP_EYE));
+        _mm_storeu_si128((__m128i*)(codes + i),_mm_castps_si128(code));
+    }
+#endif
+    for(; i < count; i++)
+        codes[i] = ClipCode(clip + 4*i,guardX,guardY);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           PlaneDistance
+// Arguments:      A clip space vertex, one plane's outcode bit and the
+//                 guard band
+// Returns:        A signed distance to the plane, >= 0 inside
+/////////////////////////////////////////////////////////////////////////////
+static inline float PlaneDistance(const float *v,unsigned int plane,float guardX,float guardY)
+{
+    switch(plane) {
+        case CLIP_EYE:          return v[3] - CLIP_MIN_W;
+        case CLIP_NEAR:         return v[2] + v[3];
+        case CLIP_FAR:          return v[3] - v[2];
+        case CLIP_GUARD_LEFT:   return v[0] + guardX*v[3];
+        case CLIP_GUARD_RIGHT:  return guardX*v[3] - v[0];
+        case CLIP_GUARD_BOTTOM: return v[1] + guardY*v[3];
+        default:                return guardY*v[3] - v[1];
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           ClipTriangle
+// Arguments:      Three clip space vertices of 'floats' floats, the outcode
+//                 bits of the planes to cut against, the guard band and
+//                 room for the result
+// Returns:        The number of vertices written to 'out'
+// Notes:          Each plane can add at most one vertex, so the polygon
+//                 never has more than 3 + 7 of them.
+/////////////////////////////////////////////////////////////////////////////
+int ClipTriangle(const float *a,const float *b,const float *c,int floats,unsigned int planes,
+                 float guardX,float guardY,float *out)
+{
+    float bufA[CLIP_MAX_FLOATS*CLIP_MAX_VERTS], bufB[CLIP_MAX_FLOATS*CLIP_MAX_VERTS];
+    float dist[CLIP_MAX_VERTS];
+    float *in = bufA, *next = bufB;
+    size_t size = floats*sizeof(float);
+    memcpy(in,a,size);
+    memcpy(in + floats,b,size);
+    memcpy(in + 2*floats,c,size);
+    int n = 3;
+
+    for(unsigned int p = 0; p < sizeof(s_ClipPlanes)/sizeof(s_ClipPlanes[0]); p++) {
+        unsigned int plane = s_ClipPlanes[p];
+        if(!(planes & plane))
+            continue;
+        for(int i = 0; i < n; i++)
+            dist[i] = PlaneDistance(in + floats*i,plane,guardX,guardY);
+
+        int m = 0;
+        for(int i = 0; i < n; i++) {
+            int j = i+1 < n ? i+1 : 0;
+            const float *vi = in + floats*i, *vj = in + floats*j;
+            float di = dist[i], dj = dist[j];
+            if(di >= 0.0f) {
+                memcpy(next + floats*m,vi,size);
+                m++;
+            }
+            if((di >= 0.0f) != (dj >= 0.0f)) {
+                // Always step from the inside end, so the edge's other
+                // triangle makes the same vertex
+                const float *from = di >= 0.0f ? vi : vj;
+                const float *to = di >= 0.0f ? vj : vi;
+                float df = di >= 0.0f ? di : dj, dt = di >= 0.0f ? dj : di;
+                float t = df/(df - dt);
+                float *v = next + floats*m;
+                for(int k = 0; k < floats; k++)
+                    v[k] = from[k] + t*(to[k] - from[k]);
+                m++;
+            }
+        }
+        if(m < 3)
+            return 0;
+        float *swap = in;
+        in = next;
+        next = swap;
+        n = m;
+    }
+    memcpy(out,in,n*size);
+    return n;
+}
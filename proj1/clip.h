@@ -0,0 +1,86 @@
+/////////////////////////////////////////////////////////////////////////////
+// clip.h
+//
+/////////////////////////////////////
+// Functions declared:
+//
+// ComputeClipCodes(): The outcodes of clip space vertices, four at a time
+//                     with SSE.
+//
+// ClipTriangle():     Sutherland-Hodgman clipping of one clip space triangle
+//                     against the planes named by its vertices' outcodes.
+//
+// Clip space is what a full 4x4 projection produces, before the divide by
+// w: a vertex is inside the frustum when -w <= x,y,z <= w.  Each vertex's
+// outcode has a bit for every plane it is outside.  For a triangle with
+// outcodes c0, c1 and c2:
+//
+//  - if c0 & c1 & c2 is not 0, all three are outside one plane, and the
+//    triangle is rejected whole,
+//  - if (c0 | c1 | c2) & CLIP_MUST_CLIP is 0, it is drawn as it is,
+//  - otherwise it goes to ClipTriangle(), which cuts away what lies outside
+//    those planes and returns a convex polygon to draw as a fan.
+//
+// Only the near and far planes are cut by default.  The side planes are
+// left to the rasterizer, which already limits itself to the viewport; a
+// triangle poking out of the sides just has some of its bounding box
+// clamped away.  The guard band is how far outside the viewport that stays
+// safe (before window coordinates get big enough to lose precision in the
+// edge functions).  Only vertices beyond it set the CLIP_GUARD_ bits and
+// have the triangle cut against the guard band's sides, which is rare.
+// CLIP_EYE covers w too near 0 to divide by, for projections that are not
+// plain perspective.
+//
+// Clipping is deterministic: a new vertex on an edge is always interpolated
+// from the edge's inside end toward its outside end, so two triangles
+// sharing an edge get bit for bit the same vertex and no cracks open up
+// between them.
+//
+/////////////////////////////////////
+// Common Operations Supported:
+//
+// ComputeClipCodes(xyzw,count,guardX,guardY,codes);
+// unsigned int all = codes[a] | codes[b] | codes[c];
+// if(codes[a] & codes[b] & codes[c]) reject;
+// else if(!(all & CLIP_MUST_CLIP)) draw(a,b,c);
+// else n = ClipTriangle(va,vb,vc,4,all,guardX,guardY,polygon);
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSE167_CLIP_H_
+#define CSE167_CLIP_H_
+
+// Outcode bits: the frustum planes, the guard band planes, and the eye
+#define CLIP_LEFT               0x001       // x < -w
+#define CLIP_RIGHT              0x002       // x >  w
+#define CLIP_BOTTOM             0x004       // y < -w
+#define CLIP_TOP                0x008       // y >  w
+#define CLIP_NEAR               0x010       // z < -w
+#define CLIP_FAR                0x020       // z >  w
+#define CLIP_GUARD_LEFT         0x040       // x < -guardX*w
+#define CLIP_GUARD_RIGHT        0x080       // x >  guardX*w
+#define CLIP_GUARD_BOTTOM       0x100       // y < -guardY*w
+#define CLIP_GUARD_TOP          0x200       // y >  guardY*w
+#define CLIP_EYE                0x400       // w < CLIP_MIN_W
+#define CLIP_GUARD              (CLIP_GUARD_LEFT | CLIP_GUARD_RIGHT | CLIP_GUARD_BOTTOM | CLIP_GUARD_TOP)
+#define CLIP_MUST_CLIP          (CLIP_NEAR | CLIP_FAR | CLIP_GUARD | CLIP_EYE)
+
+#define CLIP_MIN_W              1e-5f       // Smallest w divided by
+#define CLIP_MAX_VERTS          16          // Most vertices ClipTriangle() makes
+#define CLIP_MAX_FLOATS         8           // Most floats in a vertex
+
+// Writes the outcodes of 'count' clip space vertices (x,y,z,w each) to
+// 'codes'.  guardX and guardY are the guard band's half extents in
+// normalized device coordinates, at least 1.
+void ComputeClipCodes(const float *clip,int count,float guardX,float guardY,unsigned int *codes);
+
+// Clips the triangle a,b,c (counter-clockwise or not) to the CLIP_MUST_CLIP
+// planes set in 'planes'.  Each vertex is 'floats' floats: x,y,z,w and then
+// any attributes, which are interpolated along with the position.  Writes
+// the polygon's vertices, in the triangle's winding, to 'out'
+// (floats*CLIP_MAX_VERTS floats) and returns how many there are: 0 if
+// nothing is left, otherwise at least 3.
+int ClipTriangle(const float *a,const float *b,const float *c,int floats,unsigned int planes,
+                 float guardX,float guardY,float *out);
+
+#endif
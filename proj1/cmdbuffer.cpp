@@ -0,0 +1,232 @@
+/////////////////////////////////////////////////////////////////////////////
+// cmdbuffer.cpp
+/////////////////////////////////////
+// Recording and GL replay of command buffers.
+/////////////////////////////////////////////////////////////////////////////
+
+#include "cmdbuffer.h"
+#include "mesh.h"
+
+#define CMD_MIN_CAPACITY        4096
+#define CMD_NO_QUADS            ((size_t)-1)
+#define CMD_QUAD_BYTES          (4*3*sizeof(float))
+#define CMD_LIT_VERTEX_BYTES    (6*sizeof(float))
+
+static inline size_t AlignCommand(size_t size)
+{
+    return (size + CMD_ALIGN-1) & ~(size_t)(CMD_ALIGN-1);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           CommandBuffer constructor/destructor
+/////////////////////////////////////////////////////////////////////////////
+CommandBuffer::CommandBuffer()
+{
+    m_Alloc = m_Data = 0;
+    m_Size = m_Capacity = 0;
+    m_LastQuads = CMD_NO_QUADS;
+    m_Commands = 0;
+}
+
+CommandBuffer::~CommandBuffer()
+{
+    delete [] m_Alloc;
+}
+
+void CommandBuffer::Reset()
+{
+    m_Size = 0;
+    m_LastQuads = CMD_NO_QUADS;
+    m_Commands = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Grow
+// Arguments:      Bytes needed
+// Returns:        none
+// Side Effects:   Moves the commands to a block at least twice the size
+/////////////////////////////////////////////////////////////////////////////
+void CommandBuffer::Grow(size_t size)
+{
+    size_t capacity = 2*m_Capacity;
+    if(capacity < size)
+        capacity = size;
+    if(capacity < CMD_MIN_CAPACITY)
+        capacity = CMD_MIN_CAPACITY;
+    char *alloc = new char[capacity + CMD_ALIGN];
+    char *data = (char*)AlignCommand((size_t)alloc);
+    if(m_Size)
+        memcpy(data,m_Data,m_Size);
+    delete [] m_Alloc;
+    m_Alloc = alloc;
+    m_Data = data;
+    m_Capacity = capacity;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Append
+// Arguments:      Command type and payload size
+// Returns:        The new command's header, payload following it
+/////////////////////////////////////////////////////////////////////////////
+CommandBuffer::Header *CommandBuffer::Append(int type,size_t payload)
+{
+    payload = AlignCommand(payload);
+    size_t size = m_Size + sizeof(Header) + payload;
+    if(size > m_Capacity)
+        Grow(size);
+    Header *h = (Header*)(m_Data + m_Size);
+    h->Type = type;
+    h->Count = 0;
+    h->Size = (unsigned int)payload;
+    h->Flags = 0;
+    m_Size = size;
+    m_Commands++;
+    m_LastQuads = CMD_NO_QUADS;
+    return h;
+}
+
+void CommandBuffer::SetState(unsigned int flags)
+{
+    Append(CMD_STATE,0)->Flags = flags;
+}
+
+void CommandBuffer::SetColor(const float *rgba)
+{
+    Header *h = Append(CMD_COLOR,4*sizeof(float));
+    memcpy(h+1,rgba,4*sizeof(float));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           AddQuads
+// Arguments:      Number of quads
+// Returns:        Where to write their 4*count corners
+// Side Effects:   Extends the last command if it is CMD_QUADS, otherwise
+//                 starts a new one
+/////////////////////////////////////////////////////////////////////////////
+float *CommandBuffer::AddQuads(int count)
+{
+    size_t bytes = count*CMD_QUAD_BYTES;
+    if(m_LastQuads == CMD_NO_QUADS) {
+        Header *h = Append(CMD_QUADS,bytes);
+        h->Count = count;
+        m_LastQuads = (char*)h - m_Data;
+        return (float*)(h+1);
+    }
+
+    // The open quads command is the last thing in the buffer
+    size_t used = ((Header*)(m_Data + m_LastQuads))->Count*CMD_QUAD_BYTES;
+    size_t payload = AlignCommand(used + bytes);
+    size_t size = m_LastQuads + sizeof(Header) + payload;
+    if(size > m_Capacity)
+        Grow(size);
+    Header *h = (Header*)(m_Data + m_LastQuads);
+    h->Count += count;
+    h->Size = (unsigned int)payload;
+    m_Size = size;
+    return (float*)((char*)(h+1) + used);
+}
+
+void CommandBuffer::DrawMesh(const Mesh *mesh,const Matrix &world)
+{
+    Header *h = Append(CMD_MESH,16*sizeof(float) + sizeof(const Mesh*));
+    memcpy(h+1,world.m_m,16*sizeof(float));
+    memcpy((char*)(h+1) + 16*sizeof(float),&mesh,sizeof(const Mesh*));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           DrawLitMesh
+// Arguments:      Mesh (kept alive until replayed) and the color to leave
+//                 current afterwards
+// Returns:        Where to write 6 floats per vertex
+// Notes:          The payload is the Mesh pointer, padded to CMD_ALIGN, the
+//                 color, then the vertices
+/////////////////////////////////////////////////////////////////////////////
+float *CommandBuffer::DrawLitMesh(const Mesh *mesh,const float *rgba)
+{
+    size_t vertexBytes = (size_t)mesh->GetVertexCount()*CMD_LIT_VERTEX_BYTES;
+    Header *h = Append(CMD_LIT_MESH,CMD_ALIGN + 4*sizeof(float) + vertexBytes);
+    char *payload = (char*)(h+1);
+    memcpy(payload,&mesh,sizeof(const Mesh*));
+    memcpy(payload + CMD_ALIGN,rgba,4*sizeof(float));
+    return (float*)(payload + CMD_ALIGN + 4*sizeof(float));
+}
+
+static void ApplyState(unsigned int flags)
+{
+    if(flags & CMD_BLEND) {
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA,GL_ONE_MINUS_SRC_ALPHA);
+    }
+    else
+        glDisable(GL_BLEND);
+    if(flags & CMD_DEPTH_TEST)
+        glEnable(GL_DEPTH_TEST);
+    else
+        glDisable(GL_DEPTH_TEST);
+    glDepthMask((flags & CMD_DEPTH_WRITE) ? GL_TRUE : GL_FALSE);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Replay
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Issues the commands.  Expects GL_VERTEX_ARRAY enabled.
+/////////////////////////////////////////////////////////////////////////////
+void CommandBuffer::Replay() const
+{
+    const char *p = m_Data, *end = m_Data + m_Size;
+    while(p < end) {
+        const Header *h = (const Header*)p;
+        const char *payload = (const char*)(h+1);
+        switch(h->Type) {
+            case CMD_STATE:
+                ApplyState(h->Flags);
+                break;
+            case CMD_COLOR:
+                glColor4fv((const float*)payload);
+                break;
+            case CMD_QUADS:
+                glVertexPointer(3,GL_FLOAT,0,payload);
+                glDrawArrays(GL_QUADS,0,4*h->Count);
+                break;
+            case CMD_MESH: {
+                Matrix world;
+                const Mesh *mesh;
+                memcpy(world.m_m,payload,16*sizeof(float));
+                memcpy(&mesh,payload + 16*sizeof(float),sizeof(const Mesh*));
+                mesh->Draw(world);
+                break;
+            }
+            case CMD_LIT_MESH: {
+                const Mesh *mesh;
+                memcpy(&mesh,payload,sizeof(const Mesh*));
+                const float *color = (const float*)(payload + CMD_ALIGN);
+                const float *verts = color + 4;
+                glEnableClientState(GL_COLOR_ARRAY);
+                glVertexPointer(3,GL_FLOAT,CMD_LIT_VERTEX_BYTES,verts);
+                glColorPointer(3,GL_FLOAT,CMD_LIT_VERTEX_BYTES,verts + 3);
+                glDrawElements(GL_TRIANGLES,mesh->GetIndexCount(),GL_UNSIGNED_INT,mesh->GetIndices());
+                glDisableClientState(GL_COLOR_ARRAY);
+                // Drawing with a color array leaves the current color undefined
+                glColor4fv(color);
+                break;
+            }
+        }
+        p = payload + h->Size;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           ReplayCommandBuffers
+// Arguments:      Buffers in the order to replay them, and how many
+// Returns:        none
+// Side Effects:   GL calls; must run on the GL thread
+/////////////////////////////////////////////////////////////////////////////
+void ReplayCommandBuffers(CommandBuffer *const *buffers,int count)
+{
+    glEnableClientState(GL_VERTEX_ARRAY);
+    for(int i = 0; i < count; i++)
+        buffers[i]->Replay();
+    glDisableClientState(GL_VERTEX_ARRAY);
+    ApplyState(CMD_DEFAULT_STATE);
+}
@@ -0,0 +1,141 @@
+/////////////////////////////////////////////////////////////////////////////
+// cmdbuffer.h
+//
+/////////////////////////////////////
+// Classes declared:
+//
+// CommandBuffer: A packed stream of draw commands.  Recording one touches
+//                no GL at all, so any thread can fill its own buffer while
+//                others fill theirs; the GL thread then replays the
+//                buffers in order and is left with nothing to do but issue
+//                calls.  Commands are plain data, not GL calls:
+//
+//                CMD_STATE   blending, depth test and depth writes on/off
+//                CMD_COLOR   the current color
+//                CMD_QUADS   quads with their world space corners inline,
+//                            replayed as one glDrawArrays
+//                CMD_MESH    a Mesh and its world Matrix, replayed with
+//                            Mesh::Draw
+//                CMD_LIT_MESH
+//                            a Mesh's vertices already in world space with
+//                            a color each, drawn with the Mesh's indices
+//
+//                Quads recorded right after other quads join the same
+//                command, so a run of cubes in one color is one call.
+//
+// Functions declared:
+//
+// ReplayCommandBuffers(): Issues a set of buffers' commands to GL in
+//                         order.  GL thread only.
+//
+// Each command is a 16 byte header and its payload, padded to 16 bytes,
+// so vertex data stays aligned.  A buffer keeps its memory when Reset(),
+// so after it has grown to its largest frame recording allocates nothing.
+//
+/////////////////////////////////////
+// Common Operations Supported:
+//
+// CommandBuffer cb;                               // One per job
+// cb.Reset();
+// cb.SetColor(rgba);
+// float *xyz = cb.AddQuads(2);                    // 8 corners to fill in
+// cb.DrawMesh(&mesh,world);
+// float *xyzrgb = cb.DrawLitMesh(&mesh,rgba);     // 6 floats per vertex
+//
+// ReplayCommandBuffers(buffers,count);            // On the GL thread
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSE167_CMDBUFFER_H_
+#define CSE167_CMDBUFFER_H_
+
+#include "matrix.h"
+
+class Mesh;
+
+#define CMD_ALIGN               16
+
+enum CommandType {
+    CMD_STATE,
+    CMD_COLOR,
+    CMD_QUADS,
+    CMD_MESH,
+    CMD_LIT_MESH
+};
+
+// CMD_STATE flags
+#define CMD_BLEND               1           // Alpha blending
+#define CMD_DEPTH_TEST          2
+#define CMD_DEPTH_WRITE         4
+#define CMD_DEFAULT_STATE       (CMD_DEPTH_TEST | CMD_DEPTH_WRITE)
+
+/////////////////////////////////////////////////////////////////////////////
+// CommandBuffer
+//
+class CommandBuffer {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    CommandBuffer();
+    ~CommandBuffer();
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // Empties the buffer, keeping its memory
+    void Reset();
+
+    void SetState(unsigned int flags);
+    void SetColor(const float *rgba);
+
+    // Returns room for 'count' quads' corners (x,y,z each, 4 per quad),
+    // valid until the next command is recorded
+    float *AddQuads(int count);
+
+    // The mesh must stay alive until the buffer is replayed
+    void DrawMesh(const Mesh *mesh,const Matrix &world);
+
+    // Returns room for each of the mesh's vertices' world position and
+    // color (x,y,z,r,g,b), valid until the next command is recorded.  The
+    // current color is set back to 'rgba' after the draw.
+    float *DrawLitMesh(const Mesh *mesh,const float *rgba);
+
+    // Accessors
+    size_t GetSize() const                          {return m_Size;}
+    int GetCommandCount() const                     {return m_Commands;}
+
+private:
+    struct Header {
+        int Type;
+        int Count;                  // Quads in CMD_QUADS, otherwise unused
+        unsigned int Size;          // Payload bytes, a multiple of CMD_ALIGN
+        unsigned int Flags;         // CMD_STATE flags
+    };
+
+    friend void ReplayCommandBuffers(CommandBuffer *const *buffers,int count);
+    void Replay() const;
+
+    Header *Append(int type,size_t payload);
+    void Grow(size_t size);
+
+    // Not copyable
+    CommandBuffer(const CommandBuffer &);
+    CommandBuffer &operator=(const CommandBuffer &);
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    char *m_Alloc, *m_Data;         // m_Data is m_Alloc aligned to CMD_ALIGN
+    size_t m_Size, m_Capacity;
+    size_t m_LastQuads;             // Offset of the last command if it is CMD_QUADS
+    int m_Commands;
+};
+
+// Replays buffers[0..count-1] in order, then restores CMD_DEFAULT_STATE
+void ReplayCommandBuffers(CommandBuffer *const *buffers,int count);
+
+#endif
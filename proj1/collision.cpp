@@ -0,0 +1,534 @@
+/////////////////////////////////////////////////////////////////////////////
+// collision.cpp
+/////////////////////////////////////
+// Bounding boxes, the two broad phases and the sphere/box tests.
+/////////////////////////////////////////////////////////////////////////////
+
+#include "collision.h"
+#include "jobs.h"
+#include "timer.h"
+#include <algorithm>
+
+#define COLLISION_SWITCH_AXIS   2.0f        // Variance ratio that changes the sweep axis
+#define COLLISION_PARALLEL_EPS  1e-6f       // Keeps edge x edge axes of parallel boxes from failing
+#define COLLISION_RADIX         2048        // Hash radix sort buckets per pass (11 bits)
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Print
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Prints the counters to stdout
+/////////////////////////////////////////////////////////////////////////////
+void CollisionStats::Print() const
+{
+    printf("collision: %d objects, %d candidate pairs, %d contacts (%d began, %d ended)\n",
+           Objects,Candidates,Contacts,Began,Ended);
+    printf("           bounds %.3f ms, broad phase %.3f ms (%d swaps, %d cells), narrow %.3f ms\n",
+           BoundsMs,BroadMs,Swaps,Cells,NarrowMs);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           CollisionWorld constructor
+/////////////////////////////////////////////////////////////////////////////
+CollisionWorld::CollisionWorld()
+{
+    m_Method = BROADPHASE_SWEEP;
+    m_CellSize = 0.0f;
+    m_Axis = 0;
+    m_Stats.Reset();
+}
+
+int CollisionWorld::AddSphere(const Point3 &center,float radius)
+{
+    Shape s;
+    s.Sphere = true;
+    s.Center = center;
+    s.Half = Vector3(radius,radius,radius);
+    m_Shapes.push_back(s);
+    m_Worlds.push_back(Matrix());
+    return (int)m_Shapes.size()-1;
+}
+
+int CollisionWorld::AddBox(const Point3 &min,const Point3 &max)
+{
+    Shape s;
+    s.Sphere = false;
+    s.Center = Point3(0.5f*(min.x+max.x),0.5f*(min.y+max.y),0.5f*(min.z+max.z));
+    s.Half = Vector3(0.5f*(max.x-min.x),0.5f*(max.y-min.y),0.5f*(max.z-min.z));
+    m_Shapes.push_back(s);
+    m_Worlds.push_back(Matrix());
+    return (int)m_Shapes.size()-1;
+}
+
+void CollisionWorld::Clear()
+{
+    m_Shapes.clear();
+    m_Worlds.clear();
+    m_Bounds.clear();
+    m_Order.clear();
+    m_Candidates.clear();
+    m_Contacts.clear();
+    m_Began.clear();
+    m_Ended.clear();
+}
+
+void CollisionWorld::GetBounds(int i,Point3 &min,Point3 &max) const
+{
+    const Bounds &b = m_Bounds[i];
+    min = Point3(b.Min[0],b.Min[1],b.Min[2]);
+    max = Point3(b.Max[0],b.Max[1],b.Max[2]);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           ComputeBounds
+// Arguments:      Object range
+// Returns:        none
+// Side Effects:   Fits m_Bounds around each object's shape at its world
+//                 transform.  A box's extent along a world axis is the sum
+//                 of its half sizes times the absolute Matrix row (Arvo's
+//                 method), which is exact for the box.
+/////////////////////////////////////////////////////////////////////////////
+void CollisionWorld::ComputeBounds(int begin,int end)
+{
+    for(int i = begin; i < end; i++) {
+        const Shape &s = m_Shapes[i];
+        const float *m = m_Worlds[i].m_m;
+        float c[3], h[3];
+        for(int r = 0; r < 3; r++)
+            c[r] = m[r]*s.Center.x + m[4+r]*s.Center.y + m[8+r]*s.Center.z + m[12+r];
+        if(s.Sphere) {
+            float scale = 0.0f;
+            for(int col = 0; col < 3; col++) {
+                const float *v = m + 4*col;
+                scale = std::max(scale,v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+            }
+            h[0] = h[1] = h[2] = s.Half.x*sqrtf(scale);
+        }
+        else {
+            for(int r = 0; r < 3; r++)
+                h[r] = fabsf(m[r])*s.Half.x + fabsf(m[4+r])*s.Half.y + fabsf(m[8+r])*s.Half.z;
+        }
+        Bounds &b = m_Bounds[i];
+        for(int r = 0; r < 3; r++) {
+            b.Min[r] = c[r] - h[r];
+            b.Max[r] = c[r] + h[r];
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Sweep
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Sweep and prune into m_Found
+/////////////////////////////////////////////////////////////////////////////
+void CollisionWorld::Sweep()
+{
+    int n = GetCount();
+
+    // The axis along which the boxes are most spread out separates the
+    // most pairs
+    double sum[3] = {0,0,0}, sumSq[3] = {0,0,0};
+    for(int i = 0; i < n; i++) {
+        for(int a = 0; a < 3; a++) {
+            double c = 0.5*(m_Bounds[i].Min[a] + m_Bounds[i].Max[a]);
+            sum[a] += c;
+            sumSq[a] += c*c;
+        }
+    }
+    double var[3];
+    int best = 0;
+    for(int a = 0; a < 3; a++) {
+        var[a] = sumSq[a] - sum[a]*sum[a]/n;
+        if(var[a] > var[best])
+            best = a;
+    }
+    bool resort = (int)m_Order.size() != n;
+    if(var[best] > COLLISION_SWITCH_AXIS*var[m_Axis]) {
+        m_Axis = best;
+        resort = true;
+    }
+    const int axis = m_Axis;
+
+    // Keep last update's order and let insertion sort fix it up, moving
+    // the boxes along with the indices so the sweep reads them in order
+    m_Sorted.resize(n);
+    if(resort) {
+        m_Order.resize(n);
+        for(int i = 0; i < n; i++)
+            m_Order[i] = i;
+        std::sort(m_Order.begin(),m_Order.end(),[this,axis](int a,int b) {
+            return m_Bounds[a].Min[axis] < m_Bounds[b].Min[axis];
+        });
+        for(int k = 0; k < n; k++)
+            m_Sorted[k] = m_Bounds[m_Order[k]];
+    }
+    else {
+        for(int k = 0; k < n; k++)
+            m_Sorted[k] = m_Bounds[m_Order[k]];
+        int swaps = 0;
+        for(int k = 1; k < n; k++) {
+            float key = m_Sorted[k].Min[axis];
+            if(m_Sorted[k-1].Min[axis] <= key)
+                continue;
+            Bounds b = m_Sorted[k];
+            int id = m_Order[k];
+            int j = k;
+            do {
+                m_Sorted[j] = m_Sorted[j-1];
+                m_Order[j] = m_Order[j-1];
+                j--;
+            } while(j > 0 && m_Sorted[j-1].Min[axis] > key);
+            m_Sorted[j] = b;
+            m_Order[j] = id;
+            swaps += k - j;
+        }
+        m_Stats.Swaps = swaps;
+    }
+
+    // Everything starting before a box ends overlaps it on this axis
+    const int o1 = (axis + 1) % 3, o2 = (axis + 2) % 3;
+    for(int k = 0; k < n; k++) {
+        const Bounds &a = m_Sorted[k];
+        float end = a.Max[axis];
+        for(int j = k+1; j < n && m_Sorted[j].Min[axis] <= end; j++) {
+            const Bounds &b = m_Sorted[j];
+            if(a.Min[o1] <= b.Max[o1] && b.Min[o1] <= a.Max[o1] &&
+               a.Min[o2] <= b.Max[o2] && b.Min[o2] <= a.Max[o2]) {
+                CollisionPair p;
+                p.A = std::min(m_Order[k],m_Order[j]);
+                p.B = std::max(m_Order[k],m_Order[j]);
+                m_Found.push_back(p);
+            }
+        }
+    }
+}
+
+static inline int FloorToInt(float f)
+{
+    int i = (int)f;
+    return i - (f < (float)i);
+}
+
+static inline unsigned int HashCell(const int *cell)
+{
+    unsigned int h = ((unsigned int)cell[0]*73856093u) ^ ((unsigned int)cell[1]*19349663u) ^ ((unsigned int)cell[2]*83492791u);
+    return h*2654435769u;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Hash
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Spatial hash broad phase into m_Found
+/////////////////////////////////////////////////////////////////////////////
+void CollisionWorld::Hash()
+{
+    int n = GetCount();
+    float size = m_CellSize;
+    if(size <= 0.0f) {
+        double total = 0.0;
+        for(int i = 0; i < n; i++) {
+            const Bounds &b = m_Bounds[i];
+            total += std::max(b.Max[0]-b.Min[0],std::max(b.Max[1]-b.Min[1],b.Max[2]-b.Min[2]));
+        }
+        size = (float)(2.0*total/n);
+        if(size <= 0.0f)
+            size = 1.0f;
+    }
+    const float inv = 1.0f/size;
+
+    // One entry per object per cell it touches
+    m_Entries.clear();
+    for(int i = 0; i < n; i++) {
+        const Bounds &b = m_Bounds[i];
+        int lo[3], hi[3];
+        for(int a = 0; a < 3; a++) {
+            lo[a] = FloorToInt(b.Min[a]*inv);
+            hi[a] = FloorToInt(b.Max[a]*inv);
+        }
+        Entry e;
+        e.Object = i;
+        for(e.Cell[2] = lo[2]; e.Cell[2] <= hi[2]; e.Cell[2]++) {
+            for(e.Cell[1] = lo[1]; e.Cell[1] <= hi[1]; e.Cell[1]++) {
+                for(e.Cell[0] = lo[0]; e.Cell[0] <= hi[0]; e.Cell[0]++) {
+                    e.Hash = HashCell(e.Cell);
+                    m_Entries.push_back(e);
+                }
+            }
+        }
+    }
+    int entries = (int)m_Entries.size();
+    m_Stats.Cells = entries;
+
+    // Sort the entries by hash, 11 bits per pass, so each cell's entries
+    // end up next to each other (and any cells sharing a hash too)
+    m_EntryScratch.resize(entries);
+    Entry *from = m_Entries.data(), *to = m_EntryScratch.data();
+    for(int pass = 0; pass < 3; pass++) {
+        int shift = 11*pass;
+        int count[COLLISION_RADIX] = {0};
+        for(int i = 0; i < entries; i++)
+            count[(from[i].Hash >> shift) & (COLLISION_RADIX-1)]++;
+        int start = 0;
+        for(int r = 0; r < COLLISION_RADIX; r++) {
+            int c = count[r];
+            count[r] = start;
+            start += c;
+        }
+        for(int i = 0; i < entries; i++)
+            to[count[(from[i].Hash >> shift) & (COLLISION_RADIX-1)]++] = from[i];
+        std::swap(from,to);
+    }
+
+    // Pairs within each run of equal hashes that are in the same cell,
+    // overlap, and have the low corner of their overlap in this cell
+    for(int begin = 0, end; begin < entries; begin = end) {
+        end = begin + 1;
+        while(end < entries && from[end].Hash == from[begin].Hash)
+            end++;
+        for(int i = begin; i < end; i++) {
+            const Entry &ei = from[i];
+            const Bounds &bi = m_Bounds[ei.Object];
+            for(int j = i+1; j < end; j++) {
+                const Entry &ej = from[j];
+                if(ej.Cell[0] != ei.Cell[0] || ej.Cell[1] != ei.Cell[1] || ej.Cell[2] != ei.Cell[2])
+                    continue;
+                const Bounds &bj = m_Bounds[ej.Object];
+                bool owner = true;
+                for(int a = 0; a < 3 && owner; a++) {
+                    if(bi.Min[a] > bj.Max[a] || bj.Min[a] > bi.Max[a])
+                        owner = false;
+                    else if(FloorToInt(std::max(bi.Min[a],bj.Min[a])*inv) != ei.Cell[a])
+                        owner = false;
+                }
+                if(owner) {
+                    CollisionPair p;
+                    p.A = std::min(ei.Object,ej.Object);
+                    p.B = std::max(ei.Object,ej.Object);
+                    m_Found.push_back(p);
+                }
+            }
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           SortCandidates
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Puts m_Found into (A,B) order in m_Candidates: a counting
+//                 sort on A, then a sort of each object's few partners
+/////////////////////////////////////////////////////////////////////////////
+void CollisionWorld::SortCandidates()
+{
+    int n = GetCount();
+    int found = (int)m_Found.size();
+    m_FirstPair.assign(n,0);
+    for(int i = 0; i < found; i++)
+        m_FirstPair[m_Found[i].A]++;
+    int start = 0;
+    for(int a = 0; a < n; a++) {
+        int count = m_FirstPair[a];
+        m_FirstPair[a] = start;
+        start += count;
+    }
+    m_Candidates.resize(found);
+    for(int i = 0; i < found; i++)
+        m_Candidates[m_FirstPair[m_Found[i].A]++] = m_Found[i];
+
+    int begin = 0;
+    for(int a = 0; a < n; a++) {
+        int end = m_FirstPair[a];
+        if(end - begin > 1)
+            std::sort(m_Candidates.begin()+begin,m_Candidates.begin()+end);
+        begin = end;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Narrow
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Tests every candidate exactly (on the job pool), and
+//                 compares the contacts with the previous update's
+/////////////////////////////////////////////////////////////////////////////
+void CollisionWorld::Narrow()
+{
+    int count = (int)m_Candidates.size();
+    m_Hit.resize(count);
+    ParallelFor(count,COLLISION_GRAIN,[this](int begin,int end,int) {
+        for(int i = begin; i < end; i++)
+            m_Hit[i] = Touching(m_Candidates[i].A,m_Candidates[i].B);
+    });
+
+    m_Previous.swap(m_Contacts);
+    m_Contacts.clear();
+    for(int i = 0; i < count; i++) {
+        if(m_Hit[i])
+            m_Contacts.push_back(m_Candidates[i]);
+    }
+
+    // Both lists are sorted, so one merge finds the differences
+    m_Began.clear();
+    m_Ended.clear();
+    size_t i = 0, j = 0;
+    while(i < m_Contacts.size() || j < m_Previous.size()) {
+        if(j == m_Previous.size() || (i < m_Contacts.size() && m_Contacts[i] < m_Previous[j]))
+            m_Began.push_back(m_Contacts[i++]);
+        else if(i == m_Contacts.size() || m_Previous[j] < m_Contacts[i])
+            m_Ended.push_back(m_Previous[j++]);
+        else {
+            i++;
+            j++;
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Update
+// Arguments:      none
+// Returns:        none
+/////////////////////////////////////////////////////////////////////////////
+void CollisionWorld::Update()
+{
+    int n = GetCount();
+    m_Stats.Reset();
+    m_Stats.Objects = n;
+
+    Timer timer;
+    m_Bounds.resize(n);
+    ParallelFor(n,COLLISION_GRAIN,[this](int begin,int end,int) {
+        ComputeBounds(begin,end);
+    });
+    m_Stats.BoundsMs = timer.GetMs();
+
+    timer.Start();
+    m_Found.clear();
+    if(n > 1) {
+        if(m_Method == BROADPHASE_SWEEP)
+            Sweep();
+        else
+            Hash();
+    }
+    SortCandidates();
+    m_Stats.BroadMs = timer.GetMs();
+
+    timer.Start();
+    Narrow();
+    m_Stats.NarrowMs = timer.GetMs();
+
+    m_Stats.Candidates = (int)m_Candidates.size();
+    m_Stats.Contacts = (int)m_Contacts.size();
+    m_Stats.Began = (int)m_Began.size();
+    m_Stats.Ended = (int)m_Ended.size();
+}
+
+// A shape placed in the world: a sphere, or a box with unit axes
+struct WorldShape {
+    bool Sphere;
+    float Center[3];
+    float Axis[3][3];
+    float Half[3];                  // Radius in [0] for spheres
+};
+
+static void PlaceShape(const Point3 &center,const Vector3 &half,bool sphere,const Matrix &world,WorldShape &out)
+{
+    const float *m = world.m_m;
+    out.Sphere = sphere;
+    for(int r = 0; r < 3; r++)
+        out.Center[r] = m[r]*center.x + m[4+r]*center.y + m[8+r]*center.z + m[12+r];
+    const float h[3] = {half.x,half.y,half.z};
+    float largest = 0.0f;
+    for(int c = 0; c < 3; c++) {
+        const float *v = m + 4*c;
+        float len = sqrtf(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+        float inv = len > 0.0f ? 1.0f/len : 0.0f;
+        for(int r = 0; r < 3; r++)
+            out.Axis[c][r] = v[r]*inv;
+        out.Half[c] = h[c]*len;
+        largest = std::max(largest,len);
+    }
+    if(sphere)
+        out.Half[0] = half.x*largest;
+}
+
+static inline float Dot3(const float *a,const float *b)
+{
+    return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+}
+
+// Closest point on the box to the sphere's center, measured along each
+// box axis
+static bool SphereBox(const WorldShape &s,const WorldShape &b)
+{
+    float d[3] = {s.Center[0]-b.Center[0],s.Center[1]-b.Center[1],s.Center[2]-b.Center[2]};
+    float distSq = 0.0f;
+    for(int i = 0; i < 3; i++) {
+        float t = fabsf(Dot3(d,b.Axis[i])) - b.Half[i];
+        if(t > 0.0f)
+            distSq += t*t;
+    }
+    return distSq <= s.Half[0]*s.Half[0];
+}
+
+// Separating axis test of two oriented boxes: their 3+3 face normals and
+// the 9 cross products of their edges (Gottschalk et al.)
+static bool BoxBox(const WorldShape &a,const WorldShape &b)
+{
+    float R[3][3], absR[3][3];
+    for(int i = 0; i < 3; i++) {
+        for(int j = 0; j < 3; j++) {
+            R[i][j] = Dot3(a.Axis[i],b.Axis[j]);
+            absR[i][j] = fabsf(R[i][j]) + COLLISION_PARALLEL_EPS;
+        }
+    }
+    float d[3] = {b.Center[0]-a.Center[0],b.Center[1]-a.Center[1],b.Center[2]-a.Center[2]};
+    float t[3] = {Dot3(d,a.Axis[0]),Dot3(d,a.Axis[1]),Dot3(d,a.Axis[2])};
+    const float *ha = a.Half, *hb = b.Half;
+
+    for(int i = 0; i < 3; i++) {
+        if(fabsf(t[i]) > ha[i] + hb[0]*absR[i][0] + hb[1]*absR[i][1] + hb[2]*absR[i][2])
+            return false;
+    }
+    for(int j = 0; j < 3; j++) {
+        float s = t[0]*R[0][j] + t[1]*R[1][j] + t[2]*R[2][j];
+        if(fabsf(s) > ha[0]*absR[0][j] + ha[1]*absR[1][j] + ha[2]*absR[2][j] + hb[j])
+            return false;
+    }
+    for(int i = 0; i < 3; i++) {
+        int i1 = (i+1)%3, i2 = (i+2)%3;
+        for(int j = 0; j < 3; j++) {
+            int j1 = (j+1)%3, j2 = (j+2)%3;
+            float ra = ha[i1]*absR[i2][j] + ha[i2]*absR[i1][j];
+            float rb = hb[j1]*absR[i][j2] + hb[j2]*absR[i][j1];
+            if(fabsf(t[i2]*R[i1][j] - t[i1]*R[i2][j]) > ra + rb)
+                return false;
+        }
+    }
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Touching
+// Arguments:      Two object indices
+// Returns:        true if their shapes overlap (touching counts)
+/////////////////////////////////////////////////////////////////////////////
+bool CollisionWorld::Touching(int a,int b) const
+{
+    const Shape &sa = m_Shapes[a], &sb = m_Shapes[b];
+    WorldShape wa, wb;
+    PlaceShape(sa.Center,sa.Half,sa.Sphere,m_Worlds[a],wa);
+    PlaceShape(sb.Center,sb.Half,sb.Sphere,m_Worlds[b],wb);
+
+    if(wa.Sphere && wb.Sphere) {
+        float d[3] = {wa.Center[0]-wb.Center[0],wa.Center[1]-wb.Center[1],wa.Center[2]-wb.Center[2]};
+        float r = wa.Half[0] + wb.Half[0];
+        return Dot3(d,d) <= r*r;
+    }
+    if(wa.Sphere)
+        return SphereBox(wa,wb);
+    if(wb.Sphere)
+        return SphereBox(wb,wa);
+    return BoxBox(wa,wb);
+}
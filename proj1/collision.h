@@ -0,0 +1,199 @@
+/////////////////////////////////////////////////////////////////////////////
+// collision.h
+//
+/////////////////////////////////////
+// Classes declared:
+//
+// CollisionPair:   Two overlapping objects, A < B.
+//
+// CollisionStats:  Per update counts and timings.
+//
+// CollisionWorld:  Finds which of many moving spheres and boxes touch.
+//                  Every object has a shape in its own coordinates and a
+//                  world Matrix; Update() fits a world axis aligned box
+//                  around each one (on the job pool), finds the pairs of
+//                  boxes that overlap with one of two broad phases, and
+//                  runs the exact sphere/box tests on just those pairs.
+//
+// Broad phases:
+//
+// BROADPHASE_SWEEP: Sweep and prune.  The objects stay sorted by the low
+//                   end of their box along one axis between updates, and
+//                   each update re-sorts that order with an insertion sort,
+//                   which is close to linear when things move a little per
+//                   frame.  One sweep along the sorted order then meets
+//                   every pair that overlaps on that axis and checks the
+//                   other two.  The axis is the one the boxes are most
+//                   spread out along, and it only changes (with a full
+//                   sort) when another axis becomes clearly better.
+//
+// BROADPHASE_HASH:  A uniform grid of unbounded size.  Each object is
+//                   entered in every cell its box touches, the entries are
+//                   radix sorted by a hash of their cell so each cell's
+//                   entries end up together, and objects sharing a cell are
+//                   tested.
+//                   A pair touching several common cells is only reported
+//                   from the one holding the low corner of their overlap.
+//                   Better than the sweep for dense clouds with no
+//                   coherence or a poor sweep axis.  The cells should be
+//                   about the size of the larger objects; by default they
+//                   are twice the average box size.
+//
+// Pairs and contacts are always in increasing (A,B) order, whatever the
+// broad phase found them in, so the lists are stable from one update to
+// the next and the same for both broad phases.  Comparing them with the
+// previous update's gives the contacts that began and ended.
+//
+// Shapes are placed with any rotation, translation and scale.  A sphere
+// is scaled by the largest scale of its Matrix (so it stays a sphere);
+// a box becomes an oriented box, which is exact as long as the Matrix
+// has no shear.
+//
+/////////////////////////////////////
+// Common Operations Supported:
+//
+// CollisionWorld cw;
+// int a = cw.AddSphere(Point3(0,0,0),1.0f);
+// int b = cw.AddBox(Point3(-1,-1,-1),Point3(1,1,1));
+// cw.SetTransform(a,world);                       // Whenever objects move
+// cw.Update();
+// cw.GetContacts();                               // Touching pairs
+// cw.GetBegan();  cw.GetEnded();                  // Changes since last time
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSE167_COLLISION_H_
+#define CSE167_COLLISION_H_
+
+#include "matrix.h"
+#include <vector>
+
+#define COLLISION_GRAIN         4096        // Objects or pairs per job
+
+enum BroadPhaseMethod {
+    BROADPHASE_SWEEP,
+    BROADPHASE_HASH
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// CollisionPair
+//
+struct CollisionPair {
+    int A, B;
+};
+
+inline bool operator==(const CollisionPair &p,const CollisionPair &q)   {return p.A == q.A && p.B == q.B;}
+inline bool operator<(const CollisionPair &p,const CollisionPair &q)    {return p.A < q.A || (p.A == q.A && p.B < q.B);}
+
+/////////////////////////////////////////////////////////////////////////////
+// CollisionStats
+//
+struct CollisionStats {
+    void Reset()                                    {memset(this,0,sizeof(*this));}
+    void Print() const;
+
+    int Objects;
+    int Candidates;                 // Pairs from the broad phase
+    int Contacts;                   // Pairs that really touch
+    int Began, Ended;               // Contacts new and lost since last update
+    int Swaps;                      // Sweep: insertion sort moves
+    int Cells;                      // Hash: grid entries
+    double BoundsMs, BroadMs, NarrowMs;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// CollisionWorld
+//
+class CollisionWorld {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    CollisionWorld();
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // Add an object at the identity transform and return its index
+    int AddSphere(const Point3 &center,float radius);
+    int AddBox(const Point3 &min,const Point3 &max);
+    void Clear();
+
+    // Places an object for the next Update()
+    void SetTransform(int i,const Matrix &world)    {m_Worlds[i] = world;}
+    const Matrix &GetTransform(int i) const         {return m_Worlds[i];}
+
+    void SetMethod(BroadPhaseMethod method)         {m_Method = method;}
+    BroadPhaseMethod GetMethod() const              {return m_Method;}
+    // Hash cell size; 0 (the default) picks one from the boxes
+    void SetCellSize(float size)                    {m_CellSize = size;}
+
+    // Refits the boxes and finds the pairs and contacts
+    void Update();
+
+    // Accessors
+    int GetCount() const                            {return (int)m_Shapes.size();}
+    void GetBounds(int i,Point3 &min,Point3 &max) const;
+    const std::vector<CollisionPair> &GetCandidates() const {return m_Candidates;}
+    const std::vector<CollisionPair> &GetContacts() const   {return m_Contacts;}
+    const std::vector<CollisionPair> &GetBegan() const      {return m_Began;}
+    const std::vector<CollisionPair> &GetEnded() const      {return m_Ended;}
+    const CollisionStats &GetStats() const          {return m_Stats;}
+
+    // Exact test of one pair at the current transforms
+    bool Touching(int a,int b) const;
+
+private:
+    struct Shape {
+        bool Sphere;
+        Point3 Center;
+        Vector3 Half;               // Box half size, or the radius in x
+    };
+    // An object's box in world space, minimum then maximum
+    struct Bounds {
+        float Min[3], Max[3];
+    };
+
+    void ComputeBounds(int begin,int end);
+    void Sweep();
+    void Hash();
+    void SortCandidates();
+    void Narrow();
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    BroadPhaseMethod m_Method;
+    float m_CellSize;
+
+    std::vector<Shape> m_Shapes;
+    std::vector<Matrix> m_Worlds;
+    std::vector<Bounds> m_Bounds;
+
+    // Sweep: object order along m_Axis, kept between updates, and the
+    // boxes gathered in that order
+    int m_Axis;
+    std::vector<int> m_Order;
+    std::vector<Bounds> m_Sorted;
+
+    // Hash: one entry per object per cell, and the radix sort's scratch
+    struct Entry {
+        int Object;
+        int Cell[3];
+        unsigned int Hash;
+    };
+    std::vector<Entry> m_Entries, m_EntryScratch;
+
+    std::vector<CollisionPair> m_Found;         // Broad phase, any order
+    std::vector<int> m_FirstPair;               // Counting sort by A
+    std::vector<CollisionPair> m_Candidates;
+    std::vector<unsigned char> m_Hit;
+    std::vector<CollisionPair> m_Contacts, m_Previous, m_Began, m_Ended;
+
+    CollisionStats m_Stats;
+};
+
+#endif
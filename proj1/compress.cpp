@@ -0,0 +1,604 @@
+/////////////////////////////////////////////////////////////////////////////
+// compress.cpp
+/////////////////////////////////////
+// Compact vertex encodings, 3x4 affine matrices and the compressed mesh.
+//
+// Every bulk routine has an SSE2 path that does four elements at a time
+// and a scalar path for the leftovers (or everything, without SSE).  Both
+// do the same float operations in the same order, so they give identical
+// results.
+/////////////////////////////////////////////////////////////////////////////
+
+#include "compress.h"
+#include "simd.h"
+
+#define HALF_F32_INF            (255<<23)
+#define HALF_F16_MAX            ((127+16)<<23)  // First float that overflows a half
+#define HALF_DENORM_MAGIC       (((127-15)+(23-10)+1)<<23)
+#define HALF_MIN_NORMAL         (113<<23)       // Smallest float that is a normal half
+#define HALF_REBIAS             (((unsigned int)(15-127)<<23) + 0xfff)  // Exponent bias 127 to 15, and rounding
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           FloatToHalf
+// Arguments:      A float
+// Returns:        The nearest half float (ties to even)
+// Notes:          Overflow gives infinity, NaN stays NaN (quiet), and small
+//                 values round to half denormals.
+/////////////////////////////////////////////////////////////////////////////
+unsigned short FloatToHalf(float f)
+{
+    unsigned int u;
+    memcpy(&u,&f,4);
+    unsigned int sign = u & 0x80000000u;
+    u ^= sign;
+
+    unsigned int o;
+    if(u >= HALF_F16_MAX)
+        o = u > HALF_F32_INF ? 0x7e00 : 0x7c00;
+    else if(u < HALF_MIN_NORMAL) {
+        // Adding the magic number lines the 10 mantissa bits up at the
+        // bottom of the float, rounding to nearest even on the way
+        float fu, magic;
+        unsigned int m = HALF_DENORM_MAGIC;
+        memcpy(&fu,&u,4);
+        memcpy(&magic,&m,4);
+        fu += magic;
+        memcpy(&o,&fu,4);
+        o -= m;
+    }
+    else {
+        unsigned int odd = (u >> 13) & 1;
+        u += HALF_REBIAS;                   // Rebias, and round half up...
+        u += odd;                           // ...or to even on a tie
+        o = u >> 13;
+    }
+    return (unsigned short)(o | (sign >> 16));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           HalfToFloat
+// Arguments:      A half float
+// Returns:        Its exact float value
+/////////////////////////////////////////////////////////////////////////////
+float HalfToFloat(unsigned short h)
+{
+    const unsigned int shiftedExp = 0x7c00 << 13;
+    unsigned int o = (h & 0x7fff) << 13;
+    unsigned int exp = o & shiftedExp;
+    o += (127-15) << 23;
+    if(exp == shiftedExp)
+        o += (128-16) << 23;                // Infinity or NaN
+    else if(exp == 0) {
+        // Zero or denormal: renormalize through a float subtract
+        o += 1 << 23;
+        float f, magic;
+        unsigned int m = HALF_MIN_NORMAL;
+        memcpy(&f,&o,4);
+        memcpy(&magic,&m,4);
+        f -= magic;
+        memcpy(&o,&f,4);
+    }
+    o |= (unsigned int)(h & 0x8000) << 16;
+    float f;
+    memcpy(&f,&o,4);
+    return f;
+}
+
+#ifdef CSE167_SSE
+// Picks 'a' where 'mask' is set and 'b' elsewhere
+static inline __m128i Select(__m128i mask,__m128i a,__m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask,a),_mm_andnot_si128(mask,b));
+}
+static inline __m128 Select(__m128 mask,__m128 a,__m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask,a),_mm_andnot_ps(mask,b));
+}
+
+// FloatToHalf on four floats, giving four halves in the low 16 bits of
+// each lane
+static inline __m128i FloatToHalf4(__m128 in)
+{
+    __m128i u = _mm_castps_si128(in);
+    __m128i sign = _mm_and_si128(u,_mm_set1_epi32((int)0x80000000u));
+    u = _mm_xor_si128(u,sign);
+
+    __m128i big = _mm_cmpgt_epi32(u,_mm_set1_epi32(HALF_F16_MAX-1));
+    __m128i nan = _mm_cmpgt_epi32(u,_mm_set1_epi32(HALF_F32_INF));
+    __m128i infNan = Select(nan,_mm_set1_epi32(0x7e00),_mm_set1_epi32(0x7c00));
+
+    __m128i small = _mm_cmplt_epi32(u,_mm_set1_epi32(HALF_MIN_NORMAL));
+    __m128i magic = _mm_set1_epi32(HALF_DENORM_MAGIC);
+    __m128i denorm = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(u),_mm_castsi128_ps(magic))),magic);
+
+    __m128i odd = _mm_and_si128(_mm_srli_epi32(u,13),_mm_set1_epi32(1));
+    __m128i normal = _mm_add_epi32(u,_mm_set1_epi32((int)HALF_REBIAS));
+    normal = _mm_srli_epi32(_mm_add_epi32(normal,odd),13);
+
+    __m128i o = Select(big,infNan,Select(small,denorm,normal));
+    return _mm_or_si128(o,_mm_srli_epi32(sign,16));
+}
+
+// HalfToFloat on four halves held in the low 16 bits of each lane
+static inline __m128 HalfToFloat4(__m128i h)
+{
+    const __m128i shiftedExp = _mm_set1_epi32(0x7c00 << 13);
+    __m128i o = _mm_slli_epi32(_mm_and_si128(h,_mm_set1_epi32(0x7fff)),13);
+    __m128i exp = _mm_and_si128(o,shiftedExp);
+    o = _mm_add_epi32(o,_mm_set1_epi32((127-15) << 23));
+
+    __m128i infNan = _mm_cmpeq_epi32(exp,shiftedExp);
+    o = _mm_add_epi32(o,_mm_and_si128(infNan,_mm_set1_epi32((128-16) << 23)));
+
+    __m128i zero = _mm_cmpeq_epi32(exp,_mm_setzero_si128());
+    __m128 denorm = _mm_sub_ps(_mm_castsi128_ps(_mm_add_epi32(o,_mm_set1_epi32(1 << 23))),
+                               _mm_castsi128_ps(_mm_set1_epi32(HALF_MIN_NORMAL)));
+    o = Select(zero,_mm_castps_si128(denorm),o);
+
+    o = _mm_or_si128(o,_mm_slli_epi32(_mm_and_si128(h,_mm_set1_epi32(0x8000)),16));
+    return _mm_castsi128_ps(o);
+}
+
+// Packs the low 16 bits of each lane of 'a' and 'b' into eight shorts
+static inline __m128i Pack16(__m128i a,__m128i b)
+{
+    a = _mm_srai_epi32(_mm_slli_epi32(a,16),16);
+    b = _mm_srai_epi32(_mm_slli_epi32(b,16),16);
+    return _mm_packs_epi32(a,b);
+}
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           FloatsToHalves, HalvesToFloats
+// Arguments:      Output array, input array and the number of values
+// Returns:        none
+// Side Effects:   Converts 'count' values
+/////////////////////////////////////////////////////////////////////////////
+void FloatsToHalves(unsigned short *out,const float *in,int count)
+{
+    int i = 0;
+#ifdef CSE167_SSE
+    for(; i+8 <= count; i += 8) {
+        __m128i lo = FloatToHalf4(_mm_loadu_ps(in+i));
+        __m128i hi = FloatToHalf4(_mm_loadu_ps(in+i+4));
+        _mm_storeu_si128((__m128i*)(out+i),Pack16(lo,hi));
+    }
+#endif
+    for(; i < count; i++)
+        out[i] = FloatToHalf(in[i]);
+}
+
+void HalvesToFloats(float *out,const unsigned short *in,int count)
+{
+    int i = 0;
+#ifdef CSE167_SSE
+    for(; i+8 <= count; i += 8) {
+        __m128i h = _mm_loadu_si128((const __m128i*)(in+i));
+        _mm_storeu_ps(out+i,HalfToFloat4(_mm_unpacklo_epi16(h,_mm_setzero_si128())));
+        _mm_storeu_ps(out+i+4,HalfToFloat4(_mm_unpackhi_epi16(h,_mm_setzero_si128())));
+    }
+#endif
+    for(; i < count; i++)
+        out[i] = HalfToFloat(in[i]);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           EncodeOctahedral
+// Arguments:      Two shorts to write and a unit vector
+// Returns:        none
+// Notes:          The zero vector encodes as (0,0), which decodes to +z.
+/////////////////////////////////////////////////////////////////////////////
+void EncodeOctahedral(short *out,const Vector3 &n)
+{
+    float s = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    float inv = s > 0.0f ? 1.0f/s : 0.0f;
+    float px = n.x*inv, py = n.y*inv;
+    if(n.z < 0.0f) {
+        // Fold the lower half over the diagonals
+        float ox = (1.0f - fabsf(py))*(px < 0.0f ? -1.0f : 1.0f);
+        float oy = (1.0f - fabsf(px))*(py < 0.0f ? -1.0f : 1.0f);
+        px = ox;
+        py = oy;
+    }
+    out[0] = (short)lrintf(px*QUANTIZE_MAX);
+    out[1] = (short)lrintf(py*QUANTIZE_MAX);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           DecodeOctahedral
+// Arguments:      Two shorts written by EncodeOctahedral
+// Returns:        The unit vector
+/////////////////////////////////////////////////////////////////////////////
+Vector3 DecodeOctahedral(const short *in)
+{
+    float x = in[0]*(1.0f/QUANTIZE_MAX), y = in[1]*(1.0f/QUANTIZE_MAX);
+    float z = 1.0f - fabsf(x) - fabsf(y);
+    float t = -z > 0.0f ? -z : 0.0f;
+    x += x < 0.0f ? t : -t;
+    y += y < 0.0f ? t : -t;
+    float inv = 1.0f/sqrtf(x*x + y*y + z*z);
+    return Vector3(x*inv,y*inv,z*inv);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           EncodeNormals, DecodeNormals
+// Arguments:      Octahedral output (two shorts per normal) or input, the
+//                 normal component arrays, and the number of normals
+// Returns:        none
+/////////////////////////////////////////////////////////////////////////////
+void EncodeNormals(short *out,const float *nx,const float *ny,const float *nz,int count)
+{
+    int i = 0;
+#ifdef CSE167_SSE
+    const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32((int)0x80000000u));
+    const __m128 one = _mm_set1_ps(1.0f), zero = _mm_setzero_ps();
+    for(; i+4 <= count; i += 4) {
+        __m128 x = _mm_loadu_ps(nx+i), y = _mm_loadu_ps(ny+i), z = _mm_loadu_ps(nz+i);
+        __m128 ax = _mm_andnot_ps(signMask,x), ay = _mm_andnot_ps(signMask,y);
+        __m128 s = _mm_add_ps(_mm_add_ps(ax,ay),_mm_andnot_ps(signMask,z));
+        __m128 inv = _mm_and_ps(_mm_div_ps(one,s),_mm_cmpgt_ps(s,zero));
+        __m128 px = _mm_mul_ps(x,inv), py = _mm_mul_ps(y,inv);
+
+        __m128 sx = _mm_or_ps(one,_mm_and_ps(_mm_cmplt_ps(px,zero),signMask));
+        __m128 sy = _mm_or_ps(one,_mm_and_ps(_mm_cmplt_ps(py,zero),signMask));
+        __m128 ox = _mm_mul_ps(_mm_sub_ps(one,_mm_andnot_ps(signMask,py)),sx);
+        __m128 oy = _mm_mul_ps(_mm_sub_ps(one,_mm_andnot_ps(signMask,px)),sy);
+        __m128 below = _mm_cmplt_ps(z,zero);
+        px = Select(below,ox,px);
+        py = Select(below,oy,py);
+
+        __m128 q = _mm_set1_ps((float)QUANTIZE_MAX);
+        __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(px,q)),_mm_cvtps_epi32(_mm_mul_ps(py,q)));
+        _mm_storeu_si128((__m128i*)(out+2*i),_mm_unpacklo_epi16(packed,_mm_srli_si128(packed,8)));
+    }
+#endif
+    for(; i < count; i++)
+        EncodeOctahedral(out+2*i,Vector3(nx[i],ny[i],nz[i]));
+}
+
+void DecodeNormals(float *nx,float *ny,float *nz,const short *in,int count)
+{
+    int i = 0;
+#ifdef CSE167_SSE
+    const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32((int)0x80000000u));
+    const __m128 one = _mm_set1_ps(1.0f), zero = _mm_setzero_ps();
+    const __m128 scale = _mm_set1_ps(1.0f/QUANTIZE_MAX);
+    for(; i+4 <= count; i += 4) {
+        __m128i q = _mm_loadu_si128((const __m128i*)(in+2*i));
+        __m128 x = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(q,16),16)),scale);
+        __m128 y = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(q,16)),scale);
+        __m128 z = _mm_sub_ps(_mm_sub_ps(one,_mm_andnot_ps(signMask,x)),_mm_andnot_ps(signMask,y));
+        __m128 t = _mm_max_ps(_mm_sub_ps(zero,z),zero);
+        __m128 negT = _mm_sub_ps(zero,t);
+        x = _mm_add_ps(x,Select(_mm_cmplt_ps(x,zero),t,negT));
+        y = _mm_add_ps(y,Select(_mm_cmplt_ps(y,zero),t,negT));
+        __m128 len = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x,x),_mm_mul_ps(y,y)),_mm_mul_ps(z,z));
+        __m128 inv = _mm_div_ps(one,_mm_sqrt_ps(len));
+        _mm_storeu_ps(nx+i,_mm_mul_ps(x,inv));
+        _mm_storeu_ps(ny+i,_mm_mul_ps(y,inv));
+        _mm_storeu_ps(nz+i,_mm_mul_ps(z,inv));
+    }
+#endif
+    for(; i < count; i++) {
+        Vector3 n = DecodeOctahedral(in+2*i);
+        nx[i] = n.x;
+        ny[i] = n.y;
+        nz[i] = n.z;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           QuantizePositions
+// Arguments:      Output (four shorts per position), the position arrays,
+//                 their number and the box they lie in
+// Returns:        none
+// Notes:          Positions outside the box are clamped to it.
+/////////////////////////////////////////////////////////////////////////////
+void QuantizePositions(short *out,const float *x,const float *y,const float *z,int count,
+                       const Point3 &bmin,const Point3 &bmax)
+{
+    float center[3], scale[3];
+    for(int k = 0; k < 3; k++) {
+        float half = 0.5f*(((const float*)&bmax)[k] - ((const float*)&bmin)[k]);
+        center[k] = 0.5f*(((const float*)&bmax)[k] + ((const float*)&bmin)[k]);
+        scale[k] = half > 0.0f ? QUANTIZE_MAX/half : 0.0f;
+    }
+
+    int i = 0;
+#ifdef CSE167_SSE
+    const __m128 lo = _mm_set1_ps(-(float)QUANTIZE_MAX), hi = _mm_set1_ps((float)QUANTIZE_MAX);
+    const __m128 cx = _mm_set1_ps(center[0]), cy = _mm_set1_ps(center[1]), cz = _mm_set1_ps(center[2]);
+    const __m128 sx = _mm_set1_ps(scale[0]), sy = _mm_set1_ps(scale[1]), sz = _mm_set1_ps(scale[2]);
+    for(; i+4 <= count; i += 4) {
+        __m128 fx = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(x+i),cx),sx);
+        __m128 fy = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(y+i),cy),sy);
+        __m128 fz = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(z+i),cz),sz);
+        __m128i qx = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(fx,lo),hi));
+        __m128i qy = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(fy,lo),hi));
+        __m128i qz = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(fz,lo),hi));
+
+        // x0..x3 y0..y3 and z0..z3 0..0, interleaved to x y z 0 per vertex
+        __m128i xy = _mm_packs_epi32(qx,qy);
+        __m128i z0 = _mm_packs_epi32(qz,_mm_setzero_si128());
+        __m128i xz = _mm_unpacklo_epi16(xy,z0);
+        __m128i y0 = _mm_unpackhi_epi16(xy,z0);
+        _mm_storeu_si128((__m128i*)(out+4*i),_mm_unpacklo_epi16(xz,y0));
+        _mm_storeu_si128((__m128i*)(out+4*i+8),_mm_unpackhi_epi16(xz,y0));
+    }
+#endif
+    for(; i < count; i++) {
+        float f[3] = {(x[i]-center[0])*scale[0],(y[i]-center[1])*scale[1],(z[i]-center[2])*scale[2]};
+        for(int k = 0; k < 3; k++) {
+            if(f[k] < -QUANTIZE_MAX) f[k] = -QUANTIZE_MAX;
+            if(f[k] > QUANTIZE_MAX) f[k] = QUANTIZE_MAX;
+            out[4*i+k] = (short)lrintf(f[k]);
+        }
+        out[4*i+3] = 0;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           MakeDequantizeMatrix
+// Arguments:      Output matrix and the quantization box
+// Returns:        none
+// Side Effects:   Sets 'm' to scale quantized coordinates by half the box
+//                 size over QUANTIZE_MAX and move them to the box center
+/////////////////////////////////////////////////////////////////////////////
+void MakeDequantizeMatrix(Matrix &m,const Point3 &bmin,const Point3 &bmax)
+{
+    Vector3 half = 0.5f*(bmax - bmin);
+    m.Set(half.x/QUANTIZE_MAX,0.0f,0.0f,0.5f*(bmin.x+bmax.x),
+          0.0f,half.y/QUANTIZE_MAX,0.0f,0.5f*(bmin.y+bmax.y),
+          0.0f,0.0f,half.z/QUANTIZE_MAX,0.5f*(bmin.z+bmax.z),
+          0.0f,0.0f,0.0f,1.0f);
+}
+
+void DequantizePositions(float *x,float *y,float *z,const short *in,int count,
+                         const Point3 &bmin,const Point3 &bmax)
+{
+    Matrix m;
+    MakeDequantizeMatrix(m,bmin,bmax);
+    Matrix34(m).TransformQuantized(x,y,z,in,count);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Matrix34 Set, Get
+// Arguments:      A 4x4 matrix to take from or write to
+// Returns:        none
+/////////////////////////////////////////////////////////////////////////////
+void Matrix34::Set(const Matrix &m)
+{
+    for(int c = 0; c < 4; c++) {
+        m_m[3*c+0] = m.m_m[4*c+0];
+        m_m[3*c+1] = m.m_m[4*c+1];
+        m_m[3*c+2] = m.m_m[4*c+2];
+    }
+}
+
+void Matrix34::Get(Matrix &m) const
+{
+    m.Set(m_m[0],m_m[3],m_m[6],m_m[9],
+          m_m[1],m_m[4],m_m[7],m_m[10],
+          m_m[2],m_m[5],m_m[8],m_m[11],
+          0.0f,0.0f,0.0f,1.0f);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Multiply
+// Arguments:      Two affine matrices
+// Returns:        none
+// Side Effects:   Sets this matrix to a (dot) b
+/////////////////////////////////////////////////////////////////////////////
+void Matrix34::Multiply(const Matrix34 &a,const Matrix34 &b)
+{
+    float r[12];
+    for(int c = 0; c < 4; c++) {
+        const float *bc = &b.m_m[3*c];
+        for(int i = 0; i < 3; i++)
+            r[3*c+i] = a.m_m[i]*bc[0] + a.m_m[3+i]*bc[1] + a.m_m[6+i]*bc[2];
+    }
+    r[9] += a.m_m[9];
+    r[10] += a.m_m[10];
+    r[11] += a.m_m[11];
+    memcpy(m_m,r,sizeof(r));
+}
+
+void Matrix34::Transform(const Point3 &in,Point3 &out) const
+{
+    float x = in.x, y = in.y, z = in.z;
+    out.x = m_m[0]*x + m_m[3]*y + m_m[6]*z + m_m[9];
+    out.y = m_m[1]*x + m_m[4]*y + m_m[7]*z + m_m[10];
+    out.z = m_m[2]*x + m_m[5]*y + m_m[8]*z + m_m[11];
+}
+
+void Matrix34::Transform(const Vector3 &in,Vector3 &out) const
+{
+    float x = in.x, y = in.y, z = in.z;
+    out.x = m_m[0]*x + m_m[3]*y + m_m[6]*z;
+    out.y = m_m[1]*x + m_m[4]*y + m_m[7]*z;
+    out.z = m_m[2]*x + m_m[5]*y + m_m[8]*z;
+}
+
+#ifdef CSE167_SSE
+// One output coordinate for four points: r0*x + r1*y + r2*z + r3
+static inline __m128 Row4(const float *m,int row,__m128 x,__m128 y,__m128 z)
+{
+    __m128 r = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[row]),x),_mm_mul_ps(_mm_set1_ps(m[3+row]),y));
+    return _mm_add_ps(_mm_add_ps(r,_mm_mul_ps(_mm_set1_ps(m[6+row]),z)),_mm_set1_ps(m[9+row]));
+}
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           TransformPoints
+// Arguments:      Output and input coordinate arrays, and the point count
+// Returns:        none
+/////////////////////////////////////////////////////////////////////////////
+void Matrix34::TransformPoints(float *ox,float *oy,float *oz,const float *x,const float *y,const float *z,int count) const
+{
+    int i = 0;
+#ifdef CSE167_SSE
+    for(; i+4 <= count; i += 4) {
+        __m128 px = _mm_loadu_ps(x+i), py = _mm_loadu_ps(y+i), pz = _mm_loadu_ps(z+i);
+        _mm_storeu_ps(ox+i,Row4(m_m,0,px,py,pz));
+        _mm_storeu_ps(oy+i,Row4(m_m,1,px,py,pz));
+        _mm_storeu_ps(oz+i,Row4(m_m,2,px,py,pz));
+    }
+#endif
+    for(; i < count; i++) {
+        Point3 p(x[i],y[i],z[i]);
+        Transform(p,p);
+        ox[i] = p.x;
+        oy[i] = p.y;
+        oz[i] = p.z;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           TransformQuantized
+// Arguments:      Output coordinate arrays, quantized positions (four
+//                 shorts each) and their number
+// Returns:        none
+// Notes:          The integers are converted straight to floats and go
+//                 through this matrix, so there is no separate decode pass.
+/////////////////////////////////////////////////////////////////////////////
+void Matrix34::TransformQuantized(float *ox,float *oy,float *oz,const short *in,int count) const
+{
+    int i = 0;
+#ifdef CSE167_SSE
+    for(; i+4 <= count; i += 4) {
+        // x y z w for vertices 0,1 and 2,3, transposed to x0..x3 etc.
+        __m128i v01 = _mm_loadu_si128((const __m128i*)(in+4*i));
+        __m128i v23 = _mm_loadu_si128((const __m128i*)(in+4*i+8));
+        __m128i a = _mm_unpacklo_epi16(v01,v23);        // x0 x2 y0 y2 z0 z2 w0 w2
+        __m128i b = _mm_unpackhi_epi16(v01,v23);        // x1 x3 y1 y3 z1 z3 w1 w3
+        __m128i xy = _mm_unpacklo_epi16(a,b);           // x0 x1 x2 x3 y0 y1 y2 y3
+        __m128i zw = _mm_unpackhi_epi16(a,b);           // z0 z1 z2 z3 w0 w1 w2 w3
+        __m128 px = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(xy,xy),16));
+        __m128 py = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(xy,xy),16));
+        __m128 pz = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(zw,zw),16));
+        _mm_storeu_ps(ox+i,Row4(m_m,0,px,py,pz));
+        _mm_storeu_ps(oy+i,Row4(m_m,1,px,py,pz));
+        _mm_storeu_ps(oz+i,Row4(m_m,2,px,py,pz));
+    }
+#endif
+    for(; i < count; i++) {
+        Point3 p(in[4*i],in[4*i+1],in[4*i+2]);
+        Transform(p,p);
+        ox[i] = p.x;
+        oy[i] = p.y;
+        oz[i] = p.z;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           CompressedMesh constructor
+/////////////////////////////////////////////////////////////////////////////
+CompressedMesh::CompressedMesh()
+{
+    m_VertexCount = 0;
+    m_IndexCount = 0;
+}
+
+void CompressedMesh::Free()
+{
+    m_Positions.clear();
+    m_Normals.clear();
+    m_Indices16.clear();
+    m_Indices32.clear();
+    m_VertexCount = 0;
+    m_IndexCount = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Build
+// Arguments:      The mesh to encode
+// Returns:        false if the mesh is empty
+/////////////////////////////////////////////////////////////////////////////
+bool CompressedMesh::Build(const Mesh &mesh)
+{
+    Free();
+    if(mesh.IsEmpty() || mesh.GetVertexCount() == 0)
+        return false;
+
+    m_VertexCount = mesh.GetVertexCount();
+    m_IndexCount = mesh.GetIndexCount();
+    m_BoundsMin = mesh.GetBoundsMin();
+    m_BoundsMax = mesh.GetBoundsMax();
+    MakeDequantizeMatrix(m_Dequantize,m_BoundsMin,m_BoundsMax);
+
+    m_Positions.resize(4*m_VertexCount);
+    QuantizePositions(&m_Positions[0],mesh.GetX(),mesh.GetY(),mesh.GetZ(),m_VertexCount,m_BoundsMin,m_BoundsMax);
+    if(mesh.HasNormals()) {
+        m_Normals.resize(2*m_VertexCount);
+        EncodeNormals(&m_Normals[0],mesh.GetNX(),mesh.GetNY(),mesh.GetNZ(),m_VertexCount);
+    }
+
+    const unsigned int *idx = mesh.GetIndices();
+    if(m_VertexCount <= 0x10000)
+        m_Indices16.assign(idx,idx+m_IndexCount);
+    else
+        m_Indices32.assign(idx,idx+m_IndexCount);
+    return true;
+}
+
+size_t CompressedMesh::GetDataSize() const
+{
+    return m_Positions.size()*sizeof(short) + m_Normals.size()*sizeof(short) +
+           m_Indices16.size()*sizeof(unsigned short) + m_Indices32.size()*sizeof(unsigned int);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           TransformPositions, DecodePositions, DecodeNormals
+// Arguments:      Output arrays of GetVertexCount() floats each (and the
+//                 affine transform to apply)
+// Returns:        none
+/////////////////////////////////////////////////////////////////////////////
+void CompressedMesh::TransformPositions(const Matrix &m,float *x,float *y,float *z) const
+{
+    Matrix34 mq(m*m_Dequantize);
+    mq.TransformQuantized(x,y,z,GetPositions(),m_VertexCount);
+}
+
+void CompressedMesh::DecodePositions(float *x,float *y,float *z) const
+{
+    Matrix34(m_Dequantize).TransformQuantized(x,y,z,GetPositions(),m_VertexCount);
+}
+
+void CompressedMesh::DecodeNormals(float *nx,float *ny,float *nz) const
+{
+    if(HasNormals())
+        ::DecodeNormals(nx,ny,nz,&m_Normals[0],m_VertexCount);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Draw
+// Arguments:      A transformation to apply to the mesh before drawing
+// Returns:        none
+// Side Effects:   Draws the mesh as OpenGL triangles in the current color.
+// Notes:          The quantized positions go to GL as shorts, with the
+//                 dequantization on the modelview stack after 'mTransform'.
+/////////////////////////////////////////////////////////////////////////////
+void CompressedMesh::Draw(const Matrix &mTransform) const
+{
+    if(m_VertexCount == 0)
+        return;
+
+    const short *pos = GetPositions();
+    const short *nrm = GetNormals();
+
+    Matrix m = mTransform*m_Dequantize;
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glMultMatrixf(m.m_m);
+    glBegin(GL_TRIANGLES);
+    for(int i = 0; i < m_IndexCount; i++) {
+        unsigned int v = GetIndex(i);
+        if(nrm) {
+            Vector3 n = DecodeOctahedral(nrm+2*v);
+            glNormal3f(n.x,n.y,n.z);
+        }
+        glVertex3sv(pos+4*v);
+    }
+    glEnd();
+    glPopMatrix();
+}
@@ -0,0 +1,180 @@
+/////////////////////////////////////////////////////////////////////////////
+// compress.h
+//
+/////////////////////////////////////
+// Classes declared:
+//
+// Matrix34:       An affine transform stored as 3 rows by 4 columns (the
+//                 implied last row is 0,0,0,1).  48 bytes instead of 64, and
+//                 composing two costs 36 multiplies instead of 64.
+//
+// CompressedMesh: A Mesh re-encoded for bandwidth: positions quantized to
+//                 16 bits within the bounding box (8 bytes per vertex),
+//                 octahedral normals (4 bytes), and 16 bit indices when the
+//                 vertex count allows.  24 bytes of vertex data per vertex
+//                 become 12.  Positions are drawn and transformed without
+//                 ever being expanded back to floats: the dequantization is
+//                 folded into the transform.
+//
+// Functions declared:
+//
+// Position quantization: every coordinate becomes a signed 16 bit integer
+// q in [-32767,32767] with p = center + q * extent/65534, so the error is
+// half a step, 1/131068 of the box size along each axis (plus float
+// rounding in the decode).  Stored as x,y,z plus one
+// padding short so a vertex is 8 aligned bytes.
+//
+// Half floats: IEEE 754 binary16 with round to nearest even, denormals,
+// infinities and NaNs, converted four (or eight) at a time with SSE2
+// integer ops since there is no F16C in our baseline.
+//
+// Octahedral normals: a unit vector is projected onto the octahedron
+// |x|+|y|+|z| = 1, the lower half folded over the upper, and the resulting
+// x,y stored as two snorm16 values.  Decoded normals are within 6.4e-5
+// radians (0.004 degrees) of the original.
+//
+/////////////////////////////////////
+// Common Operations Supported:
+//
+// CompressedMesh cm;
+// cm.Build(mesh);                                 // Encode
+// cm.Draw(world);                                 // Like Mesh::Draw
+// cm.TransformPositions(mvp,x,y,z);               // Straight from 16 bits
+//
+// Matrix34 a(world);                              // Drop the last row
+// a.Transform(p,q);
+//
+// FloatsToHalves(halves,floats,count);
+// EncodeNormals(oct,nx,ny,nz,count);
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSE167_COMPRESS_H_
+#define CSE167_COMPRESS_H_
+
+#include "mesh.h"
+#include <vector>
+
+#define QUANTIZE_MAX            32767
+
+// Half floats
+unsigned short FloatToHalf(float f);
+float HalfToFloat(unsigned short h);
+void FloatsToHalves(unsigned short *out,const float *in,int count);
+void HalvesToFloats(float *out,const unsigned short *in,int count);
+
+// Octahedral unit normals, two shorts per normal
+void EncodeOctahedral(short *out,const Vector3 &n);
+Vector3 DecodeOctahedral(const short *in);
+void EncodeNormals(short *out,const float *nx,const float *ny,const float *nz,int count);
+void DecodeNormals(float *nx,float *ny,float *nz,const short *in,int count);
+
+// Positions within [bmin,bmax], four shorts per position
+void QuantizePositions(short *out,const float *x,const float *y,const float *z,int count,
+                       const Point3 &bmin,const Point3 &bmax);
+void DequantizePositions(float *x,float *y,float *z,const short *in,int count,
+                         const Point3 &bmin,const Point3 &bmax);
+// The transform from quantized integer coordinates back to [bmin,bmax]
+void MakeDequantizeMatrix(Matrix &m,const Point3 &bmin,const Point3 &bmax);
+
+/////////////////////////////////////////////////////////////////////////////
+// Matrix34
+//
+class Matrix34 {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    Matrix34()                                      {Set(Matrix::IDENTITY);}
+    explicit Matrix34(const Matrix &m)              {Set(m);}
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // Drops the last row of 'm', which must be affine
+    void Set(const Matrix &m);
+    void Get(Matrix &m) const;
+
+    // this = a * b.  Works if this is a or b.
+    void Multiply(const Matrix34 &a,const Matrix34 &b);
+
+    void Transform(const Point3 &in,Point3 &out) const;
+    void Transform(const Vector3 &in,Vector3 &out) const;
+
+    // Transforms 'count' points held as separate x, y and z arrays.  The
+    // input and output arrays may be the same.
+    void TransformPoints(float *ox,float *oy,float *oz,const float *x,const float *y,const float *z,int count) const;
+
+    // Transforms quantized positions (four shorts each) straight to floats.
+    // 'this' should already include the dequantization matrix.
+    void TransformQuantized(float *ox,float *oy,float *oz,const short *in,int count) const;
+
+////////////////////////////////
+// Member Variables
+//
+public:
+    // Column major like Matrix: columns a, b, c, d of 3 floats each
+    float m_m[12];
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// CompressedMesh
+//
+class CompressedMesh {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    CompressedMesh();
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // Encodes 'mesh'.  Returns false if it is empty.
+    bool Build(const Mesh &mesh);
+    void Free();
+
+    // Draws with OpenGL after applying 'mTransform', like Mesh::Draw
+    void Draw(const Matrix &mTransform) const;
+
+    // Object space positions transformed by 'm' (which must be affine)
+    // into x,y,z arrays of GetVertexCount() floats
+    void TransformPositions(const Matrix &m,float *x,float *y,float *z) const;
+    void DecodePositions(float *x,float *y,float *z) const;
+    void DecodeNormals(float *nx,float *ny,float *nz) const;
+
+    // Accessors
+    int GetVertexCount() const                      {return m_VertexCount;}
+    int GetIndexCount() const                       {return m_IndexCount;}
+    bool HasNormals() const                         {return !m_Normals.empty();}
+    const Matrix &GetDequantize() const             {return m_Dequantize;}
+    const short *GetPositions() const               {return m_VertexCount ? &m_Positions[0] : 0;}
+    const short *GetNormals() const                 {return HasNormals() ? &m_Normals[0] : 0;}
+    size_t GetDataSize() const;
+
+    // Index 'i' of the triangle list
+    unsigned int GetIndex(int i) const              {return m_Indices16.empty() ? m_Indices32[i] : m_Indices16[i];}
+
+private:
+    // Not copyable
+    CompressedMesh(const CompressedMesh &);
+    CompressedMesh &operator=(const CompressedMesh &);
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    std::vector<short> m_Positions;             // x,y,z,pad per vertex
+    std::vector<short> m_Normals;               // Octahedral x,y per vertex
+    std::vector<unsigned short> m_Indices16;    // Used when all indices fit
+    std::vector<unsigned int> m_Indices32;
+    int m_VertexCount, m_IndexCount;
+    Point3 m_BoundsMin, m_BoundsMax;
+    Matrix m_Dequantize;
+};
+
+#endif
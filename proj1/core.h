@@ -15,6 +15,7 @@
 #include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <GL/gl.h>
 #include <GL/glu.h>
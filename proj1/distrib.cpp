@@ -0,0 +1,294 @@
+/////////////////////////////////////////////////////////////////////////////
+// distrib.cpp
+/////////////////////////////////////
+// Sort-first rendering split over worker processes.
+/////////////////////////////////////////////////////////////////////////////
+
+#include "distrib.h"
+#include "timer.h"
+#include <algorithm>
+
+static_assert(sizeof(Matrix) == 16*sizeof(float),"matrices are sent as 16 floats");
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           DistribStats::Print
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Prints the frame and then each worker's band
+/////////////////////////////////////////////////////////////////////////////
+void DistribStats::Print() const
+{
+    printf("distributed: %d workers, %.3f ms a frame, slowest band %.3f ms, imbalance %.2f, %d rows local\n",
+           Workers,FrameMs,SlowestMs,Imbalance,LocalRows);
+    for(int i = 0; i < Workers; i++)
+        printf("  worker %d: %d rows in %.3f ms\n",i,Rows[i],RenderMs[i]);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           BuildCubes
+// Arguments:      The scene to fill, the cubes' matrices and their colors
+// Returns:        none
+/////////////////////////////////////////////////////////////////////////////
+static void BuildCubes(RayScene &scene,const Matrix *objects,int count,const unsigned int *colors)
+{
+    scene.Clear();
+    for(int i = 0; i < count; i++)
+        scene.AddCube(objects[i],colors);
+    scene.Build();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Serve
+// Arguments:      The connection to the coordinator
+// Returns:        Whether a request was answered
+// Notes:          Everything in the request is checked before any of it is
+//                 used, since it came from another process
+/////////////////////////////////////////////////////////////////////////////
+bool DistribWorker::Serve(Socket &connection)
+{
+    DistribRequest req;
+    if(!connection.Receive(&req,sizeof(req)))
+        return false;
+    if(req.Magic != DISTRIB_MAGIC || req.ObjectCount < 0 || req.ObjectCount > DISTRIB_MAX_OBJECTS ||
+       req.Width <= 0 || req.Width > DISTRIB_MAX_SIZE || req.Height <= 0 || req.Height > DISTRIB_MAX_SIZE ||
+       req.RowBegin < 0 || req.RowBegin > req.RowEnd || req.RowEnd > req.Height) {
+        printf("DistribWorker::Serve: bad request\n");
+        return false;
+    }
+    m_Objects.resize(req.ObjectCount);
+    if(req.ObjectCount > 0 && !connection.Receive(&m_Objects[0],req.ObjectCount*sizeof(Matrix)))
+        return false;
+
+    Timer timer;
+    BuildCubes(m_Scene,m_Objects.empty() ? 0 : &m_Objects[0],req.ObjectCount,req.Colors);
+    Matrix view;
+    view.Set(req.View);
+    m_Tracer.SetCamera(view,req.Fovy);
+    m_Tracer.SetBackground(req.Background);
+    m_Tracer.Render(m_Scene,req.Width,req.Height,req.RowBegin,req.RowEnd);
+
+    DistribReply reply;
+    reply.Magic = DISTRIB_MAGIC;
+    reply.Frame = req.Frame;
+    reply.RowBegin = req.RowBegin;
+    reply.RowEnd = req.RowEnd;
+    reply.RenderMs = (float)timer.GetMs();
+    size_t bytes = (size_t)req.Width*(req.RowEnd - req.RowBegin)*sizeof(unsigned int);
+    return connection.Send(&reply,sizeof(reply)) && (bytes == 0 || connection.Send(m_Tracer.GetPixels(),bytes));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           DistribCoordinator constructor
+/////////////////////////////////////////////////////////////////////////////
+DistribCoordinator::DistribCoordinator()
+{
+    m_WorkerCount = 0;
+    m_Frame = 0;
+    m_Width = m_Height = 0;
+    m_SceneBuilt = false;
+    m_Stats.Reset();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Connect
+// Arguments:      host:port,host:port,...
+// Returns:        The number of workers connected
+// Notes:          Workers that can't be reached are skipped
+/////////////////////////////////////////////////////////////////////////////
+int DistribCoordinator::Connect(const char *workers)
+{
+    Disconnect();
+    const char *p = workers;
+    while(*p && m_WorkerCount < DISTRIB_MAX_WORKERS) {
+        const char *end = strchr(p,',');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        Worker &w = m_Workers[m_WorkerCount];
+        size_t n = std::min(len,sizeof(w.Name) - 1);
+        memcpy(w.Name,p,n);
+        w.Name[n] = 0;
+        p += end ? len + 1 : len;
+        if(n == 0)
+            continue;
+
+        int port = DISTRIB_PORT;
+        char host[64];
+        strcpy(host,w.Name);
+        char *colon = strrchr(host,':');
+        if(colon) {
+            *colon = 0;
+            port = atoi(colon + 1);
+        }
+        if(!w.Link.Connect(host,port))
+            continue;
+        w.Speed = 1.0f;
+        w.RowBegin = w.RowEnd = 0;
+        w.Waiting = false;
+        printf("render worker %d: %s\n",m_WorkerCount,w.Name);
+        m_WorkerCount++;
+    }
+    return m_WorkerCount;
+}
+
+void DistribCoordinator::Disconnect()
+{
+    for(int i = 0; i < m_WorkerCount; i++)
+        m_Workers[i].Link.Close();
+    m_WorkerCount = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           GetWorkerCount
+// Arguments:      none
+// Returns:        The workers still connected
+/////////////////////////////////////////////////////////////////////////////
+int DistribCoordinator::GetWorkerCount() const
+{
+    int count = 0;
+    for(int i = 0; i < m_WorkerCount; i++)
+        count += m_Workers[i].Link.IsOpen();
+    return count;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Balance
+// Arguments:      The image height
+// Returns:        none
+// Side Effects:   Gives each connected worker a band in proportion to its
+//                 speed, top to bottom in worker order
+// Notes:          Band edges are rounded to DISTRIB_ROW_ALIGN from the
+//                 running total, so the rounding never adds up, and the
+//                 last band always ends at the bottom
+/////////////////////////////////////////////////////////////////////////////
+void DistribCoordinator::Balance(int height)
+{
+    float total = 0.0f;
+    int last = -1;
+    for(int i = 0; i < m_WorkerCount; i++) {
+        if(m_Workers[i].Link.IsOpen()) {
+            total += m_Workers[i].Speed;
+            last = i;
+        }
+    }
+    float sum = 0.0f;
+    int begin = 0;
+    for(int i = 0; i < m_WorkerCount; i++) {
+        Worker &w = m_Workers[i];
+        w.RowBegin = w.RowEnd = begin;
+        if(!w.Link.IsOpen())
+            continue;
+        sum += w.Speed;
+        int end = height;
+        if(i != last) {
+            end = (int)(height*sum/total/DISTRIB_ROW_ALIGN + 0.5f)*DISTRIB_ROW_ALIGN;
+            end = std::max(begin,std::min(end,height));
+        }
+        w.RowEnd = end;
+        begin = end;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           RenderLocal
+// Arguments:      The frame, as for Render(), and the rows to render
+// Returns:        none
+// Side Effects:   Renders the rows here and copies them into the image
+// Notes:          The scene is built at most once a frame, however many
+//                 bands need it
+/////////////////////////////////////////////////////////////////////////////
+void DistribCoordinator::RenderLocal(const Matrix &view,float fovy,const Matrix *objects,int count,
+                                     const unsigned int *colors,int rowBegin,int rowEnd)
+{
+    if(rowBegin >= rowEnd)
+        return;
+    if(!m_SceneBuilt) {
+        BuildCubes(m_Scene,objects,count,colors);
+        m_SceneBuilt = true;
+    }
+    m_Tracer.SetCamera(view,fovy);
+    m_Tracer.Render(m_Scene,m_Width,m_Height,rowBegin,rowEnd);
+    memcpy(&m_Pixels[rowBegin*m_Width],m_Tracer.GetPixels(),(size_t)m_Width*(rowEnd - rowBegin)*sizeof(unsigned int));
+    m_Stats.LocalRows += rowEnd - rowBegin;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Render
+// Arguments:      The camera, the cubes and their colors, and the image
+//                 size
+// Returns:        none
+// Side Effects:   Fills the image and the stats, and updates the workers'
+//                 speeds for the next frame's bands
+// Notes:          Replies are read straight into the image.  A worker that
+//                 fails is closed, and its band is rendered here.
+/////////////////////////////////////////////////////////////////////////////
+void DistribCoordinator::Render(const Matrix &view,float fovy,const Matrix *objects,int count,
+                                const unsigned int *colors,int width,int height)
+{
+    Timer timer;
+    m_Stats.Reset();
+    m_Frame++;
+    m_SceneBuilt = false;
+    if(width != m_Width || height != m_Height) {
+        // Speeds are in rows, which a new size changes the cost of
+        for(int i = 0; i < m_WorkerCount; i++)
+            m_Workers[i].Speed = 1.0f;
+        m_Width = width;
+        m_Height = height;
+    }
+    m_Pixels.resize(width*height);
+    if(width <= 0 || height <= 0)
+        return;
+
+    Balance(height);
+    DistribRequest req;
+    req.Magic = DISTRIB_MAGIC;
+    req.Frame = m_Frame;
+    req.Width = width;
+    req.Height = height;
+    req.ObjectCount = count;
+    req.Fovy = fovy;
+    memcpy(req.View,view.m_m,sizeof(req.View));
+    memcpy(req.Colors,colors,sizeof(req.Colors));
+    req.Background = m_Tracer.GetBackground();
+    for(int i = 0; i < m_WorkerCount; i++) {
+        Worker &w = m_Workers[i];
+        w.Waiting = false;
+        if(!w.Link.IsOpen() || w.RowBegin == w.RowEnd)
+            continue;
+        req.RowBegin = w.RowBegin;
+        req.RowEnd = w.RowEnd;
+        w.Waiting = w.Link.Send(&req,sizeof(req)) && (count == 0 || w.Link.Send(objects,count*sizeof(Matrix)));
+    }
+
+    double total = 0.0;
+    for(int i = 0; i < m_WorkerCount; i++) {
+        Worker &w = m_Workers[i];
+        if(w.RowBegin == w.RowEnd)
+            continue;
+        DistribReply reply;
+        bool ok = w.Waiting && w.Link.Receive(&reply,sizeof(reply)) && reply.Magic == DISTRIB_MAGIC &&
+                  reply.Frame == m_Frame && reply.RowBegin == w.RowBegin && reply.RowEnd == w.RowEnd &&
+                  w.Link.Receive(&m_Pixels[w.RowBegin*width],(size_t)width*(w.RowEnd - w.RowBegin)*sizeof(unsigned int));
+        if(!ok) {
+            printf("render worker %s failed, dropped\n",w.Name);
+            w.Link.Close();
+            RenderLocal(view,fovy,objects,count,colors,w.RowBegin,w.RowEnd);
+            continue;
+        }
+
+        int rows = w.RowEnd - w.RowBegin;
+        float speed = rows/std::max(reply.RenderMs,0.01f);
+        w.Speed = DISTRIB_SMOOTHING*speed + (1.0f - DISTRIB_SMOOTHING)*w.Speed;
+        int slot = m_Stats.Workers++;
+        m_Stats.Rows[slot] = rows;
+        m_Stats.RenderMs[slot] = reply.RenderMs;
+        m_Stats.SlowestMs = std::max(m_Stats.SlowestMs,(double)reply.RenderMs);
+        total += reply.RenderMs;
+    }
+
+    // Nobody to send to, or nobody answered
+    if(m_Stats.Workers == 0 && m_Stats.LocalRows == 0)
+        RenderLocal(view,fovy,objects,count,colors,0,height);
+    if(m_Stats.Workers > 0 && total > 0.0)
+        m_Stats.Imbalance = m_Stats.SlowestMs*m_Stats.Workers/total;
+    m_Stats.FrameMs = timer.GetMs();
+}
@@ -0,0 +1,205 @@
+/////////////////////////////////////////////////////////////////////////////
+// distrib.h
+//
+/////////////////////////////////////
+// Classes declared:
+//
+// DistribRequest:     What the coordinator sends a worker each frame: the
+//                     camera, the image size, the band of rows to render
+//                     and how many object matrices follow.
+//
+// DistribReply:       A worker's answer, followed by its band's pixels.
+//
+// DistribStats:       How the last frame was split and how long it took.
+//
+// DistribWorker:      Renders bands for a coordinator.  Each request is
+//                     turned into a RayScene of cubes, one per matrix, and
+//                     only the requested rows are traced (see raytrace.h).
+//                     The renderworker tool runs one per process.
+//
+// DistribCoordinator: Sort-first rendering over several worker processes.
+//                     The image is cut into one horizontal band per
+//                     worker.  Every worker gets the whole scene, which is
+//                     just a camera and a Matrix per object, and renders
+//                     only its band.  The coordinator sends every request
+//                     before waiting on any reply, so the workers render at
+//                     the same time, then copies each band into place.
+//
+//                     The bands are balanced from frame to frame.  Each
+//                     worker reports how long its band took, which gives
+//                     its speed in rows per ms.  The next frame's bands are
+//                     sized in proportion to those speeds, smoothed over
+//                     frames by DISTRIB_SMOOTHING.  A band that costs more
+//                     (more of the scene is in it, or it went to a slower
+//                     or busier machine) shrinks until every worker
+//                     finishes at about the same time.  A worker that stops
+//                     answering is dropped, and its band is rendered
+//                     locally for that frame.
+//
+// Workers are reached over TCP, so the same setup runs on one machine
+// (workers on localhost at different ports) or spread over several (the
+// workers' hosts named instead).  Messages are raw structs, so every
+// process must have the same byte order and float format.
+//
+/////////////////////////////////////
+// Common Operations Supported:
+//
+// renderworker 7167 &                             // One per process
+// renderworker 7168 &
+//
+// DistribCoordinator dc;
+// dc.Connect("localhost:7167,localhost:7168");
+// dc.Render(view,fovy,objects,count,colors,width,height);
+// glDrawPixels(width,height,GL_RGBA,GL_UNSIGNED_BYTE,dc.GetPixels());
+// dc.GetStats().Print();
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSE167_DISTRIB_H_
+#define CSE167_DISTRIB_H_
+
+#include "raytrace.h"
+#include "net.h"
+#include <vector>
+
+#define DISTRIB_PORT            7167
+#define DISTRIB_MAGIC           0x31534944  // "DIS1"
+#define DISTRIB_MAX_WORKERS     32
+#define DISTRIB_MAX_OBJECTS     (1 << 22)   // Most matrices a worker accepts
+#define DISTRIB_MAX_SIZE        16384       // Largest image side a worker accepts
+#define DISTRIB_ROW_ALIGN       2           // Bands start on even rows, the packets' height
+#define DISTRIB_SMOOTHING       0.5f        // Weight of the newest frame in a worker's speed
+
+/////////////////////////////////////////////////////////////////////////////
+// DistribRequest
+//
+struct DistribRequest {
+    unsigned int Magic;
+    unsigned int Frame;
+    int Width, Height;
+    int RowBegin, RowEnd;
+    int ObjectCount;                // Matrices following the request
+    float Fovy;
+    float View[16];                 // World to eye
+    unsigned int Colors[3];         // Cube face pairs facing x, y and z
+    unsigned int Background;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// DistribReply
+//
+struct DistribReply {
+    unsigned int Magic;
+    unsigned int Frame;
+    int RowBegin, RowEnd;           // Width*(RowEnd-RowBegin) pixels follow
+    float RenderMs;                 // Scene build and trace
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// DistribStats
+//
+struct DistribStats {
+    void Reset()                                    {memset(this,0,sizeof(*this));}
+    void Print() const;
+
+    int Workers;                    // Answering this frame
+    int Rows[DISTRIB_MAX_WORKERS];  // Band heights
+    float RenderMs[DISTRIB_MAX_WORKERS];
+    int LocalRows;                  // Rendered here for workers that failed
+    double SlowestMs;               // Longest RenderMs
+    double Imbalance;               // Slowest over the average, 1 is perfect
+    double FrameMs;                 // Render() from start to end
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// DistribWorker
+//
+class DistribWorker {
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // Answers one request on 'connection'.  Returns false when the
+    // coordinator has gone or sent something that is not a request.
+    bool Serve(Socket &connection);
+
+    const RayStats &GetStats() const                {return m_Tracer.GetStats();}
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    std::vector<Matrix> m_Objects;
+    RayScene m_Scene;
+    RayTracer m_Tracer;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// DistribCoordinator
+//
+class DistribCoordinator {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    DistribCoordinator();
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // Connects to a comma separated list of host:port (the port defaults
+    // to DISTRIB_PORT).  Returns the number of workers connected.
+    int Connect(const char *workers);
+    void Disconnect();
+
+    // Renders a width by height image of a cube for each of the 'count'
+    // matrices, colored by 'colors' (as for RayScene::AddCube), from a
+    // camera as for RayTracer::SetCamera
+    void Render(const Matrix &view,float fovy,const Matrix *objects,int count,
+                const unsigned int *colors,int width,int height);
+
+    // Accessors
+    int GetWorkerCount() const;
+    const unsigned int *GetPixels() const           {return m_Pixels.empty() ? 0 : &m_Pixels[0];}
+    int GetWidth() const                            {return m_Width;}
+    int GetHeight() const                           {return m_Height;}
+    const DistribStats &GetStats() const            {return m_Stats;}
+
+private:
+    struct Worker {
+        Socket Link;
+        char Name[64];
+        float Speed;                // Rows per ms, smoothed
+        int RowBegin, RowEnd;
+        bool Waiting;               // Sent a request this frame
+    };
+
+    void Balance(int height);
+    void RenderLocal(const Matrix &view,float fovy,const Matrix *objects,int count,
+                     const unsigned int *colors,int rowBegin,int rowEnd);
+
+    // Not copyable
+    DistribCoordinator(const DistribCoordinator &);
+    DistribCoordinator &operator=(const DistribCoordinator &);
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    Worker m_Workers[DISTRIB_MAX_WORKERS];
+    int m_WorkerCount;
+    unsigned int m_Frame;
+    int m_Width, m_Height;
+    std::vector<unsigned int> m_Pixels;
+    DistribStats m_Stats;
+
+    // For bands whose worker failed
+    RayScene m_Scene;
+    RayTracer m_Tracer;
+    bool m_SceneBuilt;
+};
+
+#endif
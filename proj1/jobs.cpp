@@ -0,0 +1,163 @@
+/////////////////////////////////////////////////////////////////////////////
+// jobs.cpp
+/////////////////////////////////////
+// Worker thread pool.
+//
+// The workers sleep on m_Wake between loops.  Run() publishes a loop under
+// m_Lock, then every thread (the caller included) pulls chunk numbers from
+// m_NextChunk until they run out.  Run() waits for both the last chunk and
+// the last worker to leave, so a slow worker can never pick up a chunk
+// number meant for the next loop.
+/////////////////////////////////////////////////////////////////////////////
+
+#include "jobs.h"
+
+// Set while a thread is running a chunk, so nested loops run inline
+static thread_local bool t_InJob = false;
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           JobPool constructor/destructor
+// Arguments:      Number of worker threads, -1 for one per hardware thread
+//                 after the first
+/////////////////////////////////////////////////////////////////////////////
+JobPool::JobPool(int workers) : m_NextChunk(0), m_Remaining(0)
+{
+    if(workers < 0)
+        workers = (int)std::thread::hardware_concurrency() - 1;
+    if(workers < 0)
+        workers = 0;
+    if(workers > JOBS_MAX_THREADS-1)
+        workers = JOBS_MAX_THREADS-1;
+
+    m_Func = 0;
+    m_Data = 0;
+    m_Count = m_Grain = m_Chunks = 0;
+    m_Generation = 0;
+    m_Active = 0;
+    m_Quit = false;
+    for(int i = 0; i < workers; i++)
+        m_Threads.push_back(std::thread(&JobPool::Worker,this,i+1));
+}
+
+JobPool::~JobPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        m_Quit = true;
+    }
+    m_Wake.notify_all();
+    for(size_t i = 0; i < m_Threads.size(); i++)
+        m_Threads[i].join();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Run
+// Arguments:      Function to call, its data pointer, iteration count and
+//                 the most iterations to give a thread at once
+// Returns:        none
+// Side Effects:   Returns when func has been called on all of [0,count)
+/////////////////////////////////////////////////////////////////////////////
+void JobPool::Run(JobFunc func,void *data,int count,int grain)
+{
+    if(count <= 0)
+        return;
+    if(grain < 1)
+        grain = 1;
+
+    // Small loops, nested loops and loops while another thread has the
+    // pool aren't worth (or able) to hand out
+    if(m_Threads.empty() || count <= grain || t_InJob || !m_RunLock.try_lock()) {
+        bool inJob = t_InJob;
+        t_InJob = true;
+        func(data,0,count,0);
+        t_InJob = inJob;
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        m_Func = func;
+        m_Data = data;
+        m_Count = count;
+        m_Grain = grain;
+        m_Chunks = (count + grain - 1)/grain;
+        m_NextChunk = 0;
+        m_Remaining = m_Chunks;
+        m_Generation++;
+    }
+    m_Wake.notify_all();
+
+    Work(0);
+
+    {
+        std::unique_lock<std::mutex> lock(m_Lock);
+        while(m_Remaining > 0 || m_Active > 0)
+            m_Done.wait(lock);
+        m_Func = 0;
+    }
+    m_RunLock.unlock();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Work
+// Arguments:      Index of the calling thread
+// Returns:        none
+// Side Effects:   Runs chunks of the current loop until none are left
+/////////////////////////////////////////////////////////////////////////////
+void JobPool::Work(int thread)
+{
+    t_InJob = true;
+    int chunk;
+    while((chunk = m_NextChunk.fetch_add(1)) < m_Chunks) {
+        int begin = chunk*m_Grain;
+        int end = begin + m_Grain < m_Count ? begin + m_Grain : m_Count;
+        m_Func(m_Data,begin,end,thread);
+        if(m_Remaining.fetch_sub(1) == 1) {
+            std::lock_guard<std::mutex> lock(m_Lock);
+            m_Done.notify_all();
+        }
+    }
+    t_InJob = false;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Worker
+// Arguments:      Index of this thread
+// Returns:        none
+// Side Effects:   Joins every loop published by Run() until the pool is
+//                 destroyed
+/////////////////////////////////////////////////////////////////////////////
+void JobPool::Worker(int thread)
+{
+    unsigned int seen = 0;
+    for(;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_Lock);
+            while(!m_Quit && (m_Generation == seen || !m_Func))
+                m_Wake.wait(lock);
+            if(m_Quit)
+                return;
+            seen = m_Generation;
+            m_Active++;
+        }
+
+        Work(thread);
+
+        {
+            std::lock_guard<std::mutex> lock(m_Lock);
+            m_Active--;
+        }
+        m_Done.notify_all();
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           SharedJobPool
+// Arguments:      none
+// Returns:        The program-wide pool, created on first use
+/////////////////////////////////////////////////////////////////////////////
+JobPool &SharedJobPool()
+{
+    static JobPool pool;
+    return pool;
+}
@@ -0,0 +1,122 @@
+/////////////////////////////////////////////////////////////////////////////
+// jobs.h
+//
+/////////////////////////////////////
+// Classes declared:
+//
+// JobPool: A fixed set of worker threads that split a loop between them.
+//          The thread calling Run() works on the loop too, and Run() only
+//          returns once every iteration is done, so to the caller it is
+//          just a faster for loop.  Chunks of iterations are handed out
+//          through one atomic counter, so threads that finish early take
+//          more and uneven work balances itself.
+//
+// Functions declared:
+//
+// SharedJobPool(): The pool everything in the program shares.  It starts
+//                  one worker per extra hardware thread the first time it
+//                  is used.
+//
+// ParallelFor():   Runs a function object over [0,count) on the shared pool.
+//
+// Every call gets a thread index in [0,GetThreadCount()): 0 is the thread
+// that called Run() and 1 and up are the workers, so per-thread scratch
+// (like FrameArena::GetThreadArena) can be indexed without locking.
+// Nothing is allocated per Run().  A Run() from inside a job, or from a
+// second thread while the pool is busy, just runs the loop inline.
+//
+/////////////////////////////////////
+// Common Operations Supported:
+//
+// ParallelFor(count,grain,[&](int begin,int end,int thread) {
+//     for(int i = begin; i < end; i++) ...
+// });
+//
+// JobPool pool(3);                                // Or a private pool
+// pool.Run(func,data,count,grain);
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSE167_JOBS_H_
+#define CSE167_JOBS_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define JOBS_MAX_THREADS        16
+
+// Work on iterations [begin,end) from thread 'thread'
+typedef void (*JobFunc)(void *data,int begin,int end,int thread);
+
+/////////////////////////////////////////////////////////////////////////////
+// JobPool
+//
+class JobPool {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    // -1 workers means one per hardware thread after the first
+    explicit JobPool(int workers=-1);
+    ~JobPool();
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // Calls 'func' on chunks of at most 'grain' iterations of [0,count)
+    // and waits for all of them
+    void Run(JobFunc func,void *data,int count,int grain);
+
+    // Workers plus the calling thread
+    int GetThreadCount() const                      {return (int)m_Threads.size() + 1;}
+
+private:
+    void Worker(int thread);
+    void Work(int thread);
+
+    // Not copyable
+    JobPool(const JobPool &);
+    JobPool &operator=(const JobPool &);
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    std::vector<std::thread> m_Threads;
+    std::mutex m_RunLock;           // Held by the thread inside Run()
+
+    // The current loop, guarded by m_Lock
+    std::mutex m_Lock;
+    std::condition_variable m_Wake, m_Done;
+    JobFunc m_Func;
+    void *m_Data;
+    int m_Count, m_Grain, m_Chunks;
+    unsigned int m_Generation;      // Bumped for every loop
+    int m_Active;                   // Workers still inside Work()
+    bool m_Quit;
+
+    std::atomic<int> m_NextChunk;
+    std::atomic<int> m_Remaining;   // Chunks not yet finished
+};
+
+// The pool shared by the whole program
+JobPool &SharedJobPool();
+
+template<class F> void ParallelForCall(void *data,int begin,int end,int thread)
+{
+    (*(const F*)data)(begin,end,thread);
+}
+
+// Calls f(begin,end,thread) over [0,count) in chunks of 'grain' on the
+// shared pool
+template<class F> void ParallelFor(int count,int grain,const F &f)
+{
+    SharedJobPool().Run(&ParallelForCall<F>,(void*)&f,count,grain);
+}
+
+#endif
@@ -0,0 +1,337 @@
+/////////////////////////////////////////////////////////////////////////////
+// lighting.cpp
+/////////////////////////////////////
+// Cluster boxes, light assignment and per vertex shading.
+/////////////////////////////////////////////////////////////////////////////
+
+#include "lighting.h"
+#include "mesh.h"
+#include "jobs.h"
+#include "simd.h"
+#include "timer.h"
+#include <algorithm>
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Print
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Prints the counters to stdout
+/////////////////////////////////////////////////////////////////////////////
+void LightStats::Print() const
+{
+    printf("lighting: %d lights, %d in depth range, %d entries in %d of %d clusters (at most %d), assign %.3f ms\n",
+           Lights,Visible,Entries,UsedClusters,LIGHT_CLUSTERS,MaxPerCluster,AssignMs);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           LightClusters constructor
+// Notes:          Starts with main.cpp's projection at a square aspect
+/////////////////////////////////////////////////////////////////////////////
+LightClusters::LightClusters()
+{
+    m_LightCount = 0;
+    SetAmbient(0.1f,0.1f,0.1f);
+    SetProjection(60.0f*(float)M_PI/180.0f,1.0f,0.1f,80.0f);
+    memset(m_First,0,sizeof(m_First));
+    memset(m_Count,0,sizeof(m_Count));
+    m_Stats.Reset();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           SetProjection
+// Arguments:      Vertical field of view in radians, aspect ratio (w/h) and
+//                 the near and far distances
+// Returns:        none
+// Side Effects:   Recomputes the cluster boxes.  Slice k covers depths
+//                 near*(far/near)^(k/Z) to near*(far/near)^((k+1)/Z).
+/////////////////////////////////////////////////////////////////////////////
+void LightClusters::SetProjection(float fovy,float aspect,float zNear,float zFar)
+{
+    m_TanY = tanf(0.5f*fovy);
+    m_TanX = m_TanY*aspect;
+    m_Near = zNear;
+    m_Far = zFar;
+    m_SliceScale = LIGHT_CLUSTERS_Z/logf(zFar/zNear);
+
+    for(int z = 0; z < LIGHT_CLUSTERS_Z; z++) {
+        float dn = zNear*powf(zFar/zNear,(float)z/LIGHT_CLUSTERS_Z);
+        float df = z == LIGHT_CLUSTERS_Z-1 ? zFar : zNear*powf(zFar/zNear,(float)(z+1)/LIGHT_CLUSTERS_Z);
+        m_SliceNear[z] = dn;
+        m_SliceFar[z] = df;
+
+        // A tile's sides are planes through the eye, so its box at these
+        // depths is the box around its corners at both ends
+        for(int x = 0; x < LIGHT_CLUSTERS_X; x++) {
+            float a = m_TanX*(2.0f*x/LIGHT_CLUSTERS_X - 1.0f);
+            float b = m_TanX*(2.0f*(x+1)/LIGHT_CLUSTERS_X - 1.0f);
+            m_MinX[z][x] = std::min(a*dn,a*df);
+            m_MaxX[z][x] = std::max(b*dn,b*df);
+        }
+        for(int y = 0; y < LIGHT_CLUSTERS_Y; y++) {
+            float a = m_TanY*(2.0f*y/LIGHT_CLUSTERS_Y - 1.0f);
+            float b = m_TanY*(2.0f*(y+1)/LIGHT_CLUSTERS_Y - 1.0f);
+            m_MinY[z][y] = std::min(a*dn,a*df);
+            m_MaxY[z][y] = std::max(b*dn,b*df);
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           FindCluster
+// Arguments:      An eye space point
+// Returns:        The index of the cluster it is in, or the nearest one
+/////////////////////////////////////////////////////////////////////////////
+int LightClusters::FindCluster(const Point3 &eye) const
+{
+    float depth = std::max(-eye.z,m_Near);
+    int z = (int)(logf(depth/m_Near)*m_SliceScale);
+    int x = (int)floorf((0.5f*eye.x/(depth*m_TanX) + 0.5f)*LIGHT_CLUSTERS_X);
+    int y = (int)floorf((0.5f*eye.y/(depth*m_TanY) + 0.5f)*LIGHT_CLUSTERS_Y);
+    z = std::min(std::max(z,0),LIGHT_CLUSTERS_Z-1);
+    x = std::min(std::max(x,0),LIGHT_CLUSTERS_X-1);
+    y = std::min(std::max(y,0),LIGHT_CLUSTERS_Y-1);
+    return GetClusterIndex(x,y,z);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           AssignSlice
+// Arguments:      Depth slice
+// Returns:        none
+// Side Effects:   Fills the slice's Out, First and Count.  Touches nothing
+//                 shared, so slices can run at the same time.
+// Notes:          The squared distance from a sphere's center to a box is
+//                 the sum of the per axis squared distances, and the y and
+//                 z terms are the same for a whole row of the slice.  Those
+//                 are taken off r^2 once per light and row, leaving a one
+//                 dimensional test per cluster, done four lights at a time.
+/////////////////////////////////////////////////////////////////////////////
+void LightClusters::AssignSlice(int slice)
+{
+    Slice &s = m_Slices[slice];
+    float dn = m_SliceNear[slice], df = m_SliceFar[slice];
+
+    s.Lights.clear();
+    s.Reach.clear();
+    for(int i = 0; i < m_LightCount; i++) {
+        float d = m_Depth[i], r = m_Radius[i];
+        float dz = d < dn ? dn - d : (d > df ? d - df : 0.0f);
+        float reach = r*r - dz*dz;
+        if(reach >= 0.0f) {
+            s.Lights.push_back(i);
+            s.Reach.push_back(reach);
+        }
+    }
+
+    s.Out.clear();
+    for(int y = 0; y < LIGHT_CLUSTERS_Y; y++) {
+        float minY = m_MinY[slice][y], maxY = m_MaxY[slice][y];
+        s.X.clear();
+        s.Left.clear();
+        s.Index.clear();
+        for(size_t k = 0; k < s.Lights.size(); k++) {
+            int i = s.Lights[k];
+            float ly = m_Y[i];
+            float dy = ly < minY ? minY - ly : (ly > maxY ? ly - maxY : 0.0f);
+            float left = s.Reach[k] - dy*dy;
+            if(left >= 0.0f) {
+                s.X.push_back(m_X[i]);
+                s.Left.push_back(left);
+                s.Index.push_back(i);
+            }
+        }
+        // Pad to whole groups of four with lights that can't reach
+        int count = (int)s.Index.size();
+        while(s.X.size() & 3) {
+            s.X.push_back(0.0f);
+            s.Left.push_back(-1.0f);
+        }
+
+        for(int x = 0; x < LIGHT_CLUSTERS_X; x++) {
+            int tile = y*LIGHT_CLUSTERS_X + x;
+            float minX = m_MinX[slice][x], maxX = m_MaxX[slice][x];
+            s.First[tile] = (int)s.Out.size();
+#ifdef CSE167_SSE
+            __m128 vmin = _mm_set1_ps(minX), vmax = _mm_set1_ps(maxX), zero = _mm_setzero_ps();
+            for(int k = 0; k < count; k += 4) {
+                __m128 lx = _mm_loadu_ps(&s.X[k]);
+                __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(vmin,lx),_mm_sub_ps(lx,vmax)),zero);
+                int hits = _mm_movemask_ps(_mm_cmple_ps(_mm_mul_ps(dx,dx),_mm_loadu_ps(&s.Left[k])));
+                while(hits) {
+                    int bit = 0;
+                    while(!(hits & (1 << bit)))
+                        bit++;
+                    hits &= hits - 1;
+                    s.Out.push_back((unsigned int)s.Index[k + bit]);
+                }
+            }
+#else
+            for(int k = 0; k < count; k++) {
+                float lx = s.X[k];
+                float dx = lx < minX ? minX - lx : (lx > maxX ? lx - maxX : 0.0f);
+                if(dx*dx <= s.Left[k])
+                    s.Out.push_back((unsigned int)s.Index[k]);
+            }
+#endif
+            s.Count[tile] = (int)s.Out.size() - s.First[tile];
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Assign
+// Arguments:      World to eye Matrix, and the lights
+// Returns:        none
+// Side Effects:   Rebuilds every cluster's list on the job pool
+// Notes:          'view' is taken to be rigid, so radii are not scaled
+/////////////////////////////////////////////////////////////////////////////
+void LightClusters::Assign(const Matrix &view,const PointLight *lights,int count)
+{
+    Timer timer;
+    m_View = view;
+    m_LightCount = count;
+    m_X.resize(count);
+    m_Y.resize(count);
+    m_Depth.resize(count);
+    m_Radius.resize(count);
+    m_R.resize(count);
+    m_G.resize(count);
+    m_B.resize(count);
+
+    const float *m = view.m_m;
+    ParallelFor(count,LIGHT_GRAIN,[&](int begin,int end,int) {
+        for(int i = begin; i < end; i++) {
+            const PointLight &l = lights[i];
+            const Point3 &p = l.Position;
+            m_X[i] = m[0]*p.x + m[4]*p.y + m[8]*p.z + m[12];
+            m_Y[i] = m[1]*p.x + m[5]*p.y + m[9]*p.z + m[13];
+            m_Depth[i] = -(m[2]*p.x + m[6]*p.y + m[10]*p.z + m[14]);
+            m_Radius[i] = l.Radius;
+            m_R[i] = l.Color[0];
+            m_G[i] = l.Color[1];
+            m_B[i] = l.Color[2];
+        }
+    });
+
+    ParallelFor(LIGHT_CLUSTERS_Z,1,[this](int begin,int end,int) {
+        for(int z = begin; z < end; z++)
+            AssignSlice(z);
+    });
+
+    // Join the slices' lists
+    m_Stats.Reset();
+    int total = 0;
+    int base[LIGHT_CLUSTERS_Z];
+    for(int z = 0; z < LIGHT_CLUSTERS_Z; z++) {
+        const Slice &s = m_Slices[z];
+        base[z] = total;
+        for(int t = 0; t < LIGHT_TILES; t++) {
+            int c = z*LIGHT_TILES + t;
+            m_First[c] = total + s.First[t];
+            m_Count[c] = s.Count[t];
+            m_Stats.MaxPerCluster = std::max(m_Stats.MaxPerCluster,s.Count[t]);
+            m_Stats.UsedClusters += s.Count[t] > 0;
+        }
+        total += (int)s.Out.size();
+    }
+    m_Indices.resize(total);
+    ParallelFor(LIGHT_CLUSTERS_Z,1,[&](int begin,int end,int) {
+        for(int z = begin; z < end; z++) {
+            const Slice &s = m_Slices[z];
+            if(!s.Out.empty())
+                memcpy(&m_Indices[base[z]],s.Out.data(),s.Out.size()*sizeof(unsigned int));
+        }
+    });
+
+    m_Stats.Lights = count;
+    for(int i = 0; i < count; i++)
+        m_Stats.Visible += m_Depth[i] + m_Radius[i] >= m_Near && m_Depth[i] - m_Radius[i] <= m_Far;
+    m_Stats.Entries = total;
+    m_Stats.AssignMs = timer.GetMs();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Shade
+// Arguments:      Eye space point and unit normal, the surface color (3
+//                 floats) and where to write the result
+// Returns:        The number of lights looked at
+// Notes:          Each light adds color*(N.L)*(1 - d^2/r^2)^2
+/////////////////////////////////////////////////////////////////////////////
+int LightClusters::Shade(const Point3 &eye,const Vector3 &normal,const float *albedo,float *rgb) const
+{
+    int cluster = FindCluster(eye);
+    const unsigned int *lights = GetClusterLights(cluster);
+    int count = m_Count[cluster];
+
+    float r = m_Ambient[0], g = m_Ambient[1], b = m_Ambient[2];
+    for(int k = 0; k < count; k++) {
+        unsigned int i = lights[k];
+        float lx = m_X[i] - eye.x, ly = m_Y[i] - eye.y, lz = -m_Depth[i] - eye.z;
+        float d2 = lx*lx + ly*ly + lz*lz;
+        float r2 = m_Radius[i]*m_Radius[i];
+        float ndotl = normal.x*lx + normal.y*ly + normal.z*lz;
+        if(d2 >= r2 || ndotl <= 0.0f)
+            continue;
+        float f = 1.0f - d2/r2;
+        float s = f*f*ndotl/sqrtf(d2);
+        r += s*m_R[i];
+        g += s*m_G[i];
+        b += s*m_B[i];
+    }
+    rgb[0] = albedo[0]*r;
+    rgb[1] = albedo[1]*g;
+    rgb[2] = albedo[2]*b;
+    return count;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           ShadeMesh
+// Arguments:      Mesh (with normals), its world Matrix, the surface color
+//                 and LIGHT_SHADE_FLOATS*vertices floats to write
+// Returns:        The number of lights looked at
+// Notes:          Runs on the calling thread; the RenderQueue calls it from
+//                 its recording jobs.  Normals go through the inverse
+//                 transpose of the upper 3x3 of view*world, so they stay
+//                 perpendicular to the surface under uneven scaling.
+/////////////////////////////////////////////////////////////////////////////
+int LightClusters::ShadeMesh(const Mesh &mesh,const Matrix &world,const float *albedo,float *out) const
+{
+    const float *x = mesh.GetX(), *y = mesh.GetY(), *z = mesh.GetZ();
+    const float *nx = mesh.GetNX(), *ny = mesh.GetNY(), *nz = mesh.GetNZ();
+    const float *w = world.m_m;
+    Matrix eyeMatrix(m_View*world);
+    const float *e = eyeMatrix.m_m;
+
+    // The inverse transpose up to scale: its columns are the cross
+    // products of pairs of columns, over the determinant.  The normals are
+    // normalized anyway, so only the determinant's sign is kept, which
+    // keeps them facing out under a mirroring transform.
+    Vector3 c0(e[0],e[1],e[2]), c1(e[4],e[5],e[6]), c2(e[8],e[9],e[10]);
+    Vector3 n0, n1, n2;
+    n0.Cross(c1,c2);
+    n1.Cross(c2,c0);
+    n2.Cross(c0,c1);
+    if(c0.Dot(n0) < 0.0f) {
+        n0 *= -1.0f;
+        n1 *= -1.0f;
+        n2 *= -1.0f;
+    }
+
+    int looked = 0;
+    for(int v = 0; v < mesh.GetVertexCount(); v++) {
+        out[0] = w[0]*x[v] + w[4]*y[v] + w[8]*z[v] + w[12];
+        out[1] = w[1]*x[v] + w[5]*y[v] + w[9]*z[v] + w[13];
+        out[2] = w[2]*x[v] + w[6]*y[v] + w[10]*z[v] + w[14];
+        Point3 p(e[0]*x[v] + e[4]*y[v] + e[8]*z[v] + e[12],
+                 e[1]*x[v] + e[5]*y[v] + e[9]*z[v] + e[13],
+                 e[2]*x[v] + e[6]*y[v] + e[10]*z[v] + e[14]);
+        Vector3 n(n0.x*nx[v] + n1.x*ny[v] + n2.x*nz[v],
+                  n0.y*nx[v] + n1.y*ny[v] + n2.y*nz[v],
+                  n0.z*nx[v] + n1.z*ny[v] + n2.z*nz[v]);
+        float len = sqrtf(n.x*n.x + n.y*n.y + n.z*n.z);
+        if(len > 0.0f)
+            n *= 1.0f/len;
+        looked += Shade(p,n,albedo,out + 3);
+        out += LIGHT_SHADE_FLOATS;
+    }
+    return looked;
+}
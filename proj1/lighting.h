@@ -0,0 +1,178 @@
+/////////////////////////////////////////////////////////////////////////////
+// lighting.h
+//
+/////////////////////////////////////
+// Classes declared:
+//
+// PointLight:    A light at a point with a color and a radius beyond which
+//                it adds nothing.
+//
+// LightStats:    Counts and timings of the last Assign().
+//
+// LightClusters: Clustered light culling, so a surface is shaded by the few
+//                lights that can reach it instead of all of them.  The view
+//                frustum is cut into LIGHT_CLUSTERS_X by LIGHT_CLUSTERS_Y
+//                tiles across the screen and LIGHT_CLUSTERS_Z slices in
+//                depth; the slices get exponentially deeper with distance,
+//                so clusters stay roughly cube shaped.  Each frame Assign()
+//                moves the lights into eye space and tests every light's
+//                sphere against the eye space box around each cluster.  The
+//                slices are assigned in parallel on the job pool, and within
+//                a slice four lights are tested against a cluster at once
+//                with SSE.  A light is tested only against the slices its
+//                depth range covers and the rows its height covers.
+//
+//                The result is, per cluster, a list of light indices in
+//                increasing order.  Shade() finds the cluster a point is in
+//                and sums just those lights: diffuse, with a smooth falloff
+//                to zero at the radius, plus an ambient term.  Points outside
+//                the frustum use the nearest cluster, which may miss lights
+//                that reach them; they are off screen anyway.
+//
+// The fixed function pipeline cannot loop over lights per pixel, so lit
+// meshes are shaded per vertex on the CPU: ShadeMesh() writes each vertex's
+// world position and color, and the RenderQueue draws them with the mesh's
+// indices (see RenderQueue::SetLighting).
+//
+/////////////////////////////////////
+// Common Operations Supported:
+//
+// LightClusters lc;
+// lc.SetProjection(fovy,aspect,zNear,zFar);       // Same as the camera's
+// lc.Assign(view,lights,count);                   // Once per frame
+// lc.Shade(eyePoint,eyeNormal,albedo,rgb);
+// lc.ShadeMesh(mesh,world,albedo,xyzrgb);
+// lc.GetStats().Print();
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSE167_LIGHTING_H_
+#define CSE167_LIGHTING_H_
+
+#include "matrix.h"
+#include <vector>
+
+class Mesh;
+
+#define LIGHT_CLUSTERS_X        16
+#define LIGHT_CLUSTERS_Y        8
+#define LIGHT_CLUSTERS_Z        24
+#define LIGHT_CLUSTERS          (LIGHT_CLUSTERS_X*LIGHT_CLUSTERS_Y*LIGHT_CLUSTERS_Z)
+#define LIGHT_TILES             (LIGHT_CLUSTERS_X*LIGHT_CLUSTERS_Y)
+#define LIGHT_GRAIN             1024        // Lights moved to eye space per job
+#define LIGHT_SHADE_FLOATS      6           // x,y,z,r,g,b per vertex from ShadeMesh
+
+/////////////////////////////////////////////////////////////////////////////
+// PointLight
+//
+struct PointLight {
+    PointLight()                                    {Radius = 1.0f; Color[0] = Color[1] = Color[2] = 1.0f;}
+
+    Point3 Position;                // World space
+    float Radius;
+    float Color[3];
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// LightStats
+//
+struct LightStats {
+    void Reset()                                    {memset(this,0,sizeof(*this));}
+    void Print() const;
+
+    int Lights;                     // Passed to Assign()
+    int Visible;                    // Within the frustum's depth range
+    int Entries;                    // Light indices over all clusters
+    int MaxPerCluster;
+    int UsedClusters;               // With at least one light
+    double AssignMs;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// LightClusters
+//
+class LightClusters {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    LightClusters();
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // The camera's projection, as for Matrix::MakePerspective.  Rebuilds
+    // the cluster boxes.
+    void SetProjection(float fovy,float aspect,float zNear,float zFar);
+
+    // Color added everywhere, before the albedo
+    void SetAmbient(float r,float g,float b)         {m_Ambient[0] = r; m_Ambient[1] = g; m_Ambient[2] = b;}
+
+    // Moves the lights into eye space with 'view' (world to eye) and builds
+    // the clusters' light lists.  The lights are copied.
+    void Assign(const Matrix &view,const PointLight *lights,int count);
+
+    // Writes albedo*(ambient + lights) for an eye space point and unit
+    // normal to rgb[0..2].  Returns the number of lights looked at.
+    int Shade(const Point3 &eye,const Vector3 &normal,const float *albedo,float *rgb) const;
+
+    // Shades every vertex of 'mesh' drawn at 'world', writing its world
+    // position and color (LIGHT_SHADE_FLOATS each) to 'out'.  The mesh
+    // must have normals, which are transformed by the inverse transpose so
+    // 'world' may scale unevenly.  Returns the number of lights looked at.
+    int ShadeMesh(const Mesh &mesh,const Matrix &world,const float *albedo,float *out) const;
+
+    // The cluster an eye space point falls in, clamped to the grid
+    int FindCluster(const Point3 &eye) const;
+
+    // Accessors
+    int GetClusterIndex(int x,int y,int z) const    {return (z*LIGHT_CLUSTERS_Y + y)*LIGHT_CLUSTERS_X + x;}
+    int GetClusterCount(int cluster) const          {return m_Count[cluster];}
+    const unsigned int *GetClusterLights(int cluster) const     {return m_Indices.data() + m_First[cluster];}
+    const Matrix &GetView() const                   {return m_View;}
+    const LightStats &GetStats() const              {return m_Stats;}
+
+private:
+    void AssignSlice(int slice);
+
+    // Not copyable
+    LightClusters(const LightClusters &);
+    LightClusters &operator=(const LightClusters &);
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    // Cluster boxes in eye space, by depth (positive, -z) rather than z.
+    // x depends only on the slice and column, y on the slice and row.
+    float m_TanX, m_TanY;           // Half extents of the frustum at depth 1
+    float m_Near, m_Far, m_SliceScale;
+    float m_SliceNear[LIGHT_CLUSTERS_Z], m_SliceFar[LIGHT_CLUSTERS_Z];
+    float m_MinX[LIGHT_CLUSTERS_Z][LIGHT_CLUSTERS_X], m_MaxX[LIGHT_CLUSTERS_Z][LIGHT_CLUSTERS_X];
+    float m_MinY[LIGHT_CLUSTERS_Z][LIGHT_CLUSTERS_Y], m_MaxY[LIGHT_CLUSTERS_Z][LIGHT_CLUSTERS_Y];
+    float m_Ambient[3];
+
+    // This frame's lights in eye space, structure of arrays
+    Matrix m_View;
+    int m_LightCount;
+    std::vector<float> m_X, m_Y, m_Depth, m_Radius, m_R, m_G, m_B;
+
+    // Each slice's lists, built in parallel, then joined into m_Indices
+    struct Slice {
+        std::vector<int> Lights;                    // Overlapping the slice's depths
+        std::vector<float> Reach;                   // Their r^2 less the depth distance^2
+        std::vector<float> X, Left;                 // Per row: x, and Reach less the y distance^2
+        std::vector<int> Index;
+        std::vector<unsigned int> Out;
+        int First[LIGHT_TILES], Count[LIGHT_TILES]; // Into Out
+    };
+    Slice m_Slices[LIGHT_CLUSTERS_Z];
+    std::vector<unsigned int> m_Indices;
+    int m_First[LIGHT_CLUSTERS], m_Count[LIGHT_CLUSTERS];
+
+    LightStats m_Stats;
+};
+
+#endif
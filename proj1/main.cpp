@@ -1,5 +1,22 @@
 #include "core.h"
 #include "matrix.h"
+#include "occlusion.h"
+#include "meshopt.h"
+#include "streaming.h"
+#include "simplify.h"
+#include "arena.h"
+#include "jobs.h"
+#include "simulation.h"
+#include "compress.h"
+#include "skin.h"
+#include "animation.h"
+#include "particles.h"
+#include "collision.h"
+#include "renderqueue.h"
+#include "lighting.h"
+#include "raytrace.h"
+#include "capture.h"
+#include "distrib.h"
 
 // Function Declarations
 // Glut requires that we use global/static functions so we declare a few below
@@ -9,12 +26,119 @@ void resizeWindow(int w, int h);
 
 // Rendering Functions
 void initRendering();
-void drawCube(const Matrix &mTransform);
+void drawCube(const Matrix &mTransform,int cacheSlot=-1);
+void asteroidTransform(const Matrix &sun,float rotation,int i,Matrix &world);
+int sceneCubes(const SceneSnapshot &scene,bool sunCube,Matrix *cubes,unsigned int *partColors);
+void traceScene(const SceneSnapshot &scene);
+void drawDistributed(const SceneSnapshot &scene);
+
+// Scene Setup
+void buildTentacle();
+void buildDust();
+void buildBodies();
+void buildMaterials();
+void buildLights();
 
 // Global Variables, use as few as possible :)
-float g_Rotation = 0;
 float g_RotStep = 0.0001;
 float g_Aspect = 1;
+int g_Width = 1;
+int g_Height = 1;
+
+// Cube geometry for the CPU side passes.  Same corners and faces as drawCube.
+Point3 g_CubeVerts[8] = {
+    Point3( 1,-1, 1), Point3( 1,-1,-1), Point3( 1, 1,-1), Point3( 1, 1, 1),
+    Point3(-1,-1, 1), Point3(-1,-1,-1), Point3(-1, 1,-1), Point3(-1, 1, 1)
+};
+unsigned int g_CubeIndices[36] = {
+    0,1,2, 0,2,3,   6,5,4, 6,4,7,   1,0,4, 1,4,5,
+    2,1,5, 2,5,6,   3,2,6, 3,6,7,   0,3,7, 0,7,4
+};
+Point3 g_CubeMin(-1,-1,-1), g_CubeMax(1,1,1);
+
+// Draws are queued and issued sorted by state at the end of the frame.
+// The cube's face pairs are green, white and blue.
+RenderQueue g_Queue;
+int g_CubeMaterials[RENDER_CUBE_PARTS];
+int g_ModelMaterial, g_TentacleMaterial;
+int g_CubeSlots;        // Cube cache slots: the SIM_ objects, then the asteroids
+
+// A ring of small cubes around the sun, toggled with 'a'.  'g' turns them
+// to glass, drawn blended in the queue's transparent pass, back to front.
+#define NUM_ASTEROIDS   2000
+#define ASTEROID_GRAIN  256     // Asteroids a job transforms
+bool g_DrawAsteroids = false;
+bool g_GlassAsteroids = false;
+int g_GlassMaterials[RENDER_CUBE_PARTS];
+
+// Colored point lights circling the sun over a floor, toggled with 'l'.
+// While they are on, meshes in the queue are shaded by them per vertex,
+// each vertex looking only at the lights in its cluster of g_Lights.
+#define NUM_LIGHTS      2048
+#define FLOOR_CELLS     128     // Quads along each side of the floor
+LightClusters g_Lights;
+PointLight g_PointLights[NUM_LIGHTS];
+Mesh g_Floor;
+int g_FloorMaterial;
+bool g_DrawLights = false;
+
+// The scene ray cast on the CPU, one frame at a time when 'r' asks for it,
+// and saved to TRACE_IMAGE
+#define TRACE_IMAGE     "raytrace.ppm"
+RayScene g_RayScene;
+RayTracer g_RayTracer;
+bool g_TraceFrame = false;
+
+// Frames read back without stalling and written out on a background
+// thread: 'v' records raw RGBA video to VIDEO_FILE, 'V' a PNG per frame
+#define VIDEO_FILE      "capture.rgba"
+#define FRAME_FILES     "frame%05d.png"
+FrameCapture g_Capture;
+
+// Render workers named by -workers on the command line.  While 'd' has it
+// on, each frame's cubes are ray cast by them, a band each, and drawn over
+// the OpenGL frame.
+DistribCoordinator g_Coordinator;
+bool g_Distributed = false;
+
+// Moves the scene on its own thread; drawScene draws its latest snapshot
+Simulation g_Sim;
+
+// Occlusion culling against a coarse CPU depth buffer
+OcclusionCuller g_Occlusion;
+
+// Optional model given on the command line, drawn in place of the big cube
+Mesh g_Model;
+Matrix g_ModelFit;      // Centers the model and scales it to the cube's size
+LodChain g_ModelLod;    // Simplified versions of g_Model
+int g_ModelLevel = -1;  // Level drawn last frame
+CompressedMesh g_ModelPacked;   // g_Model quantized, drawn instead when g_DrawPacked
+bool g_DrawPacked = false;
+
+// Skinned tentacle growing out of the top of the big cube, toggled with 'k'
+Skeleton g_Tentacle;
+SkinnedMesh g_TentacleMesh;
+AnimationClip g_TentacleSway;
+AnimationPlayer g_TentaclePlayer;
+bool g_DrawTentacle = false;
+
+// Dust thrown off the planet and pulled back in by the sun, toggled with 'p'
+ParticleSystem g_Dust;
+double g_DustTime = -1.0;   // Scene time of the last dust update, in ms
+bool g_DrawDust = false;
+
+// Collision shapes of the sun, planet and moon, in SIM_ order.  Contacts
+// are printed as they begin and end; 'b' switches the broad phase.
+CollisionWorld g_Bodies;
+
+// Optional streamed scene, given on the command line as a .stream manifest
+StreamingScene *g_Stream = 0;
+
+// Transient per-frame allocations, and how many heap allocations the last
+// frame made (should settle to 0).  Given an arena per job thread in main(),
+// since starting the pool from a static initializer isn't safe.
+FrameArena g_Frame;
+unsigned long long g_FrameHeapAllocs = 0;
 
 /////////////////////////////////////////////////////////////////////////////
 // Name:           myKeyboardFunc
@@ -32,14 +156,99 @@ void myKeyboardFunc( unsigned char key, int x, int y )
             g_RotStep += 0.0001;
             if(g_RotStep > 0.001)
                 g_RotStep = 0.001;
+            g_Sim.SetRotStep(g_RotStep);
             break;
         // Decrease the rotation step size
         case '-':        
             g_RotStep -= 0.0001;
             if(g_RotStep < 0)
                 g_RotStep = 0;
+            g_Sim.SetRotStep(g_RotStep);
             break;   
+        // Toggle occlusion culling
+        case 'o':
+            g_Occlusion.SetEnabled(!g_Occlusion.IsEnabled());
+            printf("occlusion culling %s\n",g_Occlusion.IsEnabled() ? "on" : "off");
+            break;
+        // Toggle drawing the compressed copy of the model
+        case 'c':
+            g_DrawPacked = !g_DrawPacked;
+            printf("compressed model %s\n",g_DrawPacked ? "on" : "off");
+            break;
+        // Toggle the skinned tentacle
+        case 'k':
+            g_DrawTentacle = !g_DrawTentacle;
+            printf("skinned tentacle %s\n",g_DrawTentacle ? "on" : "off");
+            break;
+        // Toggle the dust
+        case 'p':
+            g_DrawDust = !g_DrawDust;
+            printf("particles %s\n",g_DrawDust ? "on" : "off");
+            break;
+        // Toggle the asteroid ring
+        case 'a':
+            g_DrawAsteroids = !g_DrawAsteroids;
+            printf("asteroids %s\n",g_DrawAsteroids ? "on" : "off");
+            break;
+        // Toggle glass asteroids
+        case 'g':
+            g_GlassAsteroids = !g_GlassAsteroids;
+            printf("glass asteroids %s\n",g_GlassAsteroids ? "on" : "off");
+            break;
+        // Toggle the point lights and the floor they light
+        case 'l':
+            g_DrawLights = !g_DrawLights;
+            printf("point lights %s\n",g_DrawLights ? "on" : "off");
+            break;
+        // Ray trace the next frame
+        case 'r':
+            g_TraceFrame = true;
+            break;
+        // Toggle rendering on the workers
+        case 'd':
+            if(g_Coordinator.GetWorkerCount() == 0)
+                printf("no render workers; start with -workers host:port,...\n");
+            else {
+                g_Distributed = !g_Distributed;
+                printf("distributed rendering %s\n",g_Distributed ? "on" : "off");
+            }
+            break;
+        // Start or stop capturing frames
+        case 'v':
+        case 'V':
+            if(g_Capture.IsActive()) {
+                g_Capture.Stop();
+                g_Capture.GetStats().Print();
+            }
+            else if(g_Capture.Start(key == 'v' ? VIDEO_FILE : FRAME_FILES,key == 'v' ? CAPTURE_RAW : CAPTURE_PNG))
+                printf("capturing %dx%d frames to %s\n",g_Width,g_Height,key == 'v' ? VIDEO_FILE : FRAME_FILES);
+            break;
+        // Switch between sweep and prune and the spatial hash
+        case 'b':
+            g_Bodies.SetMethod(g_Bodies.GetMethod() == BROADPHASE_SWEEP ? BROADPHASE_HASH : BROADPHASE_SWEEP);
+            printf("broad phase %s\n",g_Bodies.GetMethod() == BROADPHASE_SWEEP ? "sweep and prune" : "spatial hash");
+            break;
+        // Print the instrumentation for the last frame
+        case 'i':
+            g_Occlusion.GetStats().Print();
+            if(g_Stream)
+                g_Stream->GetStats().Print();
+            g_Sim.GetStats().Print();
+            if(g_DrawDust)
+                g_Dust.GetStats().Print();
+            g_Bodies.GetStats().Print();
+            if(g_DrawLights)
+                g_Lights.GetStats().Print();
+            if(g_Capture.IsActive())
+                g_Capture.GetStats().Print();
+            if(g_Distributed)
+                g_Coordinator.GetStats().Print();
+            g_Queue.GetStats().Print();
+            g_Frame.Print();
+            printf("Heap allocations last frame: %llu\n",g_FrameHeapAllocs);
+            break;
         case 27:         // "27" is theEscape key
+            g_Capture.Stop();
             exit(1);
     }
 }
@@ -52,7 +261,8 @@ void myKeyboardFunc( unsigned char key, int x, int y )
 //                 Allocating memory (using 'new') in this function is generally 
 //                 a bad idea, and it's slow. Remember, if you do allocate memory, 
 //                 be sure to delete it before the function exits so you don't get
-//                 memory leaks.
+//                 memory leaks.  Temporary arrays should come from g_Frame
+//                 instead, which is freed wholesale a frame later.
 /////////////////////////////////////////////////////////////////////////////
 void drawScene(void)
 {
@@ -74,50 +284,181 @@ void drawScene(void)
 //************************* Begin Assignment ********************************
 
 
-	Matrix rot1, trans1, CTM;
-	CTM = Matrix::IDENTITY;
-	Vector3 v = Vector3(-1,1,-1);
-	v.Normalize();
-	// Spinning Cube
-	//rot1.MakeRotateY(g_Rotation);
-	rot1.MakeRotateUnitAxis(v,g_Rotation);
-	trans1.MakeTranslate(0,0,-40);
-	CTM = CTM*trans1;
-	drawCube(trans1*rot1);
-	CTM = CTM*rot1;
-
-	
-	Matrix rot2,scale2,trans2;
-
-	trans2.MakeTranslate(-10,0,0);
-	rot2.MakeRotateY(g_Rotation);
-	CTM = CTM*trans2;
-	CTM = CTM*rot2;
-	scale2.MakeScale(0.6f,0.6f,0.6f);
-	//trans2.MakeTranslate(0,0,-4);
-	CTM = CTM*scale2;
-	drawCube(CTM);
-
-
-
-	Matrix rot3, scale3,trans3;
-	trans3.MakeTranslate(0,0,5);
-	CTM = CTM*trans3;
-
-	rot3.MakeRotateX(g_Rotation);
-	CTM = CTM*rot3;
-
-	scale3.MakeScale(0.5f,0.5f,0.5f);
-	CTM = CTM*scale3;
-	drawCube(CTM);
+	g_Frame.BeginFrame();
+	unsigned long long heapAllocs = GetHeapAllocCount();
+
+	// The simulation thread computes the transforms; take the newest set
+	const SceneSnapshot &scene = g_Sim.Acquire();
+	const Matrix &sun = scene.Objects[SIM_SUN];
+	const Matrix &planet = scene.Objects[SIM_PLANET];
+	const Matrix &moon = scene.Objects[SIM_MOON];
+
+	// Move the collision shapes onto the bodies and report any changes
+	for(int i = 0; i < g_Bodies.GetCount(); i++)
+		g_Bodies.SetTransform(i,scene.Objects[i]);
+	g_Bodies.Update();
+	for(size_t i = 0; i < g_Bodies.GetBegan().size(); i++)
+		printf("bodies %d and %d touching\n",g_Bodies.GetBegan()[i].A,g_Bodies.GetBegan()[i].B);
+	for(size_t i = 0; i < g_Bodies.GetEnded().size(); i++)
+		printf("bodies %d and %d apart\n",g_Bodies.GetEnded()[i].A,g_Bodies.GetEnded()[i].B);
+
+	// The big cube is the occluder, the orbiting ones are only drawn when
+	// some part of their box is in front of it
+	Matrix proj;
+	proj.MakePerspective(60.0f*M_PI/180.0f,g_Aspect,0.1f,80.0f);
+	g_Occlusion.BeginFrame(proj);
+	if(g_Model.IsEmpty()) {
+		g_Occlusion.AddOccluder(sun,g_CubeVerts,8,g_CubeIndices,12);
+		drawCube(sun,g_CubeSlots + SIM_SUN);
+	}
+	else {
+		Matrix model = sun*g_ModelFit;
+		g_ModelLevel = g_ModelLod.SelectLevel(proj,model,(float)g_Height,g_ModelLevel);
+		if(g_DrawPacked) {
+			glColor3f(1,1,1);
+			g_ModelPacked.Draw(model);
+		}
+		else
+			g_Queue.Submit(model,&g_ModelLod.GetLevel(g_ModelLevel),g_ModelMaterial);
+	}
+
+	// Play the sway animation (one loop per 2 seconds at the default
+	// speed) into the joints and skin the tentacle
+	if(g_DrawTentacle) {
+		int joints = g_Tentacle.GetJointCount();
+		Matrix *local = g_Frame.AllocMatrices(2*joints);
+		Matrix *world = local + joints;
+		Matrix34 *palette = g_Frame.Get().AllocArray<Matrix34>(joints);
+		g_TentaclePlayer.Sample(20.0f*scene.Rotation/(float)M_PI,local);
+		g_Tentacle.ComputeWorld(world,local);
+		g_Tentacle.ComputePalette(palette,world);
+		SkinJob job = {&g_TentacleMesh,palette,0};
+		SkinMeshes(&job,1);
+
+		Matrix top;
+		top.MakeTranslate(0,1,0);
+		g_Queue.Submit(Matrix(sun*top),&g_TentacleMesh.GetOutput(),g_TentacleMaterial);
+	}
+
+	// Record the orbiting cubes, cull them as a batch and draw what's left
+	const int numCommands = 2;
+	DrawCommand *commands = g_Frame.AllocCommands(numCommands);
+	commands[0].World = planet;
+	commands[0].Model = 0;
+	commands[1].World = moon;
+	commands[1].Model = 0;
+	Matrix *worlds = g_Frame.AllocMatrices(numCommands);
+	unsigned char *visible = g_Frame.Get().AllocArray<unsigned char>(numCommands);
+	for(int i = 0; i < numCommands; i++)
+		worlds[i] = commands[i].World;
+	g_Occlusion.CullBoxes(worlds,g_CubeMin,g_CubeMax,numCommands,visible);
+	for(int i = 0; i < numCommands; i++) {
+		if(visible[i])
+			drawCube(commands[i].World,g_CubeSlots + SIM_PLANET + i);
+	}
+
+	// The asteroids orbit the sun in its plane, half as fast as the planet.
+	// Jobs transform a chunk each into their own thread's arena, then the
+	// chunks are queued here in order.
+	if(g_DrawAsteroids) {
+		const int chunks = (NUM_ASTEROIDS + ASTEROID_GRAIN - 1)/ASTEROID_GRAIN;
+		Matrix **chunkWorlds = g_Frame.Get().AllocArray<Matrix*>(chunks);
+		ParallelFor(chunks,1,[&](int begin,int end,int thread) {
+			for(int c = begin; c < end; c++) {
+				int first = c*ASTEROID_GRAIN;
+				int count = NUM_ASTEROIDS - first < ASTEROID_GRAIN ? NUM_ASTEROIDS - first : ASTEROID_GRAIN;
+				Matrix *worlds = g_Frame.GetThreadArena(thread).AllocArray<Matrix>(count);
+				for(int i = 0; i < count; i++)
+					asteroidTransform(sun,scene.Rotation,first + i,worlds[i]);
+				chunkWorlds[c] = worlds;
+			}
+		});
+		for(int i = 0; i < NUM_ASTEROIDS; i++) {
+			const Matrix &world = chunkWorlds[i/ASTEROID_GRAIN][i % ASTEROID_GRAIN];
+			if(g_GlassAsteroids)
+				g_Queue.SubmitCube(world,g_GlassMaterials,RENDER_PASS_TRANSPARENT,g_CubeSlots + SIM_MOON + 1 + i);
+			else
+				drawCube(world,g_CubeSlots + SIM_MOON + 1 + i);
+		}
+	}
+
+	// The lights circle the sun at their own speeds, low over the floor.
+	// They are binned into the view's clusters before the queue shades
+	// the meshes with them.
+	if(g_DrawLights) {
+		Point3 center(sun.m_m[12],sun.m_m[13],sun.m_m[14]);
+		for(int i = 0; i < NUM_LIGHTS; i++) {
+			float radius = 3.0f + 30.0f*(i + 0.5f)/NUM_LIGHTS;
+			float angle = (1.0f + 0.25f*(i % 5))*scene.Rotation + 2.4f*i;
+			g_PointLights[i].Position = center + Vector3(radius*cosf(angle),-3.5f + 0.5f*(i % 4),radius*sinf(angle));
+		}
+		g_Lights.SetProjection(60.0f*M_PI/180.0f,g_Aspect,0.1f,80.0f);
+		g_Lights.Assign(Matrix(),g_PointLights,NUM_LIGHTS);
+		g_Queue.SetLighting(&g_Lights);
+		g_Queue.Submit(Matrix(),&g_Floor,g_FloorMaterial);
+	}
+	else
+		g_Queue.SetLighting(0);
+
+	// Everything queued so far, sorted into as few state changes as possible
+	g_Queue.Execute();
+
+	if(g_DrawLights) {
+		glBegin(GL_POINTS);
+		for(int i = 0; i < NUM_LIGHTS; i++) {
+			const PointLight &l = g_PointLights[i];
+			glColor3fv(l.Color);
+			glVertex3f(l.Position.x,l.Position.y,l.Position.z);
+		}
+		glEnd();
+	}
+
+	// The planet sheds dust away from the sun, which pulls it back.  The
+	// step follows the simulation clock so the dust keeps pace with the
+	// orbits at any frame rate.
+	if(g_DrawDust) {
+		float dt = g_DustTime < 0.0 ? 0.0f : (float)(scene.Time - g_DustTime)*0.001f;
+		g_DustTime = scene.Time;
+		if(dt > 0.1f)
+			dt = 0.1f;
+		Point3 center(sun.m_m[12],sun.m_m[13],sun.m_m[14]);
+		ParticleEmitter &e = g_Dust.GetEmitter(0);
+		e.Position = Point3(planet.m_m[12],planet.m_m[13],planet.m_m[14]);
+		e.Direction = e.Position - center;
+		g_Dust.SetAttractor(0,center,20.0f);
+		g_Dust.Update(dt);
+		glColor3f(1.0f,0.7f,0.3f);
+		g_Dust.Draw();
+	}
+	else
+		g_DustTime = -1.0;
+
+	// Streamed chunks around the eye (the modelview is the identity)
+	if(g_Stream) {
+		g_Stream->Update(Point3(0,0,0),80.0f);
+		glColor3f(0.8f,0.8f,0.8f);
+		g_Stream->Draw();
+	}
+
+	g_FrameHeapAllocs = GetHeapAllocCount() - heapAllocs;
+
+	// Offline frames are left out of the heap count; they size their
+	// buffers the first time
+	if(g_TraceFrame) {
+		g_TraceFrame = false;
+		traceScene(scene);
+	}
+	if(g_Distributed)
+		drawDistributed(scene);
+
+	// Queue the finished frame's read back before it is swapped
+	g_Capture.Capture(g_Width,g_Height);
 	
 
 //************************** End Assignment *********************************
 //**************** Do not alter anything past this line *********************
 //***************************************************************************
 
-    // Update rotation angle
-    g_Rotation += g_RotStep;
     // Tell glut to redraw the scene for the next frame
     glutSwapBuffers();
     glutPostRedisplay();
@@ -143,7 +484,8 @@ void initRendering()
 // Name:           resizeWindow
 // Arguments:      none
 // Returns:        none
-// Side Effects:   sets g_Aspect to the aspect ratio w/h
+// Side Effects:   sets g_Aspect to the aspect ratio w/h, g_Width to w and
+//                 g_Height to h
 // Notes:          Called when the window is resized
 //                 w, h - width and height of the window in pixels.
 /////////////////////////////////////////////////////////////////////////////
@@ -152,6 +494,8 @@ void resizeWindow(int w, int h)
     // Define the portion of the window used for OpenGL rendering.
     glViewport( 0, 0, w, h );   // View port uses whole window
     g_Aspect = (float)w/h;
+    g_Width = w;
+    g_Height = h;
 }
     
 // Main routine
@@ -160,6 +504,54 @@ int main( int argc, char** argv )
 {
     // Initialize glut
     glutInit(&argc,argv);
+    g_Frame.Create(SharedJobPool().GetThreadCount() - 1);
+
+    // Render workers to connect to, if any, come before the model
+    if(argc > 2 && strcmp(argv[1],"-workers") == 0) {
+        if(g_Coordinator.Connect(argv[2]) > 0)
+            printf("Press d for distributed rendering on %d workers\n",g_Coordinator.GetWorkerCount());
+        argc -= 2;
+        argv += 2;
+    }
+
+    // Load a model if one was given: .obj files are imported, .stream files
+    // are streaming manifests, and anything else is taken to be a binary
+    // mesh and memory mapped
+    if(argc > 1) {
+        size_t len = strlen(argv[1]);
+        bool obj = len > 4 && strcmp(argv[1]+len-4,".obj") == 0;
+        if(len > 7 && strcmp(argv[1]+len-7,".stream") == 0) {
+            g_Stream = new StreamingScene();
+            g_Stream->LoadManifest(argv[1]);
+            printf("Streaming %s: %d chunks\n",argv[1],g_Stream->GetChunkCount());
+        }
+        else if(obj ? g_Model.LoadOBJ(argv[1]) : g_Model.Load(argv[1])) {
+            // OBJ files come in whatever order the exporter wrote; binary
+            // meshes are expected to have been optimized by meshconv
+            if(obj) {
+                MeshOptReport report;
+                OptimizeMesh(g_Model,true,&report);
+                report.Print();
+            }
+            Point3 lo = g_Model.GetBoundsMin(), hi = g_Model.GetBoundsMax();
+            Vector3 extent = hi - lo;
+            float size = extent.x > extent.y ? extent.x : extent.y;
+            if(extent.z > size) size = extent.z;
+            Matrix scale, center;
+            scale.MakeScale(size > 0.0f ? 2.0f/size : 1.0f);
+            center.MakeTranslate(-0.5f*(lo.x+hi.x),-0.5f*(lo.y+hi.y),-0.5f*(lo.z+hi.z));
+            g_ModelFit = scale*center;
+            g_ModelLod.Build(g_Model);
+            printf("Loaded %s: %d vertices, %d triangles\n",argv[1],
+                   g_Model.GetVertexCount(),g_Model.GetTriangleCount());
+            for(int i = 1; i < g_ModelLod.GetLevelCount(); i++)
+                printf("  LOD %d: %d triangles, error %g\n",i,
+                       g_ModelLod.GetLevel(i).GetTriangleCount(),g_ModelLod.GetLevelError(i));
+            g_ModelPacked.Build(g_Model);
+            printf("  Compressed: %u bytes (mesh file %u bytes)\n",
+                   (unsigned int)g_ModelPacked.GetDataSize(),(unsigned int)g_Model.GetDataSize());
+        }
+    }
 
     // GLUT_DOUBLE: double buffering for smoother animations,
     // GLUT_RGB:    select the RGB color model (actually RGBA)
@@ -185,8 +577,24 @@ int main( int argc, char** argv )
     // call this whenever window needs redrawing
     glutDisplayFunc( drawScene );
 
+    // Start moving the scene
+    buildTentacle();
+    buildDust();
+    buildBodies();
+    buildMaterials();
+    buildLights();
+
+    g_Sim.SetRotStep(g_RotStep);
+    g_Sim.Start();
+
     printf("Press Escape to exit\n\
-Use + and - to increase/decrease the rotation speed\n");
+Use + and - to increase/decrease the rotation speed\n\
+Press o to toggle occlusion culling, i to print frame statistics\n\
+Press c to draw the compressed model (when one is loaded), k for a skinned tentacle\n\
+Press p for particles, b to switch the collision broad phase, a for asteroids\n\
+Press l for point lights, r to ray trace a frame to " TRACE_IMAGE "\n\
+Press v to start or stop capturing video to " VIDEO_FILE ", V for PNG frames\n\
+Start with -workers host:port,... (before any model) to render on renderworker processes\n");
     // Start the main loop.  glutMainLoop never returns.
     glutMainLoop();
 
@@ -195,71 +603,255 @@ Use + and - to increase/decrease the rotation speed\n");
 
 /////////////////////////////////////////////////////////////////////////////
 // Name:           drawCube
-// Arguments:      A transformation to apply to the cube before drawing
+// Arguments:      A transformation to apply to the cube before drawing, and
+//                 optionally the object's g_Queue cube cache slot
 // Returns:        none
-// Side Effects:   draws a cube using OpenGL Quads
+// Side Effects:   queues a cube in g_Queue, drawn as OpenGL Quads when the
+//                 queue is executed at the end of the frame
 // Notes:          If passed the Identity matrix, this routine draws a cube
 //                 with side length 2 centered at (0,0,0).
 //                 Does not currently work with OpenGL lighting due to lack
 //                 of surface normals
 /////////////////////////////////////////////////////////////////////////////
-void drawCube(const Matrix &mTransform) {
-
-    Point3 p1 = mTransform * Point3( 1,-1, 1);
-    Point3 p2 = mTransform * Point3( 1,-1,-1);
-    Point3 p3 = mTransform * Point3( 1, 1,-1);
-    Point3 p4 = mTransform * Point3( 1, 1, 1);
-    Point3 p5 = mTransform * Point3(-1,-1, 1);
-    Point3 p6 = mTransform * Point3(-1,-1,-1);
-    Point3 p7 = mTransform * Point3(-1, 1,-1);
-    Point3 p8 = mTransform * Point3(-1, 1, 1);
-	/*mTransform.Print("mTransform");
-	p1.Print("p1");
-	p2.Print("p2");
-	p3.Print("p3");
-	p4.Print("p4");
-	p5.Print("p5");
-	p6.Print("p6");
-	p7.Print("p7");
-	p8.Print("p8");*/
-    glBegin(GL_QUADS);
-
-        glColor3f(0,1,0);
-        glVertex3fv(p1);
-        glVertex3fv(p2);
-        glVertex3fv(p3);
-        glVertex3fv(p4);
-
-        glColor3f(0,1,0);
-        glVertex3fv(p7);
-        glVertex3fv(p6);
-        glVertex3fv(p5);
-        glVertex3fv(p8);
-
-        glColor3f(1,1,1);
-        glVertex3fv(p2);
-        glVertex3fv(p1);
-        glVertex3fv(p5);
-        glVertex3fv(p6);
-
-        glColor3f(0,0,1);
-        glVertex3fv(p3);
-        glVertex3fv(p2);
-        glVertex3fv(p6);
-        glVertex3fv(p7);
-
-        glColor3f(1,1,1);
-        glVertex3fv(p4);
-        glVertex3fv(p3);
-        glVertex3fv(p7);
-        glVertex3fv(p8);
-
-        glColor3f(0,0,1);
-        glVertex3fv(p1);
-        glVertex3fv(p4);
-        glVertex3fv(p8);
-        glVertex3fv(p5);
-
-    glEnd();
-
-}
\ No newline at end of file
+void drawCube(const Matrix &mTransform,int cacheSlot) {
+
+    g_Queue.SubmitCube(mTransform,g_CubeMaterials,RENDER_PASS_OPAQUE,cacheSlot);
+
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           asteroidTransform
+// Arguments:      The sun's matrix, the scene's rotation, an asteroid's
+//                 index and where to put its matrix
+// Returns:        none
+// Notes:          The asteroids orbit the sun in its plane, half as fast as
+//                 the planet, in rings at a few radii and heights
+/////////////////////////////////////////////////////////////////////////////
+void asteroidTransform(const Matrix &sun,float rotation,int i,Matrix &world) {
+    Matrix spin, offset, size;
+    size.MakeScale(0.15f,0.15f,0.15f);
+    spin.MakeRotateY(0.5f*rotation + 2.0f*(float)M_PI*i/NUM_ASTEROIDS);
+    offset.MakeTranslate(14.0f + 0.5f*(i % 7),0.3f*(i % 5) - 0.6f,0);
+    world = Matrix(sun*spin*offset*size);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           sceneCubes
+// Arguments:      The snapshot drawScene is drawing, whether the sun is a
+//                 cube, and where to put the cubes' matrices (room for
+//                 SIM_MOON+1+NUM_ASTEROIDS) and their face pair colors
+// Returns:        The number of cubes
+/////////////////////////////////////////////////////////////////////////////
+int sceneCubes(const SceneSnapshot &scene,bool sunCube,Matrix *cubes,unsigned int *partColors) {
+    for(int part = 0; part < RENDER_CUBE_PARTS; part++) {
+        const float *c = g_Queue.GetMaterial(g_CubeMaterials[part]).Color;
+        partColors[part] = RayTracer::PackColor(c[0],c[1],c[2]);
+    }
+    const Matrix &sun = scene.Objects[SIM_SUN];
+    int cubeCount = 0;
+    if(sunCube)
+        cubes[cubeCount++] = sun;
+    cubes[cubeCount++] = scene.Objects[SIM_PLANET];
+    cubes[cubeCount++] = scene.Objects[SIM_MOON];
+    if(g_DrawAsteroids) {
+        for(int i = 0; i < NUM_ASTEROIDS; i++)
+            asteroidTransform(sun,scene.Rotation,i,cubes[cubeCount++]);
+    }
+    return cubeCount;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           traceScene
+// Arguments:      The snapshot drawScene is drawing
+// Returns:        none
+// Side Effects:   Ray casts what drawScene draws (less the particles and
+//                 the streamed chunks) at the window's size, saves it to
+//                 TRACE_IMAGE and prints the stats.  Cubes keep their three
+//                 face pair colors, everything else its material's.
+/////////////////////////////////////////////////////////////////////////////
+void traceScene(const SceneSnapshot &scene) {
+    const float *c = g_Queue.GetMaterial(g_ModelMaterial).Color;
+    unsigned int modelColor = RayTracer::PackColor(c[0],c[1],c[2]);
+    c = g_Queue.GetMaterial(g_TentacleMaterial).Color;
+    unsigned int tentacleColor = RayTracer::PackColor(c[0],c[1],c[2]);
+    c = g_Queue.GetMaterial(g_FloorMaterial).Color;
+    unsigned int floorColor = RayTracer::PackColor(c[0],c[1],c[2]);
+
+    g_RayScene.Clear();
+    const Matrix &sun = scene.Objects[SIM_SUN];
+    if(!g_Model.IsEmpty() && g_DrawPacked)
+        g_RayScene.AddMesh(g_ModelPacked,Matrix(sun*g_ModelFit),modelColor);
+    else if(!g_Model.IsEmpty())
+        g_RayScene.AddMesh(g_Model,Matrix(sun*g_ModelFit),modelColor);
+    unsigned int partColors[RENDER_CUBE_PARTS];
+    Matrix *cubes = g_Frame.AllocMatrices(SIM_MOON + 1 + NUM_ASTEROIDS);
+    int cubeCount = sceneCubes(scene,g_Model.IsEmpty(),cubes,partColors);
+    for(int i = 0; i < cubeCount; i++)
+        g_RayScene.AddCube(cubes[i],partColors);
+    if(g_DrawTentacle) {
+        Matrix top;
+        top.MakeTranslate(0,1,0);
+        g_RayScene.AddMesh(g_TentacleMesh.GetOutput(),Matrix(sun*top),tentacleColor);
+    }
+    if(g_DrawLights)
+        g_RayScene.AddMesh(g_Floor,Matrix(),floorColor);
+    g_RayScene.Build();
+
+    g_RayTracer.SetCamera(Matrix(),60.0f*(float)M_PI/180.0f);
+    g_RayTracer.Render(g_RayScene,g_Width,g_Height);
+    if(g_RayTracer.SavePPM(TRACE_IMAGE))
+        printf("ray traced frame saved to %s\n",TRACE_IMAGE);
+    g_RayTracer.GetStats().Print();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           drawDistributed
+// Arguments:      The snapshot drawScene is drawing
+// Returns:        none
+// Side Effects:   Has the render workers ray cast the frame's cubes and
+//                 draws their image over the window
+// Notes:          Only matrices go to the workers, so a loaded model is
+//                 sent as the cube it replaced
+/////////////////////////////////////////////////////////////////////////////
+void drawDistributed(const SceneSnapshot &scene) {
+    unsigned int partColors[RENDER_CUBE_PARTS];
+    Matrix *cubes = g_Frame.AllocMatrices(SIM_MOON + 1 + NUM_ASTEROIDS);
+    int cubeCount = sceneCubes(scene,true,cubes,partColors);
+    g_Coordinator.Render(Matrix(),60.0f*(float)M_PI/180.0f,cubes,cubeCount,partColors,g_Width,g_Height);
+
+    // Rows come bottom up, as glDrawPixels wants them
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    glDisable(GL_DEPTH_TEST);
+    glRasterPos2f(-1.0f,-1.0f);
+    glDrawPixels(g_Coordinator.GetWidth(),g_Coordinator.GetHeight(),GL_RGBA,GL_UNSIGNED_BYTE,g_Coordinator.GetPixels());
+    glEnable(GL_DEPTH_TEST);
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           buildTentacle
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Builds the skinned tentacle and its sway animation: every
+//                 joint bends about z, each a little out of step with the
+//                 one below it.  Keyed at 30 frames per second and left to
+//                 the clip compression to thin out.
+/////////////////////////////////////////////////////////////////////////////
+void buildTentacle() {
+    MakeSkinnedCylinder(g_Tentacle,g_TentacleMesh,8,64,16,4.0f,0.3f);
+
+    const float duration = 2.0f;
+    const int frames = 60;
+    int joints = g_Tentacle.GetJointCount();
+    RawAnimation raw;
+    raw.Create(joints,duration);
+    for(int i = 0; i < joints; i++) {
+        Point3 offset;
+        g_Tentacle.GetBindLocal(i).Transform(Point3(0,0,0),offset);
+        raw.SetRest(i,Vector3(offset.x,offset.y,offset.z),Quaternion(),Vector3(1,1,1));
+        for(int f = 0; f <= frames; f++) {
+            float t = duration*f/frames;
+            Quaternion bend;
+            bend.MakeRotateUnitAxis(Vector3(0,0,1),0.3f*sinf((float)M_PI*t + 0.7f*i));
+            raw.AddRotationKey(i,t,bend);
+        }
+    }
+    g_TentacleSway.Build(raw,AnimTolerance());
+    g_TentaclePlayer.SetClip(&g_TentacleSway);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           buildDust
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Sets up g_Dust: one emitter (moved onto the planet every
+//                 frame) and light drag so orbits slowly decay into the sun
+/////////////////////////////////////////////////////////////////////////////
+void buildDust() {
+    g_Dust.Create(200000);
+    ParticleEmitter e;
+    e.Spread = 0.6f;
+    e.Speed = 3.0f;
+    e.SpeedJitter = 1.5f;
+    e.Life = 4.0f;
+    e.LifeJitter = 1.0f;
+    e.Rate = 20000.0f;
+    g_Dust.AddEmitter(e);
+    g_Dust.SetDrag(0.2f);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           buildBodies
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Gives the sun, planet and moon a box each in g_Bodies
+/////////////////////////////////////////////////////////////////////////////
+void buildBodies() {
+    for(int i = SIM_SUN; i <= SIM_MOON; i++)
+        g_Bodies.AddBox(g_CubeMin,g_CubeMax);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           buildMaterials
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Registers the colors everything is drawn in with g_Queue,
+//                 and a cube cache slot for every cube
+/////////////////////////////////////////////////////////////////////////////
+void buildMaterials() {
+    g_CubeMaterials[RENDER_CUBE_X] = g_Queue.AddMaterial(RenderMaterial(0,1,0));
+    g_CubeMaterials[RENDER_CUBE_Y] = g_Queue.AddMaterial(RenderMaterial(1,1,1));
+    g_CubeMaterials[RENDER_CUBE_Z] = g_Queue.AddMaterial(RenderMaterial(0,0,1));
+    g_ModelMaterial = g_CubeMaterials[RENDER_CUBE_Y];
+    g_TentacleMaterial = g_Queue.AddMaterial(RenderMaterial(0.2f,0.8f,0.3f));
+    g_GlassMaterials[RENDER_CUBE_X] = g_Queue.AddMaterial(RenderMaterial(0.6f,1,0.6f,0.35f));
+    g_GlassMaterials[RENDER_CUBE_Y] = g_Queue.AddMaterial(RenderMaterial(1,1,1,0.35f));
+    g_GlassMaterials[RENDER_CUBE_Z] = g_Queue.AddMaterial(RenderMaterial(0.6f,0.6f,1,0.35f));
+    g_CubeSlots = g_Queue.AddCubeSlots(SIM_MOON + 1 + NUM_ASTEROIDS);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           buildLights
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Builds the floor under the sun, FLOOR_CELLS quads on a
+//                 side, and gives the point lights their colors and radii
+//                 (drawScene moves them)
+/////////////////////////////////////////////////////////////////////////////
+void buildLights() {
+    const int n = FLOOR_CELLS + 1;
+    g_Floor.Create(n*n,6*FLOOR_CELLS*FLOOR_CELLS,true);
+    for(int z = 0; z < n; z++) {
+        for(int x = 0; x < n; x++) {
+            g_Floor.SetPosition(z*n + x,Point3(-40.0f + 80.0f*x/FLOOR_CELLS,-4.0f,-80.0f*z/FLOOR_CELLS));
+            g_Floor.SetNormal(z*n + x,Vector3(0,1,0));
+        }
+    }
+    unsigned int *idx = g_Floor.GetIndices();
+    for(int z = 0; z < FLOOR_CELLS; z++) {
+        for(int x = 0; x < FLOOR_CELLS; x++) {
+            unsigned int a = z*n + x, b = a + 1, c = b + n, d = a + n;
+            *idx++ = a; *idx++ = b; *idx++ = c;
+            *idx++ = a; *idx++ = c; *idx++ = d;
+        }
+    }
+    g_Floor.ComputeBounds();
+    g_FloorMaterial = g_Queue.AddMaterial(RenderMaterial(0.8f,0.8f,0.8f));
+
+    for(int i = 0; i < NUM_LIGHTS; i++) {
+        float hue = 0.7f*i;
+        PointLight &l = g_PointLights[i];
+        l.Radius = 2.0f + (i % 3);
+        l.Color[0] = 0.5f + 0.5f*cosf(hue);
+        l.Color[1] = 0.5f + 0.5f*cosf(hue + 2.1f);
+        l.Color[2] = 0.5f + 0.5f*cosf(hue + 4.2f);
+    }
+}
@@ -0,0 +1,108 @@
+/////////////////////////////////////////////////////////////////////////////
+// mapfile.cpp
+/////////////////////////////////////////////////////////////////////////////
+
+#include "mapfile.h"
+
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           MappedFile constructor/destructor
+/////////////////////////////////////////////////////////////////////////////
+MappedFile::MappedFile()
+{
+    m_Data = 0;
+    m_Size = 0;
+#ifdef WIN32
+    m_File = INVALID_HANDLE_VALUE;
+    m_Mapping = 0;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Open
+// Arguments:      Name of the file to map
+// Returns:        true on success
+// Side Effects:   Maps the whole file copy-on-write.  Any previous mapping
+//                 is closed first.
+/////////////////////////////////////////////////////////////////////////////
+bool MappedFile::Open(const char *filename)
+{
+    Close();
+
+#ifdef WIN32
+    m_File = CreateFileA(filename,GENERIC_READ,FILE_SHARE_READ,0,OPEN_EXISTING,
+                         FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,0);
+    if(m_File == INVALID_HANDLE_VALUE) {
+        printf("MappedFile: can't open '%s'\n",filename);
+        return false;
+    }
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(m_File,&size) || size.QuadPart == 0) {
+        printf("MappedFile: '%s' is empty\n",filename);
+        Close();
+        return false;
+    }
+    m_Mapping = CreateFileMappingA(m_File,0,PAGE_WRITECOPY,0,0,0);
+    if(m_Mapping)
+        m_Data = MapViewOfFile(m_Mapping,FILE_MAP_COPY,0,0,0);
+    if(!m_Data) {
+        printf("MappedFile: can't map '%s'\n",filename);
+        Close();
+        return false;
+    }
+    m_Size = (size_t)size.QuadPart;
+#else
+    int fd = open(filename,O_RDONLY);
+    if(fd < 0) {
+        printf("MappedFile: can't open '%s'\n",filename);
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd,&st) != 0 || st.st_size == 0) {
+        printf("MappedFile: '%s' is empty\n",filename);
+        close(fd);
+        return false;
+    }
+    void *data = mmap(0,(size_t)st.st_size,PROT_READ|PROT_WRITE,MAP_PRIVATE,fd,0);
+    close(fd);  // The mapping keeps its own reference to the file
+    if(data == MAP_FAILED) {
+        printf("MappedFile: can't map '%s'\n",filename);
+        return false;
+    }
+    m_Data = data;
+    m_Size = (size_t)st.st_size;
+#endif
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Close
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Unmaps the file.  Pointers into it become invalid.
+/////////////////////////////////////////////////////////////////////////////
+void MappedFile::Close()
+{
+#ifdef WIN32
+    if(m_Data) UnmapViewOfFile(m_Data);
+    if(m_Mapping) CloseHandle(m_Mapping);
+    if(m_File != INVALID_HANDLE_VALUE) CloseHandle(m_File);
+    m_Mapping = 0;
+    m_File = INVALID_HANDLE_VALUE;
+#else
+    if(m_Data) munmap(m_Data,m_Size);
+#endif
+    m_Data = 0;
+    m_Size = 0;
+}
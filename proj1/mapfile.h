@@ -0,0 +1,68 @@
+/////////////////////////////////////////////////////////////////////////////
+// mapfile.h
+//
+/////////////////////////////////////
+// Classes declared:
+//
+// MappedFile: Maps a whole file into memory so it can be used in place,
+//             without reading or copying it.  Pages are only brought in from
+//             disk when they are first touched.
+//
+// The mapping is copy-on-write: the data may be modified, but changes stay
+// private to this process and are never written back to the file.
+//
+/////////////////////////////////////
+// Common Operations Supported:
+//
+// MappedFile f;
+// if(f.Open("model.mesh")) use(f.GetData(),f.GetSize());
+// f.Close();                  // Also done by the destructor
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSE167_MAPFILE_H_
+#define CSE167_MAPFILE_H_
+
+#include "core.h"
+
+/////////////////////////////////////////////////////////////////////////////
+// MappedFile
+//
+class MappedFile {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    MappedFile();
+    ~MappedFile();
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // Maps 'filename'.  Returns false (and prints why) if it can't.
+    bool Open(const char *filename);
+    void Close();
+
+    bool IsOpen() const                             {return m_Data!=0;}
+    void *GetData() const                           {return m_Data;}
+    size_t GetSize() const                          {return m_Size;}
+
+private:
+    // Not copyable
+    MappedFile(const MappedFile &);
+    MappedFile &operator=(const MappedFile &);
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    void *m_Data;
+    size_t m_Size;
+#ifdef WIN32
+    HANDLE m_File, m_Mapping;
+#endif
+};
+
+#endif
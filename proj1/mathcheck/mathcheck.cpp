@@ -0,0 +1,169 @@
+/////////////////////////////////////////////////////////////////////////////
+// mathcheck.cpp
+/////////////////////////////////////
+// Checks the math policies (see mathpolicy.h) against their documented
+// error bounds.
+//
+// Usage: mathcheck [-step N] [-vectors N]
+//
+// Rsqrt, Rcp and Sqrt of both policies are compared with double precision
+// over every positive normal float (every Nth with -step; Rcp stops short
+// of 2^126, where it is documented to underflow).  The full sweep takes a
+// few minutes.  The vector functions
+// built on FastMath are compared over random vectors (1 million unless
+// -vectors says otherwise).  Each line gives the largest error found and
+// its bound, and the exit code is 1 if any is over.
+/////////////////////////////////////////////////////////////////////////////
+
+#include "../vector.h"
+#include "../timer.h"
+#include <stdlib.h>
+#include <algorithm>
+
+// Bit patterns of the smallest positive normal float, the largest float
+// under 2^126 and the largest finite float
+#define MATHCHECK_MIN_NORMAL    0x00800000u
+#define MATHCHECK_RCP_LIMIT     0x7e7fffffu
+#define MATHCHECK_MAX_FLOAT     0x7f7fffffu
+
+static int s_Failures = 0;
+
+static float BitsToFloat(unsigned int bits)
+{
+    float f;
+    memcpy(&f,&bits,sizeof(f));
+    return f;
+}
+
+// The spacing of floats at 'd', for errors in ulps
+static double Ulp(double d)
+{
+    int exponent;
+    frexp(d,&exponent);
+    return ldexp(1.0,exponent - 24);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Report
+// Arguments:      What was checked, the largest error, its bound, the
+//                 input it was found at (negative if there isn't one) and
+//                 the unit
+// Returns:        none
+// Side Effects:   Prints a line and counts a failure if over the bound
+/////////////////////////////////////////////////////////////////////////////
+static void Report(const char *name,double error,double bound,double at,const char *unit)
+{
+    bool ok = error <= bound;
+    char where[32] = "";
+    if(at >= 0.0)
+        sprintf(where," (at %g)",at);
+    printf("%-28s max %.4g%s%s, bound %.3g%s %s\n",name,error,unit,where,bound,unit,ok ? "ok" : "OVER");
+    if(!ok)
+        s_Failures++;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Sweep
+// Arguments:      The function and its double precision reference, the
+//                 last input's bits, the step, and whether to measure in
+//                 ulps rather than relative error
+// Returns:        The largest error, with the input in 'at'
+/////////////////////////////////////////////////////////////////////////////
+template<class F,class G>
+static double Sweep(F f,G exact,unsigned int last,unsigned int step,bool ulps,double &at)
+{
+    double worst = 0.0;
+    at = 0.0;
+    for(unsigned long long bits = MATHCHECK_MIN_NORMAL; bits <= last; bits += step) {
+        float x = BitsToFloat((unsigned int)bits);
+        double d = exact((double)x);
+        double error = fabs(f(x) - d)/(ulps ? Ulp(d) : d);
+        if(!(error <= worst)) {     // Catches NaN too
+            worst = error;
+            at = x;
+        }
+    }
+    return worst;
+}
+
+static double RandomComponent()
+{
+    // Magnitudes from 2^-20 to 2^20, either sign
+    double m = ldexp(0.5 + rand()/(2.0*RAND_MAX),rand() % 41 - 20);
+    return rand() & 1 ? -m : m;
+}
+
+int main(int argc,char **argv)
+{
+    unsigned int step = 1;
+    int vectors = 1000000;
+    for(int i = 1; i + 1 < argc; i += 2) {
+        if(strcmp(argv[i],"-step") == 0)
+            step = (unsigned int)atoi(argv[i + 1]);
+        else if(strcmp(argv[i],"-vectors") == 0)
+            vectors = atoi(argv[i + 1]);
+    }
+    if(argc % 2 == 0 || step == 0 || vectors < 0) {
+        printf("Usage: mathcheck [-step N] [-vectors N]\n\
+Checks FastMath and ExactMath against the error bounds in mathpolicy.h\n");
+        return 1;
+    }
+
+    Timer t;
+    double at, error;
+    error = Sweep([](float x) {return FastMath::Rsqrt(x);},[](double x) {return 1.0/sqrt(x);},
+                  MATHCHECK_MAX_FLOAT,step,false,at);
+    Report("FastMath::Rsqrt",error,MATH_FAST_RSQRT_ERROR,at,"");
+    error = Sweep([](float x) {return FastMath::Rcp(x);},[](double x) {return 1.0/x;},
+                  MATHCHECK_RCP_LIMIT,step,false,at);
+    Report("FastMath::Rcp",error,MATH_FAST_RCP_ERROR,at,"");
+    error = Sweep([](float x) {return FastMath::Sqrt(x);},[](double x) {return sqrt(x);},
+                  MATHCHECK_MAX_FLOAT,step,false,at);
+    Report("FastMath::Sqrt",error,MATH_FAST_SQRT_ERROR,at,"");
+
+    error = Sweep([](float x) {return ExactMath::Rsqrt(x);},[](double x) {return 1.0/sqrt(x);},
+                  MATHCHECK_MAX_FLOAT,step,true,at);
+    Report("ExactMath::Rsqrt",error,MATH_EXACT_RSQRT_ULPS,at," ulp");
+    error = Sweep([](float x) {return ExactMath::Rcp(x);},[](double x) {return 1.0/x;},
+                  MATHCHECK_RCP_LIMIT,step,true,at);
+    Report("ExactMath::Rcp",error,MATH_EXACT_ULPS,at," ulp");
+    error = Sweep([](float x) {return ExactMath::Sqrt(x);},[](double x) {return sqrt(x);},
+                  MATHCHECK_MAX_FLOAT,step,true,at);
+    Report("ExactMath::Sqrt",error,MATH_EXACT_ULPS,at," ulp");
+
+    // FastMath's special cases
+    bool zero = FastMath::Sqrt(0.0f) == 0.0f;
+    printf("%-28s %s\n","FastMath::Sqrt(0) == 0",zero ? "ok" : "FAILED");
+    s_Failures += !zero;
+
+    // The vector functions, on random vectors
+    srand(1);
+    double normalize = 0.0, mag = 0.0, dist = 0.0, divide = 0.0;
+    for(int i = 0; i < vectors; i++) {
+        Vector3 v((float)RandomComponent(),(float)RandomComponent(),(float)RandomComponent());
+        double vx = v.x, vy = v.y, vz = v.z;
+        double length = sqrt(vx*vx + vy*vy + vz*vz);
+
+        Vector3 n = v;
+        n.Normalize<FastMath>();
+        double nx = n.x, ny = n.y, nz = n.z;
+        normalize = std::max(normalize,fabs(sqrt(nx*nx + ny*ny + nz*nz) - 1.0));
+        mag = std::max(mag,fabs(v.Mag<FastMath>() - length)/length);
+
+        Point3 p(v.x,v.y,v.z), origin(0,0,0);
+        dist = std::max(dist,fabs(p.Dist<FastMath>(origin) - length)/length);
+
+        float f = (float)RandomComponent();
+        Vector3 q = Divide<FastMath>(v,f);
+        divide = std::max(divide,fabs(q.x - vx/f)/fabs(vx/f));
+        divide = std::max(divide,fabs(q.y - vy/f)/fabs(vy/f));
+        divide = std::max(divide,fabs(q.z - vz/f)/fabs(vz/f));
+    }
+    Report("Vector3::Normalize<FastMath>",normalize,MATH_FAST_NORMALIZE_ERROR,-1.0,"");
+    Report("Vector3::Mag<FastMath>",mag,MATH_FAST_MAG_ERROR,-1.0,"");
+    Report("Point3::Dist<FastMath>",dist,MATH_FAST_MAG_ERROR,-1.0,"");
+    Report("Divide<FastMath>",divide,MATH_FAST_DIVIDE_ERROR,-1.0,"");
+
+    printf("%d checks over their bounds, %.1f s\n",s_Failures,t.GetMs()/1000.0);
+    return s_Failures ? 1 : 0;
+}
@@ -31,29 +31,13 @@
 
 
 #include "matrix.h"
+#include "simd.h"
 
-Matrix Matrix::IDENTITY(1.0f,0.0f,0.0f,0.0f,
-                        0.0f,1.0f,0.0f,0.0f,
-                        0.0f,0.0f,1.0f,0.0f,
-                        0.0f,0.0f,0.0f,1.0f);
-
-/////////////////////////////////////////////////////////////////////////////
-// Name:           Matrix constructor
-// Arguments:      16 float values
-// Returns:        none
-// Side Effects:   Sets this matrix to the provided 16 values  
-// Notes:          For convenience the 16 entries are provided in row order.
-/////////////////////////////////////////////////////////////////////////////
-Matrix::Matrix(float m0, float m4, float m8,  float m12,  // First Row
-               float m1, float m5, float m9,  float m13,  // Second Row
-               float m2, float m6, float m10, float m14,  // Third Row
-               float m3, float m7, float m11, float m15)  // Fourth Row
-{
-    Set(m0,m4,m8, m12,
-        m1,m5,m9, m13,
-        m2,m6,m10,m14,
-        m3,m7,m11,m15);
-}
+// The constexpr constructor makes this a compile time constant
+const Matrix Matrix::IDENTITY(1.0f,0.0f,0.0f,0.0f,
+                              0.0f,1.0f,0.0f,0.0f,
+                              0.0f,0.0f,1.0f,0.0f,
+                              0.0f,0.0f,0.0f,1.0f);
 
 /////////////////////////////////////////////////////////////////////////////
 // Name:           Matrix constructor
@@ -134,22 +118,43 @@ void Matrix::Set(const Vector3 &a, const Vector3 &b, const Vector3 &c, const Poi
 /////////////////////////////////////////////////////////////////////////////
 void Matrix::Multiply(const Matrix &m,const Matrix &n) {
 
-	//Identity();
-	m_m[0] = 0.0f;
-	m_m[5] = 0.0f;
-	m_m[10] = 0.0f;
-	m_m[15] = 0.0f;
+	float tmp[16];
+	MatrixMultiply(tmp,m.m_m,n.m_m);
+	memcpy(m_m,tmp,16*sizeof(float));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           MatrixMultiply
+// Arguments:      Output and the two column major matrices to multiply
+// Returns:        none
+// Side Effects:   Sets 'out' to a (dot) b
+// Notes:          Column j of the result is the columns of 'a' weighted by
+//                 the entries of column j of 'b', which is four multiply-adds
+//                 of whole columns with SSE.
+/////////////////////////////////////////////////////////////////////////////
+void MatrixMultiply(float *out,const float *a,const float *b)
+{
+#ifdef CSE167_SSE
+	__m128 a0 = _mm_loadu_ps(a), a1 = _mm_loadu_ps(a+4);
+	__m128 a2 = _mm_loadu_ps(a+8), a3 = _mm_loadu_ps(a+12);
+	for(int j=0; j<4; j++)
+	{
+		const float *bj = b + j*4;
+		__m128 c = _mm_mul_ps(a0,_mm_set1_ps(bj[0]));
+		c = _mm_add_ps(c,_mm_mul_ps(a1,_mm_set1_ps(bj[1])));
+		c = _mm_add_ps(c,_mm_mul_ps(a2,_mm_set1_ps(bj[2])));
+		c = _mm_add_ps(c,_mm_mul_ps(a3,_mm_set1_ps(bj[3])));
+		_mm_storeu_ps(out + j*4,c);
+	}
+#else
 	for(int i=0; i<4; i++)
 	{
 		for(int j=0; j<4; j++)
 		{
-			for(int k=0; k<4; k++)
-			{
-		    	m_m[i+j*4] += m.m_m[i+k*4] * n.m_m[j*4+k]; 
-			}
+			out[i+j*4] = a[i]*b[j*4] + a[i+4]*b[j*4+1] + a[i+8]*b[j*4+2] + a[i+12]*b[j*4+3];
 		}
 	}
-
+#endif
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -382,9 +387,32 @@ void Matrix::Translate(const Vector3 &v)
 /////////////////////////////////////////////////////////////////////////////
 void Matrix::TransformFull(const Point3 &in, Point3 &out) const 
 {
+    float x = m_m[0]*in.x + m_m[4]*in.y + m_m[8]*in.z  + m_m[12];
+    float y = m_m[1]*in.x + m_m[5]*in.y + m_m[9]*in.z  + m_m[13];
+    float z = m_m[2]*in.x + m_m[6]*in.y + m_m[10]*in.z + m_m[14];
+    float w = m_m[3]*in.x + m_m[7]*in.y + m_m[11]*in.z + m_m[15];
+    float invW = 1.0f/w;
+    out.x = x*invW;
+    out.y = y*invW;
+    out.z = z*invW;
+}
 
-  // Not needed for Proj 1.  Wait until we reach perspective projections.
-	out = in;
+/////////////////////////////////////////////////////////////////////////////
+// Name:           MakePerspective
+// Arguments:      Vertical field of view in radians, aspect ratio (w/h) and
+//                 the distances to the near and far clipping planes
+// Returns:        none
+// Side Effects:   Makes this matrix the same perspective projection that
+//                 gluPerspective builds.  Clip space z maps [-near,-far] to
+//                 [-1,1] after the homogeneous divide.
+/////////////////////////////////////////////////////////////////////////////
+void Matrix::MakePerspective(float fovy,float aspect,float znear,float zfar)
+{
+    float f = 1.0f/tanf(0.5f*fovy);
+    Set(f/aspect, 0.0f, 0.0f,                        0.0f,
+        0.0f,     f,    0.0f,                        0.0f,
+        0.0f,     0.0f, (zfar+znear)/(znear-zfar),   2.0f*zfar*znear/(znear-zfar),
+        0.0f,     0.0f, -1.0f,                       0.0f);
 }
 
 
@@ -409,6 +437,46 @@ void Matrix::Transpose() {
 
 
 
+/////////////////////////////////////////////////////////////////////////////
+// Name:           InvertAffine
+// Arguments:      none
+// Returns:        false if the upper 3x3 is singular
+// Side Effects:   Replaces the current matrix with its inverse.  The bottom
+//                 row is taken to be 0,0,0,1.
+/////////////////////////////////////////////////////////////////////////////
+bool Matrix::InvertAffine() {
+    const float *m = m_m;
+    // Cofactors of the upper 3x3, as the rows of its adjugate
+    float c0 = m[5]*m[10] - m[9]*m[6];
+    float c1 = m[9]*m[2]  - m[1]*m[10];
+    float c2 = m[1]*m[6]  - m[5]*m[2];
+    float det = m[0]*c0 + m[4]*c1 + m[8]*c2;
+    if(det == 0.0f)
+        return false;
+    float r = 1.0f/det;
+
+    float inv[16];
+    inv[0]  = c0*r;
+    inv[1]  = c1*r;
+    inv[2]  = c2*r;
+    inv[4]  = (m[8]*m[6]  - m[4]*m[10])*r;
+    inv[5]  = (m[0]*m[10] - m[8]*m[2])*r;
+    inv[6]  = (m[4]*m[2]  - m[0]*m[6])*r;
+    inv[8]  = (m[4]*m[9]  - m[8]*m[5])*r;
+    inv[9]  = (m[8]*m[1]  - m[0]*m[9])*r;
+    inv[10] = (m[0]*m[5]  - m[4]*m[1])*r;
+    // Translation is -inverse(3x3) * d
+    inv[12] = -(inv[0]*m[12] + inv[4]*m[13] + inv[8]*m[14]);
+    inv[13] = -(inv[1]*m[12] + inv[5]*m[13] + inv[9]*m[14]);
+    inv[14] = -(inv[2]*m[12] + inv[6]*m[13] + inv[10]*m[14]);
+    inv[3] = inv[7] = inv[11] = 0.0f;
+    inv[15] = 1.0f;
+    Set(inv);
+    return true;
+}
+
+
+
 /////////////////////////////////////////////////////////////////////////////
 // Name:           Print
 // Arguments:      string for debugging information
@@ -36,6 +36,21 @@
 // ma.Transform(q,p);    // Matrix-Point Multiply   p = ma * q
 // ma = mb * mc;         // Matrix-Matrix Multiply  ma = mb * mc
 // ma.Multiply(mb, mc);  // Matrix-Matrix Multiply  ma = mb * mc
+// ma = mb * mc * md;    // Chains are evaluated in one pass (see below)
+// p = mb * mc * q;      // Transforms q by mc then mb, with no matrix product
+//
+// Matrix products are expression templates: 'mb * mc' doesn't compute
+// anything, it returns a MatrixProduct that refers to both operands, and the
+// work happens when the whole chain is used.  Assigned to a Matrix, it costs
+// one product per '*', each written in turn to the destination or one
+// scratch matrix, so a chain of any length needs only those two.  Applied
+// to a point or vector, it costs one transform per matrix, right to left,
+// and no products at all.  Since a MatrixProduct only holds references,
+// never keep one past the end of the expression (e.g. with 'auto'); assign
+// it to a Matrix.
+//
+// The constructors are constexpr, so constant matrices like IDENTITY are
+// built at compile time.
 //
 // 
 ///////////////////////////////////// 
@@ -50,6 +65,10 @@
 
 #include "vector.h"
 
+template<class L,class R> class MatrixProduct;
+
+// out = a * b for column major 4x4 matrices.  'out' may not be 'a' or 'b'.
+void MatrixMultiply(float *out,const float *a,const float *b);
 
 /////////////////////////////////////////////////////////////////////////////
 // Matrix
@@ -60,13 +79,22 @@ class Matrix {
 // Constructors/Destructors
 //
 public:
-    Matrix() {Identity();}
-    Matrix(float m0, float m4, float m8,  float m12,  // First Row
-           float m1, float m5, float m9,  float m13,  // Second Row
-           float m2, float m6, float m10, float m14,  // Third Row
-           float m3, float m7, float m11, float m15); // Fourth Row
+    constexpr Matrix() : m_m{1.0f,0.0f,0.0f,0.0f, 0.0f,1.0f,0.0f,0.0f,
+                             0.0f,0.0f,1.0f,0.0f, 0.0f,0.0f,0.0f,1.0f} {}
+    // For convenience the 16 entries are provided in row order
+    constexpr Matrix(float m0, float m4, float m8,  float m12,  // First Row
+                     float m1, float m5, float m9,  float m13,  // Second Row
+                     float m2, float m6, float m10, float m14,  // Third Row
+                     float m3, float m7, float m11, float m15)  // Fourth Row
+        : m_m{m0,m1,m2,m3, m4,m5,m6,m7, m8,m9,m10,m11, m12,m13,m14,m15} {}
     Matrix(const Vector3 &a, const Vector3 &b, const Vector3 &c, const Point3 &d);
 
+    // Evaluates a product chain directly into this matrix
+    template<class L,class R> Matrix(const MatrixProduct<L,R> &e) {
+        float scratch[16];
+        e.Eval(m_m,scratch);
+    }
+
 ////////////////////////////////
 // Local Procedures
 //  
@@ -121,7 +149,13 @@ public:
     // Full 16 pt Matrix Transform (post-multiplying)
     void TransformFull(const Point3 &in, Point3 &out) const;
 
+    // MakePerspective (NOTE: fovy is an angle in RADIANS)
+    void MakePerspective(float fovy,float aspect,float znear,float zfar);
+
     void Transpose();
+    // Inverts an affine matrix in place.  Returns false (and leaves it
+    // unchanged) if it is singular.
+    bool InvertAffine();
     void Print(const char *s=0) const;
 ////////////////////////////////
 // Overloaded Operators
@@ -133,17 +167,100 @@ public:
     // The following operators use the OPTIMIZED versions of the Transform function, 
     Vector3 operator*(const Vector3 &v) const       {Vector3 out; Transform(v,out); return out;}
     Point3  operator*(const Point3  &p) const       {Point3  out; Transform(p,out); return out;}
-    Matrix  operator*(const Matrix &m) const        {Matrix n; n.Multiply(*this,m); return n;}
+    MatrixProduct<Matrix,Matrix> operator*(const Matrix &m) const;
+    template<class L,class R> MatrixProduct<Matrix,MatrixProduct<L,R> > operator*(const MatrixProduct<L,R> &m) const;
+
+    // Evaluates a product chain straight into this matrix, unless the
+    // chain refers to it (as in 'ma = ma * mb'); then into a temporary
+    // first
+    template<class L,class R> Matrix &operator=(const MatrixProduct<L,R> &e) {
+        float scratch[16];
+        if(!e.Refers(this))
+            e.Eval(m_m,scratch);
+        else {
+            float tmp[16];
+            e.Eval(tmp,scratch);
+            memcpy(m_m,tmp,16*sizeof(float));
+        }
+        return *this;
+    }
+
+    // Expression template leaf: a matrix evaluates to its own entries,
+    // without touching either buffer
+    const float *Eval(float *,float *) const        {return m_m;}
+    bool Refers(const Matrix *m) const              {return m == this;}
 
 ////////////////////////////////
 // Overloaded Operators
 //
 public:
     // Static matrices
-    static Matrix IDENTITY;
+    static const Matrix IDENTITY;
 
 public:
     float m_m[16];
 };
 
+/////////////////////////////////////////////////////////////////////////////
+// MatrixProduct
+//
+// The unevaluated product L * R, where L and R are each a Matrix or another
+// MatrixProduct.
+//
+template<class L,class R>
+class MatrixProduct {
+public:
+    MatrixProduct(const L &l,const R &r) : m_L(l), m_R(r) {}
+
+    // Computes the product into 'dst' and returns it.  The left operand is
+    // evaluated into 'scratch' with 'dst' as its scratch, and so on down
+    // the chain, so the two buffers take turns and nothing else is used.
+    // A right operand that is itself a product (only from explicit
+    // parentheses, as in 'ma * (mb * mc)') needs buffers of its own.
+    const float *Eval(float *dst,float *scratch) const {
+        const float *l = m_L.Eval(scratch,dst);
+        MultiplyRight(dst,l,m_R);
+        return dst;
+    }
+
+    // Whether any matrix in the chain is 'm'
+    bool Refers(const Matrix *m) const              {return m_L.Refers(m) || m_R.Refers(m);}
+
+    // Chains keep growing to the right
+    MatrixProduct<MatrixProduct,Matrix> operator*(const Matrix &m) const {
+        return MatrixProduct<MatrixProduct,Matrix>(*this,m);
+    }
+    template<class A,class B> MatrixProduct<MatrixProduct,MatrixProduct<A,B> > operator*(const MatrixProduct<A,B> &m) const {
+        return MatrixProduct<MatrixProduct,MatrixProduct<A,B> >(*this,m);
+    }
+
+    // Applying the chain to a point or vector transforms it by each matrix
+    // in turn, right to left
+    Point3 operator*(const Point3 &p) const         {return m_L*(m_R*p);}
+    Vector3 operator*(const Vector3 &v) const       {return m_L*(m_R*v);}
+
+private:
+    static void MultiplyRight(float *dst,const float *l,const Matrix &r) {
+        MatrixMultiply(dst,l,r.m_m);
+    }
+    template<class A,class B> static void MultiplyRight(float *dst,const float *l,const MatrixProduct<A,B> &r) {
+        float rt[16], scratch[16];
+        MatrixMultiply(dst,l,r.Eval(rt,scratch));
+    }
+
+    const L &m_L;
+    const R &m_R;
+};
+
+inline MatrixProduct<Matrix,Matrix> Matrix::operator*(const Matrix &m) const
+{
+    return MatrixProduct<Matrix,Matrix>(*this,m);
+}
+
+template<class L,class R>
+inline MatrixProduct<Matrix,MatrixProduct<L,R> > Matrix::operator*(const MatrixProduct<L,R> &m) const
+{
+    return MatrixProduct<Matrix,MatrixProduct<L,R> >(*this,m);
+}
+
 #endif
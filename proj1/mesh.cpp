@@ -0,0 +1,454 @@
+/////////////////////////////////////////////////////////////////////////////
+// mesh.cpp
+/////////////////////////////////////
+// Indexed triangle meshes stored in the binary mesh file layout, loaded
+// either by memory mapping a binary file or by importing an OBJ file.
+/////////////////////////////////////////////////////////////////////////////
+
+#include "mesh.h"
+#include <float.h>
+#include <vector>
+#include <unordered_map>
+
+static inline unsigned int AlignUp(unsigned int n,unsigned int a)   {return (n + a-1) & ~(a-1);}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Mesh constructor/destructor
+/////////////////////////////////////////////////////////////////////////////
+Mesh::Mesh()
+{
+    m_Header = 0;
+    m_Data = 0;
+    m_Alloc = 0;
+}
+
+Mesh::~Mesh()
+{
+    Free();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Free
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Releases the mesh data, owned or mapped
+/////////////////////////////////////////////////////////////////////////////
+void Mesh::Free()
+{
+    delete[] m_Alloc;
+    m_File.Close();
+    m_Alloc = 0;
+    m_Data = 0;
+    m_Header = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Create
+// Arguments:      Number of vertices, number of indices (3 per triangle),
+//                 and whether to reserve space for normals
+// Returns:        none
+// Side Effects:   Replaces the mesh with a zeroed one of the given size,
+//                 laid out exactly as the binary file will be.
+/////////////////////////////////////////////////////////////////////////////
+void Mesh::Create(int vertexCount,int indexCount,bool normals)
+{
+    Free();
+
+    unsigned int stride = AlignUp(vertexCount,MESH_ALIGN/sizeof(float));
+    unsigned int attribBytes = 3*stride*sizeof(float);
+    unsigned int offset = AlignUp(sizeof(MeshFileHeader),MESH_ALIGN);
+
+    MeshFileHeader h;
+    memset(&h,0,sizeof(h));
+    memcpy(h.Magic,"MESH",4);
+    h.Version = MESH_FILE_VERSION;
+    h.VertexCount = vertexCount;
+    h.VertexStride = stride;
+    h.IndexCount = indexCount;
+    h.Flags = normals ? MESH_HAS_NORMALS : 0;
+    h.PositionOffset = offset;
+    offset += attribBytes;
+    if(normals) {
+        h.NormalOffset = offset;
+        offset += attribBytes;
+    }
+    h.IndexOffset = offset;
+    offset += AlignUp(indexCount*sizeof(unsigned int),MESH_ALIGN);
+    h.FileSize = offset;
+
+    m_Alloc = new char[h.FileSize + MESH_ALIGN];
+    m_Data = m_Alloc + (MESH_ALIGN - ((size_t)m_Alloc & (MESH_ALIGN-1)));
+    memset(m_Data,0,h.FileSize);
+    memcpy(m_Data,&h,sizeof(h));
+    m_Header = (MeshFileHeader*)m_Data;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Load
+// Arguments:      Name of a binary mesh file
+// Returns:        true on success
+// Side Effects:   Maps the file and uses it in place.  The header is
+//                 checked, and every index against the vertex count; the
+//                 attribute pages are not touched until they are used.
+// Notes:          Offsets and sizes are added up in 64 bits, so a hostile
+//                 header can't wrap them around on a 32 bit build.
+/////////////////////////////////////////////////////////////////////////////
+bool Mesh::Load(const char *filename)
+{
+    Free();
+    if(!m_File.Open(filename))
+        return false;
+
+    const MeshFileHeader *h = (const MeshFileHeader*)m_File.GetData();
+    size_t size = m_File.GetSize();
+    if(size < sizeof(MeshFileHeader)) {
+        printf("Mesh::Load: '%s' is too small to be a mesh file\n",filename);
+        m_File.Close();
+        return false;
+    }
+    unsigned long long attribBytes = 3ULL*h->VertexStride*sizeof(float);
+    unsigned long long indexBytes = (unsigned long long)h->IndexCount*sizeof(unsigned int);
+    bool ok = memcmp(h->Magic,"MESH",4) == 0 &&
+              h->Version == MESH_FILE_VERSION &&
+              h->FileSize <= size &&
+              h->VertexStride >= h->VertexCount &&
+              h->VertexStride % (MESH_ALIGN/sizeof(float)) == 0 &&
+              h->IndexCount % 3 == 0 &&
+              h->PositionOffset % MESH_ALIGN == 0 &&
+              h->NormalOffset % MESH_ALIGN == 0 &&
+              h->IndexOffset % MESH_ALIGN == 0 &&
+              h->PositionOffset + attribBytes <= h->FileSize &&
+              (!(h->Flags & MESH_HAS_NORMALS) || h->NormalOffset + attribBytes <= h->FileSize) &&
+              h->IndexOffset + indexBytes <= h->FileSize;
+    const unsigned int *indices = (const unsigned int*)((const char*)h + h->IndexOffset);
+    for(unsigned int i = 0; ok && i < h->IndexCount; i++)
+        ok = indices[i] < h->VertexCount;
+    if(!ok) {
+        printf("Mesh::Load: '%s' is not a valid mesh file\n",filename);
+        m_File.Close();
+        return false;
+    }
+
+    m_Data = (char*)m_File.GetData();
+    m_Header = (MeshFileHeader*)m_Data;
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Save
+// Arguments:      Name of the binary mesh file to write
+// Returns:        true on success
+// Notes:          The in-memory layout is the file layout, so this is a
+//                 single write.
+/////////////////////////////////////////////////////////////////////////////
+bool Mesh::Save(const char *filename) const
+{
+    if(!m_Header) {
+        printf("Mesh::Save: mesh is empty\n");
+        return false;
+    }
+    FILE *f = fopen(filename,"wb");
+    if(!f) {
+        printf("Mesh::Save: can't open '%s'\n",filename);
+        return false;
+    }
+    bool ok = fwrite(m_Data,1,m_Header->FileSize,f) == m_Header->FileSize;
+    ok = (fclose(f) == 0) && ok;
+    if(!ok)
+        printf("Mesh::Save: error writing '%s'\n",filename);
+    return ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           ParseOBJIndex
+// Arguments:      Pointer into a face line, and the number of positions and
+//                 normals read so far
+// Returns:        Pointer past the vertex reference, or 0 if there is none.
+//                 'v' and 'vn' get zero based indices, 'vn' is -1 if the
+//                 reference has no normal and -2 if it names one before
+//                 the first (0, or too far back).
+// Notes:          Handles "v", "v/vt", "v//vn" and "v/vt/vn", with negative
+//                 (relative) indices.
+/////////////////////////////////////////////////////////////////////////////
+static const char *ParseOBJIndex(const char *s,int numPos,int numNrm,int &v,int &vn)
+{
+    while(*s == ' ' || *s == '\t') s++;
+    char *end;
+    long i = strtol(s,&end,10);
+    if(end == s)
+        return 0;
+    v = i < 0 ? numPos + (int)i : (int)i - 1;
+    vn = -1;
+    s = end;
+    if(*s == '/') {
+        s++;
+        if(*s != '/') {
+            strtol(s,&end,10);  // Texture coordinates are not used
+            s = end;
+        }
+        if(*s == '/') {
+            s++;
+            i = strtol(s,&end,10);
+            if(end != s) {
+                vn = i < 0 ? numNrm + (int)i : (int)i - 1;
+                if(vn < 0)
+                    vn = -2;
+            }
+            s = end;
+        }
+    }
+    return s;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           LoadOBJ
+// Arguments:      Name of a Wavefront OBJ file
+// Returns:        true on success
+// Side Effects:   Replaces the mesh with the triangles in the file.
+// Notes:          Polygons are triangulated as fans.  OBJ indexes positions
+//                 and normals separately, so each distinct (position,normal)
+//                 pair becomes one vertex.  If the file has no normals they
+//                 are computed from the triangles.
+/////////////////////////////////////////////////////////////////////////////
+bool Mesh::LoadOBJ(const char *filename)
+{
+    Free();
+    FILE *f = fopen(filename,"r");
+    if(!f) {
+        printf("Mesh::LoadOBJ: can't open '%s'\n",filename);
+        return false;
+    }
+
+    std::vector<Point3> positions;
+    std::vector<Vector3> normals;
+    std::vector<int> vertPos, vertNrm;          // Source of each output vertex
+    std::vector<unsigned int> indices;
+    std::unordered_map<unsigned long long,unsigned int> vertMap;
+    std::vector<unsigned int> face;
+    bool ok = true;
+    int lineNum = 0;
+    char line[1024];
+
+    while(ok && fgets(line,sizeof(line),f)) {
+        lineNum++;
+        // A line that doesn't fit would be read as several records
+        size_t len = strlen(line);
+        if(len == sizeof(line)-1 && line[len-1] != '\n' && !feof(f)) {
+            fclose(f);
+            printf("Mesh::LoadOBJ: '%s' line %d is longer than %d characters\n",filename,lineNum,(int)sizeof(line)-2);
+            return false;
+        }
+        const char *s = line;
+        while(*s == ' ' || *s == '\t') s++;
+
+        if(s[0] == 'v' && (s[1] == ' ' || s[1] == '\t')) {
+            Point3 p;
+            if(sscanf(s+2,"%f %f %f",&p.x,&p.y,&p.z) != 3) ok = false;
+            positions.push_back(p);
+        }
+        else if(s[0] == 'v' && s[1] == 'n' && (s[2] == ' ' || s[2] == '\t')) {
+            Vector3 n;
+            if(sscanf(s+3,"%f %f %f",&n.x,&n.y,&n.z) != 3) ok = false;
+            normals.push_back(n);
+        }
+        else if(s[0] == 'f' && (s[1] == ' ' || s[1] == '\t')) {
+            face.clear();
+            int v, vn;
+            s += 2;
+            while((s = ParseOBJIndex(s,(int)positions.size(),(int)normals.size(),v,vn)) != 0) {
+                if(v < 0 || v >= (int)positions.size() || vn < -1 || vn >= (int)normals.size()) {
+                    ok = false;
+                    break;
+                }
+                unsigned long long key = ((unsigned long long)v << 32) | (unsigned int)(vn+1);
+                std::unordered_map<unsigned long long,unsigned int>::iterator it = vertMap.find(key);
+                if(it == vertMap.end()) {
+                    it = vertMap.insert(std::make_pair(key,(unsigned int)vertPos.size())).first;
+                    vertPos.push_back(v);
+                    vertNrm.push_back(vn);
+                }
+                face.push_back(it->second);
+            }
+            if(face.size() < 3)
+                ok = false;
+            for(size_t i = 2; ok && i < face.size(); i++) {
+                indices.push_back(face[0]);
+                indices.push_back(face[i-1]);
+                indices.push_back(face[i]);
+            }
+        }
+        // Everything else (vt, g, o, s, usemtl, mtllib, comments) is skipped
+    }
+    fclose(f);
+
+    if(!ok) {
+        printf("Mesh::LoadOBJ: '%s' line %d is malformed\n",filename,lineNum);
+        return false;
+    }
+    if(indices.empty()) {
+        printf("Mesh::LoadOBJ: '%s' has no faces\n",filename);
+        return false;
+    }
+
+    bool hasNormals = true;
+    for(size_t i = 0; i < vertNrm.size(); i++) {
+        if(vertNrm[i] < 0) {
+            hasNormals = false;
+            break;
+        }
+    }
+
+    Create((int)vertPos.size(),(int)indices.size(),true);
+    for(size_t i = 0; i < vertPos.size(); i++) {
+        SetPosition((int)i,positions[vertPos[i]]);
+        if(hasNormals)
+            SetNormal((int)i,normals[vertNrm[i]]);
+    }
+    memcpy(GetIndices(),&indices[0],indices.size()*sizeof(unsigned int));
+
+    ComputeBounds();
+    if(!hasNormals)
+        ComputeNormals();
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           SaveOBJ
+// Arguments:      Name of the OBJ file to write
+// Returns:        true on success
+/////////////////////////////////////////////////////////////////////////////
+bool Mesh::SaveOBJ(const char *filename) const
+{
+    if(!m_Header) {
+        printf("Mesh::SaveOBJ: mesh is empty\n");
+        return false;
+    }
+    FILE *f = fopen(filename,"w");
+    if(!f) {
+        printf("Mesh::SaveOBJ: can't open '%s'\n",filename);
+        return false;
+    }
+
+    int numVerts = GetVertexCount();
+    const float *x = GetX(), *y = GetY(), *z = GetZ();
+    for(int i = 0; i < numVerts; i++)
+        fprintf(f,"v %.9g %.9g %.9g\n",x[i],y[i],z[i]);
+    if(HasNormals()) {
+        const float *nx = GetNX(), *ny = GetNY(), *nz = GetNZ();
+        for(int i = 0; i < numVerts; i++)
+            fprintf(f,"vn %.9g %.9g %.9g\n",nx[i],ny[i],nz[i]);
+    }
+
+    const unsigned int *idx = GetIndices();
+    for(int i = 0; i < GetIndexCount(); i += 3) {
+        if(HasNormals())
+            fprintf(f,"f %u//%u %u//%u %u//%u\n",idx[i]+1,idx[i]+1,idx[i+1]+1,idx[i+1]+1,idx[i+2]+1,idx[i+2]+1);
+        else
+            fprintf(f,"f %u %u %u\n",idx[i]+1,idx[i+1]+1,idx[i+2]+1);
+    }
+
+    bool ok = !ferror(f);
+    ok = (fclose(f) == 0) && ok;
+    if(!ok)
+        printf("Mesh::SaveOBJ: error writing '%s'\n",filename);
+    return ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           ComputeBounds
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Sets the header bounds to the box around all positions
+/////////////////////////////////////////////////////////////////////////////
+void Mesh::ComputeBounds()
+{
+    int n = GetVertexCount();
+    const float *x = GetX(), *y = GetY(), *z = GetZ();
+    float lo[3] = {FLT_MAX,FLT_MAX,FLT_MAX}, hi[3] = {-FLT_MAX,-FLT_MAX,-FLT_MAX};
+    for(int i = 0; i < n; i++) {
+        if(x[i] < lo[0]) lo[0] = x[i];
+        if(x[i] > hi[0]) hi[0] = x[i];
+        if(y[i] < lo[1]) lo[1] = y[i];
+        if(y[i] > hi[1]) hi[1] = y[i];
+        if(z[i] < lo[2]) lo[2] = z[i];
+        if(z[i] > hi[2]) hi[2] = z[i];
+    }
+    if(n == 0) {
+        lo[0] = lo[1] = lo[2] = 0.0f;
+        hi[0] = hi[1] = hi[2] = 0.0f;
+    }
+    memcpy(m_Header->BoundsMin,lo,sizeof(lo));
+    memcpy(m_Header->BoundsMax,hi,sizeof(hi));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           ComputeNormals
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Sets every vertex normal to the normalized sum of the
+//                 (area weighted) normals of the triangles using it.
+//                 Vertices not used by any triangle get a zero normal.
+// Notes:          The mesh must have been created with normals.
+/////////////////////////////////////////////////////////////////////////////
+void Mesh::ComputeNormals()
+{
+    if(!HasNormals())
+        return;
+
+    int n = GetVertexCount();
+    float *nx = GetNX(), *ny = GetNY(), *nz = GetNZ();
+    memset(nx,0,n*sizeof(float));
+    memset(ny,0,n*sizeof(float));
+    memset(nz,0,n*sizeof(float));
+
+    const unsigned int *idx = GetIndices();
+    for(int i = 0; i < GetIndexCount(); i += 3) {
+        Point3 a = GetPosition(idx[i]), b = GetPosition(idx[i+1]), c = GetPosition(idx[i+2]);
+        Vector3 fn;
+        fn.Cross(b-a,c-a);  // Length is twice the area
+        for(int k = 0; k < 3; k++) {
+            nx[idx[i+k]] += fn.x;
+            ny[idx[i+k]] += fn.y;
+            nz[idx[i+k]] += fn.z;
+        }
+    }
+
+    for(int i = 0; i < n; i++) {
+        Vector3 v(nx[i],ny[i],nz[i]);
+        if(v.MagSq() > 0.0f)
+            v.Normalize<FastMath>();
+        SetNormal(i,v);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Draw
+// Arguments:      A transformation to apply to the mesh before drawing
+// Returns:        none
+// Side Effects:   Draws the mesh as OpenGL triangles in the current color.
+// Notes:          The transform is applied on the GL modelview stack rather
+//                 than per vertex as drawCube does, since meshes can be big.
+/////////////////////////////////////////////////////////////////////////////
+void Mesh::Draw(const Matrix &mTransform) const
+{
+    if(!m_Header)
+        return;
+
+    const float *x = GetX(), *y = GetY(), *z = GetZ();
+    const float *nx = HasNormals() ? GetNX() : 0;
+    const float *ny = HasNormals() ? GetNY() : 0;
+    const float *nz = HasNormals() ? GetNZ() : 0;
+    const unsigned int *idx = GetIndices();
+
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glMultMatrixf(mTransform.m_m);
+    glBegin(GL_TRIANGLES);
+    for(int i = 0; i < GetIndexCount(); i++) {
+        unsigned int v = idx[i];
+        if(nx) glNormal3f(nx[v],ny[v],nz[v]);
+        glVertex3f(x[v],y[v],z[v]);
+    }
+    glEnd();
+    glPopMatrix();
+}
@@ -0,0 +1,146 @@
+/////////////////////////////////////////////////////////////////////////////
+// mesh.h
+//
+/////////////////////////////////////
+// Classes declared:
+//
+// MeshFileHeader: The first 64 bytes of a binary mesh file.
+//
+// Mesh: An indexed triangle mesh with positions and (optionally) normals.
+//       The data is kept in exactly the layout of the binary file, so a
+//       binary mesh is loaded by mapping the file into memory: there is no
+//       parsing and nothing is copied.  Meshes can also be imported from
+//       Wavefront OBJ files and saved back out in either format.
+//
+/////////////////////////////////////
+// Binary Layout:
+//
+//   offset 0                 MeshFileHeader (64 bytes)
+//   PositionOffset           x[VertexStride], y[VertexStride], z[VertexStride]
+//   NormalOffset             nx[VertexStride], ny[VertexStride], nz[VertexStride]
+//   IndexOffset              unsigned int indices[IndexCount]
+//
+// Attributes are stored structure-of-arrays.  VertexStride is VertexCount
+// rounded up to a multiple of 16, so every array starts on a 64 byte
+// boundary and SIMD code can run over whole groups of vertices without a
+// scalar tail.  Padding entries are zero.  All values are little endian.
+// NormalOffset is 0 when the mesh has no normals.
+//
+/////////////////////////////////////
+// Common Operations Supported:
+//
+// Mesh m;
+// m.LoadOBJ("model.obj");     // Parse a text OBJ file
+// m.Save("model.mesh");       // Write the binary format
+// m.Load("model.mesh");       // Memory map the binary format
+// m.Create(nverts,nindices,true);  // Allocate an empty mesh to fill in
+// float *x = m.GetX();        // SoA position arrays
+// m.Draw(mTransform);         // Draw with OpenGL
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSE167_MESH_H_
+#define CSE167_MESH_H_
+
+#include "matrix.h"
+#include "mapfile.h"
+
+#define MESH_FILE_VERSION   1
+#define MESH_ALIGN          64      // Alignment of every array, in bytes
+#define MESH_HAS_NORMALS    0x1     // MeshFileHeader::Flags
+
+/////////////////////////////////////////////////////////////////////////////
+// MeshFileHeader
+//
+struct MeshFileHeader {
+    char Magic[4];                  // "MESH"
+    unsigned int Version;           // MESH_FILE_VERSION
+    unsigned int VertexCount;
+    unsigned int VertexStride;      // Floats in each attribute array
+    unsigned int IndexCount;        // 3 per triangle
+    unsigned int Flags;             // MESH_HAS_NORMALS
+    float BoundsMin[3];
+    float BoundsMax[3];
+    unsigned int PositionOffset;    // Byte offsets from the start of the file
+    unsigned int NormalOffset;
+    unsigned int IndexOffset;
+    unsigned int FileSize;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// Mesh
+//
+class Mesh {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    Mesh();
+    ~Mesh();
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // Allocates an empty mesh (all zero) with room for the given counts
+    void Create(int vertexCount,int indexCount,bool normals);
+    void Free();
+
+    // File I/O.  All return false (and print why) on failure.
+    bool Load(const char *filename);            // Binary, memory mapped
+    bool Save(const char *filename) const;      // Binary
+    bool LoadOBJ(const char *filename);
+    bool SaveOBJ(const char *filename) const;
+
+    // Recomputes the bounding box from the positions
+    void ComputeBounds();
+    // Recomputes area weighted vertex normals from the triangles
+    void ComputeNormals();
+
+    // Draws the triangles with OpenGL after applying 'mTransform'
+    void Draw(const Matrix &mTransform) const;
+
+    // Accessors
+    bool IsEmpty() const                            {return m_Header==0;}
+    bool IsMapped() const                           {return m_File.IsOpen();}
+    bool HasNormals() const                         {return m_Header && (m_Header->Flags & MESH_HAS_NORMALS);}
+    int GetVertexCount() const                      {return m_Header ? (int)m_Header->VertexCount : 0;}
+    int GetVertexStride() const                     {return m_Header ? (int)m_Header->VertexStride : 0;}
+    int GetIndexCount() const                       {return m_Header ? (int)m_Header->IndexCount : 0;}
+    int GetTriangleCount() const                    {return GetIndexCount()/3;}
+    size_t GetDataSize() const                      {return m_Header ? m_Header->FileSize : 0;}
+    const MeshFileHeader *GetHeader() const         {return m_Header;}
+
+    float *GetX() const                             {return (float*)(m_Data + m_Header->PositionOffset);}
+    float *GetY() const                             {return GetX() + m_Header->VertexStride;}
+    float *GetZ() const                             {return GetY() + m_Header->VertexStride;}
+    float *GetNX() const                            {return (float*)(m_Data + m_Header->NormalOffset);}
+    float *GetNY() const                            {return GetNX() + m_Header->VertexStride;}
+    float *GetNZ() const                            {return GetNY() + m_Header->VertexStride;}
+    unsigned int *GetIndices() const                {return (unsigned int*)(m_Data + m_Header->IndexOffset);}
+
+    Point3 GetPosition(int i) const                 {return Point3(GetX()[i],GetY()[i],GetZ()[i]);}
+    Vector3 GetNormal(int i) const                  {return Vector3(GetNX()[i],GetNY()[i],GetNZ()[i]);}
+    void SetPosition(int i,const Point3 &p)         {GetX()[i]=p.x; GetY()[i]=p.y; GetZ()[i]=p.z;}
+    void SetNormal(int i,const Vector3 &n)          {GetNX()[i]=n.x; GetNY()[i]=n.y; GetNZ()[i]=n.z;}
+
+    Point3 GetBoundsMin() const                     {return Point3(m_Header->BoundsMin[0],m_Header->BoundsMin[1],m_Header->BoundsMin[2]);}
+    Point3 GetBoundsMax() const                     {return Point3(m_Header->BoundsMax[0],m_Header->BoundsMax[1],m_Header->BoundsMax[2]);}
+
+private:
+    // Not copyable
+    Mesh(const Mesh &);
+    Mesh &operator=(const Mesh &);
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    MeshFileHeader *m_Header;   // Start of m_Data
+    char *m_Data;               // Owned allocation or the mapped file
+    char *m_Alloc;              // Unaligned allocation behind m_Data, if owned
+    MappedFile m_File;
+};
+
+#endif
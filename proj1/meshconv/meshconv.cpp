@@ -0,0 +1,63 @@
+/////////////////////////////////////////////////////////////////////////////
+// meshconv.cpp
+/////////////////////////////////////
+// Converts meshes between Wavefront OBJ and the binary mesh format.
+//
+// Usage: meshconv [-optimize] input output
+//
+// The format of each file is picked from its extension: ".obj" is OBJ and
+// anything else is the binary format (".mesh" by convention).  -optimize
+// reorders triangles and vertices for the vertex cache, overdraw and vertex
+// fetch before saving (see meshopt.h).
+/////////////////////////////////////////////////////////////////////////////
+
+#include "../meshopt.h"
+#include "../timer.h"
+
+static bool IsOBJ(const char *filename)
+{
+    size_t len = strlen(filename);
+    if(len < 4)
+        return false;
+    const char *ext = filename + len - 4;
+    return ext[0] == '.' && (ext[1]|0x20) == 'o' && (ext[2]|0x20) == 'b' && (ext[3]|0x20) == 'j';
+}
+
+int main(int argc,char **argv)
+{
+    bool optimize = argc > 1 && strcmp(argv[1],"-optimize") == 0;
+    if(optimize) {
+        argc--;
+        argv++;
+    }
+    if(argc != 3) {
+        printf("Usage: meshconv [-optimize] input output\n\
+Converts between .obj files and binary .mesh files\n");
+        return 1;
+    }
+
+    Mesh mesh;
+    Timer t;
+    bool ok = IsOBJ(argv[1]) ? mesh.LoadOBJ(argv[1]) : mesh.Load(argv[1]);
+    if(!ok)
+        return 1;
+    double loadMs = t.GetMs();
+
+    if(optimize) {
+        MeshOptReport report;
+        OptimizeMesh(mesh,true,&report);
+        report.Print();
+    }
+
+    t.Start();
+    ok = IsOBJ(argv[2]) ? mesh.SaveOBJ(argv[2]) : mesh.Save(argv[2]);
+    if(!ok)
+        return 1;
+    double saveMs = t.GetMs();
+
+    Point3 lo = mesh.GetBoundsMin(), hi = mesh.GetBoundsMax();
+    printf("%d vertices, %d triangles, bounds {%g,%g,%g}-{%g,%g,%g}\n",
+           mesh.GetVertexCount(),mesh.GetTriangleCount(),lo.x,lo.y,lo.z,hi.x,hi.y,hi.z);
+    printf("load %.2f ms, save %.2f ms\n",loadMs,saveMs);
+    return 0;
+}
@@ -0,0 +1,406 @@
+/////////////////////////////////////////////////////////////////////////////
+// meshopt.cpp
+/////////////////////////////////////
+// Vertex cache, overdraw and vertex fetch ordering for indexed triangles.
+/////////////////////////////////////////////////////////////////////////////
+
+#include "meshopt.h"
+#include "timer.h"
+#include <vector>
+#include <algorithm>
+
+// Cache size assumed by the Forsyth scoring.  It doesn't have to match the
+// hardware exactly; results are good for any real cache up to this size.
+#define FORSYTH_CACHE_SIZE      32
+#define FORSYTH_MAX_VALENCE     64
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Print
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Prints the report to stdout
+/////////////////////////////////////////////////////////////////////////////
+void MeshOptReport::Print() const
+{
+    printf("meshopt: %d verts, %d tris, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f",
+           Vertices,Triangles,AcmrBefore,AcmrAfter,AtvrBefore,AtvrAfter);
+    if(Clusters)
+        printf(", %d clusters",Clusters);
+    printf(", %.2f ms\n",Ms);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           ComputeACMR
+// Arguments:      Index list, vertex count and FIFO cache size
+// Returns:        Vertices transformed per triangle
+// Notes:          A vertex is in a FIFO cache if fewer than 'cacheSize'
+//                 misses happened since it was last loaded, so we only need
+//                 to remember the miss count at which each vertex was loaded.
+/////////////////////////////////////////////////////////////////////////////
+float ComputeACMR(const unsigned int *indices,int indexCount,int vertexCount,int cacheSize)
+{
+    if(indexCount < 3)
+        return 0.0f;
+
+    std::vector<unsigned int> loadedAt(vertexCount,0);
+    unsigned int misses = 0, clock = cacheSize+1;
+    for(int i = 0; i < indexCount; i++) {
+        unsigned int v = indices[i];
+        if(clock - loadedAt[v] > (unsigned int)cacheSize) {
+            loadedAt[v] = clock++;
+            misses++;
+        }
+    }
+    return (float)misses/(indexCount/3);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Forsyth vertex scoring.  Vertices in the cache score higher the more
+// recently they were used (except the last triangle's three, which are
+// slightly penalized to avoid strips), and vertices with few triangles left
+// get a boost so they are finished off rather than left stranded.
+/////////////////////////////////////////////////////////////////////////////
+struct ForsythTables {
+    ForsythTables() {
+        for(int i = 0; i < FORSYTH_CACHE_SIZE; i++) {
+            if(i < 3)
+                Cache[i] = 0.75f;
+            else
+                Cache[i] = powf(1.0f - (float)(i-3)/(FORSYTH_CACHE_SIZE-3),1.5f);
+        }
+        Valence[0] = 0.0f;
+        for(int i = 1; i < FORSYTH_MAX_VALENCE; i++)
+            Valence[i] = 2.0f*powf((float)i,-0.5f);
+    }
+    float Score(int cachePos,int remaining) const {
+        if(remaining == 0)
+            return -1.0f;
+        float score = cachePos >= 0 ? Cache[cachePos] : 0.0f;
+        return score + Valence[remaining < FORSYTH_MAX_VALENCE ? remaining : FORSYTH_MAX_VALENCE-1];
+    }
+
+    float Cache[FORSYTH_CACHE_SIZE];
+    float Valence[FORSYTH_MAX_VALENCE];
+};
+
+static const ForsythTables g_Forsyth;
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           OptimizeVertexCache
+// Arguments:      Output index list, input index list, index count and
+//                 vertex count
+// Returns:        none
+// Side Effects:   Writes the triangles to 'dst' in cache friendly order.
+// Notes:          Greedy: always emits the unemitted triangle with the best
+//                 total vertex score.  Only triangles touching the cache can
+//                 change score, so only those are rescored after each step.
+/////////////////////////////////////////////////////////////////////////////
+void OptimizeVertexCache(unsigned int *dst,const unsigned int *indices,int indexCount,int vertexCount)
+{
+    int triCount = indexCount/3;
+    if(triCount == 0)
+        return;
+
+    // Triangles using each vertex.  The first 'remaining[v]' entries of a
+    // vertex's list are the ones not emitted yet.
+    std::vector<int> offset(vertexCount+1,0), remaining(vertexCount,0);
+    for(int i = 0; i < indexCount; i++)
+        remaining[indices[i]]++;
+    for(int v = 0; v < vertexCount; v++)
+        offset[v+1] = offset[v] + remaining[v];
+    std::vector<int> adjacency(indexCount), fill(offset.begin(),offset.end()-1);
+    for(int i = 0; i < indexCount; i++)
+        adjacency[fill[indices[i]]++] = i/3;
+
+    std::vector<int> cachePos(vertexCount,-1);
+    std::vector<float> vertScore(vertexCount);
+    for(int v = 0; v < vertexCount; v++)
+        vertScore[v] = g_Forsyth.Score(-1,remaining[v]);
+
+    std::vector<float> triScore(triCount);
+    std::vector<bool> emitted(triCount,false);
+    int best = 0;
+    for(int t = 0; t < triCount; t++) {
+        triScore[t] = vertScore[indices[3*t]] + vertScore[indices[3*t+1]] + vertScore[indices[3*t+2]];
+        if(triScore[t] > triScore[best])
+            best = t;
+    }
+
+    int cache[FORSYTH_CACHE_SIZE+3], cacheCount = 0;
+    int newCache[FORSYTH_CACHE_SIZE+3];
+    int cursor = 0;     // Every triangle before this has been emitted
+
+    for(int out = 0; out < triCount; out++) {
+        if(best < 0) {
+            // Nothing in the cache has triangles left: start somewhere new
+            while(emitted[cursor]) cursor++;
+            best = cursor;
+        }
+
+        const unsigned int *tri = indices + 3*best;
+        dst[3*out+0] = tri[0];
+        dst[3*out+1] = tri[1];
+        dst[3*out+2] = tri[2];
+        emitted[best] = true;
+
+        // Remove the triangle from its vertices' lists
+        for(int k = 0; k < 3; k++) {
+            int v = tri[k];
+            int *list = &adjacency[offset[v]];
+            for(int j = 0; j < remaining[v]; j++) {
+                if(list[j] == best) {
+                    list[j] = list[remaining[v]-1];
+                    list[remaining[v]-1] = best;
+                    break;
+                }
+            }
+            remaining[v]--;
+        }
+
+        // The triangle's vertices move to the front of the LRU cache
+        int newCount = 0;
+        for(int k = 0; k < 3; k++)
+            newCache[newCount++] = tri[k];
+        for(int i = 0; i < cacheCount; i++) {
+            int v = cache[i];
+            if(v != (int)tri[0] && v != (int)tri[1] && v != (int)tri[2])
+                newCache[newCount++] = v;
+        }
+        if(newCount > FORSYTH_CACHE_SIZE+3)
+            newCount = FORSYTH_CACHE_SIZE+3;
+
+        // Rescore every vertex in (or just pushed out of) the cache and pass
+        // the change on to their remaining triangles
+        for(int i = 0; i < newCount; i++) {
+            int v = newCache[i];
+            cachePos[v] = i < FORSYTH_CACHE_SIZE ? i : -1;
+            float score = g_Forsyth.Score(cachePos[v],remaining[v]);
+            float delta = score - vertScore[v];
+            vertScore[v] = score;
+            const int *list = &adjacency[offset[v]];
+            for(int j = 0; j < remaining[v]; j++)
+                triScore[list[j]] += delta;
+        }
+
+        best = -1;
+        float bestScore = -1e30f;
+        for(int i = 0; i < newCount && i < FORSYTH_CACHE_SIZE; i++) {
+            int v = newCache[i];
+            const int *list = &adjacency[offset[v]];
+            for(int j = 0; j < remaining[v]; j++) {
+                if(triScore[list[j]] > bestScore) {
+                    bestScore = triScore[list[j]];
+                    best = list[j];
+                }
+            }
+        }
+
+        memcpy(cache,newCache,newCount*sizeof(int));
+        cacheCount = newCount > FORSYTH_CACHE_SIZE ? FORSYTH_CACHE_SIZE : newCount;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           OptimizeOverdraw
+// Arguments:      Output index list, cache optimized input index list,
+//                 positions, and how much worse the ACMR of a cluster may
+//                 get when it is split off
+// Returns:        The number of clusters
+// Side Effects:   Writes the clusters to 'dst', outermost first.
+// Notes:          Cluster boundaries go where the FIFO cache is completely
+//                 cold anyway (a triangle with three misses) plus extra
+//                 "soft" boundaries where starting cold costs little.
+//                 Clusters are sorted by how far their centroid lies along
+//                 their normal from the mesh centroid, so clusters that face
+//                 outward from the outside of the mesh are drawn first.
+/////////////////////////////////////////////////////////////////////////////
+int OptimizeOverdraw(unsigned int *dst,const unsigned int *indices,int indexCount,
+                     const Point3 *positions,int vertexCount,float threshold)
+{
+    int triCount = indexCount/3;
+    if(triCount == 0)
+        return 0;
+
+    // Hard boundaries from a FIFO simulation of the whole list
+    std::vector<int> starts;
+    std::vector<unsigned int> loadedAt(vertexCount,0);
+    unsigned int clock = MESHOPT_FIFO_SIZE+1;
+    for(int t = 0; t < triCount; t++) {
+        int misses = 0;
+        for(int k = 0; k < 3; k++) {
+            unsigned int v = indices[3*t+k];
+            if(clock - loadedAt[v] > MESHOPT_FIFO_SIZE) {
+                loadedAt[v] = clock++;
+                misses++;
+            }
+        }
+        if(t == 0 || misses == 3)
+            starts.push_back(t);
+    }
+    starts.push_back(triCount);
+
+    // Soft boundaries: within a hard cluster, cut wherever the part since
+    // the last cut (simulated from a cold cache) is already within
+    // 'threshold' of the whole cluster's ACMR
+    std::vector<int> clusters;
+    for(size_t c = 0; c+1 < starts.size(); c++) {
+        int begin = starts[c], end = starts[c+1];
+        float clusterAcmr = ComputeACMR(indices+3*begin,3*(end-begin),vertexCount);
+
+        clusters.push_back(begin);
+        clock += MESHOPT_FIFO_SIZE+1;   // Cold cache
+        int misses = 0, first = begin;
+        for(int t = begin; t < end; t++) {
+            for(int k = 0; k < 3; k++) {
+                unsigned int v = indices[3*t+k];
+                if(clock - loadedAt[v] > MESHOPT_FIFO_SIZE) {
+                    loadedAt[v] = clock++;
+                    misses++;
+                }
+            }
+            int tris = t+1-first;
+            if(t+1 < end && (float)misses/tris <= clusterAcmr*threshold) {
+                clusters.push_back(t+1);
+                clock += MESHOPT_FIFO_SIZE+1;
+                misses = 0;
+                first = t+1;
+            }
+        }
+    }
+    int clusterCount = (int)clusters.size();
+    clusters.push_back(triCount);
+
+    // Area weighted centroid and normal of every cluster and of the mesh
+    std::vector<Point3> centroid(clusterCount);
+    std::vector<Vector3> normal(clusterCount);
+    Vector3 meshSum;
+    float meshArea = 0.0f;
+    for(int c = 0; c < clusterCount; c++) {
+        Vector3 sum, nsum;
+        float area = 0.0f;
+        for(int t = clusters[c]; t < clusters[c+1]; t++) {
+            const Point3 &a = positions[indices[3*t]];
+            const Point3 &b = positions[indices[3*t+1]];
+            const Point3 &d = positions[indices[3*t+2]];
+            Vector3 n;
+            n.Cross(b-a,d-a);
+            float w = n.Mag();
+            sum += (a.ToVector3() + b.ToVector3() + d.ToVector3())*(w/3.0f);
+            nsum += n;
+            area += w;
+        }
+        meshSum += sum;
+        meshArea += area;
+        centroid[c] = Point3(area > 0.0f ? sum/area : sum);
+        if(nsum.MagSq() > 0.0f)
+            nsum.Normalize();
+        normal[c] = nsum;
+    }
+    Point3 meshCentroid(meshArea > 0.0f ? meshSum/meshArea : meshSum);
+
+    std::vector<std::pair<float,int> > order(clusterCount);
+    for(int c = 0; c < clusterCount; c++)
+        order[c] = std::make_pair(-(centroid[c]-meshCentroid).Dot(normal[c]),c);
+    std::stable_sort(order.begin(),order.end());
+
+    int out = 0;
+    for(int i = 0; i < clusterCount; i++) {
+        int c = order[i].second;
+        int n = 3*(clusters[c+1]-clusters[c]);
+        memcpy(dst+out,indices+3*clusters[c],n*sizeof(unsigned int));
+        out += n;
+    }
+    return clusterCount;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           OptimizeVertexFetch
+// Arguments:      Output remap table, index list (rewritten in place), index
+//                 count and vertex count
+// Returns:        none
+/////////////////////////////////////////////////////////////////////////////
+void OptimizeVertexFetch(unsigned int *remap,unsigned int *indices,int indexCount,int vertexCount)
+{
+    const unsigned int unused = 0xffffffff;
+    for(int v = 0; v < vertexCount; v++)
+        remap[v] = unused;
+
+    unsigned int next = 0;
+    for(int i = 0; i < indexCount; i++) {
+        unsigned int v = indices[i];
+        if(remap[v] == unused)
+            remap[v] = next++;
+        indices[i] = remap[v];
+    }
+    for(int v = 0; v < vertexCount; v++) {
+        if(remap[v] == unused)
+            remap[v] = next++;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           RemapAttribute
+// Notes:          out[remap[v]] = in[v] for one SoA attribute array, in place
+/////////////////////////////////////////////////////////////////////////////
+static void RemapAttribute(float *a,const unsigned int *remap,int vertexCount,std::vector<float> &tmp)
+{
+    tmp.assign(a,a+vertexCount);
+    for(int v = 0; v < vertexCount; v++)
+        a[remap[v]] = tmp[v];
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           OptimizeMesh
+// Arguments:      The mesh, whether to also optimize for overdraw, and an
+//                 optional report to fill in
+// Returns:        none
+// Side Effects:   Reorders the mesh's triangles and vertices in place.  The
+//                 triangles and vertex count are unchanged.
+/////////////////////////////////////////////////////////////////////////////
+void OptimizeMesh(Mesh &mesh,bool overdraw,MeshOptReport *report)
+{
+    Timer timer;
+    int numVerts = mesh.GetVertexCount(), numIndices = mesh.GetIndexCount();
+    if(mesh.IsEmpty() || numIndices < 3)
+        return;
+
+    unsigned int *indices = mesh.GetIndices();
+    float acmrBefore = ComputeACMR(indices,numIndices,numVerts);
+
+    std::vector<unsigned int> tmp(numIndices);
+    OptimizeVertexCache(&tmp[0],indices,numIndices,numVerts);
+
+    int clusters = 0;
+    if(overdraw) {
+        std::vector<Point3> positions(numVerts);
+        for(int v = 0; v < numVerts; v++)
+            positions[v] = mesh.GetPosition(v);
+        clusters = OptimizeOverdraw(indices,&tmp[0],numIndices,&positions[0],numVerts);
+    }
+    else
+        memcpy(indices,&tmp[0],numIndices*sizeof(unsigned int));
+
+    std::vector<unsigned int> remap(numVerts);
+    OptimizeVertexFetch(&remap[0],indices,numIndices,numVerts);
+    std::vector<float> scratch;
+    RemapAttribute(mesh.GetX(),&remap[0],numVerts,scratch);
+    RemapAttribute(mesh.GetY(),&remap[0],numVerts,scratch);
+    RemapAttribute(mesh.GetZ(),&remap[0],numVerts,scratch);
+    if(mesh.HasNormals()) {
+        RemapAttribute(mesh.GetNX(),&remap[0],numVerts,scratch);
+        RemapAttribute(mesh.GetNY(),&remap[0],numVerts,scratch);
+        RemapAttribute(mesh.GetNZ(),&remap[0],numVerts,scratch);
+    }
+
+    if(report) {
+        float trisPerVert = (float)(numIndices/3)/numVerts;
+        report->Vertices = numVerts;
+        report->Triangles = numIndices/3;
+        report->AcmrBefore = acmrBefore;
+        report->AcmrAfter = ComputeACMR(indices,numIndices,numVerts);
+        report->AtvrBefore = report->AcmrBefore*trisPerVert;
+        report->AtvrAfter = report->AcmrAfter*trisPerVert;
+        report->Clusters = clusters;
+        report->Ms = timer.GetMs();
+    }
+}
@@ -0,0 +1,74 @@
+/////////////////////////////////////////////////////////////////////////////
+// meshopt.h
+//
+/////////////////////////////////////
+// Functions declared:
+//
+// Reordering of indexed triangle lists so they transform and draw faster.
+// None of them change the triangles themselves, only the order they (and
+// their vertices) are stored in.
+//
+// OptimizeVertexCache: Reorders triangles so vertices are reused while they
+//                      are still in the post-transform cache (Tom Forsyth's
+//                      "Linear-Speed Vertex Cache Optimisation").
+//
+// OptimizeOverdraw:    Splits a cache optimized index list into clusters
+//                      and sorts them so outward facing, outer clusters are
+//                      drawn first, which lets the depth test reject more of
+//                      what is drawn later.  Clusters are only split where
+//                      it costs less than 'threshold' times the cache
+//                      efficiency.
+//
+// OptimizeVertexFetch: Renumbers vertices in the order the index list first
+//                      uses them, so vertex fetches walk memory forwards.
+//
+// ComputeACMR:         Average cache miss ratio (transformed vertices per
+//                      triangle) for a FIFO post-transform cache.  1.0 or
+//                      less is good, 3.0 is the worst possible.
+//
+// OptimizeMesh:        Runs all of the above on a Mesh in place.
+//
+/////////////////////////////////////
+// Common Operations Supported:
+//
+// MeshOptReport r;
+// OptimizeMesh(mesh,true,&r);     // Cache, overdraw and fetch order
+// r.Print();                      // ACMR before and after
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSE167_MESHOPT_H_
+#define CSE167_MESHOPT_H_
+
+#include "mesh.h"
+
+#define MESHOPT_FIFO_SIZE       16  // Cache size ComputeACMR simulates
+#define MESHOPT_OVERDRAW_THRESHOLD  1.05f
+
+/////////////////////////////////////////////////////////////////////////////
+// MeshOptReport
+//
+struct MeshOptReport {
+    void Print() const;
+
+    int Vertices, Triangles;
+    float AcmrBefore, AcmrAfter;    // ACMR for a MESHOPT_FIFO_SIZE FIFO
+    float AtvrBefore, AtvrAfter;    // Transforms per vertex (1.0 is ideal)
+    int Clusters;                   // Overdraw clusters, 0 if not run
+    double Ms;
+};
+
+// 'dst' may not be the same array as 'indices' in either of these
+void OptimizeVertexCache(unsigned int *dst,const unsigned int *indices,int indexCount,int vertexCount);
+int OptimizeOverdraw(unsigned int *dst,const unsigned int *indices,int indexCount,
+                     const Point3 *positions,int vertexCount,float threshold=MESHOPT_OVERDRAW_THRESHOLD);
+
+// Rewrites 'indices' in place and fills 'remap' (vertexCount entries) with
+// the new index of every old vertex.  Unused vertices go to the end.
+void OptimizeVertexFetch(unsigned int *remap,unsigned int *indices,int indexCount,int vertexCount);
+
+float ComputeACMR(const unsigned int *indices,int indexCount,int vertexCount,int cacheSize=MESHOPT_FIFO_SIZE);
+
+void OptimizeMesh(Mesh &mesh,bool overdraw,MeshOptReport *report=0);
+
+#endif
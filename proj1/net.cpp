@@ -0,0 +1,213 @@
+/////////////////////////////////////////////////////////////////////////////
+// net.cpp
+/////////////////////////////////////
+// Blocking TCP sockets over Winsock or BSD sockets.
+/////////////////////////////////////////////////////////////////////////////
+
+// Winsock 2 has to come before windows.h, which pulls in the old winsock.h
+#ifdef WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib,"ws2_32.lib")
+typedef int SocketLength;
+#define NET_CLOSE(s)            closesocket(s)
+#define NET_NO_SIGNAL           0
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <unistd.h>
+typedef int SOCKET;
+typedef socklen_t SocketLength;
+#define INVALID_SOCKET          (-1)
+#define NET_CLOSE(s)            close(s)
+#ifdef MSG_NOSIGNAL
+#define NET_NO_SIGNAL           MSG_NOSIGNAL        // A closed peer is an error, not SIGPIPE
+#else
+#define NET_NO_SIGNAL           0
+#endif
+#endif
+
+#include "net.h"
+#include <stdio.h>
+#include <string.h>
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Socket constructor/destructor
+/////////////////////////////////////////////////////////////////////////////
+Socket::Socket()
+{
+    m_Handle = INVALID;
+}
+
+Socket::~Socket()
+{
+    Close();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Startup
+// Arguments:      none
+// Returns:        Whether sockets can be used
+/////////////////////////////////////////////////////////////////////////////
+bool Socket::Startup()
+{
+#ifdef WIN32
+    static bool started = false;
+    if(!started) {
+        WSADATA data;
+        if(WSAStartup(MAKEWORD(2,2),&data) != 0) {
+            printf("Socket: can't start Winsock\n");
+            return false;
+        }
+        started = true;
+    }
+#endif
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Listen
+// Arguments:      The port to listen on
+// Returns:        Whether the socket is listening
+// Notes:          SO_REUSEADDR lets a restarted process take the port back
+//                 while the old connections are still timing out
+/////////////////////////////////////////////////////////////////////////////
+bool Socket::Listen(int port)
+{
+    Close();
+    if(!Startup())
+        return false;
+    SOCKET s = socket(AF_INET,SOCK_STREAM,IPPROTO_TCP);
+    if(s == INVALID_SOCKET) {
+        printf("Socket::Listen: can't make a socket\n");
+        return false;
+    }
+    int on = 1;
+    setsockopt(s,SOL_SOCKET,SO_REUSEADDR,(const char*)&on,sizeof(on));
+
+    sockaddr_in addr;
+    memset(&addr,0,sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((unsigned short)port);
+    if(bind(s,(sockaddr*)&addr,sizeof(addr)) != 0 || listen(s,4) != 0) {
+        printf("Socket::Listen: can't listen on port %d\n",port);
+        NET_CLOSE(s);
+        return false;
+    }
+    m_Handle = (Handle)s;
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Accept
+// Arguments:      The socket to make the new connection
+// Returns:        Whether a connection was made
+/////////////////////////////////////////////////////////////////////////////
+bool Socket::Accept(Socket &client) const
+{
+    client.Close();
+    if(!IsOpen())
+        return false;
+    sockaddr_in addr;
+    SocketLength len = sizeof(addr);
+    SOCKET s = accept((SOCKET)m_Handle,(sockaddr*)&addr,&len);
+    if(s == INVALID_SOCKET)
+        return false;
+    int on = 1;
+    setsockopt(s,IPPROTO_TCP,TCP_NODELAY,(const char*)&on,sizeof(on));
+    client.m_Handle = (Handle)s;
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Connect
+// Arguments:      The host and port to connect to
+// Returns:        Whether it connected
+// Notes:          Tries every address the name resolves to, in order
+/////////////////////////////////////////////////////////////////////////////
+bool Socket::Connect(const char *host,int port)
+{
+    Close();
+    if(!Startup())
+        return false;
+    char service[16];
+    snprintf(service,sizeof(service),"%d",port);
+    addrinfo hints, *found = 0;
+    memset(&hints,0,sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    if(getaddrinfo(host,service,&hints,&found) != 0) {
+        printf("Socket::Connect: can't find '%s'\n",host);
+        return false;
+    }
+    for(addrinfo *a = found; a && !IsOpen(); a = a->ai_next) {
+        SOCKET s = socket(a->ai_family,a->ai_socktype,a->ai_protocol);
+        if(s == INVALID_SOCKET)
+            continue;
+        if(connect(s,a->ai_addr,(SocketLength)a->ai_addrlen) != 0) {
+            NET_CLOSE(s);
+            continue;
+        }
+        int on = 1;
+        setsockopt(s,IPPROTO_TCP,TCP_NODELAY,(const char*)&on,sizeof(on));
+        m_Handle = (Handle)s;
+    }
+    freeaddrinfo(found);
+    if(!IsOpen())
+        printf("Socket::Connect: can't connect to %s:%d\n",host,port);
+    return IsOpen();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Send
+// Arguments:      The bytes to send
+// Returns:        Whether all of them were sent
+/////////////////////////////////////////////////////////////////////////////
+bool Socket::Send(const void *data,size_t size)
+{
+    const char *p = (const char*)data;
+    while(size > 0 && IsOpen()) {
+        int chunk = size > (1 << 30) ? (1 << 30) : (int)size;
+        int sent = send((SOCKET)m_Handle,p,chunk,NET_NO_SIGNAL);
+        if(sent <= 0) {
+            Close();
+            return false;
+        }
+        p += sent;
+        size -= sent;
+    }
+    return size == 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Receive
+// Arguments:      Where to put the bytes, and how many to wait for
+// Returns:        Whether all of them arrived
+/////////////////////////////////////////////////////////////////////////////
+bool Socket::Receive(void *data,size_t size)
+{
+    char *p = (char*)data;
+    while(size > 0 && IsOpen()) {
+        int chunk = size > (1 << 30) ? (1 << 30) : (int)size;
+        int got = recv((SOCKET)m_Handle,p,chunk,0);
+        if(got <= 0) {
+            Close();
+            return false;
+        }
+        p += got;
+        size -= got;
+    }
+    return size == 0;
+}
+
+void Socket::Close()
+{
+    if(IsOpen()) {
+        NET_CLOSE((SOCKET)m_Handle);
+        m_Handle = INVALID;
+    }
+}
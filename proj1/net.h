@@ -0,0 +1,91 @@
+/////////////////////////////////////////////////////////////////////////////
+// net.h
+//
+/////////////////////////////////////
+// Classes declared:
+//
+// Socket: A blocking TCP connection, or a socket listening for them.  Just
+//         enough for sending whole messages between processes, on one
+//         machine or across several: Send() and Receive() always move the
+//         full size asked for (or fail), so a message is a fixed header
+//         followed by whatever it says comes next.  Connections have
+//         Nagle's algorithm turned off, since every message is sent whole
+//         and a reply is waited for.
+//
+// The same code works over Winsock and BSD sockets.  Nothing here includes
+// the system headers, so this header is safe to include anywhere.
+//
+/////////////////////////////////////
+// Common Operations Supported:
+//
+// Socket server, client;
+// server.Listen(port);
+// server.Accept(client);                          // Waits for a connection
+//
+// Socket s;
+// s.Connect("localhost",port);
+// s.Send(&header,sizeof(header));
+// s.Receive(&reply,sizeof(reply));                // false once the peer is gone
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSE167_NET_H_
+#define CSE167_NET_H_
+
+#include <stddef.h>
+
+/////////////////////////////////////////////////////////////////////////////
+// Socket
+//
+class Socket {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    Socket();
+    ~Socket();
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // Listens on 'port' on every interface.  Returns false (and prints
+    // why) if it can't.
+    bool Listen(int port);
+
+    // Waits for a connection to a listening socket and makes 'client' it
+    bool Accept(Socket &client) const;
+
+    // Connects to 'host' (a name or an address) on 'port'.  Returns false
+    // (and prints why) if it can't.
+    bool Connect(const char *host,int port);
+
+    // Send or receive exactly 'size' bytes.  False if the connection fails
+    // or is closed first.
+    bool Send(const void *data,size_t size);
+    bool Receive(void *data,size_t size);
+
+    void Close();
+    bool IsOpen() const                             {return m_Handle != INVALID;}
+
+private:
+    // Winsock's SOCKET is pointer sized, BSD's socket is an int
+    typedef long long Handle;
+    enum {INVALID = -1};
+
+    // Starts Winsock before the first socket; nothing elsewhere
+    static bool Startup();
+
+    // Not copyable
+    Socket(const Socket &);
+    Socket &operator=(const Socket &);
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    Handle m_Handle;
+};
+
+#endif
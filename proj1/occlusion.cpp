@@ -0,0 +1,160 @@
+/////////////////////////////////////////////////////////////////////////////
+// occlusion.cpp
+/////////////////////////////////////
+// Software occlusion culling against a coarse CPU depth buffer.
+//
+// Box tests run in two steps.  The depth buffer's ProjectBox gives the
+// box's screen rectangle and nearest depth (four corners at a time with
+// SSE).  The rectangle is then checked against the Hi-Z of the depth
+// buffer, and if the Hi-Z can't prove it hidden, against the depth pixels
+// themselves, again four at a time.
+/////////////////////////////////////////////////////////////////////////////
+
+#include "occlusion.h"
+#include "simd.h"
+#include "timer.h"
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Print
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Prints the counters and timings to stdout
+/////////////////////////////////////////////////////////////////////////////
+void OcclusionStats::Print() const
+{
+    printf("occlusion: %d occluders (%d tris) %.3f ms, %d/%d culled %.3f ms\n",
+           Occluders,OccluderTriangles,RasterMs,Culled,Tested,TestMs);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           OcclusionCuller constructor
+// Arguments:      Size of the occlusion depth buffer in pixels
+// Returns:        none
+/////////////////////////////////////////////////////////////////////////////
+OcclusionCuller::OcclusionCuller(int width,int height) : m_Depth(width,height)
+{
+    m_Enabled = true;
+    m_Stats.Reset();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           BeginFrame
+// Arguments:      World to clip space matrix for this frame
+// Returns:        none
+// Side Effects:   Clears the depth buffer to the far plane and resets stats
+/////////////////////////////////////////////////////////////////////////////
+void OcclusionCuller::BeginFrame(const Matrix &viewProj)
+{
+    m_ViewProj = viewProj;
+    m_Stats.Reset();
+    if(m_Enabled)
+        m_Depth.Clear(0,1.0f);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           AddOccluder
+// Arguments:      World matrix and an indexed triangle mesh in object space
+// Returns:        none
+// Side Effects:   Draws the mesh into the occlusion depth buffer
+/////////////////////////////////////////////////////////////////////////////
+void OcclusionCuller::AddOccluder(const Matrix &world,const Point3 *verts,int vertCount,
+                                  const unsigned int *indices,int triCount)
+{
+    if(!m_Enabled)
+        return;
+
+    Timer t;
+    m_Depth.DrawTriangles(m_ViewProj*world,verts,vertCount,indices,triCount,0xffffffff);
+    m_Stats.Occluders++;
+    m_Stats.OccluderTriangles += triCount;
+    m_Stats.RasterMs += t.GetMs();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           IsVisible
+// Arguments:      World matrix and object space bounding box
+// Returns:        false if the box is hidden behind the occluders
+/////////////////////////////////////////////////////////////////////////////
+bool OcclusionCuller::IsVisible(const Matrix &world,const Point3 &bmin,const Point3 &bmax)
+{
+    if(!m_Enabled)
+        return true;
+
+    Timer t;
+    bool visible = TestBox(m_ViewProj*world,bmin,bmax);
+    m_Stats.Tested++;
+    if(!visible)
+        m_Stats.Culled++;
+    m_Stats.TestMs += t.GetMs();
+    return visible;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           CullBoxes
+// Arguments:      Array of world matrices, their shared object space box,
+//                 and an output array with one entry per matrix
+// Returns:        The number of visible boxes
+/////////////////////////////////////////////////////////////////////////////
+int OcclusionCuller::CullBoxes(const Matrix *worlds,const Point3 &bmin,const Point3 &bmax,
+                               int count,unsigned char *visible)
+{
+    if(!m_Enabled) {
+        memset(visible,1,count);
+        return count;
+    }
+
+    Timer t;
+    int numVisible = 0;
+    for(int i = 0; i < count; i++) {
+        visible[i] = TestBox(Matrix(m_ViewProj*worlds[i]),bmin,bmax) ? 1 : 0;
+        numVisible += visible[i];
+    }
+    m_Stats.Tested += count;
+    m_Stats.Culled += count-numVisible;
+    m_Stats.TestMs += t.GetMs();
+    return numVisible;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           TestBox
+// Arguments:      Object to clip space matrix and object space box
+// Returns:        false if the box is hidden behind the occluders
+/////////////////////////////////////////////////////////////////////////////
+bool OcclusionCuller::TestBox(const Matrix &mvp,const Point3 &bmin,const Point3 &bmax)
+{
+    float xmin, ymin, xmax, ymax, zmin;
+    if(!m_Depth.ProjectBox(mvp,bmin,bmax,xmin,ymin,xmax,ymax,zmin))
+        return true;
+    int width = m_Depth.GetWidth(), height = m_Depth.GetHeight();
+
+    // Coarse test against the Hi-Z, which also rejects off screen boxes
+    if(!m_Depth.TestRect(xmin,ymin,xmax,ymax,zmin))
+        return false;
+
+    // Fine test: visible if any pixel under the rectangle is behind zmin
+    int x0 = (int)floorf(xmin), x1 = (int)floorf(xmax);
+    int y0 = (int)floorf(ymin), y1 = (int)floorf(ymax);
+    if(x0 < 0) x0 = 0;
+    if(y0 < 0) y0 = 0;
+    if(x1 > width-1) x1 = width-1;
+    if(y1 > height-1) y1 = height-1;
+
+    const float *depth = m_Depth.GetDepthBuffer();
+    int stride = m_Depth.GetStride();
+    for(int y = y0; y <= y1; y++) {
+        const float *row = depth + y*stride;
+        int x = x0;
+#ifdef CSE167_SSE
+        __m128 vz = _mm_set1_ps(zmin);
+        for(; x+3 <= x1; x += 4) {
+            if(_mm_movemask_ps(_mm_cmpgt_ps(_mm_loadu_ps(row+x),vz)))
+                return true;
+        }
+#endif
+        for(; x <= x1; x++) {
+            if(row[x] > zmin)
+                return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,104 @@
+/////////////////////////////////////////////////////////////////////////////
+// occlusion.h
+//
+/////////////////////////////////////
+// Classes declared:
+//
+// OcclusionStats:  Per frame counts and timings of the culling pass.
+//
+// OcclusionCuller: Skips objects that are hidden behind large occluders.
+//                  Each frame a few hand picked occluder meshes are drawn
+//                  into a small (256x128 by default) CPU depth buffer, and
+//                  then the bounding box of every object is tested against
+//                  it before the object is submitted to OpenGL.
+//
+// The culler is conservative in the usual way: anything it can't bound on
+// screen (boxes crossing the eye plane) is reported visible.  The occluder
+// depth buffer is sampled at pixel centers, so an object peeking out from
+// behind an occluder by less than one low resolution pixel may be culled.
+//
+/////////////////////////////////////
+// Common Operations Supported:
+//
+// OcclusionCuller oc;
+// oc.BeginFrame(viewProj);                            // Clear for a new frame
+// oc.AddOccluder(world,verts,nverts,idx,ntris);       // Draw an occluder
+// if(oc.IsVisible(world,bmin,bmax)) draw(...);        // Test one object
+// oc.CullBoxes(worlds,bmin,bmax,count,visible);       // Test many objects
+// oc.GetStats().Print();
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSE167_OCCLUSION_H_
+#define CSE167_OCCLUSION_H_
+
+#include "raster.h"
+
+/////////////////////////////////////////////////////////////////////////////
+// OcclusionStats
+//
+struct OcclusionStats {
+    void Reset()                                    {memset(this,0,sizeof(*this));}
+    void Print() const;
+
+    int Occluders;          // Meshes drawn into the depth buffer
+    int OccluderTriangles;  // Triangles in those meshes
+    int Tested;             // Bounding boxes tested
+    int Culled;             // Bounding boxes found hidden
+    double RasterMs;        // Time spent drawing occluders
+    double TestMs;          // Time spent testing boxes
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// OcclusionCuller
+//
+class OcclusionCuller {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    OcclusionCuller(int width=256,int height=128);
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // Clears the depth buffer.  'viewProj' takes world space to clip space.
+    void BeginFrame(const Matrix &viewProj);
+
+    // Draws an occluder mesh given in object space with its world matrix
+    void AddOccluder(const Matrix &world,const Point3 *verts,int vertCount,
+                     const unsigned int *indices,int triCount);
+
+    // Tests an object space bounding box under its world matrix.  Returns
+    // false if the box is hidden behind the occluders drawn so far.
+    bool IsVisible(const Matrix &world,const Point3 &bmin,const Point3 &bmax);
+
+    // Tests 'count' objects that share one object space bounding box and
+    // writes 1 (visible) or 0 (culled) to 'visible'.  Returns the number
+    // of visible objects.
+    int CullBoxes(const Matrix *worlds,const Point3 &bmin,const Point3 &bmax,
+                  int count,unsigned char *visible);
+
+    void SetEnabled(bool enabled)                   {m_Enabled=enabled;}
+    bool IsEnabled() const                          {return m_Enabled;}
+
+    // Accessors
+    const OcclusionStats &GetStats() const          {return m_Stats;}
+    Rasterizer &GetDepthBuffer()                    {return m_Depth;}
+
+private:
+    bool TestBox(const Matrix &mvp,const Point3 &bmin,const Point3 &bmax);
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    Rasterizer m_Depth;
+    Matrix m_ViewProj;
+    bool m_Enabled;
+    OcclusionStats m_Stats;
+};
+
+#endif
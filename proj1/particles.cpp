@@ -0,0 +1,390 @@
+/////////////////////////////////////////////////////////////////////////////
+// particles.cpp
+/////////////////////////////////////
+// SoA particle pool, emitters and the parallel update.
+/////////////////////////////////////////////////////////////////////////////
+
+#include "particles.h"
+#include "jobs.h"
+#include "simd.h"
+#include "timer.h"
+
+#define PARTICLE_ALIGN          64
+#define PARTICLE_SOFTENING      0.01f       // Added to distance^2 so attractors stay finite
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           ParticleEmitter constructor
+// Notes:          A fountain at the origin: upwards in a 30 degree cone at
+//                 5 +- 1 units/s, each particle living 2 +- 0.5 s
+/////////////////////////////////////////////////////////////////////////////
+ParticleEmitter::ParticleEmitter() : Position(0,0,0), Direction(0,1,0)
+{
+    Spread = 0.5236f;
+    Speed = 5.0f;
+    SpeedJitter = 1.0f;
+    Life = 2.0f;
+    LifeJitter = 0.5f;
+    Rate = 1000.0f;
+    Enabled = true;
+    Pending = 0.0f;
+    Seed = 0x2545f491u;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Print
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Prints the counters to stdout
+/////////////////////////////////////////////////////////////////////////////
+void ParticleStats::Print() const
+{
+    printf("particles: %d of %d live, %d emitted, %d died, %d dropped\n",
+           Count,Capacity,Emitted,Died,Dropped);
+    printf("           update %.3f ms, draw %.3f ms\n",UpdateMs,DrawMs);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           ParticleSystem constructor/destructor
+/////////////////////////////////////////////////////////////////////////////
+ParticleSystem::ParticleSystem() : m_Gravity(0,0,0)
+{
+    m_Count = m_Capacity = 0;
+    m_Alloc = 0;
+    m_X = m_Y = m_Z = m_VX = m_VY = m_VZ = m_Life = m_Packed = 0;
+    m_Dead = 0;
+    m_Drag = 0.0f;
+    for(int i = 0; i < PARTICLE_MAX_ATTRACTORS; i++)
+        m_Strengths[i] = 0.0f;
+    memset(&m_Stats,0,sizeof(m_Stats));
+}
+
+ParticleSystem::~ParticleSystem()
+{
+    Free();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Create
+// Arguments:      The most particles that can be alive at once
+// Returns:        none
+// Side Effects:   Allocates every array in one block.  The capacity is
+//                 rounded up to a multiple of 16 so the SIMD loops never
+//                 need a scalar tail.
+/////////////////////////////////////////////////////////////////////////////
+void ParticleSystem::Create(int capacity)
+{
+    Free();
+    if(capacity < 1)
+        return;
+    m_Capacity = (capacity + 15) & ~15;
+
+    // 7 attribute arrays, the packed positions and the dead lists
+    size_t floats = (size_t)m_Capacity;
+    size_t bytes = (7 + 3 + 1)*floats*sizeof(float) + PARTICLE_ALIGN;
+    m_Alloc = new char[bytes];
+    memset(m_Alloc,0,bytes);
+    float *p = (float*)(m_Alloc + (PARTICLE_ALIGN - ((size_t)m_Alloc & (PARTICLE_ALIGN-1))) % PARTICLE_ALIGN);
+    m_X = p;    p += floats;
+    m_Y = p;    p += floats;
+    m_Z = p;    p += floats;
+    m_VX = p;   p += floats;
+    m_VY = p;   p += floats;
+    m_VZ = p;   p += floats;
+    m_Life = p; p += floats;
+    m_Packed = p; p += 3*floats;
+    m_Dead = (int*)p;
+
+    m_DeadCounts.assign((m_Capacity + PARTICLE_GRAIN - 1)/PARTICLE_GRAIN,0);
+    m_Count = 0;
+    m_Stats.Capacity = m_Capacity;
+}
+
+void ParticleSystem::Free()
+{
+    delete [] m_Alloc;
+    m_Alloc = 0;
+    m_X = m_Y = m_Z = m_VX = m_VY = m_VZ = m_Life = m_Packed = 0;
+    m_Dead = 0;
+    m_DeadCounts.clear();
+    m_Count = m_Capacity = 0;
+}
+
+int ParticleSystem::AddEmitter(const ParticleEmitter &e)
+{
+    if((int)m_Emitters.size() >= PARTICLE_MAX_EMITTERS)
+        return -1;
+    m_Emitters.push_back(e);
+    return (int)m_Emitters.size()-1;
+}
+
+void ParticleSystem::SetAttractor(int i,const Point3 &p,float strength)
+{
+    if(i < 0 || i >= PARTICLE_MAX_ATTRACTORS)
+        return;
+    m_Attractors[i] = p;
+    m_Strengths[i] = strength;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Emit
+// Arguments:      Position, velocity and life in seconds
+// Returns:        false if the pool is full
+/////////////////////////////////////////////////////////////////////////////
+bool ParticleSystem::Emit(const Point3 &p,const Vector3 &v,float life)
+{
+    if(m_Count >= m_Capacity)
+        return false;
+    int i = m_Count++;
+    m_X[i] = p.x;
+    m_Y[i] = p.y;
+    m_Z[i] = p.z;
+    m_VX[i] = v.x;
+    m_VY[i] = v.y;
+    m_VZ[i] = v.z;
+    m_Life[i] = life;
+    return true;
+}
+
+// xorshift32, as a float in [0,1)
+static inline float Random(unsigned int &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return (state >> 8)*(1.0f/16777216.0f);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           EmitFrom
+// Arguments:      An emitter and the time step
+// Returns:        none
+// Side Effects:   Emits Rate*dt particles (carrying the fraction over) in
+//                 random directions inside the emitter's cone
+/////////////////////////////////////////////////////////////////////////////
+void ParticleSystem::EmitFrom(ParticleEmitter &e,float dt)
+{
+    e.Pending += e.Rate*dt;
+    int n = (int)e.Pending;
+    e.Pending -= n;
+
+    // A basis around the cone axis
+    Vector3 d = e.Direction;
+    d.Normalize();
+    Vector3 u, w;
+    u.Cross(d,fabsf(d.x) < 0.9f ? Vector3(1,0,0) : Vector3(0,1,0));
+    u.Normalize();
+    w.Cross(d,u);
+    float cosSpread = cosf(e.Spread);
+
+    for(int i = 0; i < n; i++) {
+        if(m_Count >= m_Capacity) {
+            m_Stats.Dropped += n - i;
+            break;
+        }
+        // Uniform over the spherical cap
+        float cosT = 1.0f - Random(e.Seed)*(1.0f - cosSpread);
+        float sinT = sqrtf(fmaxf(0.0f,1.0f - cosT*cosT));
+        float phi = 2.0f*(float)M_PI*Random(e.Seed);
+        float speed = e.Speed + e.SpeedJitter*(2.0f*Random(e.Seed) - 1.0f);
+        Vector3 dir = (sinT*cosf(phi))*u + (sinT*sinf(phi))*w + cosT*d;
+        float life = e.Life + e.LifeJitter*(2.0f*Random(e.Seed) - 1.0f);
+        Emit(e.Position,speed*dir,life);
+        m_Stats.Emitted++;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Integrate
+// Arguments:      Particle range (a multiple of 4, within the capacity), the
+//                 job's chunk number and the time step
+// Returns:        none
+// Side Effects:   Semi-implicit Euler: velocity first, then position with
+//                 the new velocity.  Particles that die are listed in the
+//                 chunk's part of m_Dead.
+/////////////////////////////////////////////////////////////////////////////
+void ParticleSystem::Integrate(int begin,int end,int chunk,float dt)
+{
+    float damp = 1.0f/(1.0f + m_Drag*dt);
+    int *dead = m_Dead + chunk*PARTICLE_GRAIN;
+    int deadCount = 0;
+
+    int attractors = 0;
+    float ax[PARTICLE_MAX_ATTRACTORS], ay[PARTICLE_MAX_ATTRACTORS], az[PARTICLE_MAX_ATTRACTORS];
+    float as[PARTICLE_MAX_ATTRACTORS];
+    for(int a = 0; a < PARTICLE_MAX_ATTRACTORS; a++) {
+        if(m_Strengths[a] != 0.0f) {
+            ax[attractors] = m_Attractors[a].x;
+            ay[attractors] = m_Attractors[a].y;
+            az[attractors] = m_Attractors[a].z;
+            as[attractors++] = m_Strengths[a]*dt;
+        }
+    }
+
+#ifdef CSE167_SSE
+    const __m128 vdt = _mm_set1_ps(dt), vdamp = _mm_set1_ps(damp);
+    const __m128 gx = _mm_set1_ps(m_Gravity.x*dt), gy = _mm_set1_ps(m_Gravity.y*dt), gz = _mm_set1_ps(m_Gravity.z*dt);
+    const __m128 soft = _mm_set1_ps(PARTICLE_SOFTENING), zero = _mm_setzero_ps();
+    for(int i = begin; i < end; i += 4) {
+        __m128 x = _mm_load_ps(m_X+i), y = _mm_load_ps(m_Y+i), z = _mm_load_ps(m_Z+i);
+        __m128 vx = _mm_add_ps(_mm_load_ps(m_VX+i),gx);
+        __m128 vy = _mm_add_ps(_mm_load_ps(m_VY+i),gy);
+        __m128 vz = _mm_add_ps(_mm_load_ps(m_VZ+i),gz);
+        for(int a = 0; a < attractors; a++) {
+            // strength*dt * d/|d|^3, with the estimate rsqrt (forces don't
+            // need the last bits)
+            __m128 dx = _mm_sub_ps(_mm_set1_ps(ax[a]),x);
+            __m128 dy = _mm_sub_ps(_mm_set1_ps(ay[a]),y);
+            __m128 dz = _mm_sub_ps(_mm_set1_ps(az[a]),z);
+            __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx,dx),_mm_mul_ps(dy,dy)),_mm_add_ps(_mm_mul_ps(dz,dz),soft));
+            __m128 r = _mm_rsqrt_ps(d2);
+            __m128 s = _mm_mul_ps(_mm_set1_ps(as[a]),_mm_mul_ps(r,_mm_mul_ps(r,r)));
+            vx = _mm_add_ps(vx,_mm_mul_ps(dx,s));
+            vy = _mm_add_ps(vy,_mm_mul_ps(dy,s));
+            vz = _mm_add_ps(vz,_mm_mul_ps(dz,s));
+        }
+        vx = _mm_mul_ps(vx,vdamp);
+        vy = _mm_mul_ps(vy,vdamp);
+        vz = _mm_mul_ps(vz,vdamp);
+        _mm_store_ps(m_VX+i,vx);
+        _mm_store_ps(m_VY+i,vy);
+        _mm_store_ps(m_VZ+i,vz);
+        _mm_store_ps(m_X+i,_mm_add_ps(x,_mm_mul_ps(vx,vdt)));
+        _mm_store_ps(m_Y+i,_mm_add_ps(y,_mm_mul_ps(vy,vdt)));
+        _mm_store_ps(m_Z+i,_mm_add_ps(z,_mm_mul_ps(vz,vdt)));
+
+        __m128 life = _mm_sub_ps(_mm_load_ps(m_Life+i),vdt);
+        _mm_store_ps(m_Life+i,life);
+        int died = _mm_movemask_ps(_mm_cmple_ps(life,zero));
+        while(died) {
+            int k = 0;
+            while(!(died & (1 << k)))
+                k++;
+            died &= ~(1 << k);
+            if(i + k < m_Count)
+                dead[deadCount++] = i + k;
+        }
+    }
+#else
+    for(int i = begin; i < end; i++) {
+        float vx = m_VX[i] + m_Gravity.x*dt;
+        float vy = m_VY[i] + m_Gravity.y*dt;
+        float vz = m_VZ[i] + m_Gravity.z*dt;
+        for(int a = 0; a < attractors; a++) {
+            float dx = ax[a] - m_X[i], dy = ay[a] - m_Y[i], dz = az[a] - m_Z[i];
+            float r = 1.0f/sqrtf(dx*dx + dy*dy + dz*dz + PARTICLE_SOFTENING);
+            float s = as[a]*r*r*r;
+            vx += dx*s;
+            vy += dy*s;
+            vz += dz*s;
+        }
+        m_VX[i] = vx *= damp;
+        m_VY[i] = vy *= damp;
+        m_VZ[i] = vz *= damp;
+        m_X[i] += vx*dt;
+        m_Y[i] += vy*dt;
+        m_Z[i] += vz*dt;
+        m_Life[i] -= dt;
+        if(m_Life[i] <= 0.0f && i < m_Count)
+            dead[deadCount++] = i;
+    }
+#endif
+    m_DeadCounts[chunk] = deadCount;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Compact
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Fills each dead slot, lowest first, with the last live
+//                 particle, and shrinks the count past the dead ones left
+//                 at the end
+/////////////////////////////////////////////////////////////////////////////
+void ParticleSystem::Compact()
+{
+    int end = m_Count;
+    int chunks = (m_Count + PARTICLE_GRAIN - 1)/PARTICLE_GRAIN;
+    for(int c = 0; c < chunks; c++) {
+        const int *dead = m_Dead + c*PARTICLE_GRAIN;
+        for(int k = 0; k < m_DeadCounts[c]; k++) {
+            int d = dead[k];
+            if(d >= end)
+                goto done;
+            do {
+                end--;
+            } while(end > d && m_Life[end] <= 0.0f);
+            if(end > d) {
+                m_X[d] = m_X[end];
+                m_Y[d] = m_Y[end];
+                m_Z[d] = m_Z[end];
+                m_VX[d] = m_VX[end];
+                m_VY[d] = m_VY[end];
+                m_VZ[d] = m_VZ[end];
+                m_Life[d] = m_Life[end];
+            }
+        }
+    }
+done:
+    m_Count = end;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Update
+// Arguments:      Time step in seconds
+// Returns:        none
+/////////////////////////////////////////////////////////////////////////////
+void ParticleSystem::Update(float dt)
+{
+    Timer timer;
+    int before = m_Count;
+    m_Stats.Emitted = m_Stats.Died = m_Stats.Dropped = 0;
+
+    if(m_Count > 0 && dt > 0.0f) {
+        int padded = (m_Count + 3) & ~3;
+        int chunks = (padded + PARTICLE_GRAIN - 1)/PARTICLE_GRAIN;
+        ParallelFor(chunks,1,[this,padded,dt](int begin,int end,int) {
+            for(int c = begin; c < end; c++) {
+                int first = c*PARTICLE_GRAIN;
+                int last = first + PARTICLE_GRAIN < padded ? first + PARTICLE_GRAIN : padded;
+                Integrate(first,last,c,dt);
+            }
+        });
+        Compact();
+    }
+    m_Stats.Died = before - m_Count;
+
+    for(size_t i = 0; i < m_Emitters.size(); i++) {
+        if(m_Emitters[i].Enabled && dt > 0.0f)
+            EmitFrom(m_Emitters[i],dt);
+    }
+
+    m_Stats.Count = m_Count;
+    m_Stats.UpdateMs = timer.GetMs();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Draw
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Interleaves the positions on the job pool and draws them
+//                 as GL_POINTS in the current color and modelview
+/////////////////////////////////////////////////////////////////////////////
+void ParticleSystem::Draw()
+{
+    Timer timer;
+    if(m_Count > 0) {
+        ParallelFor(m_Count,PARTICLE_GRAIN,[this](int begin,int end,int) {
+            float *out = m_Packed + 3*begin;
+            for(int i = begin; i < end; i++) {
+                *out++ = m_X[i];
+                *out++ = m_Y[i];
+                *out++ = m_Z[i];
+            }
+        });
+
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glVertexPointer(3,GL_FLOAT,0,m_Packed);
+        glDrawArrays(GL_POINTS,0,m_Count);
+        glDisableClientState(GL_VERTEX_ARRAY);
+    }
+    m_Stats.DrawMs = timer.GetMs();
+}
@@ -0,0 +1,170 @@
+/////////////////////////////////////////////////////////////////////////////
+// particles.h
+//
+/////////////////////////////////////
+// Classes declared:
+//
+// ParticleEmitter: Where new particles come from, how fast, in which
+//                  directions and how long they live.
+//
+// ParticleSystem:  A fixed capacity pool of point particles stored
+//                  structure-of-arrays (x, y, z, vx, vy, vz and remaining
+//                  life, each its own aligned float array).  Every Update()
+//                  integrates all live particles under gravity, drag and
+//                  point attractors four at a time with SSE, split over the
+//                  shared job pool; removes the ones that died by moving
+//                  live particles from the end into their slots; and then
+//                  emits new ones at the end.
+//
+// ParticleStats:   Counters from the last Update().
+//
+// Live particles are always packed into [0,GetCount()), in no particular
+// order.  Removal moves a particle from the end into each dead slot, so
+// it costs time in proportion to the number that died, not the number
+// alive, and no per-frame memory is allocated anywhere.
+//
+// Particles are drawn as GL points from one interleaved array built by
+// the job pool at draw time, in a single glDrawArrays call.
+//
+/////////////////////////////////////
+// Common Operations Supported:
+//
+// ParticleSystem ps;
+// ps.Create(1000000);
+// ParticleEmitter e;  e.Rate = 10000;  ps.AddEmitter(e);
+// ps.SetGravity(Vector3(0,-9.8f,0));
+// ps.SetAttractor(0,center,strength);
+// ps.Update(dt);                                  // Once per frame
+// ps.Draw();
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSE167_PARTICLES_H_
+#define CSE167_PARTICLES_H_
+
+#include "matrix.h"
+#include <vector>
+
+#define PARTICLE_GRAIN              16384       // Particles per job, a multiple of 4
+#define PARTICLE_MAX_ATTRACTORS     4
+#define PARTICLE_MAX_EMITTERS       16
+
+/////////////////////////////////////////////////////////////////////////////
+// ParticleEmitter
+//
+struct ParticleEmitter {
+    ParticleEmitter();
+
+    Point3 Position;
+    Vector3 Direction;              // Unit axis of the emission cone
+    float Spread;                   // Half angle of the cone, in radians (pi for all directions)
+    float Speed, SpeedJitter;       // Speed is Speed +- SpeedJitter
+    float Life, LifeJitter;         // Seconds
+    float Rate;                     // Particles per second
+    bool Enabled;
+
+    float Pending;                  // Fraction of a particle carried to the next frame
+    unsigned int Seed;              // Random state
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// ParticleStats
+//
+struct ParticleStats {
+    void Print() const;
+
+    int Count;                      // Live particles
+    int Capacity;
+    int Emitted;                    // In the last update
+    int Died;
+    int Dropped;                    // Wanted to emit but the pool was full
+    double UpdateMs;                // Integration, compaction and emission
+    double DrawMs;                  // Packing and submission
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// ParticleSystem
+//
+class ParticleSystem {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    ParticleSystem();
+    ~ParticleSystem();
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // Allocates room for 'capacity' particles and removes all of them
+    void Create(int capacity);
+    void Free();
+    void Clear()                                    {m_Count = 0;}
+
+    // Returns the emitter's index, or -1 if there are PARTICLE_MAX_EMITTERS
+    int AddEmitter(const ParticleEmitter &e);
+    ParticleEmitter &GetEmitter(int i)              {return m_Emitters[i];}
+    int GetEmitterCount() const                     {return (int)m_Emitters.size();}
+
+    // Forces.  Drag removes that fraction of the velocity per second (for
+    // small dt); an attractor of strength s pulls with acceleration
+    // s/distance^2.  A strength of 0 turns an attractor off.
+    void SetGravity(const Vector3 &g)               {m_Gravity = g;}
+    void SetDrag(float drag)                        {m_Drag = drag;}
+    void SetAttractor(int i,const Point3 &p,float strength);
+
+    // Adds one particle; returns false if the pool is full
+    bool Emit(const Point3 &p,const Vector3 &v,float life);
+
+    // Advances the simulation 'dt' seconds
+    void Update(float dt);
+
+    // Draws every live particle as a GL point
+    void Draw();
+
+    // Accessors
+    int GetCount() const                            {return m_Count;}
+    int GetCapacity() const                         {return m_Capacity;}
+    const float *GetX() const                       {return m_X;}
+    const float *GetY() const                       {return m_Y;}
+    const float *GetZ() const                       {return m_Z;}
+    const float *GetLife() const                    {return m_Life;}
+    const ParticleStats &GetStats() const           {return m_Stats;}
+
+private:
+    void Integrate(int begin,int end,int chunk,float dt);
+    void Compact();
+    void EmitFrom(ParticleEmitter &e,float dt);
+
+    // Not copyable
+    ParticleSystem(const ParticleSystem &);
+    ParticleSystem &operator=(const ParticleSystem &);
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    int m_Count, m_Capacity;
+    char *m_Alloc;                  // One block behind every array
+    float *m_X, *m_Y, *m_Z;
+    float *m_VX, *m_VY, *m_VZ;
+    float *m_Life;                  // Seconds left; dead at 0 or below
+    float *m_Packed;                // x,y,z per particle for drawing
+
+    // Dead particles found by each job, in increasing order:
+    // m_DeadCounts[c] indices from m_Dead + c*PARTICLE_GRAIN
+    int *m_Dead;
+    std::vector<int> m_DeadCounts;
+
+    Vector3 m_Gravity;
+    float m_Drag;
+    Point3 m_Attractors[PARTICLE_MAX_ATTRACTORS];
+    float m_Strengths[PARTICLE_MAX_ATTRACTORS];
+
+    std::vector<ParticleEmitter> m_Emitters;
+    ParticleStats m_Stats;
+};
+
+#endif
@@ -0,0 +1,694 @@
+/////////////////////////////////////////////////////////////////////////////
+// raster.cpp
+/////////////////////////////////////
+// Software triangle rasterizer with a hierarchical depth buffer.
+//
+// Triangles are scan converted with edge functions one 8x8 block at a time.
+// Every block is first classified against the three edges (outside, fully
+// covered or partially covered) and against the Hi-Z (occluded, in front of
+// everything, or needs a per-pixel test), so most of the work in deep scenes
+// is done per block rather than per pixel.
+/////////////////////////////////////////////////////////////////////////////
+
+#include "raster.h"
+#include "clip.h"
+#include "texture.h"
+#include "simd.h"
+#include <float.h>
+
+static inline float Min3(float a,float b,float c)   {return a<b ? (a<c?a:c) : (b<c?b:c);}
+static inline float Max3(float a,float b,float c)   {return a>b ? (a>c?a:c) : (b>c?b:c);}
+
+/////////////////////////////////////////////////////////////////////////////
+// Edge function E(x,y) = A*x + B*y + C for the directed edge v0->v1.  It is
+// positive to the left of the edge, so a counter-clockwise triangle is the
+// region where all three are positive.  Pixels exactly on an edge belong to
+// the triangle only for top and left edges (the usual fill rule), which is
+// expressed by testing E >= Bias.
+/////////////////////////////////////////////////////////////////////////////
+struct RasterEdge {
+    void Setup(const Point3 &v0,const Point3 &v1) {
+        A = v0.y - v1.y;
+        B = v1.x - v0.x;
+        C = v0.x*v1.y - v0.y*v1.x;
+        bool topLeft = (A > 0.0f) || (A == 0.0f && B < 0.0f);
+        Bias = topLeft ? 0.0f : FLT_MIN;
+    }
+    float Eval(float x,float y) const               {return A*x + B*y + C;}
+
+    float A, B, C, Bias;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Rasterizer constructors
+// Arguments:      Optionally the size of the buffers in pixels
+// Returns:        none
+// Side Effects:   Allocates the buffers and clears them
+/////////////////////////////////////////////////////////////////////////////
+Rasterizer::Rasterizer()
+{
+    m_Color = 0; m_Depth = 0;
+    m_BlockMin = m_BlockMax = 0;
+    m_TileMin = m_TileMax = 0;
+    m_CullBackFaces = true;
+    m_Texture = 0;
+    Resize(0,0);
+}
+
+Rasterizer::Rasterizer(int width,int height)
+{
+    m_Color = 0; m_Depth = 0;
+    m_BlockMin = m_BlockMax = 0;
+    m_TileMin = m_TileMax = 0;
+    m_CullBackFaces = true;
+    m_Texture = 0;
+    Resize(width,height);
+    Clear();
+}
+
+Rasterizer::~Rasterizer()
+{
+    Free();
+}
+
+void Rasterizer::Free()
+{
+    delete[] m_Color;    m_Color = 0;
+    delete[] m_Depth;    m_Depth = 0;
+    delete[] m_BlockMin; m_BlockMin = 0;
+    delete[] m_BlockMax; m_BlockMax = 0;
+    delete[] m_TileMin;  m_TileMin = 0;
+    delete[] m_TileMax;  m_TileMax = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Resize
+// Arguments:      New size in pixels
+// Returns:        none
+// Side Effects:   Reallocates every buffer.  The buffers are padded up to a
+//                 whole number of tiles so no block or tile is ever partial.
+/////////////////////////////////////////////////////////////////////////////
+void Rasterizer::Resize(int width,int height)
+{
+    Free();
+    if(width < 0) width = 0;
+    if(height < 0) height = 0;
+
+    m_Width = width;
+    m_Height = height;
+    m_TilesX = (width + RASTER_TILE_SIZE-1) / RASTER_TILE_SIZE;
+    m_TilesY = (height + RASTER_TILE_SIZE-1) / RASTER_TILE_SIZE;
+    m_BlocksX = m_TilesX * RASTER_TILE_BLOCKS;
+    m_BlocksY = m_TilesY * RASTER_TILE_BLOCKS;
+    m_Stride = m_TilesX * RASTER_TILE_SIZE;
+    m_Rows = m_TilesY * RASTER_TILE_SIZE;
+    m_GuardX = 1.0f + 2.0f*RASTER_GUARD_BAND/(width > 0 ? width : 1);
+    m_GuardY = 1.0f + 2.0f*RASTER_GUARD_BAND/(height > 0 ? height : 1);
+
+    int pixels = m_Stride*m_Rows;
+    m_Color = new unsigned int[pixels > 0 ? pixels : 1];
+    m_Depth = new float[pixels > 0 ? pixels : 1];
+    m_BlockMin = new float[m_BlocksX*m_BlocksY + 1];
+    m_BlockMax = new float[m_BlocksX*m_BlocksY + 1];
+    m_TileMin = new float[m_TilesX*m_TilesY + 1];
+    m_TileMax = new float[m_TilesX*m_TilesY + 1];
+    m_Stats.Reset();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Clear
+// Arguments:      Clear color (packed RGBA) and clear depth
+// Returns:        none
+// Side Effects:   Clears the color and depth buffers and the Hi-Z.
+// Notes:          Padding pixels outside the visible area get depth 0 so
+//                 they never raise the max depth of the blocks they share
+//                 with visible pixels.
+/////////////////////////////////////////////////////////////////////////////
+void Rasterizer::Clear(unsigned int color,float depth)
+{
+    for(int y = 0; y < m_Rows; y++) {
+        unsigned int *c = m_Color + y*m_Stride;
+        float *d = m_Depth + y*m_Stride;
+        for(int x = 0; x < m_Stride; x++) {
+            c[x] = color;
+            d[x] = (x < m_Width && y < m_Height) ? depth : 0.0f;
+        }
+    }
+    for(int i = 0; i < m_BlocksX*m_BlocksY; i++) {
+        m_BlockMin[i] = depth;
+        m_BlockMax[i] = depth;
+    }
+    for(int i = 0; i < m_TilesX*m_TilesY; i++) {
+        m_TileMin[i] = depth;
+        m_TileMax[i] = depth;
+    }
+    m_Stats.Reset();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           UpdateBlock, UpdateTile
+// Arguments:      Block or tile coordinates
+// Returns:        none
+// Side Effects:   Recomputes the min and max depth of a block from its
+//                 pixels, or of a tile from its blocks.
+/////////////////////////////////////////////////////////////////////////////
+void Rasterizer::UpdateBlock(int bx,int by)
+{
+    int x0 = bx*RASTER_BLOCK_SIZE, y0 = by*RASTER_BLOCK_SIZE;
+    int x1 = x0+RASTER_BLOCK_SIZE, y1 = y0+RASTER_BLOCK_SIZE;
+    if(x1 > m_Width) x1 = m_Width;
+    if(y1 > m_Height) y1 = m_Height;
+
+    float zmin = FLT_MAX, zmax = -FLT_MAX;
+    for(int y = y0; y < y1; y++) {
+        const float *d = m_Depth + y*m_Stride;
+        for(int x = x0; x < x1; x++) {
+            if(d[x] < zmin) zmin = d[x];
+            if(d[x] > zmax) zmax = d[x];
+        }
+    }
+    m_BlockMin[by*m_BlocksX+bx] = zmin;
+    m_BlockMax[by*m_BlocksX+bx] = zmax;
+}
+
+void Rasterizer::UpdateTile(int tx,int ty)
+{
+    float zmin = FLT_MAX, zmax = -FLT_MAX;
+    for(int by = ty*RASTER_TILE_BLOCKS; by < (ty+1)*RASTER_TILE_BLOCKS; by++) {
+        for(int bx = tx*RASTER_TILE_BLOCKS; bx < (tx+1)*RASTER_TILE_BLOCKS; bx++) {
+            int bi = by*m_BlocksX+bx;
+            if(m_BlockMin[bi] < zmin) zmin = m_BlockMin[bi];
+            if(m_BlockMax[bi] > zmax) zmax = m_BlockMax[bi];
+        }
+    }
+    m_TileMin[ty*m_TilesX+tx] = zmin;
+    m_TileMax[ty*m_TilesX+tx] = zmax;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           RectVisible
+// Arguments:      Inclusive pixel rectangle (already clamped to the screen)
+//                 and the nearest depth of whatever covers it
+// Returns:        false if every pixel in the rectangle is already nearer
+//                 than 'zmin', true otherwise
+// Notes:          Works top down: a tile whose max depth is in front of
+//                 'zmin' is skipped whole, and a tile whose min depth is
+//                 behind 'zmin' proves visibility without looking at its
+//                 blocks.
+/////////////////////////////////////////////////////////////////////////////
+static bool RectVisible(const float *tileMin,const float *tileMax,int tilesX,
+                        const float *blockMax,int blocksX,
+                        int x0,int y0,int x1,int y1,float zmin)
+{
+    int bx0 = x0/RASTER_BLOCK_SIZE, bx1 = x1/RASTER_BLOCK_SIZE;
+    int by0 = y0/RASTER_BLOCK_SIZE, by1 = y1/RASTER_BLOCK_SIZE;
+
+    for(int ty = by0/RASTER_TILE_BLOCKS; ty <= by1/RASTER_TILE_BLOCKS; ty++) {
+        for(int tx = bx0/RASTER_TILE_BLOCKS; tx <= bx1/RASTER_TILE_BLOCKS; tx++) {
+            int ti = ty*tilesX+tx;
+            if(zmin >= tileMax[ti])
+                continue;
+            if(zmin < tileMin[ti])
+                return true;
+
+            int ybeg = ty*RASTER_TILE_BLOCKS, yend = ybeg+RASTER_TILE_BLOCKS-1;
+            int xbeg = tx*RASTER_TILE_BLOCKS, xend = xbeg+RASTER_TILE_BLOCKS-1;
+            if(ybeg < by0) ybeg = by0;
+            if(yend > by1) yend = by1;
+            if(xbeg < bx0) xbeg = bx0;
+            if(xend > bx1) xend = bx1;
+            for(int by = ybeg; by <= yend; by++) {
+                for(int bx = xbeg; bx <= xend; bx++) {
+                    if(zmin < blockMax[by*blocksX+bx])
+                        return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           TestRect
+// Arguments:      Window space rectangle and the nearest depth of the object
+//                 it bounds
+// Returns:        false if the object is certainly hidden (or off screen),
+//                 true if it may be visible
+/////////////////////////////////////////////////////////////////////////////
+bool Rasterizer::TestRect(float xmin,float ymin,float xmax,float ymax,float zmin)
+{
+    m_Stats.QueriesIssued++;
+
+    int x0 = (int)floorf(xmin), x1 = (int)floorf(xmax);
+    int y0 = (int)floorf(ymin), y1 = (int)floorf(ymax);
+    if(x0 < 0) x0 = 0;
+    if(y0 < 0) y0 = 0;
+    if(x1 > m_Width-1) x1 = m_Width-1;
+    if(y1 > m_Height-1) y1 = m_Height-1;
+
+    if(x0 > x1 || y0 > y1 ||
+       !RectVisible(m_TileMin,m_TileMax,m_TilesX,m_BlockMax,m_BlocksX,x0,y0,x1,y1,zmin)) {
+        m_Stats.QueriesOccluded++;
+        return false;
+    }
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           ProjectBox
+// Arguments:      Object to clip space matrix, an object space bounding box
+//                 and where to put its window space bounds
+// Returns:        false if the box crosses the eye plane
+// Notes:          Corners 0-3 lie on the bmin.z face and corners 4-7 on the
+//                 bmax.z face, so each face is projected four at a time
+/////////////////////////////////////////////////////////////////////////////
+bool Rasterizer::ProjectBox(const Matrix &mvp,const Point3 &bmin,const Point3 &bmax,
+                            float &xmin,float &ymin,float &xmax,float &ymax,float &zmin) const
+{
+    const float *m = mvp.m_m;
+
+#ifdef CSE167_SSE
+    __m128 px = _mm_setr_ps(bmin.x,bmax.x,bmin.x,bmax.x);
+    __m128 py = _mm_setr_ps(bmin.y,bmin.y,bmax.y,bmax.y);
+    __m128 vxmin = _mm_set1_ps(FLT_MAX), vymin = vxmin, vzmin = vxmin;
+    __m128 vxmax = _mm_set1_ps(-FLT_MAX), vymax = vxmax;
+    for(int face = 0; face < 2; face++) {
+        __m128 pz = _mm_set1_ps(face ? bmax.z : bmin.z);
+        __m128 w = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[3]),px),_mm_mul_ps(_mm_set1_ps(m[7]),py)),
+                              _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[11]),pz),_mm_set1_ps(m[15])));
+        if(_mm_movemask_ps(_mm_cmplt_ps(w,_mm_set1_ps(CLIP_MIN_W))))
+            return false;
+        __m128 invW = _mm_div_ps(_mm_set1_ps(1.0f),w);
+        __m128 x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[0]),px),_mm_mul_ps(_mm_set1_ps(m[4]),py)),
+                              _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[8]),pz),_mm_set1_ps(m[12])));
+        __m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[1]),px),_mm_mul_ps(_mm_set1_ps(m[5]),py)),
+                              _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[9]),pz),_mm_set1_ps(m[13])));
+        __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[2]),px),_mm_mul_ps(_mm_set1_ps(m[6]),py)),
+                              _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[10]),pz),_mm_set1_ps(m[14])));
+        x = _mm_mul_ps(x,invW);
+        y = _mm_mul_ps(y,invW);
+        z = _mm_mul_ps(z,invW);
+        vxmin = _mm_min_ps(vxmin,x); vxmax = _mm_max_ps(vxmax,x);
+        vymin = _mm_min_ps(vymin,y); vymax = _mm_max_ps(vymax,y);
+        vzmin = _mm_min_ps(vzmin,z);
+    }
+    CSE167_ALIGN(16) float lo[3][4], hi[2][4];
+    _mm_store_ps(lo[0],vxmin); _mm_store_ps(lo[1],vymin); _mm_store_ps(lo[2],vzmin);
+    _mm_store_ps(hi[0],vxmax); _mm_store_ps(hi[1],vymax);
+    xmin = lo[0][0]; ymin = lo[1][0]; zmin = lo[2][0];
+    xmax = hi[0][0]; ymax = hi[1][0];
+    for(int i = 1; i < 4; i++) {
+        if(lo[0][i] < xmin) xmin = lo[0][i];
+        if(lo[1][i] < ymin) ymin = lo[1][i];
+        if(lo[2][i] < zmin) zmin = lo[2][i];
+        if(hi[0][i] > xmax) xmax = hi[0][i];
+        if(hi[1][i] > ymax) ymax = hi[1][i];
+    }
+#else
+    xmin = ymin = zmin = FLT_MAX;
+    xmax = ymax = -FLT_MAX;
+    for(int i = 0; i < 8; i++) {
+        float px = (i&1) ? bmax.x : bmin.x;
+        float py = (i&2) ? bmax.y : bmin.y;
+        float pz = (i&4) ? bmax.z : bmin.z;
+        float w = m[3]*px + m[7]*py + m[11]*pz + m[15];
+        if(w < CLIP_MIN_W)
+            return false;
+        float invW = 1.0f/w;
+        float x = (m[0]*px + m[4]*py + m[8]*pz  + m[12])*invW;
+        float y = (m[1]*px + m[5]*py + m[9]*pz  + m[13])*invW;
+        float z = (m[2]*px + m[6]*py + m[10]*pz + m[14])*invW;
+        if(x < xmin) xmin = x;
+        if(x > xmax) xmax = x;
+        if(y < ymin) ymin = y;
+        if(y > ymax) ymax = y;
+        if(z < zmin) zmin = z;
+    }
+#endif
+
+    // Normalized device coordinates to pixels and depth
+    xmin = (xmin*0.5f + 0.5f)*m_Width;
+    xmax = (xmax*0.5f + 0.5f)*m_Width;
+    ymin = (ymin*0.5f + 0.5f)*m_Height;
+    ymax = (ymax*0.5f + 0.5f)*m_Height;
+    zmin = zmin*0.5f + 0.5f;
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           TestBox
+// Arguments:      Object to clip space matrix and an object space bounding
+//                 box
+// Returns:        false if the box is certainly hidden, true otherwise
+/////////////////////////////////////////////////////////////////////////////
+bool Rasterizer::TestBox(const Matrix &mvp,const Point3 &bmin,const Point3 &bmax)
+{
+    float xmin, ymin, xmax, ymax, zmin;
+    if(!ProjectBox(mvp,bmin,bmax,xmin,ymin,xmax,ymax,zmin)) {
+        // Crosses the eye plane, so we can't bound it on screen
+        m_Stats.QueriesIssued++;
+        return true;
+    }
+    return TestRect(xmin,ymin,xmax,ymax,zmin);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           DrawTriangle
+// Arguments:      Three window space vertices and a packed RGBA color
+// Returns:        true if any pixel was written
+// Side Effects:   Writes color and depth and keeps the Hi-Z up to date
+/////////////////////////////////////////////////////////////////////////////
+bool Rasterizer::DrawTriangle(const Point3 &a,const Point3 &b,const Point3 &c,unsigned int color)
+{
+    return Rasterize(a,b,c,color,0);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           ShadeBlockRow
+// Arguments:      The triangle's texture planes, the window position of the
+//                 first pixel center and where to put RASTER_BLOCK_SIZE
+//                 colors
+// Returns:        none
+// Notes:          The level of detail comes from the exact derivatives of
+//                 u = U/Q and v = V/Q at each pixel: du/dx = (Ux - u*Qx)/Q
+/////////////////////////////////////////////////////////////////////////////
+void Rasterizer::ShadeBlockRow(const TexPlanes &p,float x,float y,unsigned int *out) const
+{
+    CSE167_ALIGN(16) float u[RASTER_BLOCK_SIZE], v[RASTER_BLOCK_SIZE], lod[RASTER_BLOCK_SIZE];
+    float w = (float)m_Texture->GetWidth(), h = (float)m_Texture->GetHeight();
+    float U = p.U[0] + p.U[1]*x + p.U[2]*y;
+    float V = p.V[0] + p.V[1]*x + p.V[2]*y;
+    float Q = p.Q[0] + p.Q[1]*x + p.Q[2]*y;
+    for(int i = 0; i < RASTER_BLOCK_SIZE; i++, U += p.U[1], V += p.V[1], Q += p.Q[1]) {
+        float invQ = 1.0f/Q;
+        float s = U*invQ, t = V*invQ;
+        float dsdx = (p.U[1] - s*p.Q[1])*invQ*w, dtdx = (p.V[1] - t*p.Q[1])*invQ*h;
+        float dsdy = (p.U[2] - s*p.Q[2])*invQ*w, dtdy = (p.V[2] - t*p.Q[2])*invQ*h;
+        float rx = dsdx*dsdx + dtdx*dtdx, ry = dsdy*dsdy + dtdy*dtdy;
+        u[i] = s;
+        v[i] = t;
+        lod[i] = Texture::ComputeLod(rx > ry ? rx : ry);
+    }
+    for(int i = 0; i < RASTER_BLOCK_SIZE; i += 4)
+        m_Texture->Sample4(u+i,v+i,lod+i,out+i);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Rasterize
+// Arguments:      Three window space vertices, a packed RGBA color, and
+//                 u/w, v/w and 1/w for each vertex (or 0)
+// Returns:        true if any pixel was written
+// Side Effects:   See DrawTriangle
+/////////////////////////////////////////////////////////////////////////////
+bool Rasterizer::Rasterize(const Point3 &a,const Point3 &b0,const Point3 &c0,unsigned int color,const float *tex0)
+{
+    m_Stats.TrianglesIn++;
+
+    Point3 b = b0, c = c0;
+    float tex[9];
+    if(tex0)
+        memcpy(tex,tex0,sizeof(tex));
+    float area = (b.x-a.x)*(c.y-a.y) - (b.y-a.y)*(c.x-a.x);
+    if(area <= 0.0f) {
+        if(m_CullBackFaces || area == 0.0f) {
+            m_Stats.TrianglesCulled++;
+            return false;
+        }
+        b = c0; c = b0;
+        area = -area;
+        if(tex0) {
+            memcpy(tex+3,tex0+6,3*sizeof(float));
+            memcpy(tex+6,tex0+3,3*sizeof(float));
+        }
+    }
+
+    // Screen bounding box (inclusive pixels) and depth range
+    int x0 = (int)floorf(Min3(a.x,b.x,c.x)), x1 = (int)floorf(Max3(a.x,b.x,c.x));
+    int y0 = (int)floorf(Min3(a.y,b.y,c.y)), y1 = (int)floorf(Max3(a.y,b.y,c.y));
+    if(x0 < 0) x0 = 0;
+    if(y0 < 0) y0 = 0;
+    if(x1 > m_Width-1) x1 = m_Width-1;
+    if(y1 > m_Height-1) y1 = m_Height-1;
+    if(x0 > x1 || y0 > y1) {
+        m_Stats.TrianglesCulled++;
+        return false;
+    }
+    float zmin = Min3(a.z,b.z,c.z), zmax = Max3(a.z,b.z,c.z);
+
+    // Whole triangle test against the Hi-Z
+    if(!RectVisible(m_TileMin,m_TileMax,m_TilesX,m_BlockMax,m_BlocksX,x0,y0,x1,y1,zmin)) {
+        m_Stats.TrianglesOccluded++;
+        return false;
+    }
+
+    RasterEdge e0, e1, e2;
+    e0.Setup(a,b);
+    e1.Setup(b,c);
+    e2.Setup(c,a);
+
+    // Depth plane z(x,y) = a.z + dzdx*(x-a.x) + dzdy*(y-a.y)
+    float invArea = 1.0f/area;
+    float dzdx = ((b.z-a.z)*(c.y-a.y) - (c.z-a.z)*(b.y-a.y))*invArea;
+    float dzdy = ((c.z-a.z)*(b.x-a.x) - (b.z-a.z)*(c.x-a.x))*invArea;
+    float zc = a.z - dzdx*a.x - dzdy*a.y;
+
+    // The same for the texture coordinates
+    bool textured = tex0 && m_Texture;
+    TexPlanes planes;
+    if(textured) {
+        float *plane[3] = {planes.U,planes.V,planes.Q};
+        for(int k = 0; k < 3; k++) {
+            float ta = tex[k], tb = tex[3+k], tc = tex[6+k];
+            float dx = ((tb-ta)*(c.y-a.y) - (tc-ta)*(b.y-a.y))*invArea;
+            float dy = ((tc-ta)*(b.x-a.x) - (tb-ta)*(c.x-a.x))*invArea;
+            plane[k][0] = ta - dx*a.x - dy*a.y;
+            plane[k][1] = dx;
+            plane[k][2] = dy;
+        }
+    }
+
+    int bx0 = x0/RASTER_BLOCK_SIZE, bx1 = x1/RASTER_BLOCK_SIZE;
+    int by0 = y0/RASTER_BLOCK_SIZE, by1 = y1/RASTER_BLOCK_SIZE;
+    bool wrote = false;
+
+    for(int by = by0; by <= by1; by++) {
+        for(int bx = bx0; bx <= bx1; bx++) {
+            int bi = by*m_BlocksX+bx;
+            if(zmin >= m_BlockMax[bi]) {
+                m_Stats.BlocksOccluded++;
+                continue;
+            }
+
+            // Classify the block against the edges using its corner pixels
+            int px = bx*RASTER_BLOCK_SIZE, py = by*RASTER_BLOCK_SIZE;
+            float fx0 = px+0.5f, fy0 = py+0.5f;
+            float fx1 = fx0+(RASTER_BLOCK_SIZE-1), fy1 = fy0+(RASTER_BLOCK_SIZE-1);
+            const RasterEdge *edges[3] = {&e0,&e1,&e2};
+            bool outside = false, covered = true;
+            for(int e = 0; e < 3; e++) {
+                const RasterEdge &E = *edges[e];
+                float v00 = E.Eval(fx0,fy0), v10 = E.Eval(fx1,fy0);
+                float v01 = E.Eval(fx0,fy1), v11 = E.Eval(fx1,fy1);
+                float vmax = Max3(v00,v10,v01), vmin = Min3(v00,v10,v01);
+                if(v11 > vmax) vmax = v11;
+                if(v11 < vmin) vmin = v11;
+                if(vmax < E.Bias) {outside = true; break;}
+                if(vmin < E.Bias) covered = false;
+            }
+            if(outside)
+                continue;
+
+            if(covered && zmax < m_BlockMin[bi] &&
+               px+RASTER_BLOCK_SIZE <= m_Width && py+RASTER_BLOCK_SIZE <= m_Height) {
+                // In front of everything in the block: no depth test needed
+                float bmin = FLT_MAX, bmax = -FLT_MAX;
+                for(int y = 0; y < RASTER_BLOCK_SIZE; y++) {
+                    unsigned int *cp = m_Color + (py+y)*m_Stride + px;
+                    float *dp = m_Depth + (py+y)*m_Stride + px;
+                    float z = zc + dzdx*fx0 + dzdy*(fy0+y);
+                    if(textured)
+                        ShadeBlockRow(planes,fx0,fy0+y,cp);
+                    for(int x = 0; x < RASTER_BLOCK_SIZE; x++, z += dzdx) {
+                        if(!textured)
+                            cp[x] = color;
+                        dp[x] = z;
+                        if(z < bmin) bmin = z;
+                        if(z > bmax) bmax = z;
+                    }
+                }
+                m_BlockMin[bi] = bmin;
+                m_BlockMax[bi] = bmax;
+                m_Stats.BlocksAccepted++;
+                m_Stats.PixelsShaded += RASTER_BLOCK_SIZE*RASTER_BLOCK_SIZE;
+                wrote = true;
+                continue;
+            }
+
+            // Partially covered or partially occluded: per-pixel tests
+            int xs = px > x0 ? px : x0, xe = px+RASTER_BLOCK_SIZE-1 < x1 ? px+RASTER_BLOCK_SIZE-1 : x1;
+            int ys = py > y0 ? py : y0, ye = py+RASTER_BLOCK_SIZE-1 < y1 ? py+RASTER_BLOCK_SIZE-1 : y1;
+            int written = 0;
+            unsigned int shaded[RASTER_BLOCK_SIZE];
+            for(int y = ys; y <= ye; y++) {
+                float fx = xs+0.5f, fy = y+0.5f;
+                float w0 = e0.Eval(fx,fy), w1 = e1.Eval(fx,fy), w2 = e2.Eval(fx,fy);
+                float z = zc + dzdx*fx + dzdy*fy;
+                unsigned int *cp = m_Color + y*m_Stride;
+                float *dp = m_Depth + y*m_Stride;
+                if(textured)
+                    ShadeBlockRow(planes,px+0.5f,fy,shaded);
+                for(int x = xs; x <= xe; x++) {
+                    if(w0 >= e0.Bias && w1 >= e1.Bias && w2 >= e2.Bias && z < dp[x]) {
+                        cp[x] = textured ? shaded[x-px] : color;
+                        dp[x] = z;
+                        written++;
+                    }
+                    w0 += e0.A; w1 += e1.A; w2 += e2.A;
+                    z += dzdx;
+                }
+            }
+            if(written) {
+                UpdateBlock(bx,by);
+                m_Stats.PixelsShaded += written;
+                wrote = true;
+            }
+        }
+    }
+
+    if(wrote) {
+        for(int ty = by0/RASTER_TILE_BLOCKS; ty <= by1/RASTER_TILE_BLOCKS; ty++)
+            for(int tx = bx0/RASTER_TILE_BLOCKS; tx <= bx1/RASTER_TILE_BLOCKS; tx++)
+                UpdateTile(tx,ty);
+    }
+    return wrote;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           ToWindow
+// Arguments:      A clip space vertex with w >= CLIP_MIN_W
+// Returns:        Its window space position
+/////////////////////////////////////////////////////////////////////////////
+Point3 Rasterizer::ToWindow(const float *clip) const
+{
+    float invW = 1.0f/clip[3];
+    return Point3((clip[0]*invW*0.5f + 0.5f)*m_Width,
+                  (clip[1]*invW*0.5f + 0.5f)*m_Height,
+                   clip[2]*invW*0.5f + 0.5f);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           DrawTriangles
+// Arguments:      Object to clip space matrix, vertex positions, and an
+//                 indexed triangle list (3 indices per triangle)
+// Returns:        none
+// Side Effects:   Draws every triangle with DrawTriangle
+// Notes:          The outcodes reject or accept most triangles outright.
+//                 The rest are clipped and drawn as fans; a clipped
+//                 triangle counts once in TrianglesClipped and once in
+//                 TrianglesIn for each triangle of its fan.  Texture
+//                 coordinates are clipped along with the positions.
+/////////////////////////////////////////////////////////////////////////////
+void Rasterizer::DrawTriangles(const Matrix &mvp,const Point3 *verts,int vertCount,
+                               const unsigned int *indices,int triCount,unsigned int color,
+                               const float *texCoords)
+{
+    if(vertCount <= 0)
+        return;
+    const float *m = mvp.m_m;
+    bool textured = texCoords && m_Texture;
+    m_Clip.resize(vertCount*4);
+    m_Window.resize(vertCount*3);
+    m_Codes.resize(vertCount);
+    if(textured)
+        m_Tex.resize(vertCount*3);
+    float *clip = &m_Clip[0], *window = &m_Window[0];
+    float *tex = textured ? &m_Tex[0] : 0;
+    unsigned int *codes = &m_Codes[0];
+
+    for(int i = 0; i < vertCount; i++) {
+        const Point3 &p = verts[i];
+        float *out = clip + 4*i;
+        out[0] = m[0]*p.x + m[4]*p.y + m[8]*p.z  + m[12];
+        out[1] = m[1]*p.x + m[5]*p.y + m[9]*p.z  + m[13];
+        out[2] = m[2]*p.x + m[6]*p.y + m[10]*p.z + m[14];
+        out[3] = m[3]*p.x + m[7]*p.y + m[11]*p.z + m[15];
+    }
+    ComputeClipCodes(clip,vertCount,m_GuardX,m_GuardY,codes);
+
+    // Window space for every vertex that can be divided by its w
+    for(int i = 0; i < vertCount; i++) {
+        if(codes[i] & CLIP_EYE)
+            continue;
+        Point3 p = ToWindow(clip + 4*i);
+        window[3*i+0] = p.x;
+        window[3*i+1] = p.y;
+        window[3*i+2] = p.z;
+        if(textured) {
+            float invW = 1.0f/clip[4*i+3];
+            tex[3*i+0] = texCoords[2*i+0]*invW;
+            tex[3*i+1] = texCoords[2*i+1]*invW;
+            tex[3*i+2] = invW;
+        }
+    }
+
+    // Clipped vertices are x,y,z,w,u,v
+    const int floats = textured ? 6 : 4;
+    float in[3][6], polygon[6*CLIP_MAX_VERTS], polyTex[3*CLIP_MAX_VERTS];
+    for(int t = 0; t < triCount; t++) {
+        unsigned int i0 = indices[3*t+0], i1 = indices[3*t+1], i2 = indices[3*t+2];
+        unsigned int c0 = codes[i0], c1 = codes[i1], c2 = codes[i2];
+        if(c0 & c1 & c2) {
+            m_Stats.TrianglesIn++;
+            m_Stats.TrianglesCulled++;
+            continue;
+        }
+        if(!((c0 | c1 | c2) & CLIP_MUST_CLIP)) {
+            const float *v0 = window + 3*i0, *v1 = window + 3*i1, *v2 = window + 3*i2;
+            float uvq[9];
+            if(textured) {
+                memcpy(uvq,tex + 3*i0,3*sizeof(float));
+                memcpy(uvq+3,tex + 3*i1,3*sizeof(float));
+                memcpy(uvq+6,tex + 3*i2,3*sizeof(float));
+            }
+            Rasterize(Point3(v0[0],v0[1],v0[2]),Point3(v1[0],v1[1],v1[2]),Point3(v2[0],v2[1],v2[2]),
+                      color,textured ? uvq : 0);
+            continue;
+        }
+
+        m_Stats.TrianglesClipped++;
+        unsigned int tri[3] = {i0,i1,i2};
+        for(int k = 0; k < 3; k++) {
+            memcpy(in[k],clip + 4*tri[k],4*sizeof(float));
+            if(textured) {
+                in[k][4] = texCoords[2*tri[k]+0];
+                in[k][5] = texCoords[2*tri[k]+1];
+            }
+        }
+        int n = ClipTriangle(in[0],in[1],in[2],floats,c0 | c1 | c2,m_GuardX,m_GuardY,polygon);
+        if(n == 0) {
+            m_Stats.TrianglesIn++;
+            m_Stats.TrianglesCulled++;
+            continue;
+        }
+        Point3 corners[CLIP_MAX_VERTS];
+        for(int k = 0; k < n; k++) {
+            const float *v = polygon + floats*k;
+            corners[k] = ToWindow(v);
+            if(textured) {
+                float invW = 1.0f/v[3];
+                polyTex[3*k+0] = v[4]*invW;
+                polyTex[3*k+1] = v[5]*invW;
+                polyTex[3*k+2] = invW;
+            }
+        }
+        for(int k = 2; k < n; k++) {
+            float uvq[9];
+            if(textured) {
+                memcpy(uvq,polyTex,3*sizeof(float));
+                memcpy(uvq+3,polyTex + 3*(k-1),3*sizeof(float));
+                memcpy(uvq+6,polyTex + 3*k,3*sizeof(float));
+            }
+            Rasterize(corners[0],corners[k-1],corners[k],color,textured ? uvq : 0);
+        }
+    }
+}
@@ -0,0 +1,188 @@
+/////////////////////////////////////////////////////////////////////////////
+// raster.h
+//
+/////////////////////////////////////
+// Classes declared:
+//
+// RasterStats: Counters describing how much work the last frame did and how
+//              much was skipped by the hierarchical depth buffer.
+//
+// Rasterizer:  A software triangle rasterizer with a color buffer, a depth
+//              buffer and a hierarchical depth buffer (Hi-Z) on top of it.
+//
+// The Hi-Z keeps the min and max depth of every 8x8 block of pixels and of
+// every 32x32 tile (a 4x4 group of blocks).  It is kept up to date as
+// triangles are drawn and is used to:
+//
+//  - reject whole triangles whose nearest depth is behind everything already
+//    drawn under their screen bounding box,
+//  - skip 8x8 blocks inside a triangle that are already fully occluded,
+//  - write fully covered blocks that are in front of everything in them
+//    without any per-pixel depth test,
+//  - answer occlusion queries (TestRect / TestBox) for an object's screen
+//    space bounds before the object is drawn.
+//
+// DrawTriangles() clips in homogeneous space first (see clip.h): triangles
+// wholly outside a frustum plane are rejected, triangles crossing the near
+// or far plane are cut, and the sides are left to the viewport bounds as
+// long as the triangle stays inside a RASTER_GUARD_BAND pixel guard band.
+//
+// With a Texture set, triangles drawn with texture coordinates take their
+// colors from it instead: perspective correct, trilinear filtered, with
+// the level of detail worked out for every pixel.  Four pixels are sampled
+// at a time.
+//
+// Conventions: window coordinates have their origin in the lower left corner
+// (as in glViewport) and depth runs from 0 (near) to 1 (far), so a fragment
+// passes the depth test when it is LESS than the stored depth.
+//
+/////////////////////////////////////
+// Common Operations Supported:
+//
+// Rasterizer r(360,360);
+// r.Clear();                                  // Reset color, depth and Hi-Z
+// r.DrawTriangle(a,b,c,color);                // Window space triangle
+// r.DrawTriangles(mvp,verts,idx,ntris,color); // Object space, full 4x4 mvp
+// r.SetTexture(&texture);
+// r.DrawTriangles(mvp,verts,idx,ntris,color,uvs); // Textured
+// if(r.TestBox(mvp,bmin,bmax)) draw(...);     // Occlusion query
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSE167_RASTER_H_
+#define CSE167_RASTER_H_
+
+#include "matrix.h"
+#include <vector>
+
+class Texture;
+
+#define RASTER_BLOCK_SIZE   8   // Pixels per side of a Hi-Z block
+#define RASTER_TILE_SIZE    32  // Pixels per side of a Hi-Z tile
+#define RASTER_TILE_BLOCKS  (RASTER_TILE_SIZE/RASTER_BLOCK_SIZE)
+#define RASTER_GUARD_BAND   2048    // Pixels past each side drawn without clipping
+
+/////////////////////////////////////////////////////////////////////////////
+// RasterStats
+//
+struct RasterStats {
+    void Reset()                                    {memset(this,0,sizeof(*this));}
+
+    int TrianglesIn;        // Triangles handed to DrawTriangle
+    int TrianglesCulled;    // Back facing, degenerate or outside the frustum
+    int TrianglesClipped;   // Cut against near/far or the guard band
+    int TrianglesOccluded;  // Rejected whole by the Hi-Z
+    int BlocksOccluded;     // 8x8 blocks skipped by the Hi-Z
+    int BlocksAccepted;     // 8x8 blocks written without a depth test
+    int PixelsShaded;       // Pixels that passed the depth test
+    int QueriesIssued;      // Calls to TestRect/TestBox
+    int QueriesOccluded;    // Queries that reported "not visible"
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// Rasterizer
+//
+class Rasterizer {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    Rasterizer();
+    Rasterizer(int width,int height);
+    ~Rasterizer();
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // Reallocates all buffers.  Contents are undefined until Clear().
+    void Resize(int width,int height);
+
+    // Sets every pixel to 'color' and 'depth' and resets the Hi-Z to match
+    void Clear(unsigned int color=0,float depth=1.0f);
+
+    // Draws a triangle given in window space (x,y in pixels, z in [0,1]).
+    // Returns true if any pixel was written.
+    bool DrawTriangle(const Point3 &a,const Point3 &b,const Point3 &c,unsigned int color);
+
+    // Transforms 'verts' with the full 4x4 matrix 'mvp' (object to clip
+    // space) and draws the indexed triangle list, clipped to the frustum.
+    // 'texCoords' (u,v for each vertex) textures it if a Texture is set.
+    void DrawTriangles(const Matrix &mvp,const Point3 *verts,int vertCount,
+                       const unsigned int *indices,int triCount,unsigned int color,
+                       const float *texCoords=0);
+
+    // The texture DrawTriangles uses, or 0.  It must stay alive while set.
+    void SetTexture(const Texture *texture)         {m_Texture = texture;}
+
+    // Occlusion query against the Hi-Z.  Returns false only if every pixel
+    // of the window space rectangle is already nearer than 'zmin'.
+    bool TestRect(float xmin,float ymin,float xmax,float ymax,float zmin);
+
+    // Occlusion query for an object space bounding box transformed by 'mvp'.
+    // Boxes crossing the eye plane are always reported visible.
+    bool TestBox(const Matrix &mvp,const Point3 &bmin,const Point3 &bmax);
+
+    // Window space rectangle and nearest depth of an object space box
+    // under 'mvp'.  Returns false if the box crosses the eye plane, when
+    // it can't be bounded on screen.
+    bool ProjectBox(const Matrix &mvp,const Point3 &bmin,const Point3 &bmax,
+                    float &xmin,float &ymin,float &xmax,float &ymax,float &zmin) const;
+
+    // Back face culling of counter-clockwise front faces, as with GL_CULL_FACE
+    void SetCullBackFaces(bool cull)                {m_CullBackFaces=cull;}
+
+    // Accessors
+    int GetWidth() const                            {return m_Width;}
+    int GetHeight() const                           {return m_Height;}
+    int GetStride() const                           {return m_Stride;}
+    const unsigned int *GetColorBuffer() const      {return m_Color;}
+    const float *GetDepthBuffer() const             {return m_Depth;}
+    const float *GetBlockMax() const                {return m_BlockMax;}
+    int GetBlocksX() const                          {return m_BlocksX;}
+    int GetBlocksY() const                          {return m_BlocksY;}
+    RasterStats &GetStats()                         {return m_Stats;}
+
+private:
+    // u/w, v/w and 1/w as planes over the window, c + dx*x + dy*y
+    struct TexPlanes {
+        float U[3], V[3], Q[3];
+    };
+
+    // 'tex' is u/w, v/w and 1/w for each vertex, or 0 for flat color
+    bool Rasterize(const Point3 &a,const Point3 &b,const Point3 &c,unsigned int color,const float *tex);
+    void ShadeBlockRow(const TexPlanes &planes,float x,float y,unsigned int *out) const;
+    void Free();
+    void UpdateBlock(int bx,int by);
+    void UpdateTile(int tx,int ty);
+    Point3 ToWindow(const float *clip) const;
+
+    // Not copyable
+    Rasterizer(const Rasterizer &);
+    Rasterizer &operator=(const Rasterizer &);
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    int m_Width, m_Height;          // Visible size in pixels
+    int m_Stride, m_Rows;           // Allocated size, padded to whole tiles
+    int m_BlocksX, m_BlocksY;
+    int m_TilesX, m_TilesY;
+    bool m_CullBackFaces;
+    float m_GuardX, m_GuardY;       // Guard band in normalized device coordinates
+    const Texture *m_Texture;
+
+    unsigned int *m_Color;
+    float *m_Depth;
+    float *m_BlockMin, *m_BlockMax;
+    float *m_TileMin, *m_TileMax;
+
+    // Scratch space for DrawTriangles
+    std::vector<float> m_Clip, m_Window, m_Tex;
+    std::vector<unsigned int> m_Codes;
+    RasterStats m_Stats;
+};
+
+#endif
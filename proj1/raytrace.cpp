@@ -0,0 +1,869 @@
+/////////////////////////////////////////////////////////////////////////////
+// raytrace.cpp
+/////////////////////////////////////
+// BVH ray casting with SSE ray packets.
+/////////////////////////////////////////////////////////////////////////////
+
+#include "raytrace.h"
+#include "mesh.h"
+#include "compress.h"
+#include "jobs.h"
+#include "timer.h"
+#include <algorithm>
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           RayStats::Print
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Prints one line per group of counters
+/////////////////////////////////////////////////////////////////////////////
+void RayStats::Print() const
+{
+    printf("ray scene: %d triangles, %d nodes, built in %.3f ms\n",Triangles,Nodes,BuildMs);
+    printf("ray trace: %dx%d, %d primary rays (%d hit), %d shadow rays, %d packets, %.1f node and %.1f triangle tests per packet\n",
+           Width,Height,PrimaryRays,Hits,ShadowRays,Packets,
+           Packets ? (double)NodeVisits/Packets : 0.0,Packets ? (double)TriangleTests/Packets : 0.0);
+    printf("ray trace: %.3f ms, %.2f Mrays/s\n",RenderMs,RaysPerSecond*1e-6);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           HitBox
+// Arguments:      A box, a ray's origin and reciprocal direction, and how
+//                 far along it to look
+// Returns:        Whether the ray enters the box in [0,tMax]
+// Notes:          The slab test, with the same comparisons in the same
+//                 order as HitBox4, so one ray and a packet agree
+/////////////////////////////////////////////////////////////////////////////
+static inline float RayMin(float a,float b)         {return a < b ? a : b;}
+static inline float RayMax(float a,float b)         {return a > b ? a : b;}
+
+static inline bool HitBox(const float *lo,const float *hi,const float *o,const float *inv,float tMax)
+{
+    float x0 = (lo[0] - o[0])*inv[0], x1 = (hi[0] - o[0])*inv[0];
+    float y0 = (lo[1] - o[1])*inv[1], y1 = (hi[1] - o[1])*inv[1];
+    float z0 = (lo[2] - o[2])*inv[2], z1 = (hi[2] - o[2])*inv[2];
+    float tNear = RayMax(RayMax(RayMin(x0,x1),RayMin(y0,y1)),RayMax(RayMin(z0,z1),0.0f));
+    float tFar = RayMin(RayMin(RayMax(x0,x1),RayMax(y0,y1)),RayMin(RayMax(z0,z1),tMax));
+    return tNear <= tFar;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           HitTriangle
+// Arguments:      A triangle's corner and the two edges from it, a ray,
+//                 how far along it to look, and where to put the hit
+// Returns:        Whether the ray hits the triangle in (RAY_EPSILON,tMax)
+// Notes:          Moller-Trumbore.  A triangle edge on to the ray has a
+//                 determinant of 0, which turns u, v and t into infinities
+//                 or NaNs that fail the tests below, so there is no
+//                 separate check for it.
+/////////////////////////////////////////////////////////////////////////////
+static inline bool HitTriangle(const float *v0,const float *e1,const float *e2,
+                               const float *o,const float *d,float tMax,float &t)
+{
+    float px = d[1]*e2[2] - d[2]*e2[1];
+    float py = d[2]*e2[0] - d[0]*e2[2];
+    float pz = d[0]*e2[1] - d[1]*e2[0];
+    float inv = 1.0f/(e1[0]*px + e1[1]*py + e1[2]*pz);
+    float sx = o[0] - v0[0], sy = o[1] - v0[1], sz = o[2] - v0[2];
+    float u = (sx*px + sy*py + sz*pz)*inv;
+    float qx = sy*e1[2] - sz*e1[1];
+    float qy = sz*e1[0] - sx*e1[2];
+    float qz = sx*e1[1] - sy*e1[0];
+    float v = (d[0]*qx + d[1]*qy + d[2]*qz)*inv;
+    float h = (e2[0]*qx + e2[1]*qy + e2[2]*qz)*inv;
+    if(u >= 0.0f && v >= 0.0f && u + v <= 1.0f && h > RAY_EPSILON && h < tMax) {
+        t = h;
+        return true;
+    }
+    return false;
+}
+
+#ifdef CSE167_SSE
+// A packet's rays in registers
+struct RayLanes {
+    __m128 Ox, Oy, Oz;
+    __m128 Dx, Dy, Dz;
+    __m128 Ix, Iy, Iz;              // 1/D
+};
+
+static inline void LoadLanes(const RayPacket &p,RayLanes &r)
+{
+    __m128 one = _mm_set1_ps(1.0f);
+    r.Ox = _mm_load_ps(p.Ox); r.Oy = _mm_load_ps(p.Oy); r.Oz = _mm_load_ps(p.Oz);
+    r.Dx = _mm_load_ps(p.Dx); r.Dy = _mm_load_ps(p.Dy); r.Dz = _mm_load_ps(p.Dz);
+    r.Ix = _mm_div_ps(one,r.Dx); r.Iy = _mm_div_ps(one,r.Dy); r.Iz = _mm_div_ps(one,r.Dz);
+}
+
+static inline __m128 Select(__m128 mask,__m128 a,__m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask,a),_mm_andnot_ps(mask,b));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           HitBox4
+// Arguments:      A box, four rays and how far along each to look
+// Returns:        A bit per ray that enters the box
+/////////////////////////////////////////////////////////////////////////////
+static inline int HitBox4(const float *lo,const float *hi,const RayLanes &r,__m128 tMax)
+{
+    __m128 x0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(lo[0]),r.Ox),r.Ix);
+    __m128 x1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(hi[0]),r.Ox),r.Ix);
+    __m128 y0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(lo[1]),r.Oy),r.Iy);
+    __m128 y1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(hi[1]),r.Oy),r.Iy);
+    __m128 z0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(lo[2]),r.Oz),r.Iz);
+    __m128 z1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(hi[2]),r.Oz),r.Iz);
+    __m128 tNear = _mm_max_ps(_mm_max_ps(_mm_min_ps(x0,x1),_mm_min_ps(y0,y1)),
+                              _mm_max_ps(_mm_min_ps(z0,z1),_mm_setzero_ps()));
+    __m128 tFar = _mm_min_ps(_mm_min_ps(_mm_max_ps(x0,x1),_mm_max_ps(y0,y1)),
+                             _mm_min_ps(_mm_max_ps(z0,z1),tMax));
+    return _mm_movemask_ps(_mm_cmple_ps(tNear,tFar));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           HitTriangle4
+// Arguments:      A triangle, four rays, how far along each to look and
+//                 where to put the hits
+// Returns:        A mask lane per ray that hits the triangle
+// Notes:          HitTriangle four rays at a time
+/////////////////////////////////////////////////////////////////////////////
+static inline __m128 HitTriangle4(const float *v0,const float *e1,const float *e2,
+                                  const RayLanes &r,__m128 tMax,__m128 &t)
+{
+    __m128 e1x = _mm_set1_ps(e1[0]), e1y = _mm_set1_ps(e1[1]), e1z = _mm_set1_ps(e1[2]);
+    __m128 e2x = _mm_set1_ps(e2[0]), e2y = _mm_set1_ps(e2[1]), e2z = _mm_set1_ps(e2[2]);
+    __m128 px = _mm_sub_ps(_mm_mul_ps(r.Dy,e2z),_mm_mul_ps(r.Dz,e2y));
+    __m128 py = _mm_sub_ps(_mm_mul_ps(r.Dz,e2x),_mm_mul_ps(r.Dx,e2z));
+    __m128 pz = _mm_sub_ps(_mm_mul_ps(r.Dx,e2y),_mm_mul_ps(r.Dy,e2x));
+    __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x,px),_mm_mul_ps(e1y,py)),_mm_mul_ps(e1z,pz));
+    __m128 inv = _mm_div_ps(_mm_set1_ps(1.0f),det);
+    __m128 sx = _mm_sub_ps(r.Ox,_mm_set1_ps(v0[0]));
+    __m128 sy = _mm_sub_ps(r.Oy,_mm_set1_ps(v0[1]));
+    __m128 sz = _mm_sub_ps(r.Oz,_mm_set1_ps(v0[2]));
+    __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx,px),_mm_mul_ps(sy,py)),_mm_mul_ps(sz,pz)),inv);
+    __m128 qx = _mm_sub_ps(_mm_mul_ps(sy,e1z),_mm_mul_ps(sz,e1y));
+    __m128 qy = _mm_sub_ps(_mm_mul_ps(sz,e1x),_mm_mul_ps(sx,e1z));
+    __m128 qz = _mm_sub_ps(_mm_mul_ps(sx,e1y),_mm_mul_ps(sy,e1x));
+    __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(r.Dx,qx),_mm_mul_ps(r.Dy,qy)),_mm_mul_ps(r.Dz,qz)),inv);
+    t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x,qx),_mm_mul_ps(e2y,qy)),_mm_mul_ps(e2z,qz)),inv);
+
+    __m128 zero = _mm_setzero_ps();
+    __m128 hit = _mm_and_ps(_mm_cmpge_ps(u,zero),_mm_cmpge_ps(v,zero));
+    hit = _mm_and_ps(hit,_mm_cmple_ps(_mm_add_ps(u,v),_mm_set1_ps(1.0f)));
+    hit = _mm_and_ps(hit,_mm_cmpgt_ps(t,_mm_set1_ps(RAY_EPSILON)));
+    return _mm_and_ps(hit,_mm_cmplt_ps(t,tMax));
+}
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           RayScene constructor
+/////////////////////////////////////////////////////////////////////////////
+RayScene::RayScene()
+{
+    m_BuildMs = 0.0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Clear
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Drops the triangles and the tree
+/////////////////////////////////////////////////////////////////////////////
+void RayScene::Clear()
+{
+    m_Triangles.clear();
+    m_Nodes.clear();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           AddTriangles
+// Arguments:      Vertices, three indices per triangle, the number of
+//                 triangles, their world matrix and their color
+// Returns:        none
+// Side Effects:   Appends the triangles in world space.  Build() must be
+//                 called before tracing them.
+/////////////////////////////////////////////////////////////////////////////
+void RayScene::AddTriangles(const Point3 *verts,const unsigned int *indices,int triCount,
+                            const Matrix &world,unsigned int color)
+{
+    for(int i = 0; i < triCount; i++) {
+        Point3 a, b, c;
+        world.Transform(verts[indices[3*i]],a);
+        world.Transform(verts[indices[3*i+1]],b);
+        world.Transform(verts[indices[3*i+2]],c);
+        Vector3 e1 = b - a, e2 = c - a, n;
+        n.Cross(e1,e2);
+        float len = n.Mag();
+        if(len <= 0.0f)
+            continue;
+        n *= 1.0f/len;
+
+        Triangle t;
+        t.V0[0] = a.x;  t.V0[1] = a.y;  t.V0[2] = a.z;
+        t.E1[0] = e1.x; t.E1[1] = e1.y; t.E1[2] = e1.z;
+        t.E2[0] = e2.x; t.E2[1] = e2.y; t.E2[2] = e2.z;
+        t.N[0] = n.x;   t.N[1] = n.y;   t.N[2] = n.z;
+        t.Color = color;
+        m_Triangles.push_back(t);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           AddMesh
+// Arguments:      A mesh, its world matrix and its color
+// Returns:        none
+// Notes:          Positions are gathered out of the SoA arrays a triangle
+//                 at a time, so no copy of the mesh is made
+/////////////////////////////////////////////////////////////////////////////
+void RayScene::AddMesh(const Mesh &mesh,const Matrix &world,unsigned int color)
+{
+    if(mesh.IsEmpty())
+        return;
+    const float *x = mesh.GetX(), *y = mesh.GetY(), *z = mesh.GetZ();
+    const unsigned int *idx = mesh.GetIndices();
+    Point3 corners[3];
+    static const unsigned int order[3] = {0,1,2};
+    for(int i = 0; i < mesh.GetTriangleCount(); i++) {
+        for(int k = 0; k < 3; k++) {
+            unsigned int v = idx[3*i + k];
+            corners[k] = Point3(x[v],y[v],z[v]);
+        }
+        AddTriangles(corners,order,1,world,color);
+    }
+}
+
+void RayScene::AddMesh(const CompressedMesh &mesh,const Matrix &world,unsigned int color)
+{
+    int n = mesh.GetVertexCount();
+    if(n == 0)
+        return;
+    m_Positions.resize(3*n);
+    float *x = &m_Positions[0], *y = x + n, *z = y + n;
+    mesh.TransformPositions(world,x,y,z);
+    Point3 corners[3];
+    static const unsigned int order[3] = {0,1,2};
+    for(int i = 0; i + 3 <= mesh.GetIndexCount(); i += 3) {
+        for(int k = 0; k < 3; k++) {
+            unsigned int v = mesh.GetIndex(i + k);
+            corners[k] = Point3(x[v],y[v],z[v]);
+        }
+        AddTriangles(corners,order,1,Matrix::IDENTITY,color);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           AddCube
+// Arguments:      The cube's world matrix and its three face pair colors
+// Returns:        none
+// Notes:          The corners and faces are drawCube's, two triangles a
+//                 face, faces in the order x, x, y, z, y, z
+/////////////////////////////////////////////////////////////////////////////
+void RayScene::AddCube(const Matrix &world,const unsigned int *colors)
+{
+    static const Point3 corners[8] = {
+        Point3( 1,-1, 1), Point3( 1,-1,-1), Point3( 1, 1,-1), Point3( 1, 1, 1),
+        Point3(-1,-1, 1), Point3(-1,-1,-1), Point3(-1, 1,-1), Point3(-1, 1, 1)
+    };
+    static const unsigned int faces[36] = {
+        0,1,2, 0,2,3,   6,5,4, 6,4,7,   1,0,4, 1,4,5,
+        2,1,5, 2,5,6,   3,2,6, 3,6,7,   0,3,7, 0,7,4
+    };
+    static const int faceAxis[6] = {0,0,1,2,1,2};
+    for(int face = 0; face < 6; face++)
+        AddTriangles(corners,faces + 6*face,2,world,colors[faceAxis[face]]);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Build
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Builds the tree and sorts the triangles into leaf order
+// Notes:          A tree over n triangles has at most 2n-1 nodes, so the
+//                 node array is sized once and never moves while building.
+/////////////////////////////////////////////////////////////////////////////
+void RayScene::Build()
+{
+    Timer timer;
+    int count = (int)m_Triangles.size();
+    m_Nodes.clear();
+    m_Order.resize(count);
+    m_Centers.resize(3*count);
+    m_Bounds.resize(6*count);
+    for(int i = 0; i < count; i++) {
+        const Triangle &t = m_Triangles[i];
+        float *b = &m_Bounds[6*i];
+        for(int k = 0; k < 3; k++) {
+            float p0 = t.V0[k], p1 = p0 + t.E1[k], p2 = p0 + t.E2[k];
+            b[k] = std::min(p0,std::min(p1,p2));
+            b[k+3] = std::max(p0,std::max(p1,p2));
+            m_Centers[3*i + k] = 0.5f*(b[k] + b[k+3]);
+        }
+        m_Order[i] = i;
+    }
+
+    if(count > 0) {
+        m_Nodes.reserve(2*count);
+        m_Nodes.resize(1);
+        BuildNode(0,0,count,0);
+
+        std::vector<Triangle> sorted(count);
+        for(int i = 0; i < count; i++)
+            sorted[i] = m_Triangles[m_Order[i]];
+        m_Triangles.swap(sorted);
+    }
+    m_BuildMs = timer.GetMs();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           HalfArea
+// Arguments:      A box's min and max
+// Returns:        Half its surface area, which is all the SAH compares
+/////////////////////////////////////////////////////////////////////////////
+static inline float HalfArea(const float *lo,const float *hi)
+{
+    float dx = hi[0] - lo[0], dy = hi[1] - lo[1], dz = hi[2] - lo[2];
+    return dx*dy + dy*dz + dz*dx;
+}
+
+static inline void GrowBox(float *lo,float *hi,const float *b)
+{
+    for(int k = 0; k < 3; k++) {
+        lo[k] = std::min(lo[k],b[k]);
+        hi[k] = std::max(hi[k],b[k+3]);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           BuildNode
+// Arguments:      The node to fill, the range of m_Order it covers and its
+//                 depth
+// Returns:        none
+// Notes:          Binned SAH: the triangles' centers are dropped into
+//                 RAY_BINS buckets along each axis, and the split between
+//                 buckets with the least area times count on both sides
+//                 wins.  The centers' bounds span the first to the last
+//                 bucket, so neither side of any split is ever empty.  When
+//                 every center is in one place the range is just halved.
+/////////////////////////////////////////////////////////////////////////////
+void RayScene::BuildNode(int node,int begin,int end,int depth)
+{
+    float lo[3] = {RAY_FAR,RAY_FAR,RAY_FAR}, hi[3] = {-RAY_FAR,-RAY_FAR,-RAY_FAR};
+    float cLo[3] = {RAY_FAR,RAY_FAR,RAY_FAR}, cHi[3] = {-RAY_FAR,-RAY_FAR,-RAY_FAR};
+    for(int i = begin; i < end; i++) {
+        unsigned int t = m_Order[i];
+        GrowBox(lo,hi,&m_Bounds[6*t]);
+        const float *c = &m_Centers[3*t];
+        for(int k = 0; k < 3; k++) {
+            cLo[k] = std::min(cLo[k],c[k]);
+            cHi[k] = std::max(cHi[k],c[k]);
+        }
+    }
+    Node &n = m_Nodes[node];
+    memcpy(n.Min,lo,sizeof(lo));
+    memcpy(n.Max,hi,sizeof(hi));
+    n.First = begin;
+    n.Count = end - begin;
+    n.Axis = 0;
+    if(end - begin <= RAY_LEAF_SIZE || depth >= RAY_MAX_DEPTH - 1)
+        return;
+
+    int bestAxis = -1, bestBin = 0;
+    float bestCost = RAY_FAR;
+    for(int axis = 0; axis < 3; axis++) {
+        float extent = cHi[axis] - cLo[axis];
+        if(extent <= 0.0f)
+            continue;
+        float scale = RAY_BINS/extent;
+        int binCount[RAY_BINS] = {0};
+        float binLo[RAY_BINS][3], binHi[RAY_BINS][3];
+        for(int b = 0; b < RAY_BINS; b++) {
+            binLo[b][0] = binLo[b][1] = binLo[b][2] = RAY_FAR;
+            binHi[b][0] = binHi[b][1] = binHi[b][2] = -RAY_FAR;
+        }
+        for(int i = begin; i < end; i++) {
+            unsigned int t = m_Order[i];
+            int b = std::min((int)((m_Centers[3*t + axis] - cLo[axis])*scale),RAY_BINS - 1);
+            binCount[b]++;
+            GrowBox(binLo[b],binHi[b],&m_Bounds[6*t]);
+        }
+
+        // Sweep from the right for the areas and counts right of each
+        // split, then from the left to price every split
+        float rightArea[RAY_BINS];
+        int rightCount[RAY_BINS];
+        float bLo[3] = {RAY_FAR,RAY_FAR,RAY_FAR}, bHi[3] = {-RAY_FAR,-RAY_FAR,-RAY_FAR};
+        int c = 0;
+        for(int b = RAY_BINS - 1; b > 0; b--) {
+            float box[6] = {binLo[b][0],binLo[b][1],binLo[b][2],binHi[b][0],binHi[b][1],binHi[b][2]};
+            GrowBox(bLo,bHi,box);
+            c += binCount[b];
+            rightArea[b] = c ? HalfArea(bLo,bHi) : 0.0f;
+            rightCount[b] = c;
+        }
+        bLo[0] = bLo[1] = bLo[2] = RAY_FAR;
+        bHi[0] = bHi[1] = bHi[2] = -RAY_FAR;
+        c = 0;
+        for(int b = 0; b < RAY_BINS - 1; b++) {
+            float box[6] = {binLo[b][0],binLo[b][1],binLo[b][2],binHi[b][0],binHi[b][1],binHi[b][2]};
+            GrowBox(bLo,bHi,box);
+            c += binCount[b];
+            if(c == 0 || rightCount[b+1] == 0)
+                continue;
+            float cost = c*HalfArea(bLo,bHi) + rightCount[b+1]*rightArea[b+1];
+            if(cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = b;
+            }
+        }
+    }
+
+    int mid;
+    if(bestAxis < 0)
+        mid = (begin + end)/2;
+    else {
+        float scale = RAY_BINS/(cHi[bestAxis] - cLo[bestAxis]);
+        float base = cLo[bestAxis];
+        const float *centers = &m_Centers[bestAxis];
+        unsigned int *split = std::partition(&m_Order[0] + begin,&m_Order[0] + end,[&](unsigned int t) {
+            return std::min((int)((centers[3*t] - base)*scale),RAY_BINS - 1) <= bestBin;
+        });
+        mid = (int)(split - &m_Order[0]);
+    }
+
+    int children = (int)m_Nodes.size();
+    m_Nodes.resize(children + 2);
+    m_Nodes[node].First = children;
+    m_Nodes[node].Count = 0;
+    m_Nodes[node].Axis = bestAxis < 0 ? 0 : bestAxis;
+    BuildNode(children,begin,mid,depth + 1);
+    BuildNode(children + 1,mid,end,depth + 1);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Intersect
+// Arguments:      A ray, how far along it to look and where to put the hit
+// Returns:        Whether anything was hit
+// Notes:          Children are visited nearest first along the split axis,
+//                 so later boxes are often cut off by an early hit
+/////////////////////////////////////////////////////////////////////////////
+bool RayScene::Intersect(const Point3 &origin,const Vector3 &dir,float tMax,RayHit &hit) const
+{
+    hit.T = tMax;
+    hit.Triangle = -1;
+    if(m_Nodes.empty())
+        return false;
+    float o[3] = {origin.x,origin.y,origin.z};
+    float d[3] = {dir.x,dir.y,dir.z};
+    float inv[3] = {1.0f/dir.x,1.0f/dir.y,1.0f/dir.z};
+
+    unsigned int stack[RAY_MAX_DEPTH];
+    int top = 0;
+    stack[top++] = 0;
+    while(top > 0) {
+        const Node &n = m_Nodes[stack[--top]];
+        if(!HitBox(n.Min,n.Max,o,inv,hit.T))
+            continue;
+        if(n.Count) {
+            for(unsigned int i = n.First; i < n.First + n.Count; i++) {
+                const Triangle &t = m_Triangles[i];
+                if(HitTriangle(t.V0,t.E1,t.E2,o,d,hit.T,hit.T))
+                    hit.Triangle = i;
+            }
+        }
+        else {
+            int nearFirst = d[n.Axis] < 0.0f;
+            stack[top++] = n.First + 1 - nearFirst;
+            stack[top++] = n.First + nearFirst;
+        }
+    }
+    return hit.Triangle >= 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Occluded
+// Arguments:      A ray and how far along it to look
+// Returns:        Whether anything lies on it
+/////////////////////////////////////////////////////////////////////////////
+bool RayScene::Occluded(const Point3 &origin,const Vector3 &dir,float tMax) const
+{
+    if(m_Nodes.empty())
+        return false;
+    float o[3] = {origin.x,origin.y,origin.z};
+    float d[3] = {dir.x,dir.y,dir.z};
+    float inv[3] = {1.0f/dir.x,1.0f/dir.y,1.0f/dir.z};
+
+    unsigned int stack[RAY_MAX_DEPTH];
+    int top = 0;
+    stack[top++] = 0;
+    while(top > 0) {
+        const Node &n = m_Nodes[stack[--top]];
+        if(!HitBox(n.Min,n.Max,o,inv,tMax))
+            continue;
+        if(n.Count) {
+            for(unsigned int i = n.First; i < n.First + n.Count; i++) {
+                const Triangle &t = m_Triangles[i];
+                float h;
+                if(HitTriangle(t.V0,t.E1,t.E2,o,d,tMax,h))
+                    return true;
+            }
+        }
+        else {
+            stack[top++] = n.First + 1;
+            stack[top++] = n.First;
+        }
+    }
+    return false;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Intersect4
+// Arguments:      A packet of four rays, and counters to add the nodes and
+//                 triangles tested to
+// Returns:        none
+// Side Effects:   Writes each ray's hit to p.T and p.Triangle
+// Notes:          A node is opened when any ray still in the running hits
+//                 its box, and its children are ordered by the packet's
+//                 summed direction.  The counters are only kept with SSE.
+/////////////////////////////////////////////////////////////////////////////
+void RayScene::Intersect4(RayPacket &p,long long &nodes,long long &tris) const
+{
+#ifdef CSE167_SSE
+    __m128i hitTri = _mm_set1_epi32(-1);
+    __m128 tMax = _mm_load_ps(p.T);
+    if(!m_Nodes.empty()) {
+        RayLanes r;
+        LoadLanes(p,r);
+        int dirNeg[3] = {
+            p.Dx[0] + p.Dx[1] + p.Dx[2] + p.Dx[3] < 0.0f,
+            p.Dy[0] + p.Dy[1] + p.Dy[2] + p.Dy[3] < 0.0f,
+            p.Dz[0] + p.Dz[1] + p.Dz[2] + p.Dz[3] < 0.0f
+        };
+
+        unsigned int stack[RAY_MAX_DEPTH];
+        int top = 0;
+        stack[top++] = 0;
+        while(top > 0) {
+            const Node &n = m_Nodes[stack[--top]];
+            nodes++;
+            if(!HitBox4(n.Min,n.Max,r,tMax))
+                continue;
+            if(n.Count) {
+                tris += n.Count;
+                for(unsigned int i = n.First; i < n.First + n.Count; i++) {
+                    const Triangle &t = m_Triangles[i];
+                    __m128 h;
+                    __m128 mask = HitTriangle4(t.V0,t.E1,t.E2,r,tMax,h);
+                    tMax = Select(mask,h,tMax);
+                    hitTri = _mm_castps_si128(Select(mask,_mm_castsi128_ps(_mm_set1_epi32(i)),_mm_castsi128_ps(hitTri)));
+                }
+            }
+            else {
+                int nearFirst = dirNeg[n.Axis];
+                stack[top++] = n.First + 1 - nearFirst;
+                stack[top++] = n.First + nearFirst;
+            }
+        }
+    }
+    _mm_store_ps(p.T,tMax);
+    _mm_store_si128((__m128i*)p.Triangle,hitTri);
+#else
+    for(int i = 0; i < 4; i++) {
+        RayHit hit;
+        Intersect(Point3(p.Ox[i],p.Oy[i],p.Oz[i]),Vector3(p.Dx[i],p.Dy[i],p.Dz[i]),p.T[i],hit);
+        p.T[i] = hit.T;
+        p.Triangle[i] = hit.Triangle;
+    }
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Occluded4
+// Arguments:      A packet of four rays, and counters to add the nodes and
+//                 triangles tested to
+// Returns:        A bit per ray that is blocked
+// Notes:          A blocked ray's length is set below 0 so it drops out of
+//                 the box tests, and the walk ends when every ray that was
+//                 cast is blocked
+/////////////////////////////////////////////////////////////////////////////
+int RayScene::Occluded4(const RayPacket &p,long long &nodes,long long &tris) const
+{
+#ifdef CSE167_SSE
+    if(m_Nodes.empty())
+        return 0;
+    RayLanes r;
+    LoadLanes(p,r);
+    __m128 tMax = _mm_load_ps(p.T);
+    __m128 off = _mm_set1_ps(-1.0f);
+    int cast = _mm_movemask_ps(_mm_cmpgt_ps(tMax,_mm_setzero_ps()));
+    int blocked = 0;
+
+    unsigned int stack[RAY_MAX_DEPTH];
+    int top = 0;
+    stack[top++] = 0;
+    while(top > 0 && blocked != cast) {
+        const Node &n = m_Nodes[stack[--top]];
+        nodes++;
+        if(!HitBox4(n.Min,n.Max,r,tMax))
+            continue;
+        if(n.Count) {
+            tris += n.Count;
+            for(unsigned int i = n.First; i < n.First + n.Count; i++) {
+                const Triangle &t = m_Triangles[i];
+                __m128 h;
+                __m128 mask = HitTriangle4(t.V0,t.E1,t.E2,r,tMax,h);
+                blocked |= _mm_movemask_ps(mask);
+                tMax = Select(mask,off,tMax);
+            }
+        }
+        else {
+            stack[top++] = n.First + 1;
+            stack[top++] = n.First;
+        }
+    }
+    return blocked;
+#else
+    int blocked = 0;
+    for(int i = 0; i < 4; i++) {
+        if(Occluded(Point3(p.Ox[i],p.Oy[i],p.Oz[i]),Vector3(p.Dx[i],p.Dy[i],p.Dz[i]),p.T[i]))
+            blocked |= 1 << i;
+    }
+    return blocked;
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           RayTracer constructor
+// Notes:          Starts with main.cpp's camera, lit from above and to the
+//                 right, on GL's clear color
+/////////////////////////////////////////////////////////////////////////////
+RayTracer::RayTracer()
+{
+    m_Width = m_Height = 0;
+    m_RowBegin = m_RowEnd = 0;
+    m_TilesX = 0;
+    SetCamera(Matrix(),60.0f*(float)M_PI/180.0f);
+    SetLight(Vector3(0.4f,1.0f,0.3f),0.25f);
+    m_Background = PackColor(0.5f,0.7f,0.9f);
+    m_Stats.Reset();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           SetCamera
+// Arguments:      World to eye matrix and vertical field of view in radians
+// Returns:        none
+/////////////////////////////////////////////////////////////////////////////
+void RayTracer::SetCamera(const Matrix &view,float fovy)
+{
+    m_Camera = view;
+    if(!m_Camera.InvertAffine())
+        m_Camera = Matrix();
+    m_Fovy = fovy;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           SetLight
+// Arguments:      Direction toward the light and the ambient fraction
+// Returns:        none
+/////////////////////////////////////////////////////////////////////////////
+void RayTracer::SetLight(const Vector3 &toLight,float ambient)
+{
+    m_ToLight = toLight;
+    m_ToLight.Normalize();
+    m_Ambient = ambient;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           PackColor
+// Arguments:      Red, green and blue in [0,1]
+// Returns:        The packed opaque color
+/////////////////////////////////////////////////////////////////////////////
+unsigned int RayTracer::PackColor(float r,float g,float b)
+{
+    float c[3] = {r,g,b};
+    unsigned int packed = 0xff000000;
+    for(int k = 0; k < 3; k++) {
+        float v = c[k] < 0.0f ? 0.0f : (c[k] > 1.0f ? 1.0f : c[k]);
+        packed |= (unsigned int)(v*255.0f + 0.5f) << (8*k);
+    }
+    return packed;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Render
+// Arguments:      A built scene, the image size and the rows to trace
+// Returns:        none
+// Side Effects:   Fills those rows of the image and the stats
+// Notes:          Every thread keeps its own counters, summed at the end.
+//                 The camera covers the whole image whatever the rows, so
+//                 bands rendered apart line up when put back together.
+/////////////////////////////////////////////////////////////////////////////
+void RayTracer::Render(const RayScene &scene,int width,int height,int rowBegin,int rowEnd)
+{
+    Timer timer;
+    m_Stats.Reset();
+    if(rowEnd < 0 || rowEnd > height)
+        rowEnd = height;
+    rowBegin = std::max(0,std::min(rowBegin,rowEnd));
+    m_Width = width;
+    m_Height = height;
+    m_RowBegin = rowBegin;
+    m_RowEnd = rowEnd;
+    int rows = rowEnd - rowBegin;
+    m_Pixels.resize(width*rows);
+    if(width <= 0 || rows <= 0)
+        return;
+
+    // Pixel centers on the image plane one unit in front of the eye
+    float tanY = tanf(0.5f*m_Fovy), tanX = tanY*width/height;
+    Vector3 right, up, forward;
+    m_Camera.Transform(Vector3(1,0,0),right);
+    m_Camera.Transform(Vector3(0,1,0),up);
+    m_Camera.Transform(Vector3(0,0,-1),forward);
+    m_Eye = Point3(m_Camera.m_m[12],m_Camera.m_m[13],m_Camera.m_m[14]);
+    m_StepX = right*(2.0f*tanX/width);
+    m_StepY = up*(2.0f*tanY/height);
+    m_Corner = forward - right*tanX - up*tanY + 0.5f*(m_StepX + m_StepY);
+
+    m_TilesX = (width + RAY_TILE_SIZE - 1)/RAY_TILE_SIZE;
+    int tiles = m_TilesX*((rows + RAY_TILE_SIZE - 1)/RAY_TILE_SIZE);
+    RayStats threadStats[JOBS_MAX_THREADS];
+    for(int i = 0; i < JOBS_MAX_THREADS; i++)
+        threadStats[i].Reset();
+    ParallelFor(tiles,1,[&](int begin,int end,int thread) {
+        for(int i = begin; i < end; i++)
+            RenderTile(scene,i,threadStats[thread]);
+    });
+
+    for(int i = 0; i < JOBS_MAX_THREADS; i++) {
+        const RayStats &s = threadStats[i];
+        m_Stats.PrimaryRays += s.PrimaryRays;
+        m_Stats.ShadowRays += s.ShadowRays;
+        m_Stats.Hits += s.Hits;
+        m_Stats.Packets += s.Packets;
+        m_Stats.NodeVisits += s.NodeVisits;
+        m_Stats.TriangleTests += s.TriangleTests;
+    }
+    m_Stats.Triangles = scene.GetTriangleCount();
+    m_Stats.Nodes = scene.GetNodeCount();
+    m_Stats.BuildMs = scene.GetBuildMs();
+    m_Stats.Width = width;
+    m_Stats.Height = rows;
+    m_Stats.RenderMs = timer.GetMs();
+    if(m_Stats.RenderMs > 0.0)
+        m_Stats.RaysPerSecond = (m_Stats.PrimaryRays + m_Stats.ShadowRays)*1000.0/m_Stats.RenderMs;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           RenderTile
+// Arguments:      The scene, a tile index and the thread's counters
+// Returns:        none
+// Side Effects:   Fills the tile's pixels
+// Notes:          Each 2x2 block of pixels is one primary packet and, for
+//                 the hits facing the light, one shadow packet.  Lanes off
+//                 the edge of the image are cast with a negative length so
+//                 they hit nothing.
+/////////////////////////////////////////////////////////////////////////////
+void RayTracer::RenderTile(const RayScene &scene,int tile,RayStats &stats)
+{
+    int x0 = (tile % m_TilesX)*RAY_TILE_SIZE, y0 = m_RowBegin + (tile / m_TilesX)*RAY_TILE_SIZE;
+    int x1 = std::min(x0 + RAY_TILE_SIZE,m_Width), y1 = std::min(y0 + RAY_TILE_SIZE,m_RowEnd);
+    RayPacket primary, shadow;
+    float light[4];
+
+    for(int y = y0; y < y1; y += 2) {
+        for(int x = x0; x < x1; x += 2) {
+            for(int i = 0; i < 4; i++) {
+                int px = x + (i & 1), py = y + (i >> 1);
+                Vector3 d = m_Corner + (float)px*m_StepX + (float)py*m_StepY;
+                primary.Ox[i] = m_Eye.x; primary.Oy[i] = m_Eye.y; primary.Oz[i] = m_Eye.z;
+                primary.Dx[i] = d.x; primary.Dy[i] = d.y; primary.Dz[i] = d.z;
+                bool inside = px < x1 && py < y1;
+                primary.T[i] = inside ? RAY_FAR : -1.0f;
+                stats.PrimaryRays += inside;
+            }
+            scene.Intersect4(primary,stats.NodeVisits,stats.TriangleTests);
+            stats.Packets++;
+
+            // Shadow rays start just off the surface, on the side the eye
+            // sees, so they don't hit the triangle they leave from
+            int shadows = 0;
+            for(int i = 0; i < 4; i++) {
+                light[i] = 0.0f;
+                shadow.T[i] = -1.0f;
+                shadow.Ox[i] = shadow.Oy[i] = shadow.Oz[i] = 0.0f;
+                shadow.Dx[i] = m_ToLight.x; shadow.Dy[i] = m_ToLight.y; shadow.Dz[i] = m_ToLight.z;
+                int tri = primary.Triangle[i];
+                if(tri < 0)
+                    continue;
+                stats.Hits++;
+                Vector3 d(primary.Dx[i],primary.Dy[i],primary.Dz[i]);
+                Vector3 n = scene.GetNormal(tri);
+                if(n.Dot(d) > 0.0f)
+                    n = -n;
+                light[i] = n.Dot(m_ToLight);
+                if(light[i] <= 0.0f)
+                    continue;
+                Point3 p = m_Eye + primary.T[i]*d + RAY_EPSILON*n;
+                shadow.Ox[i] = p.x; shadow.Oy[i] = p.y; shadow.Oz[i] = p.z;
+                shadow.T[i] = RAY_FAR;
+                shadows++;
+            }
+            int blocked = 0;
+            if(shadows) {
+                stats.ShadowRays += shadows;
+                stats.Packets++;
+                blocked = scene.Occluded4(shadow,stats.NodeVisits,stats.TriangleTests);
+            }
+
+            for(int i = 0; i < 4; i++) {
+                int px = x + (i & 1), py = y + (i >> 1);
+                if(px >= x1 || py >= y1)
+                    continue;
+                int tri = primary.Triangle[i];
+                unsigned int color = m_Background;
+                if(tri >= 0) {
+                    float diffuse = (blocked & (1 << i)) || light[i] < 0.0f ? 0.0f : light[i];
+                    float shade = m_Ambient + (1.0f - m_Ambient)*diffuse;
+                    unsigned int albedo = scene.GetColor(tri);
+                    color = PackColor(shade*(albedo & 0xff)/255.0f,
+                                      shade*((albedo >> 8) & 0xff)/255.0f,
+                                      shade*((albedo >> 16) & 0xff)/255.0f);
+                }
+                m_Pixels[(py - m_RowBegin)*m_Width + px] = color;
+            }
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           SavePPM
+// Arguments:      The file to write
+// Returns:        Whether it was written
+/////////////////////////////////////////////////////////////////////////////
+bool RayTracer::SavePPM(const char *filename) const
+{
+    if(m_Pixels.empty()) {
+        printf("RayTracer::SavePPM: nothing has been rendered\n");
+        return false;
+    }
+    FILE *f = fopen(filename,"wb");
+    if(!f) {
+        printf("RayTracer::SavePPM: can't open '%s'\n",filename);
+        return false;
+    }
+    bool ok = fprintf(f,"P6\n%d %d\n255\n",m_Width,GetRowCount()) > 0;
+    std::vector<unsigned char> row(3*m_Width);
+    for(int y = GetRowCount() - 1; y >= 0 && ok; y--) {
+        const unsigned int *src = &m_Pixels[y*m_Width];
+        for(int x = 0; x < m_Width; x++) {
+            row[3*x] = (unsigned char)(src[x] & 0xff);
+            row[3*x+1] = (unsigned char)((src[x] >> 8) & 0xff);
+            row[3*x+2] = (unsigned char)((src[x] >> 16) & 0xff);
+        }
+        ok = fwrite(&row[0],1,row.size(),f) == row.size();
+    }
+    ok = (fclose(f) == 0) && ok;
+    if(!ok)
+        printf("RayTracer::SavePPM: error writing '%s'\n",filename);
+    return ok;
+}
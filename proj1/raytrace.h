@@ -0,0 +1,286 @@
+/////////////////////////////////////////////////////////////////////////////
+// raytrace.h
+//
+/////////////////////////////////////
+// Classes declared:
+//
+// RayHit:     The nearest triangle along one ray.
+//
+// RayPacket:  Four rays traced together, one per SSE lane, laid out as
+//             arrays of x, y and z so each loads straight into a register.
+//
+// RayStats:   Counts and timings of the last RayTracer::Render().
+//
+// RayScene:   World space triangles and a bounding volume hierarchy (BVH)
+//             over them.  Meshes are added with their world matrix and a
+//             flat color; Build() then sorts the triangles into a binary
+//             tree of boxes, choosing each split with the surface area
+//             heuristic over RAY_BINS buckets of triangle centers.  The
+//             triangles are reordered so every leaf's are consecutive.
+//
+//             Intersect4() walks the tree once for a whole packet: a box is
+//             opened if any live ray hits it (one slab test for four rays)
+//             and every triangle in a leaf is tested against all four rays
+//             (Moller-Trumbore, four wide).  Rays that start close together
+//             and point the same way visit nearly the same nodes, so the
+//             packet costs little more than one ray.  Occluded4() is the
+//             same walk for shadow rays, stopping a ray at its first hit.
+//             Intersect() and Occluded() are the one-ray versions; without
+//             SSE the packet calls use them lane by lane.
+//
+// RayTracer:  Renders a RayScene from a camera into an RGBA8 image, for
+//             offline frames on machines without a GPU.  The image is cut
+//             into RAY_TILE_SIZE square tiles spread over the job pool, and
+//             each tile is traced as 2x2 pixel packets: primary rays, then
+//             shadow rays toward one directional light from whichever
+//             primary rays hit, then Lambert shading with an ambient term.
+//             Rows are stored bottom up, like glReadPixels.  Render() can
+//             be given a band of the image's rows, for splitting one frame
+//             between machines (see distrib.h); only those rows are traced
+//             and stored.
+//
+/////////////////////////////////////
+// Common Operations Supported:
+//
+// RayScene rs;
+// rs.AddMesh(mesh,world,color);
+// rs.AddTriangles(verts,indices,triCount,world,color);
+// rs.AddCube(world,colors);                       // Unit cube, a color per face pair
+// rs.Build();
+//
+// RayTracer rt;
+// rt.SetCamera(view,fovy);                        // view is world to eye
+// rt.SetLight(direction,ambient);
+// rt.Render(rs,width,height);
+// rt.Render(rs,width,height,rowBegin,rowEnd);     // Just those rows
+// rt.SavePPM("frame.ppm");
+// rt.GetStats().Print();                          // Rays per second
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSE167_RAYTRACE_H_
+#define CSE167_RAYTRACE_H_
+
+#include "matrix.h"
+#include "simd.h"
+#include <vector>
+
+class Mesh;
+class CompressedMesh;
+
+#define RAY_BINS                16          // SAH buckets per split
+#define RAY_LEAF_SIZE           4           // Most triangles in a leaf
+#define RAY_MAX_DEPTH           64          // Nodes this deep are leaves, however full
+#define RAY_TILE_SIZE           16          // Pixels on a side of a tile
+#define RAY_EPSILON             1e-4f       // Nearest hit counted, and shadow ray offset
+#define RAY_FAR                 1e30f       // "No limit" for a ray's length
+
+/////////////////////////////////////////////////////////////////////////////
+// RayHit
+//
+struct RayHit {
+    float T;                        // Along the direction, in its lengths
+    int Triangle;                   // -1 if nothing was hit
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// RayPacket
+//
+struct CSE167_ALIGN(16) RayPacket {
+    float Ox[4], Oy[4], Oz[4];      // Origins
+    float Dx[4], Dy[4], Dz[4];      // Directions, any length
+    float T[4];                     // In: how far to look, < 0 for no ray.  Out: the hit.
+    int Triangle[4];                // Out: Intersect4()'s hits, -1 for none
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// RayStats
+//
+struct RayStats {
+    void Reset()                                    {memset(this,0,sizeof(*this));}
+    void Print() const;
+
+    int Triangles;                  // In the scene
+    int Nodes;                      // In its BVH
+    int Width, Height;              // Of the rows rendered
+    int PrimaryRays;
+    int ShadowRays;                 // Cast from primary hits facing the light
+    int Hits;                       // Primary rays that hit something
+    int Packets;                    // Primary and shadow
+    long long NodeVisits;           // Boxes tested, one per packet
+    long long TriangleTests;        // Triangles tested, one per packet
+    double BuildMs;                 // RayScene::Build()
+    double RenderMs;
+    double RaysPerSecond;           // Primary and shadow rays over RenderMs
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// RayScene
+//
+class RayScene {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    RayScene();
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // Empties the scene, keeping its memory
+    void Clear();
+
+    // Adds 'triCount' triangles of 'verts' moved to world space by 'world',
+    // all of one packed RGBA color
+    void AddTriangles(const Point3 *verts,const unsigned int *indices,int triCount,
+                      const Matrix &world,unsigned int color);
+    void AddMesh(const Mesh &mesh,const Matrix &world,unsigned int color);
+    // A quantized mesh goes to world space straight from its 16 bit
+    // positions (see CompressedMesh::TransformPositions)
+    void AddMesh(const CompressedMesh &mesh,const Matrix &world,unsigned int color);
+
+    // Adds the cube from -1 to 1 moved by 'world', with the faces facing x
+    // in colors[0], y in colors[1] and z in colors[2] (as drawCube draws
+    // them)
+    void AddCube(const Matrix &world,const unsigned int *colors);
+
+    // Builds the BVH over everything added.  Call again after adding more.
+    void Build();
+
+    // Nearest hit along one ray closer than 'tMax'.  Returns false (and
+    // hit.Triangle -1) if there is none.
+    bool Intersect(const Point3 &origin,const Vector3 &dir,float tMax,RayHit &hit) const;
+
+    // Whether anything lies along the ray closer than 'tMax'
+    bool Occluded(const Point3 &origin,const Vector3 &dir,float tMax) const;
+
+    // Intersect() for the four rays of 'p', writing p.T and p.Triangle.
+    // Returns the traversal's counts through 'nodes' and 'tris'.
+    void Intersect4(RayPacket &p,long long &nodes,long long &tris) const;
+
+    // Occluded() for the four rays of 'p'.  Returns a mask with bit i set
+    // if ray i is blocked.
+    int Occluded4(const RayPacket &p,long long &nodes,long long &tris) const;
+
+    // Triangle 'i' (in BVH order)'s unit normal and color
+    Vector3 GetNormal(int i) const                  {const Triangle &t = m_Triangles[i]; return Vector3(t.N[0],t.N[1],t.N[2]);}
+    unsigned int GetColor(int i) const              {return m_Triangles[i].Color;}
+
+    // Accessors
+    int GetTriangleCount() const                    {return (int)m_Triangles.size();}
+    int GetNodeCount() const                        {return (int)m_Nodes.size();}
+    double GetBuildMs() const                       {return m_BuildMs;}
+
+private:
+    // Precomputed for Moller-Trumbore: a corner and the edges from it
+    struct Triangle {
+        float V0[3], E1[3], E2[3];
+        float N[3];
+        unsigned int Color;
+    };
+
+    // Children are consecutive: an inner node's are First and First+1.  A
+    // leaf's triangles are First..First+Count-1.
+    struct Node {
+        float Min[3];
+        unsigned int First;
+        float Max[3];
+        unsigned int Count : 30;    // 0 for inner nodes
+        unsigned int Axis : 2;      // Split axis of an inner node
+    };
+
+    void BuildNode(int node,int begin,int end,int depth);
+
+    // Not copyable
+    RayScene(const RayScene &);
+    RayScene &operator=(const RayScene &);
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    std::vector<Triangle> m_Triangles;
+    std::vector<Node> m_Nodes;
+    std::vector<unsigned int> m_Order;          // Triangle indices while building
+    std::vector<float> m_Centers;               // x,y,z of each triangle's box center
+    std::vector<float> m_Bounds;                // Min x,y,z and max x,y,z of each triangle
+    std::vector<float> m_Positions;             // A CompressedMesh's world x, y and z arrays
+    double m_BuildMs;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// RayTracer
+//
+class RayTracer {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    RayTracer();
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // The camera, as the GL path has it: 'view' takes world to eye space
+    // (looking down -z) and 'fovy' is the vertical field of view in radians
+    void SetCamera(const Matrix &view,float fovy);
+
+    // A directional light shining from 'toLight' (need not be unit), and
+    // the fraction of the albedo every surface gets in shadow
+    void SetLight(const Vector3 &toLight,float ambient);
+
+    // Packed RGBA color where rays hit nothing
+    void SetBackground(unsigned int color)          {m_Background = color;}
+    unsigned int GetBackground() const              {return m_Background;}
+
+    // Traces rows rowBegin to rowEnd-1 (all of them by default) of a width
+    // by height image of 'scene', which must be built
+    void Render(const RayScene &scene,int width,int height,int rowBegin=0,int rowEnd=-1);
+
+    // Writes the rows rendered as a binary PPM, top row first.  Returns
+    // false (and prints why) if the file can't be written.
+    bool SavePPM(const char *filename) const;
+
+    // RGBA with red in the low byte, like the Rasterizer's colors
+    static unsigned int PackColor(float r,float g,float b);
+
+    // Accessors
+    const unsigned int *GetPixels() const           {return m_Pixels.empty() ? 0 : &m_Pixels[0];}
+    int GetWidth() const                            {return m_Width;}
+    int GetHeight() const                           {return m_Height;}
+    int GetRowBegin() const                         {return m_RowBegin;}
+    int GetRowCount() const                         {return m_RowEnd - m_RowBegin;}
+    const RayStats &GetStats() const                {return m_Stats;}
+
+private:
+    void RenderTile(const RayScene &scene,int tile,RayStats &stats);
+
+    // Not copyable
+    RayTracer(const RayTracer &);
+    RayTracer &operator=(const RayTracer &);
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    Matrix m_Camera;                            // Eye to world
+    float m_Fovy;
+    Vector3 m_ToLight;                          // Unit
+    float m_Ambient;
+    unsigned int m_Background;
+    int m_Width, m_Height;
+    int m_RowBegin, m_RowEnd;                   // Rows in m_Pixels
+    int m_TilesX;
+    std::vector<unsigned int> m_Pixels;
+    RayStats m_Stats;
+
+    // Set up by Render() for RenderTile()
+    Point3 m_Eye;
+    Vector3 m_Corner, m_StepX, m_StepY;         // Pixel (0,0)'s direction and the steps between pixels
+};
+
+#endif
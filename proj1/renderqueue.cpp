@@ -0,0 +1,333 @@
+/////////////////////////////////////////////////////////////////////////////
+// renderqueue.cpp
+/////////////////////////////////////
+// Sort keys, the radix sort, and recording the batches.
+/////////////////////////////////////////////////////////////////////////////
+
+#include "renderqueue.h"
+#include "lighting.h"
+#include "mesh.h"
+#include "jobs.h"
+#include "timer.h"
+#include <algorithm>
+
+#define RENDER_PASS_SHIFT       62
+#define RENDER_MATERIAL_SHIFT   40
+#define RENDER_DEPTH_SHIFT      16
+#define RENDER_BACK_DEPTH_SHIFT     (RENDER_PASS_SHIFT - RENDER_DEPTH_BITS)    // Transparent pass
+#define RENDER_BACK_MATERIAL_SHIFT  RENDER_DEPTH_SHIFT
+
+// The unit cube's corners, and the two quads of each RenderCubePart with
+// the same corners, winding and colors as the cube main.cpp always drew
+static const float s_CubeVerts[8][3] = {
+    { 1,-1, 1}, { 1,-1,-1}, { 1, 1,-1}, { 1, 1, 1},
+    {-1,-1, 1}, {-1,-1,-1}, {-1, 1,-1}, {-1, 1, 1}
+};
+static const int s_CubeQuads[RENDER_CUBE_PARTS][8] = {
+    {0,1,2,3, 6,5,4,7},
+    {1,0,4,5, 3,2,6,7},
+    {2,1,5,6, 0,3,7,4}
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Print
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Prints the counters to stdout
+/////////////////////////////////////////////////////////////////////////////
+void RenderStats::Print() const
+{
+    printf("render queue: %d draws in %d batches, %d state changes\n",Draws,Batches,StateChanges);
+    printf("              sort %.3f ms (%d radix passes), record %.3f ms (%d buffers, %u bytes), replay %.3f ms\n",
+           SortMs,SortPasses,RecordMs,Buffers,(unsigned int)CommandBytes,ReplayMs);
+    if(CacheHits + CacheMisses)
+        printf("              cube cache %d hits, %d misses (%.1f%% hit rate), %.3f ms\n",
+               CacheHits,CacheMisses,100.0f*CacheHits/(CacheHits + CacheMisses),CacheMs);
+    if(LitVertices)
+        printf("              lit %d vertices, %d light lookups (%.1f per vertex)\n",
+               LitVertices,LightLookups,(float)LightLookups/LitVertices);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           RenderQueue constructor
+// Notes:          The view starts as the identity with depths 0.1 to 80,
+//                 the projection main.cpp uses
+/////////////////////////////////////////////////////////////////////////////
+RenderQueue::RenderQueue()
+{
+    SetView(Matrix(),0.1f,80.0f);
+    m_Lighting = 0;
+    m_Stats.Reset();
+
+    Point3 corners[8];
+    for(int k = 0; k < 8; k++)
+        corners[k] = Point3(s_CubeVerts[k][0],s_CubeVerts[k][1],s_CubeVerts[k][2]);
+    m_CubeCache.Create(corners,8);
+}
+
+RenderQueue::~RenderQueue()
+{
+    for(size_t i = 0; i < m_Buffers.size(); i++)
+        delete m_Buffers[i];
+}
+
+int RenderQueue::AddMaterial(const RenderMaterial &m)
+{
+    if(m_Materials.size() >= (1u << RENDER_MATERIAL_BITS)) {
+        printf("RenderQueue: too many materials\n");
+        return 0;
+    }
+    m_Materials.push_back(m);
+    return (int)m_Materials.size()-1;
+}
+
+void RenderQueue::SetView(const Matrix &view,float nearDepth,float farDepth)
+{
+    m_View = view;
+    m_Near = nearDepth;
+    m_DepthScale = farDepth > nearDepth ? 1.0f/(farDepth - nearDepth) : 1.0f;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           MakeKey
+// Arguments:      Pass, material index and eye space distance
+// Returns:        The sort key (see renderqueue.h)
+/////////////////////////////////////////////////////////////////////////////
+unsigned long long RenderQueue::MakeKey(RenderPass pass,int material,float depth) const
+{
+    const unsigned int maxDepth = (1u << RENDER_DEPTH_BITS) - 1;
+    float f = (depth - m_Near)*m_DepthScale;
+    f = f < 0.0f ? 0.0f : (f > 1.0f ? 1.0f : f);
+    unsigned int d = (unsigned int)(f*maxDepth);
+    if(pass == RENDER_PASS_TRANSPARENT)
+        return ((unsigned long long)pass << RENDER_PASS_SHIFT) |
+               ((unsigned long long)(maxDepth - d) << RENDER_BACK_DEPTH_SHIFT) |
+               ((unsigned long long)material << RENDER_BACK_MATERIAL_SHIFT);
+    return ((unsigned long long)pass << RENDER_PASS_SHIFT) |
+           ((unsigned long long)material << RENDER_MATERIAL_SHIFT) |
+           ((unsigned long long)d << RENDER_DEPTH_SHIFT);
+}
+
+// The material index back out of a key made by MakeKey
+static inline int KeyMaterial(unsigned long long key)
+{
+    const unsigned int materialMask = (1u << RENDER_MATERIAL_BITS) - 1;
+    int shift = (int)(key >> RENDER_PASS_SHIFT) == RENDER_PASS_TRANSPARENT ? RENDER_BACK_MATERIAL_SHIFT : RENDER_MATERIAL_SHIFT;
+    return (int)((key >> shift) & materialMask);
+}
+
+void RenderQueue::Add(const Matrix &world,const Mesh *model,int part,int slot,int material,RenderPass pass)
+{
+    Item item;
+    item.World = world;
+    item.Model = model;
+    item.Part = part;
+    item.Slot = slot;
+
+    // Depth of the object's origin
+    const float *v = m_View.m_m, *w = world.m_m;
+    float z = v[2]*w[12] + v[6]*w[13] + v[10]*w[14] + v[14];
+
+    SortEntry e;
+    e.Key = MakeKey(pass,material,-z);
+    e.Item = (int)m_Items.size();
+    m_Items.push_back(item);
+    m_Keys.push_back(e);
+}
+
+void RenderQueue::Submit(const Matrix &world,const Mesh *model,int material,RenderPass pass)
+{
+    Add(world,model,-1,-1,material,pass);
+}
+
+void RenderQueue::SubmitCube(const Matrix &world,const int *materials,RenderPass pass,int slot)
+{
+    if(slot >= 0)
+        m_CubeCache.Request(slot,world);
+    for(int part = 0; part < RENDER_CUBE_PARTS; part++)
+        Add(world,0,part,slot,materials[part],pass);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Sort
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Radix sorts m_Keys, least significant byte first.  One
+//                 read builds all eight histograms, and a byte that is the
+//                 same in every key is skipped.
+/////////////////////////////////////////////////////////////////////////////
+void RenderQueue::Sort()
+{
+    int n = (int)m_Keys.size();
+    int counts[8][256];
+    memset(counts,0,sizeof(counts));
+    for(int i = 0; i < n; i++) {
+        unsigned long long key = m_Keys[i].Key;
+        for(int b = 0; b < 8; b++)
+            counts[b][(key >> (8*b)) & 255]++;
+    }
+
+    m_Scratch.resize(n);
+    SortEntry *from = m_Keys.data(), *to = m_Scratch.data();
+    for(int b = 0; b < 8; b++) {
+        int shift = 8*b;
+        int *count = counts[b];
+        if(n == 0 || count[(from[0].Key >> shift) & 255] == n)
+            continue;
+        int start = 0;
+        for(int r = 0; r < 256; r++) {
+            int c = count[r];
+            count[r] = start;
+            start += c;
+        }
+        for(int i = 0; i < n; i++)
+            to[count[(from[i].Key >> shift) & 255]++] = from[i];
+        std::swap(from,to);
+        m_Stats.SortPasses++;
+    }
+    if(from != m_Keys.data())
+        m_Keys.swap(m_Scratch);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Record
+// Arguments:      Chunk number
+// Returns:        none
+// Side Effects:   Records sorted draws [chunk*RENDER_GRAIN, +RENDER_GRAIN)
+//                 into m_Buffers[chunk], changing state only where it
+//                 differs from the draw before.  Touches no GL, so chunks
+//                 are recorded in parallel.
+/////////////////////////////////////////////////////////////////////////////
+void RenderQueue::Record(int chunk)
+{
+    int begin = chunk*RENDER_GRAIN;
+    int end = std::min(begin + RENDER_GRAIN,(int)m_Keys.size());
+    CommandBuffer &cb = *m_Buffers[chunk];
+    ChunkStats &stats = m_ChunkStats[chunk];
+    cb.Reset();
+    stats.Batches = stats.StateChanges = 0;
+    stats.LitVertices = stats.LightLookups = 0;
+
+    int pass = RENDER_PASS_OPAQUE, material = -1;
+    if(begin > 0) {
+        unsigned long long key = m_Keys[begin-1].Key;
+        pass = (int)(key >> RENDER_PASS_SHIFT);
+        material = KeyMaterial(key);
+    }
+
+    for(int i = begin; i < end; i++) {
+        unsigned long long key = m_Keys[i].Key;
+        int p = (int)(key >> RENDER_PASS_SHIFT);
+        int mat = KeyMaterial(key);
+        if(p != pass || mat != material) {
+            if(p != pass) {
+                if(p == RENDER_PASS_TRANSPARENT)
+                    cb.SetState(CMD_BLEND | CMD_DEPTH_TEST);
+                else if(p == RENDER_PASS_OVERLAY)
+                    cb.SetState(CMD_BLEND);
+                else
+                    cb.SetState(CMD_DEFAULT_STATE);
+                pass = p;
+                stats.StateChanges++;
+            }
+            if(mat != material) {
+                cb.SetColor(m_Materials[mat].Color);
+                material = mat;
+                stats.StateChanges++;
+            }
+            stats.Batches++;
+        }
+
+        const Item &item = m_Items[m_Keys[i].Item];
+        if(item.Model) {
+            if(m_Lighting && pass == RENDER_PASS_OPAQUE && item.Model->HasNormals()) {
+                const float *color = m_Materials[material].Color;
+                float *out = cb.DrawLitMesh(item.Model,color);
+                stats.LightLookups += m_Lighting->ShadeMesh(*item.Model,item.World,color,out);
+                stats.LitVertices += item.Model->GetVertexCount();
+            }
+            else
+                cb.DrawMesh(item.Model,item.World);
+            continue;
+        }
+
+        // The cube's corners in world space: from the cache if its slot
+        // holds this Matrix, otherwise transformed here
+        float corners[8*3];
+        const float *world = corners;
+        if(item.Slot >= 0 && memcmp(m_CubeCache.GetMatrix(item.Slot).m_m,item.World.m_m,sizeof(corners[0])*16) == 0)
+            world = m_CubeCache.Get(item.Slot);
+        else {
+            const float *m = item.World.m_m;
+            for(int k = 0; k < 8; k++) {
+                const float *c = s_CubeVerts[k];
+                corners[3*k+0] = m[0]*c[0] + m[4]*c[1] + m[8]*c[2] + m[12];
+                corners[3*k+1] = m[1]*c[0] + m[5]*c[1] + m[9]*c[2] + m[13];
+                corners[3*k+2] = m[2]*c[0] + m[6]*c[1] + m[10]*c[2] + m[14];
+            }
+        }
+
+        int first = item.Part < 0 ? 0 : item.Part;
+        int last = item.Part < 0 ? RENDER_CUBE_PARTS-1 : item.Part;
+        float *out = cb.AddQuads(2*(last - first + 1));
+        for(int part = first; part <= last; part++) {
+            for(int k = 0; k < 8; k++) {
+                const float *c = world + 3*s_CubeQuads[part][k];
+                *out++ = c[0];
+                *out++ = c[1];
+                *out++ = c[2];
+            }
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Execute
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Sorts, records on the job pool, replays here and empties
+//                 the queue.  Leaves the GL state as it found it for the
+//                 opaque pass (no blending, depth test and writes on); the
+//                 color is the last material's.
+/////////////////////////////////////////////////////////////////////////////
+void RenderQueue::Execute()
+{
+    int draws = (int)m_Keys.size();
+    m_Stats.Reset();
+    m_Stats.Draws = draws;
+
+    Timer timer;
+    Sort();
+    m_Stats.SortMs = timer.GetMs();
+
+    m_CubeCache.Update();
+    m_Stats.CacheHits = m_CubeCache.GetStats().Hits;
+    m_Stats.CacheMisses = m_CubeCache.GetStats().Misses;
+    m_Stats.CacheMs = m_CubeCache.GetStats().UpdateMs;
+
+    timer.Start();
+    int chunks = (draws + RENDER_GRAIN - 1)/RENDER_GRAIN;
+    while((int)m_Buffers.size() < chunks)
+        m_Buffers.push_back(new CommandBuffer);
+    m_ChunkStats.resize(chunks);
+    ParallelFor(chunks,1,[this](int begin,int end,int) {
+        for(int c = begin; c < end; c++)
+            Record(c);
+    });
+    for(int c = 0; c < chunks; c++) {
+        m_Stats.Batches += m_ChunkStats[c].Batches;
+        m_Stats.StateChanges += m_ChunkStats[c].StateChanges;
+        m_Stats.LitVertices += m_ChunkStats[c].LitVertices;
+        m_Stats.LightLookups += m_ChunkStats[c].LightLookups;
+        m_Stats.CommandBytes += m_Buffers[c]->GetSize();
+    }
+    m_Stats.Buffers = chunks;
+    m_Stats.RecordMs = timer.GetMs();
+
+    timer.Start();
+    ReplayCommandBuffers(m_Buffers.data(),chunks);
+    m_Stats.ReplayMs = timer.GetMs();
+
+    m_Items.clear();
+    m_Keys.clear();
+}
@@ -0,0 +1,225 @@
+/////////////////////////////////////////////////////////////////////////////
+// renderqueue.h
+//
+/////////////////////////////////////
+// Classes declared:
+//
+// RenderMaterial: The GL state a draw needs.  For now that is only the
+//                 color; materials are registered once and referred to by
+//                 index.
+//
+// RenderStats:    Counts and timings of the last Execute().
+//
+// RenderQueue:    Collects the frame's draws instead of issuing them as
+//                 they come, then issues them in the order that changes
+//                 state the least.  Every draw is given a 64 bit sort key:
+//
+//                 bits 62-63  pass (opaque, then transparent, then overlay)
+//                 bits 40-61  material
+//                 bits 16-39  view depth, front to back
+//                 bits 0-15   unused
+//
+//                 In the transparent pass the depth must win over the
+//                 material, so the two swap places there: the depth,
+//                 inverted to sort back to front, takes bits 38-61 and the
+//                 material bits 16-37.
+//
+//                 The keys are radix sorted, 8 bits per pass, skipping the
+//                 passes where every key has the same byte (usually most
+//                 of them).  The sort is stable, so draws with equal keys
+//                 keep their submission order.  Consecutive draws with the
+//                 same pass and material form a batch: the state is set
+//                 once per batch, and all the cube faces in a batch go in
+//                 one glDrawArrays.
+//
+//                 Execute() records the sorted draws into CommandBuffers,
+//                 RENDER_GRAIN draws to a buffer, in parallel on the job
+//                 pool; this is where the cube corners are transformed.
+//                 The calling (GL) thread then replays the buffers in
+//                 order.  Each buffer starts from the state the draw
+//                 before it left, so the result is exactly what one
+//                 thread recording everything would issue.
+//
+// The unit cube is built in: its six faces are three pairs of opposite
+// faces, and SubmitCube() takes a material for each pair, so a field of
+// cubes costs three color changes in total instead of six per cube.  Any
+// Mesh can be submitted too; those are drawn with Mesh::Draw, one call
+// each, but still share their batch's state.
+//
+// A cube submitted with a slot from AddCubeSlots() keeps its world space
+// corners in a TransformCache, so a cube whose Matrix has not changed
+// since the last frame is not transformed again.
+//
+// With SetLighting(), meshes with normals in the opaque pass are lit by the
+// clustered point lights: each vertex is shaded on the CPU as the draw is
+// recorded, with the material's color as the albedo.  Cubes stay unlit.
+//
+// Nothing is allocated per frame once the queue has grown to the largest
+// frame's size.
+//
+/////////////////////////////////////
+// Common Operations Supported:
+//
+// RenderQueue q;
+// int green = q.AddMaterial(RenderMaterial(0,1,0));
+// q.SetView(view,near,far);                       // Once per frame
+// q.SubmitCube(world,pairMaterials);
+// q.Submit(world,&mesh,green);
+// q.SetLighting(&clusters);                       // After clusters.Assign()
+// q.Execute();                                    // Sort, draw and clear
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSE167_RENDERQUEUE_H_
+#define CSE167_RENDERQUEUE_H_
+
+#include "cmdbuffer.h"
+#include "transformcache.h"
+#include <vector>
+
+class Mesh;
+class LightClusters;
+
+#define RENDER_MATERIAL_BITS    22
+#define RENDER_DEPTH_BITS       24
+#define RENDER_GRAIN            1024        // Draws recorded per command buffer
+
+enum RenderPass {
+    RENDER_PASS_OPAQUE,
+    RENDER_PASS_TRANSPARENT,        // Blended, depth writes off
+    RENDER_PASS_OVERLAY,            // Blended, no depth test
+    RENDER_PASS_COUNT
+};
+
+// The unit cube's pairs of opposite faces: +x/-x, -y/+y and -z/+z
+enum RenderCubePart {
+    RENDER_CUBE_X,
+    RENDER_CUBE_Y,
+    RENDER_CUBE_Z,
+    RENDER_CUBE_PARTS
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// RenderMaterial
+//
+struct RenderMaterial {
+    RenderMaterial()                                {Color[0] = Color[1] = Color[2] = Color[3] = 1.0f;}
+    RenderMaterial(float r,float g,float b,float a=1.0f)   {Color[0] = r; Color[1] = g; Color[2] = b; Color[3] = a;}
+
+    float Color[4];
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// RenderStats
+//
+struct RenderStats {
+    void Reset()                                    {memset(this,0,sizeof(*this));}
+    void Print() const;
+
+    int Draws;                      // Submitted (a cube counts once per face pair)
+    int Batches;
+    int StateChanges;               // Material and pass changes issued
+    int SortPasses;                 // Radix passes not skipped
+    int Buffers;                    // Command buffers recorded
+    size_t CommandBytes;
+    int LitVertices;
+    int LightLookups;               // Lights looked at while shading them
+    int CacheHits, CacheMisses;     // Cube slots reused and transformed
+    double SortMs, CacheMs, RecordMs, ReplayMs;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// RenderQueue
+//
+class RenderQueue {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    RenderQueue();
+    ~RenderQueue();
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // Returns the material's index for Submit()
+    int AddMaterial(const RenderMaterial &m);
+    const RenderMaterial &GetMaterial(int i) const  {return m_Materials[i];}
+
+    // The world to eye transform, and the depth range the keys cover
+    void SetView(const Matrix &view,float nearDepth,float farDepth);
+
+    // Draw 'model' (0 for the unit cube, all faces) at 'world'
+    void Submit(const Matrix &world,const Mesh *model,int material,RenderPass pass=RENDER_PASS_OPAQUE);
+
+    // The unit cube with a material for each RenderCubePart.  'slot',
+    // from AddCubeSlots(), caches its corners between frames: use one per
+    // object.  If a slot is submitted twice in a frame with different
+    // matrices, only the last is cached.
+    void SubmitCube(const Matrix &world,const int *materials,RenderPass pass=RENDER_PASS_OPAQUE,int slot=-1);
+    int AddCubeSlots(int count)                     {return m_CubeCache.AddSlots(count);}
+
+    // Light meshes with 'lights' (0 for none) from now on.  The clusters
+    // must not change until Execute() returns.
+    void SetLighting(const LightClusters *lights)   {m_Lighting = lights;}
+
+    // Sorts and draws everything submitted since the last Execute(), then
+    // empties the queue.  GL thread only.
+    void Execute();
+
+    // Accessors
+    int GetCount() const                            {return (int)m_Items.size();}
+    const RenderStats &GetStats() const             {return m_Stats;}
+
+    // The key a draw at 'depth' (eye space distance) gets
+    unsigned long long MakeKey(RenderPass pass,int material,float depth) const;
+
+private:
+    // One draw: a mesh, or some faces of the cube
+    struct Item {
+        Matrix World;
+        const Mesh *Model;
+        int Part;                   // RenderCubePart, or -1 for the whole model
+        int Slot;                   // Cube cache slot, or -1
+    };
+    struct SortEntry {
+        unsigned long long Key;
+        int Item;
+    };
+
+    // What one command buffer's recording did
+    struct ChunkStats {
+        int Batches;
+        int StateChanges;
+        int LitVertices;
+        int LightLookups;
+    };
+
+    void Add(const Matrix &world,const Mesh *model,int part,int slot,int material,RenderPass pass);
+    void Sort();
+    void Record(int chunk);
+
+    // Not copyable
+    RenderQueue(const RenderQueue &);
+    RenderQueue &operator=(const RenderQueue &);
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    std::vector<RenderMaterial> m_Materials;
+    Matrix m_View;
+    float m_Near, m_DepthScale;
+
+    std::vector<Item> m_Items;
+    std::vector<SortEntry> m_Keys, m_Scratch;
+    std::vector<CommandBuffer*> m_Buffers;      // Kept between frames
+    std::vector<ChunkStats> m_ChunkStats;
+    TransformCache m_CubeCache;
+    const LightClusters *m_Lighting;
+    RenderStats m_Stats;
+};
+
+#endif
@@ -0,0 +1,40 @@
+/////////////////////////////////////////////////////////////////////////////
+// renderworker.cpp
+/////////////////////////////////////
+// Renders bands of frames for a DistribCoordinator (see distrib.h).
+//
+// Usage: renderworker [port]
+//
+// Listens on the port (DISTRIB_PORT by default) and serves one coordinator
+// at a time until it disconnects, then waits for the next.  Run one per
+// process; several on one machine need different ports.
+/////////////////////////////////////////////////////////////////////////////
+
+#include "../distrib.h"
+
+int main(int argc,char **argv)
+{
+    if(argc > 2) {
+        printf("Usage: renderworker [port]\n\
+Renders for the viewer's -workers option, on port %d by default\n",DISTRIB_PORT);
+        return 1;
+    }
+    int port = argc > 1 ? atoi(argv[1]) : DISTRIB_PORT;
+
+    Socket server;
+    if(!server.Listen(port))
+        return 1;
+    printf("renderworker: listening on port %d\n",port);
+
+    DistribWorker worker;
+    Socket coordinator;
+    while(server.Accept(coordinator)) {
+        printf("renderworker: coordinator connected\n");
+        int frames = 0;
+        while(worker.Serve(coordinator))
+            frames++;
+        coordinator.Close();
+        printf("renderworker: coordinator gone after %d frames\n",frames);
+    }
+    return 0;
+}
@@ -0,0 +1,32 @@
+////////////////////////////////////////
+// simd.h
+////////////////////////////////////////
+
+#ifndef CSE167_SIMD_H
+#define CSE167_SIMD_H
+
+////////////////////////////////////////////////////////////////////////////////
+
+/*
+Picks up the SSE intrinsics when the compiler targets a CPU that has them.
+Code that uses SIMD checks CSE167_SSE and keeps a plain C++ path for the
+other case, so everything still builds for any target.
+
+SSE2 is part of every x86-64 CPU and is enabled by default on x64 compilers,
+so in practice only 32 bit builds without /arch:SSE2 fall back to scalar.
+*/
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CSE167_SSE 1
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#define CSE167_ALIGN(n)     __declspec(align(n))
+#else
+#define CSE167_ALIGN(n)     __attribute__((aligned(n)))
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+
+#endif
@@ -0,0 +1,473 @@
+/////////////////////////////////////////////////////////////////////////////
+// simplify.cpp
+/////////////////////////////////////
+// Quadric error metric mesh simplification and LOD chains.
+//
+// Vertices that share a position are welded before simplifying, so seams
+// where the source mesh splits vertices (for normals) don't tear open.
+// Normals of the simplified meshes are recomputed from their triangles.
+/////////////////////////////////////////////////////////////////////////////
+
+#include "simplify.h"
+#include "meshopt.h"
+#include <queue>
+#include <unordered_map>
+#include <algorithm>
+
+// Weight of the constraint planes along open boundaries
+#define QEM_BOUNDARY_WEIGHT     100.0
+
+// A collapse may not turn any face normal by more than this (cosine)
+#define QEM_MIN_NORMAL_DOT      0.2
+
+// Weight of the pull towards each vertex's own position.  Flat regions have
+// no plane error at all, so without this every collapse there costs zero
+// and they all pile into one vertex; with it short edges go first.
+#define QEM_REGULARIZE          1e-4
+
+/////////////////////////////////////////////////////////////////////////////
+// Quadric: symmetric 4x4 matrix stored as its upper triangle, so that
+// v^T Q v is the weighted sum of squared distances from v to the planes in
+// Q.  'Area' is the face area that went into it; dividing by it turns the
+// error back into a squared distance.
+/////////////////////////////////////////////////////////////////////////////
+struct Quadric {
+    Quadric()                                       {memset(q,0,sizeof(q)); Area = 0.0;}
+
+    // Adds the plane a*x + b*y + c*z + d = 0 with the given weight
+    void AddPlane(double a,double b,double c,double d,double w) {
+        q[0] += w*a*a; q[1] += w*a*b; q[2] += w*a*c; q[3] += w*a*d;
+                       q[4] += w*b*b; q[5] += w*b*c; q[6] += w*b*d;
+                                      q[7] += w*c*c; q[8] += w*c*d;
+                                                     q[9] += w*d*d;
+    }
+    void Add(const Quadric &o)                      {for(int i = 0; i < 10; i++) q[i] += o.q[i]; Area += o.Area;}
+
+    double Error(double x,double y,double z) const {
+        return q[0]*x*x + 2*q[1]*x*y + 2*q[2]*x*z + 2*q[3]*x
+                        +   q[4]*y*y + 2*q[5]*y*z + 2*q[6]*y
+                                     +   q[7]*z*z + 2*q[8]*z
+                                                  +   q[9];
+    }
+
+    // Point of minimum error.  Returns false if the quadric is singular
+    // (a flat or linear region) so there is no unique minimum.
+    bool Optimal(double &x,double &y,double &z) const {
+        double a = q[0], b = q[1], c = q[2], e = q[4], f = q[5], h = q[7];
+        double det = a*(e*h-f*f) - b*(b*h-f*c) + c*(b*f-e*c);
+        if(fabs(det) < 1e-12)
+            return false;
+        double inv = 1.0/det;
+        x = -inv*( q[3]*(e*h-f*f) - q[6]*(b*h-c*f) + q[8]*(b*f-c*e));
+        y = -inv*(-q[3]*(b*h-f*c) + q[6]*(a*h-c*c) - q[8]*(a*f-b*c));
+        z = -inv*( q[3]*(b*f-e*c) - q[6]*(a*f-c*b) + q[8]*(a*e-b*b));
+        return true;
+    }
+
+    double q[10];
+    double Area;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// Candidate collapse in the priority queue.  Entries go stale when either
+// vertex changes; the stamps detect that when they are popped.
+/////////////////////////////////////////////////////////////////////////////
+struct Collapse {
+    bool operator<(const Collapse &o) const         {return Cost > o.Cost;}
+
+    double Cost;
+    int V0, V1;
+    unsigned int Stamp0, Stamp1;
+    Point3 Target;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// Working state for one simplification
+/////////////////////////////////////////////////////////////////////////////
+struct Simplifier {
+    std::vector<Point3> Pos;
+    std::vector<Quadric> Quad;
+    std::vector<unsigned int> Stamp;
+    std::vector<bool> Removed;              // Vertex collapsed away
+    std::vector<std::vector<int> > VertTris;
+    std::vector<int> Tris;                  // 3 vertex indices per triangle
+    std::vector<bool> TriDead;
+    std::priority_queue<Collapse> Queue;
+    int LiveTris;
+
+    Vector3 FaceNormal(int t) const {
+        const int *v = &Tris[3*t];
+        Vector3 n;
+        n.Cross(Pos[v[1]]-Pos[v[0]],Pos[v[2]]-Pos[v[0]]);
+        return n;
+    }
+
+    void PushEdge(int v0,int v1) {
+        Quadric q = Quad[v0];
+        q.Add(Quad[v1]);
+        double x, y, z;
+        Collapse c;
+        if(q.Optimal(x,y,z)) {
+            c.Target = Point3((float)x,(float)y,(float)z);
+            c.Cost = q.Error(x,y,z);
+        }
+        else {
+            // Best of the two ends and the middle
+            Point3 cand[3] = {Pos[v0],Pos[v0],Pos[v1]};
+            cand[0].Lerp(0.5f,Pos[v0],Pos[v1]);
+            c.Cost = 1e300;
+            for(int i = 0; i < 3; i++) {
+                double e = q.Error(cand[i].x,cand[i].y,cand[i].z);
+                if(e < c.Cost) {
+                    c.Cost = e;
+                    c.Target = cand[i];
+                }
+            }
+        }
+        c.Cost = q.Area > 0.0 ? c.Cost/q.Area : c.Cost;
+        if(c.Cost < 0.0) c.Cost = 0.0;
+        c.V0 = v0;
+        c.V1 = v1;
+        c.Stamp0 = Stamp[v0];
+        c.Stamp1 = Stamp[v1];
+        Queue.push(c);
+    }
+
+    // Would moving v0 and v1 to 'p' flip any triangle that survives?
+    bool Flips(int v0,int v1,const Point3 &p) const {
+        for(int k = 0; k < 2; k++) {
+            int v = k ? v1 : v0;
+            const std::vector<int> &list = VertTris[v];
+            for(size_t i = 0; i < list.size(); i++) {
+                int t = list[i];
+                const int *tv = &Tris[3*t];
+                if(TriDead[t] || ((tv[0]==v0||tv[1]==v0||tv[2]==v0) && (tv[0]==v1||tv[1]==v1||tv[2]==v1)))
+                    continue;
+                Point3 q[3];
+                for(int j = 0; j < 3; j++)
+                    q[j] = (tv[j] == v) ? p : Pos[tv[j]];
+                Vector3 before = FaceNormal(t), after;
+                after.Cross(q[1]-q[0],q[2]-q[0]);
+                double lb = before.Mag(), la = after.Mag();
+                if(la <= 0.0 || before.Dot(after) < QEM_MIN_NORMAL_DOT*lb*la)
+                    return true;
+            }
+        }
+        return false;
+    }
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           SimplifyMesh
+// Arguments:      Output mesh, source mesh, triangle budget and the largest
+//                 quadric error (as a distance) to accept
+// Returns:        The geometric error of the result
+// Side Effects:   Replaces 'dst' with the simplified mesh, cache optimized
+//                 and with recomputed normals.
+/////////////////////////////////////////////////////////////////////////////
+float SimplifyMesh(Mesh &dst,const Mesh &src,int targetTriangles,float maxError)
+{
+    Simplifier s;
+    int srcVerts = src.GetVertexCount(), srcIndices = src.GetIndexCount();
+    const unsigned int *srcIdx = src.GetIndices();
+
+    // Weld vertices with identical positions
+    std::vector<int> weld(srcVerts);
+    {
+        std::unordered_map<unsigned long long,int> seen;
+        const float *x = src.GetX(), *y = src.GetY(), *z = src.GetZ();
+        for(int v = 0; v < srcVerts; v++) {
+            unsigned int bits[3];
+            memcpy(&bits[0],&x[v],4);
+            memcpy(&bits[1],&y[v],4);
+            memcpy(&bits[2],&z[v],4);
+            unsigned long long key = ((unsigned long long)bits[0]*0x9E3779B97F4A7C15ULL) ^
+                                     ((unsigned long long)bits[1]*0xC2B2AE3D27D4EB4FULL) ^ bits[2];
+            // Hash collisions are resolved by checking the actual position
+            int found = -1;
+            for(;; key++) {
+                std::unordered_map<unsigned long long,int>::iterator it = seen.find(key);
+                if(it == seen.end())
+                    break;
+                const Point3 &p = s.Pos[it->second];
+                if(p.x == x[v] && p.y == y[v] && p.z == z[v]) {
+                    found = it->second;
+                    break;
+                }
+            }
+            if(found < 0) {
+                found = (int)s.Pos.size();
+                seen[key] = found;
+                s.Pos.push_back(Point3(x[v],y[v],z[v]));
+            }
+            weld[v] = found;
+        }
+    }
+
+    int numVerts = (int)s.Pos.size();
+    s.Quad.resize(numVerts);
+    s.Stamp.assign(numVerts,0);
+    s.Removed.assign(numVerts,false);
+    s.VertTris.resize(numVerts);
+
+    for(int i = 0; i+2 < srcIndices; i += 3) {
+        int a = weld[srcIdx[i]], b = weld[srcIdx[i+1]], c = weld[srcIdx[i+2]];
+        if(a == b || b == c || c == a)
+            continue;
+        int t = (int)s.Tris.size()/3;
+        s.Tris.push_back(a);
+        s.Tris.push_back(b);
+        s.Tris.push_back(c);
+        s.VertTris[a].push_back(t);
+        s.VertTris[b].push_back(t);
+        s.VertTris[c].push_back(t);
+    }
+    int numTris = (int)s.Tris.size()/3;
+    s.TriDead.assign(numTris,false);
+    s.LiveTris = numTris;
+
+    // Plane quadrics, area weighted, and the edge use counts for boundaries
+    std::unordered_map<unsigned long long,int> edgeUse;
+    for(int t = 0; t < numTris; t++) {
+        const int *v = &s.Tris[3*t];
+        Vector3 n = s.FaceNormal(t);
+        double area = n.Mag();
+        if(area <= 0.0)
+            continue;
+        n.Scale((float)(1.0/area));
+        double d = -n.Dot(s.Pos[v[0]].ToVector3());
+        for(int k = 0; k < 3; k++) {
+            Quadric &q = s.Quad[v[k]];
+            const Point3 &p = s.Pos[v[k]];
+            double w = area*0.5;
+            q.AddPlane(n.x,n.y,n.z,d,w);
+            q.AddPlane(1,0,0,-p.x,w*QEM_REGULARIZE);
+            q.AddPlane(0,1,0,-p.y,w*QEM_REGULARIZE);
+            q.AddPlane(0,0,1,-p.z,w*QEM_REGULARIZE);
+            q.Area += w;
+        }
+        for(int k = 0; k < 3; k++) {
+            unsigned int a = v[k], b = v[(k+1)%3];
+            unsigned long long key = a < b ? ((unsigned long long)a<<32)|b : ((unsigned long long)b<<32)|a;
+            edgeUse[key]++;
+        }
+    }
+
+    // Boundary edges get a plane through the edge perpendicular to the face
+    for(int t = 0; t < numTris; t++) {
+        const int *v = &s.Tris[3*t];
+        Vector3 n = s.FaceNormal(t);
+        if(n.MagSq() <= 0.0f)
+            continue;
+        for(int k = 0; k < 3; k++) {
+            unsigned int a = v[k], b = v[(k+1)%3];
+            unsigned long long key = a < b ? ((unsigned long long)a<<32)|b : ((unsigned long long)b<<32)|a;
+            if(edgeUse[key] != 1)
+                continue;
+            Vector3 e = s.Pos[b]-s.Pos[a], p;
+            float len = e.Mag();
+            p.Cross(e,n);
+            if(p.MagSq() <= 0.0f)
+                continue;
+            p.Normalize();
+            double d = -p.Dot(s.Pos[a].ToVector3());
+            double w = QEM_BOUNDARY_WEIGHT*len*len;
+            s.Quad[a].AddPlane(p.x,p.y,p.z,d,w);
+            s.Quad[b].AddPlane(p.x,p.y,p.z,d,w);
+        }
+    }
+
+    for(std::unordered_map<unsigned long long,int>::iterator it = edgeUse.begin(); it != edgeUse.end(); ++it)
+        s.PushEdge((int)(it->first>>32),(int)(it->first & 0xffffffff));
+
+    // Collapse cheapest first
+    double maxCost = (double)maxError*maxError, worst = 0.0;
+    std::vector<int> neighbors;
+    while(s.LiveTris > targetTriangles && !s.Queue.empty()) {
+        Collapse c = s.Queue.top();
+        s.Queue.pop();
+        if(s.Removed[c.V0] || s.Removed[c.V1] ||
+           c.Stamp0 != s.Stamp[c.V0] || c.Stamp1 != s.Stamp[c.V1])
+            continue;
+        if(c.Cost > maxCost)
+            break;
+        if(s.Flips(c.V0,c.V1,c.Target))
+            continue;
+
+        if(c.Cost > worst)
+            worst = c.Cost;
+
+        // Merge V1 into V0
+        int v0 = c.V0, v1 = c.V1;
+        s.Pos[v0] = c.Target;
+        s.Quad[v0].Add(s.Quad[v1]);
+        s.Removed[v1] = true;
+        s.Stamp[v0]++;
+
+        std::vector<int> &list0 = s.VertTris[v0];
+        const std::vector<int> &list1 = s.VertTris[v1];
+        for(size_t i = 0; i < list1.size(); i++) {
+            int t = list1[i];
+            if(s.TriDead[t])
+                continue;
+            int *tv = &s.Tris[3*t];
+            if(tv[0] == v0 || tv[1] == v0 || tv[2] == v0) {
+                s.TriDead[t] = true;
+                s.LiveTris--;
+                continue;
+            }
+            for(int k = 0; k < 3; k++)
+                if(tv[k] == v1) tv[k] = v0;
+            list0.push_back(t);
+        }
+        s.VertTris[v1].clear();
+
+        // Drop dead triangles from v0's list and requeue its edges
+        neighbors.clear();
+        size_t live = 0;
+        for(size_t i = 0; i < list0.size(); i++) {
+            int t = list0[i];
+            if(s.TriDead[t])
+                continue;
+            list0[live++] = t;
+            for(int k = 0; k < 3; k++)
+                if(s.Tris[3*t+k] != v0) neighbors.push_back(s.Tris[3*t+k]);
+        }
+        list0.resize(live);
+        std::sort(neighbors.begin(),neighbors.end());
+        neighbors.erase(std::unique(neighbors.begin(),neighbors.end()),neighbors.end());
+        for(size_t i = 0; i < neighbors.size(); i++)
+            s.PushEdge(v0,neighbors[i]);
+    }
+
+    // Compact what is left into the output mesh
+    std::vector<int> outIndex(numVerts,-1);
+    int outVerts = 0;
+    for(int t = 0; t < numTris; t++) {
+        if(s.TriDead[t])
+            continue;
+        for(int k = 0; k < 3; k++) {
+            int v = s.Tris[3*t+k];
+            if(outIndex[v] < 0) outIndex[v] = outVerts++;
+        }
+    }
+    dst.Create(outVerts,3*s.LiveTris,true);
+    for(int v = 0; v < numVerts; v++) {
+        if(outIndex[v] >= 0)
+            dst.SetPosition(outIndex[v],s.Pos[v]);
+    }
+    unsigned int *idx = dst.GetIndices();
+    for(int t = 0; t < numTris; t++) {
+        if(s.TriDead[t])
+            continue;
+        for(int k = 0; k < 3; k++)
+            *idx++ = outIndex[s.Tris[3*t+k]];
+    }
+    dst.ComputeBounds();
+    dst.ComputeNormals();
+    OptimizeMesh(dst,false);
+
+    return (float)sqrt(worst);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           LodChain constructor/destructor
+/////////////////////////////////////////////////////////////////////////////
+LodChain::LodChain()
+{
+    m_Radius = 0.0f;
+}
+
+LodChain::~LodChain()
+{
+    Free();
+}
+
+void LodChain::Free()
+{
+    for(size_t i = 1; i < m_Levels.size(); i++)
+        delete m_Levels[i];
+    m_Levels.clear();
+    m_Errors.clear();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Build
+// Arguments:      Full detail mesh, most levels to build (including the
+//                 full mesh), triangle ratio between levels and the
+//                 smallest level worth building
+// Returns:        none
+// Side Effects:   Every level is simplified from the full mesh rather than
+//                 from the level before, so errors don't accumulate.
+//                 Building stops early once a level can't get any smaller.
+/////////////////////////////////////////////////////////////////////////////
+void LodChain::Build(const Mesh &mesh,int maxLevels,float ratio,int minTriangles)
+{
+    Free();
+    m_Levels.push_back(&mesh);
+    m_Errors.push_back(0.0f);
+
+    Point3 lo = mesh.GetBoundsMin(), hi = mesh.GetBoundsMax();
+    m_Center.Lerp(0.5f,lo,hi);
+    m_Radius = 0.5f*(hi-lo).Mag();
+
+    if(maxLevels > LOD_MAX_LEVELS)
+        maxLevels = LOD_MAX_LEVELS;
+    int target = mesh.GetTriangleCount();
+    while((int)m_Levels.size() < maxLevels) {
+        target = (int)(target*ratio);
+        if(target < minTriangles)
+            break;
+        Mesh *level = new Mesh;
+        float error = SimplifyMesh(*level,mesh,target);
+        if(level->GetTriangleCount() >= m_Levels.back()->GetTriangleCount()) {
+            delete level;
+            break;
+        }
+        // Keep errors increasing even if a coarser level happened to
+        // measure lower, so selection stays monotonic with distance
+        if(error < m_Errors.back())
+            error = m_Errors.back();
+        m_Levels.push_back(level);
+        m_Errors.push_back(error);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           SelectLevel
+// Arguments:      Projection and modelview matrices, viewport height in
+//                 pixels and the level used last frame (-1 if none)
+// Returns:        The coarsest level whose error projects to less than
+//                 LOD_PIXEL_ERROR pixels.  Switching to a coarser level
+//                 than 'current' needs the error to be LOD_HYSTERESIS below
+//                 the threshold.
+// Notes:          The error is projected at the near side of the bounding
+//                 sphere, which is the worst case for the whole object.
+/////////////////////////////////////////////////////////////////////////////
+int LodChain::SelectLevel(const Matrix &proj,const Matrix &modelView,float screenHeight,int current) const
+{
+    if(m_Levels.empty())
+        return -1;
+
+    const float *m = modelView.m_m;
+    float sx = m[0]*m[0] + m[1]*m[1] + m[2]*m[2];
+    float sy = m[4]*m[4] + m[5]*m[5] + m[6]*m[6];
+    float sz = m[8]*m[8] + m[9]*m[9] + m[10]*m[10];
+    float scale = sqrtf(sx > sy ? (sx > sz ? sx : sz) : (sy > sz ? sy : sz));
+
+    Point3 center;
+    modelView.Transform(m_Center,center);
+    float dist = -center.z - m_Radius*scale;
+    if(dist <= 1e-4f)
+        return 0;
+
+    float pixelsPerUnit = proj.m_m[5]*0.5f*screenHeight/dist;
+    for(int i = (int)m_Levels.size()-1; i > 0; i--) {
+        float limit = LOD_PIXEL_ERROR;
+        if(current >= 0 && i > current)
+            limit *= 1.0f - LOD_HYSTERESIS;
+        if(m_Errors[i]*scale*pixelsPerUnit <= limit)
+            return i;
+    }
+    return 0;
+}
@@ -0,0 +1,102 @@
+/////////////////////////////////////////////////////////////////////////////
+// simplify.h
+//
+/////////////////////////////////////
+// Classes declared:
+//
+// LodChain: A mesh and a chain of progressively simpler versions of it,
+//           built at load time, plus the runtime choice of which one to
+//           draw for a given view.
+//
+// Functions declared:
+//
+// SimplifyMesh: Quadric error metric simplification (Garland & Heckbert).
+//               Edges are collapsed cheapest first from a priority queue
+//               until the triangle budget or error limit is reached.
+//               Collapses that would flip a triangle are refused, and open
+//               boundaries get extra constraint planes so they keep their
+//               shape.
+//
+// The error of a level is the square root of the largest quadric error of
+// any collapse that built it, divided by the surface area behind it, which
+// is roughly the distance (in object units) the simplified surface can be
+// from the original.  Level selection
+// projects that error to pixels using the projection and modelview
+// matrices and picks the coarsest level whose error stays under a pixel
+// threshold.  A level must be comfortably under the threshold before we
+// switch down to it, so objects sitting right at a switch distance don't
+// pop back and forth.
+//
+/////////////////////////////////////
+// Common Operations Supported:
+//
+// LodChain lod;
+// lod.Build(mesh);                                // At load time
+// int level = lod.SelectLevel(proj,mv,height,lastLevel);   // Every frame
+// lod.GetLevel(level).Draw(mv);
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSE167_SIMPLIFY_H_
+#define CSE167_SIMPLIFY_H_
+
+#include "mesh.h"
+#include <vector>
+
+#define LOD_MAX_LEVELS          8
+#define LOD_PIXEL_ERROR         1.0f    // Allowed error on screen, in pixels
+#define LOD_HYSTERESIS          0.25f   // Fraction below the threshold needed to switch down
+
+// Writes a simplified copy of 'src' with at most 'targetTriangles' triangles
+// to 'dst' (stopping early if the next collapse would cost more than
+// 'maxError').  Returns the geometric error of the result.
+float SimplifyMesh(Mesh &dst,const Mesh &src,int targetTriangles,float maxError=1e30f);
+
+/////////////////////////////////////////////////////////////////////////////
+// LodChain
+//
+class LodChain {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    LodChain();
+    ~LodChain();
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // Builds the chain from 'mesh', which becomes level 0 and must outlive
+    // the chain.  Each level aims for 'ratio' times the triangles of the
+    // one before, stopping at 'minTriangles' or 'maxLevels'.
+    void Build(const Mesh &mesh,int maxLevels=5,float ratio=0.5f,int minTriangles=32);
+    void Free();
+
+    // Picks the level to draw.  'proj' and 'modelView' are the projection
+    // and object to eye matrices, 'screenHeight' is in pixels, and
+    // 'current' is the level drawn last frame (-1 if none).
+    int SelectLevel(const Matrix &proj,const Matrix &modelView,float screenHeight,int current) const;
+
+    // Accessors
+    int GetLevelCount() const                       {return (int)m_Levels.size();}
+    const Mesh &GetLevel(int i) const               {return *m_Levels[i];}
+    float GetLevelError(int i) const                {return m_Errors[i];}
+
+private:
+    // Not copyable
+    LodChain(const LodChain &);
+    LodChain &operator=(const LodChain &);
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    std::vector<const Mesh*> m_Levels;  // Level 0 is not owned
+    std::vector<float> m_Errors;
+    Point3 m_Center;                    // Bounding sphere in object space
+    float m_Radius;
+};
+
+#endif
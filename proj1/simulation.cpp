@@ -0,0 +1,170 @@
+/////////////////////////////////////////////////////////////////////////////
+// simulation.cpp
+/////////////////////////////////////
+// Simulation thread and scene snapshots.
+/////////////////////////////////////////////////////////////////////////////
+
+#include "simulation.h"
+#include "timer.h"
+#include <chrono>
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Print
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Prints the simulation counters
+/////////////////////////////////////////////////////////////////////////////
+void SimStats::Print() const
+{
+    printf("Simulation: %u ticks (%.0f/s), %.4f ms per tick, %u skipped\n",
+           Ticks,TicksPerSecond,StepMs,Behind);
+    printf("  %u frames, %u without a new snapshot, %u snapshots never drawn\n",
+           Frames,StaleFrames,Dropped);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Simulation constructor/destructor
+/////////////////////////////////////////////////////////////////////////////
+Simulation::Simulation() : m_Running(false), m_RotStep(0.0001f),
+    m_Ticks(0), m_Dropped(0), m_Behind(0), m_StepMs(0.0)
+{
+    m_Hz = SIM_HZ;
+    m_StartTime = 0.0;
+    m_Frames = 0;
+    m_StaleFrames = 0;
+    SceneSnapshot &first = m_Buffer.GetFront();
+    Step(0.0f,first);
+    first.Tick = 0;
+    first.Time = 0.0;
+}
+
+Simulation::~Simulation()
+{
+    Stop();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Start
+// Arguments:      Ticks per second
+// Returns:        none
+// Side Effects:   Starts the simulation thread
+/////////////////////////////////////////////////////////////////////////////
+void Simulation::Start(float hz)
+{
+    Stop();
+    m_Hz = hz > 0.0f ? hz : SIM_HZ;
+    m_StartTime = Timer::Now();
+    m_Running = true;
+    m_Thread = std::thread(&Simulation::Run,this);
+}
+
+void Simulation::Stop()
+{
+    m_Running = false;
+    if(m_Thread.joinable())
+        m_Thread.join();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Acquire
+// Arguments:      none
+// Returns:        The newest published snapshot
+// Notes:          Render thread only
+/////////////////////////////////////////////////////////////////////////////
+const SceneSnapshot &Simulation::Acquire()
+{
+    m_Frames++;
+    if(!m_Buffer.Update())
+        m_StaleFrames++;
+    return m_Buffer.GetFront();
+}
+
+SimStats Simulation::GetStats() const
+{
+    SimStats s;
+    s.Ticks = m_Ticks;
+    s.Dropped = m_Dropped;
+    s.Behind = m_Behind;
+    s.Frames = m_Frames;
+    s.StaleFrames = m_StaleFrames;
+    s.StepMs = m_StepMs;
+    double elapsed = Timer::Now() - m_StartTime;
+    s.TicksPerSecond = m_Running && elapsed > 0.0 ? s.Ticks*1000.0/elapsed : 0.0;
+    return s;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Run
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Ticks at m_Hz until Stop() is called.  If a tick is late
+//                 the following ones run back to back to catch up, unless
+//                 the simulation is more than SIM_MAX_CATCHUP_MS behind, in
+//                 which case the missed ticks are skipped.
+/////////////////////////////////////////////////////////////////////////////
+void Simulation::Run()
+{
+    double period = 1000.0/m_Hz;
+    double next = Timer::Now();
+    float rotation = m_Buffer.GetFront().Rotation;
+    unsigned int tick = m_Buffer.GetFront().Tick;
+    double stepTotal = 0.0;
+
+    while(m_Running) {
+        Timer t;
+        rotation += m_RotStep;
+        tick++;
+        SceneSnapshot &s = m_Buffer.GetBack();
+        Step(rotation,s);
+        s.Tick = tick;
+        s.Time = tick*period;
+        if(m_Buffer.Publish())
+            m_Dropped++;
+        stepTotal += t.GetMs();
+        m_Ticks++;
+        m_StepMs = stepTotal/m_Ticks;
+
+        next += period;
+        double now = Timer::Now();
+        if(next > now)
+            std::this_thread::sleep_for(std::chrono::microseconds((long long)((next-now)*1000.0)));
+        else if(now - next > SIM_MAX_CATCHUP_MS) {
+            m_Behind += (unsigned int)((now-next)/period);
+            next = now;
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Step
+// Arguments:      Rotation angle and the snapshot to fill
+// Returns:        none
+// Notes:          The sun spins about a diagonal axis, the planet orbits it
+//                 and the moon orbits the planet.  Each level is built on
+//                 the transform of the one above.
+/////////////////////////////////////////////////////////////////////////////
+void Simulation::Step(float rotation,SceneSnapshot &out)
+{
+    Matrix rot1, trans1;
+    Vector3 v = Vector3(-1,1,-1);
+    v.Normalize();
+    // Spinning Cube
+    rot1.MakeRotateUnitAxis(v,rotation);
+    trans1.MakeTranslate(0,0,-40);
+    out.Objects[SIM_SUN] = trans1*rot1;
+
+    Matrix rot2, scale2, trans2;
+    trans2.MakeTranslate(-10,0,0);
+    rot2.MakeRotateY(rotation);
+    scale2.MakeScale(0.6f,0.6f,0.6f);
+    out.Objects[SIM_PLANET] = out.Objects[SIM_SUN]*trans2*rot2*scale2;
+
+    Matrix rot3, scale3, trans3;
+    trans3.MakeTranslate(0,0,5);
+    rot3.MakeRotateX(rotation);
+    scale3.MakeScale(0.5f,0.5f,0.5f);
+    out.Objects[SIM_MOON] = out.Objects[SIM_PLANET]*trans3*rot3*scale3;
+
+    out.Rotation = rotation;
+    out.ObjectCount = SIM_OBJECT_COUNT;
+}
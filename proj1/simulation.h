@@ -0,0 +1,193 @@
+/////////////////////////////////////////////////////////////////////////////
+// simulation.h
+//
+/////////////////////////////////////
+// Classes declared:
+//
+// TripleBuffer:  Lock-free single producer, single consumer hand-off of
+//                whole values.  The producer always has a slot to write,
+//                the consumer always has a slot to read, and the third
+//                slot holds the newest finished value between them.
+//                Neither side ever waits for the other; if the producer is
+//                faster, values the consumer never saw are overwritten.
+//
+// SceneSnapshot: The world transforms of every object at one simulation
+//                tick.  Immutable once published.
+//
+// Simulation:    Advances the scene on its own thread at a fixed tick rate
+//                and publishes a snapshot after every tick.  The render
+//                thread picks up the newest snapshot at the start of each
+//                frame, so a slow frame never holds up the simulation and
+//                a slow tick never holds up drawing.
+//
+/////////////////////////////////////
+// Common Operations Supported:
+//
+// Simulation sim;
+// sim.Start();                                    // Starts the thread
+// const SceneSnapshot &s = sim.Acquire();         // Render thread, per frame
+// drawCube(s.Objects[SIM_PLANET]);
+// sim.SetRotStep(step);                           // From any thread
+// sim.GetStats().Print();
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSE167_SIMULATION_H_
+#define CSE167_SIMULATION_H_
+
+#include "matrix.h"
+#include <atomic>
+#include <thread>
+
+#define SIM_HZ                  1000.0f         // Ticks per second
+#define SIM_MAX_OBJECTS         64
+#define SIM_MAX_CATCHUP_MS      100.0           // Ticks further behind than this are skipped
+
+// Objects in the snapshot
+enum {
+    SIM_SUN,
+    SIM_PLANET,
+    SIM_MOON,
+    SIM_OBJECT_COUNT
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// TripleBuffer
+//
+template<class T>
+class TripleBuffer {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    TripleBuffer() : m_Middle(1)                    {m_Front=0; m_Back=2;}
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // Producer: slot to fill, then Publish() to hand it over.  Returns
+    // true if the value it replaced was never read.
+    T &GetBack()                                    {return m_Slots[m_Back];}
+    bool Publish() {
+        int old = m_Middle.exchange(m_Back | FRESH,std::memory_order_acq_rel);
+        m_Back = old & INDEX;
+        return (old & FRESH) != 0;
+    }
+
+    // Consumer: takes the newest published value if there is one.  Returns
+    // false (and keeps the current front) if nothing new was published.
+    bool Update() {
+        if(!(m_Middle.load(std::memory_order_acquire) & FRESH))
+            return false;
+        m_Front = m_Middle.exchange(m_Front,std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+    const T &GetFront() const                       {return m_Slots[m_Front];}
+    T &GetFront()                                   {return m_Slots[m_Front];}
+
+private:
+    // Not copyable
+    TripleBuffer(const TripleBuffer &);
+    TripleBuffer &operator=(const TripleBuffer &);
+
+    enum {INDEX = 3, FRESH = 4};
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    T m_Slots[3];
+    int m_Front;                    // Owned by the consumer
+    int m_Back;                     // Owned by the producer
+    std::atomic<int> m_Middle;      // Slot index, plus FRESH if not yet read
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// SceneSnapshot
+//
+struct SceneSnapshot {
+    unsigned int Tick;
+    double Time;                    // Simulation time in ms
+    float Rotation;
+    int ObjectCount;
+    Matrix Objects[SIM_MAX_OBJECTS];
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// SimStats
+//
+struct SimStats {
+    void Print() const;
+
+    unsigned int Ticks;             // Total ticks simulated
+    unsigned int Dropped;           // Snapshots replaced before being drawn
+    unsigned int Frames;            // Frames that acquired a snapshot
+    unsigned int StaleFrames;       // Frames that got no new snapshot
+    unsigned int Behind;            // Ticks the simulation couldn't keep up with
+    double StepMs;                  // Average time per tick
+    double TicksPerSecond;          // Measured rate since Start()
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// Simulation
+//
+class Simulation {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    Simulation();
+    ~Simulation();
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // Publishes the first snapshot and starts ticking 'hz' times a second
+    void Start(float hz=SIM_HZ);
+    void Stop();
+    bool IsRunning() const                          {return m_Running;}
+
+    // Render thread: the newest snapshot.  It stays valid and unchanged
+    // until the next call.
+    const SceneSnapshot &Acquire();
+
+    // Rotation per tick, in radians
+    void SetRotStep(float step)                     {m_RotStep = step;}
+    float GetRotStep() const                        {return m_RotStep;}
+
+    SimStats GetStats() const;
+
+    // Computes the scene at 'rotation' into 'out'
+    static void Step(float rotation,SceneSnapshot &out);
+
+private:
+    // Not copyable
+    Simulation(const Simulation &);
+    Simulation &operator=(const Simulation &);
+
+    void Run();
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    TripleBuffer<SceneSnapshot> m_Buffer;
+    std::thread m_Thread;
+    std::atomic<bool> m_Running;
+    std::atomic<float> m_RotStep;
+    float m_Hz;
+    double m_StartTime;
+
+    // Written by the simulation thread, read by GetStats
+    std::atomic<unsigned int> m_Ticks, m_Dropped, m_Behind;
+    std::atomic<double> m_StepMs;
+
+    // Render thread only
+    unsigned int m_Frames, m_StaleFrames;
+};
+
+#endif
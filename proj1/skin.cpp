@@ -0,0 +1,410 @@
+/////////////////////////////////////////////////////////////////////////////
+// skin.cpp
+/////////////////////////////////////
+// Joint hierarchies and linear blend skinning.
+/////////////////////////////////////////////////////////////////////////////
+
+#include "skin.h"
+#include "jobs.h"
+#include "simd.h"
+#include <algorithm>
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           AddJoint
+// Arguments:      Parent joint (-1 for a root) and the bind pose transform
+//                 relative to it
+// Returns:        The new joint's index, or -1 on error
+/////////////////////////////////////////////////////////////////////////////
+int Skeleton::AddJoint(int parent,const Matrix &bindLocal)
+{
+    int index = GetJointCount();
+    if(parent < -1 || parent >= index) {
+        printf("Skeleton: joint %d has invalid parent %d\n",index,parent);
+        return -1;
+    }
+    if(index >= SKIN_MAX_JOINTS) {
+        printf("Skeleton: more than %d joints\n",SKIN_MAX_JOINTS);
+        return -1;
+    }
+
+    Matrix world = parent < 0 ? bindLocal : Matrix(m_BindWorld[parent]*bindLocal);
+    Matrix inverse = world;
+    if(!inverse.InvertAffine()) {
+        printf("Skeleton: joint %d has a singular bind pose\n",index);
+        inverse.Identity();
+    }
+    m_Parents.push_back(parent);
+    m_BindLocal.push_back(bindLocal);
+    m_BindWorld.push_back(world);
+    m_InverseBind.push_back(inverse);
+    return index;
+}
+
+void Skeleton::Clear()
+{
+    m_Parents.clear();
+    m_BindLocal.clear();
+    m_BindWorld.clear();
+    m_InverseBind.clear();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           ComputeWorld
+// Arguments:      Output world transforms and the joints' local transforms,
+//                 one of each per joint
+// Returns:        none
+/////////////////////////////////////////////////////////////////////////////
+void Skeleton::ComputeWorld(Matrix *world,const Matrix *local) const
+{
+    for(int i = 0; i < GetJointCount(); i++) {
+        int parent = m_Parents[i];
+        if(parent < 0)
+            world[i] = local[i];
+        else
+            world[i] = world[parent]*local[i];
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           ComputePalette
+// Arguments:      Output skinning matrices and the joints' world transforms
+// Returns:        none
+/////////////////////////////////////////////////////////////////////////////
+void Skeleton::ComputePalette(Matrix34 *palette,const Matrix *world) const
+{
+    for(int i = 0; i < GetJointCount(); i++)
+        palette[i].Multiply(Matrix34(world[i]),Matrix34(m_InverseBind[i]));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           SkinnedMesh constructor
+/////////////////////////////////////////////////////////////////////////////
+SkinnedMesh::SkinnedMesh()
+{
+    m_JointCount = 0;
+}
+
+void SkinnedMesh::Free()
+{
+    m_BindPose.Free();
+    m_Output.Free();
+    m_Weights.clear();
+    m_Joints.clear();
+    m_JointCount = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Create
+// Arguments:      The mesh in its bind pose
+// Returns:        false if it is empty
+// Side Effects:   The output starts as a copy of the bind pose
+/////////////////////////////////////////////////////////////////////////////
+bool SkinnedMesh::Create(const Mesh &bindPose)
+{
+    Free();
+    if(bindPose.IsEmpty())
+        return false;
+
+    // Both copies have the same counts, so the same layout byte for byte
+    int vertexCount = bindPose.GetVertexCount();
+    m_BindPose.Create(vertexCount,bindPose.GetIndexCount(),bindPose.HasNormals());
+    m_Output.Create(vertexCount,bindPose.GetIndexCount(),bindPose.HasNormals());
+    memcpy((void*)m_BindPose.GetHeader(),bindPose.GetHeader(),bindPose.GetDataSize());
+    memcpy((void*)m_Output.GetHeader(),bindPose.GetHeader(),bindPose.GetDataSize());
+
+    // Padding vertices get all zero weights, which skin them to zero
+    int stride = GetVertexStride();
+    m_Weights.assign(SKIN_MAX_WEIGHTS*stride,0);
+    m_Joints.assign(SKIN_MAX_WEIGHTS*stride,0);
+    for(int v = 0; v < vertexCount; v++)
+        m_Weights[SKIN_MAX_WEIGHTS*v] = FloatToHalf(1.0f);
+    m_JointCount = 1;
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           SetInfluences
+// Arguments:      Vertex index, and 'count' joint indices and weights
+// Returns:        none
+// Notes:          Invalid joints and non-positive weights are dropped.  If
+//                 nothing is left the vertex follows joint 0.
+/////////////////////////////////////////////////////////////////////////////
+void SkinnedMesh::SetInfluences(int v,const int *joints,const float *weights,int count)
+{
+    int keep[SKIN_MAX_WEIGHTS];
+    float kept[SKIN_MAX_WEIGHTS];
+    int n = 0;
+    for(int i = 0; i < count; i++) {
+        if(joints[i] < 0 || joints[i] >= SKIN_MAX_JOINTS) {
+            printf("SkinnedMesh: vertex %d has invalid joint %d\n",v,joints[i]);
+            continue;
+        }
+        if(!(weights[i] > 0.0f))
+            continue;
+        // Insert in decreasing weight order, dropping the smallest
+        int pos = n < SKIN_MAX_WEIGHTS ? n++ : SKIN_MAX_WEIGHTS;
+        while(pos > 0 && kept[pos-1] < weights[i]) {
+            if(pos < SKIN_MAX_WEIGHTS) {
+                keep[pos] = keep[pos-1];
+                kept[pos] = kept[pos-1];
+            }
+            pos--;
+        }
+        if(pos < SKIN_MAX_WEIGHTS) {
+            keep[pos] = joints[i];
+            kept[pos] = weights[i];
+        }
+    }
+
+    float w[SKIN_MAX_WEIGHTS];
+    unsigned char *j = &m_Joints[SKIN_MAX_WEIGHTS*v];
+    float sum = 0.0f;
+    for(int i = 0; i < n; i++)
+        sum += kept[i];
+    for(int i = 0; i < SKIN_MAX_WEIGHTS; i++) {
+        w[i] = i < n ? kept[i]/sum : 0.0f;
+        j[i] = i < n ? (unsigned char)keep[i] : 0;
+        if(i < n && keep[i] >= m_JointCount)
+            m_JointCount = keep[i] + 1;
+    }
+    if(n == 0)
+        w[0] = 1.0f;
+
+    // Stored as halves.  The largest weight takes up what the rounding of
+    // the others left over, so the sum is 1 to within one rounding of it
+    // (2^-12).
+    unsigned short *h = &m_Weights[SKIN_MAX_WEIGHTS*v];
+    FloatsToHalves(h,w,SKIN_MAX_WEIGHTS);
+    float rest = 0.0f;
+    for(int i = 1; i < SKIN_MAX_WEIGHTS; i++)
+        rest += HalfToFloat(h[i]);
+    h[0] = FloatToHalf(1.0f - rest);
+}
+
+#ifdef CSE167_SSE
+#define SKIN_SPLAT(v,i)     _mm_shuffle_ps(v,v,_MM_SHUFFLE(i,i,i,i))
+
+// The last column of a Matrix34, from the end of it so nothing past the
+// matrix is read
+#define SKIN_LAST_COLUMN(m) _mm_shuffle_ps(_mm_loadu_ps((m)+8),_mm_loadu_ps((m)+8),_MM_SHUFFLE(3,3,2,1))
+
+// c += w * the columns of 'm'.  The columns are three floats apart, so the
+// fourth lane of each picks up the next one's first float.  Only the x, y
+// and z lanes of the results are ever stored.
+static inline void AddWeighted(__m128 c[4],__m128 w,const float *m)
+{
+    c[0] = _mm_add_ps(c[0],_mm_mul_ps(w,_mm_loadu_ps(m)));
+    c[1] = _mm_add_ps(c[1],_mm_mul_ps(w,_mm_loadu_ps(m+3)));
+    c[2] = _mm_add_ps(c[2],_mm_mul_ps(w,_mm_loadu_ps(m+6)));
+    c[3] = _mm_add_ps(c[3],_mm_mul_ps(w,SKIN_LAST_COLUMN(m)));
+}
+
+// Blends the palette entries of one vertex into the columns 'c'
+static inline void Blend(__m128 c[4],const Matrix34 *palette,const float *weights,const unsigned char *joints)
+{
+    __m128 w = _mm_loadu_ps(weights);
+    __m128 w0 = SKIN_SPLAT(w,0);
+    const float *m = palette[joints[0]].m_m;
+    c[0] = _mm_mul_ps(w0,_mm_loadu_ps(m));
+    c[1] = _mm_mul_ps(w0,_mm_loadu_ps(m+3));
+    c[2] = _mm_mul_ps(w0,_mm_loadu_ps(m+6));
+    c[3] = _mm_mul_ps(w0,SKIN_LAST_COLUMN(m));
+    AddWeighted(c,SKIN_SPLAT(w,1),palette[joints[1]].m_m);
+    AddWeighted(c,SKIN_SPLAT(w,2),palette[joints[2]].m_m);
+    AddWeighted(c,SKIN_SPLAT(w,3),palette[joints[3]].m_m);
+}
+
+// c0*x + c1*y + c2*z (+ c3 for points)
+static inline __m128 ApplyPoint(const __m128 c[4],__m128 x,__m128 y,__m128 z)
+{
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[0],x),_mm_mul_ps(c[1],y)),
+                      _mm_add_ps(_mm_mul_ps(c[2],z),c[3]));
+}
+static inline __m128 ApplyVector(const __m128 c[4],__m128 x,__m128 y,__m128 z)
+{
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[0],x),_mm_mul_ps(c[1],y)),_mm_mul_ps(c[2],z));
+}
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Skin
+// Arguments:      Skinning matrices, and the range of vertices to skin
+// Returns:        none
+// Side Effects:   Writes the skinned positions (and normals) of the range
+//                 into the output mesh.  Its bounds are left alone.
+/////////////////////////////////////////////////////////////////////////////
+void SkinnedMesh::Skin(const Matrix34 *palette,int begin,int end)
+{
+    if(m_BindPose.IsEmpty())
+        return;
+    bool normals = m_BindPose.HasNormals();
+    const float *x = m_BindPose.GetX(), *y = m_BindPose.GetY(), *z = m_BindPose.GetZ();
+    float *ox = m_Output.GetX(), *oy = m_Output.GetY(), *oz = m_Output.GetZ();
+    const float *nx = 0, *ny = 0, *nz = 0;
+    float *onx = 0, *ony = 0, *onz = 0;
+    if(normals) {
+        nx = m_BindPose.GetNX(); ny = m_BindPose.GetNY(); nz = m_BindPose.GetNZ();
+        onx = m_Output.GetNX(); ony = m_Output.GetNY(); onz = m_Output.GetNZ();
+    }
+    const unsigned short *weights = &m_Weights[0];
+    const unsigned char *joints = &m_Joints[0];
+
+#ifdef CSE167_SSE
+    // The mesh arrays are 64 byte aligned and padded, so whole groups of
+    // four can be loaded and stored directly
+    for(int v = begin; v < end; v += 4) {
+        float w[4*SKIN_MAX_WEIGHTS];
+        HalvesToFloats(w,weights + SKIN_MAX_WEIGHTS*v,4*SKIN_MAX_WEIGHTS);
+        __m128 c[4][4];
+        for(int k = 0; k < 4; k++)
+            Blend(c[k],palette,w + SKIN_MAX_WEIGHTS*k,joints + SKIN_MAX_WEIGHTS*(v+k));
+
+        __m128 px = _mm_load_ps(x+v), py = _mm_load_ps(y+v), pz = _mm_load_ps(z+v);
+        __m128 p0 = ApplyPoint(c[0],SKIN_SPLAT(px,0),SKIN_SPLAT(py,0),SKIN_SPLAT(pz,0));
+        __m128 p1 = ApplyPoint(c[1],SKIN_SPLAT(px,1),SKIN_SPLAT(py,1),SKIN_SPLAT(pz,1));
+        __m128 p2 = ApplyPoint(c[2],SKIN_SPLAT(px,2),SKIN_SPLAT(py,2),SKIN_SPLAT(pz,2));
+        __m128 p3 = ApplyPoint(c[3],SKIN_SPLAT(px,3),SKIN_SPLAT(py,3),SKIN_SPLAT(pz,3));
+        _MM_TRANSPOSE4_PS(p0,p1,p2,p3);
+        _mm_store_ps(ox+v,p0);
+        _mm_store_ps(oy+v,p1);
+        _mm_store_ps(oz+v,p2);
+
+        if(normals) {
+            __m128 qx = _mm_load_ps(nx+v), qy = _mm_load_ps(ny+v), qz = _mm_load_ps(nz+v);
+            __m128 n0 = ApplyVector(c[0],SKIN_SPLAT(qx,0),SKIN_SPLAT(qy,0),SKIN_SPLAT(qz,0));
+            __m128 n1 = ApplyVector(c[1],SKIN_SPLAT(qx,1),SKIN_SPLAT(qy,1),SKIN_SPLAT(qz,1));
+            __m128 n2 = ApplyVector(c[2],SKIN_SPLAT(qx,2),SKIN_SPLAT(qy,2),SKIN_SPLAT(qz,2));
+            __m128 n3 = ApplyVector(c[3],SKIN_SPLAT(qx,3),SKIN_SPLAT(qy,3),SKIN_SPLAT(qz,3));
+            _MM_TRANSPOSE4_PS(n0,n1,n2,n3);
+
+            // Renormalize with rsqrt and one Newton-Raphson step, leaving
+            // zero length (padding) normals at zero
+            __m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(n0,n0),_mm_mul_ps(n1,n1)),_mm_mul_ps(n2,n2));
+            __m128 r = _mm_rsqrt_ps(len2);
+            __m128 hx = _mm_mul_ps(_mm_set1_ps(0.5f),len2);
+            r = _mm_mul_ps(r,_mm_sub_ps(_mm_set1_ps(1.5f),_mm_mul_ps(hx,_mm_mul_ps(r,r))));
+            r = _mm_and_ps(r,_mm_cmpgt_ps(len2,_mm_setzero_ps()));
+            _mm_store_ps(onx+v,_mm_mul_ps(n0,r));
+            _mm_store_ps(ony+v,_mm_mul_ps(n1,r));
+            _mm_store_ps(onz+v,_mm_mul_ps(n2,r));
+        }
+    }
+#else
+    for(int v = begin; v < end; v++) {
+        float w[SKIN_MAX_WEIGHTS];
+        HalvesToFloats(w,weights + SKIN_MAX_WEIGHTS*v,SKIN_MAX_WEIGHTS);
+        const unsigned char *j = joints + SKIN_MAX_WEIGHTS*v;
+        float c[12];
+        for(int i = 0; i < 12; i++)
+            c[i] = w[0]*palette[j[0]].m_m[i] + w[1]*palette[j[1]].m_m[i] +
+                   w[2]*palette[j[2]].m_m[i] + w[3]*palette[j[3]].m_m[i];
+        ox[v] = c[0]*x[v] + c[3]*y[v] + c[6]*z[v] + c[9];
+        oy[v] = c[1]*x[v] + c[4]*y[v] + c[7]*z[v] + c[10];
+        oz[v] = c[2]*x[v] + c[5]*y[v] + c[8]*z[v] + c[11];
+        if(normals) {
+            Vector3 n(c[0]*nx[v] + c[3]*ny[v] + c[6]*nz[v],
+                      c[1]*nx[v] + c[4]*ny[v] + c[7]*nz[v],
+                      c[2]*nx[v] + c[5]*ny[v] + c[8]*nz[v]);
+            if(n.x != 0.0f || n.y != 0.0f || n.z != 0.0f)
+                n.Normalize<FastMath>();
+            onx[v] = n.x;
+            ony[v] = n.y;
+            onz[v] = n.z;
+        }
+    }
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           SkinMeshes
+// Arguments:      Meshes and their palettes, and how many there are
+// Returns:        none
+// Side Effects:   Every mesh is cut into SKIN_GRAIN vertex chunks and all
+//                 the chunks of all the meshes are spread over the shared
+//                 job pool together
+/////////////////////////////////////////////////////////////////////////////
+void SkinMeshes(SkinJob *jobs,int count)
+{
+    int chunks = 0;
+    for(int i = 0; i < count; i++) {
+        jobs[i].FirstChunk = chunks;
+        chunks += (jobs[i].Target->GetVertexStride() + SKIN_GRAIN - 1)/SKIN_GRAIN;
+    }
+
+    ParallelFor(chunks,1,[jobs,count](int begin,int end,int) {
+        for(int chunk = begin; chunk < end; chunk++) {
+            // The last job starting at or before this chunk (empty meshes
+            // have no chunks, so it is never one of those)
+            int lo = 0, hi = count;
+            while(hi - lo > 1) {
+                int mid = (lo + hi)/2;
+                if(jobs[mid].FirstChunk <= chunk)
+                    lo = mid;
+                else
+                    hi = mid;
+            }
+            const SkinJob &job = jobs[lo];
+            int first = (chunk - job.FirstChunk)*SKIN_GRAIN;
+            int last = std::min(first + SKIN_GRAIN,job.Target->GetVertexStride());
+            job.Target->Skin(job.Palette,first,last);
+        }
+    });
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           MakeSkinnedCylinder
+// Arguments:      Skeleton and mesh to fill, number of joints, rings of
+//                 quads along the tube and vertices around it, and the
+//                 tube's size
+// Returns:        none
+/////////////////////////////////////////////////////////////////////////////
+void MakeSkinnedCylinder(Skeleton &skel,SkinnedMesh &mesh,int joints,int rings,int sides,
+                         float length,float radius)
+{
+    if(joints < 1) joints = 1;
+    if(joints > SKIN_MAX_JOINTS) joints = SKIN_MAX_JOINTS;
+    if(rings < 1) rings = 1;
+    if(sides < 3) sides = 3;
+
+    float segment = joints > 1 ? length/(joints-1) : length;
+    skel.Clear();
+    for(int i = 0; i < joints; i++) {
+        Matrix local;
+        if(i > 0)
+            local.MakeTranslate(0.0f,segment,0.0f);
+        skel.AddJoint(i-1,local);
+    }
+
+    Mesh bind;
+    bind.Create((rings+1)*sides,6*rings*sides,true);
+    for(int r = 0; r <= rings; r++) {
+        float y = length*r/rings;
+        for(int s = 0; s < sides; s++) {
+            float a = 2.0f*(float)M_PI*s/sides;
+            int v = r*sides + s;
+            bind.SetPosition(v,Point3(radius*cosf(a),y,radius*sinf(a)));
+            bind.SetNormal(v,Vector3(cosf(a),0.0f,sinf(a)));
+        }
+    }
+    unsigned int *idx = bind.GetIndices();
+    for(int r = 0; r < rings; r++) {
+        for(int s = 0; s < sides; s++) {
+            unsigned int a = r*sides + s, b = r*sides + (s+1)%sides;
+            unsigned int c = a + sides, d = b + sides;
+            *idx++ = a; *idx++ = c; *idx++ = b;
+            *idx++ = b; *idx++ = c; *idx++ = d;
+        }
+    }
+    bind.ComputeBounds();
+
+    mesh.Create(bind);
+    for(int v = 0; v < mesh.GetVertexCount(); v++) {
+        // Blend between the joints just below and just above
+        float t = bind.GetY()[v]/segment;
+        int j0 = std::min((int)t,std::max(joints-2,0));
+        int j[2] = {j0,std::min(j0+1,joints-1)};
+        float f = t - j0;
+        float w[2] = {1.0f - f,f};
+        mesh.SetInfluences(v,j,w,2);
+    }
+}
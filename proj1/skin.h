@@ -0,0 +1,192 @@
+/////////////////////////////////////////////////////////////////////////////
+// skin.h
+//
+/////////////////////////////////////
+// Classes declared:
+//
+// Skeleton:    A joint hierarchy in its bind pose.  Joints are added
+//              parents first, so walking the array in order always visits
+//              a parent before its children and world transforms take one
+//              pass.  Each joint keeps the inverse of its bind pose world
+//              transform, which takes a bind pose vertex into the joint's
+//              own space.
+//
+// SkinnedMesh: A bind pose Mesh plus up to SKIN_MAX_WEIGHTS joint
+//              influences per vertex, and the output Mesh it is skinned
+//              into.  The output has exactly the layout of any other Mesh,
+//              so it is drawn (or handed to anything else that takes a
+//              Mesh) as usual.
+//
+// SkinJob:     One mesh and the palette to skin it with, for SkinMeshes().
+//
+// Functions declared:
+//
+// SkinMeshes():            Skins a batch of meshes on the shared job pool,
+//                          splitting large meshes into SKIN_GRAIN vertex
+//                          chunks so one big character still uses every
+//                          thread.
+// MakeSkinnedCylinder():   A test subject: a tube along +y with a chain of
+//                          joints up its middle.
+//
+// Linear blend skinning: the palette entry for joint j is
+//
+//     palette[j] = world[j] * inverseBind[j]
+//
+// and each vertex is transformed by the weighted sum of the palette entries
+// of its joints.  The joints are affine, so the palette holds Matrix34s
+// (see compress.h): 48 bytes an entry instead of 64, read four times per
+// vertex.  The weights are half floats (see compress.h), 8 bytes a vertex
+// instead of 16, widened four vertices at a time as they are skinned.
+// The SSE kernel blends the matrices column by column
+// (4 multiply-adds per weight, branch free), transforms one vertex per
+// blended matrix, and transposes four results at a time back into the SoA
+// arrays.  Normals go through the same blended matrix and are renormalized,
+// which is right as long as the joints don't scale non-uniformly.
+//
+/////////////////////////////////////
+// Common Operations Supported:
+//
+// Skeleton skel;
+// int hip = skel.AddJoint(-1,hipBind);            // Parents first
+// int knee = skel.AddJoint(hip,kneeBind);         // Bind pose relative to parent
+//
+// SkinnedMesh mesh;
+// mesh.Create(bindPoseMesh);
+// mesh.SetInfluences(v,joints,weights,2);         // Per vertex
+//
+// skel.ComputeWorld(world,local);                 // Per frame: animate,
+// skel.ComputePalette(palette,world);             // build the palette,
+// mesh.Skin(palette);                             // skin
+// mesh.GetOutput().Draw(m);                       // and draw
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSE167_SKIN_H_
+#define CSE167_SKIN_H_
+
+#include "mesh.h"
+#include "compress.h"
+#include <vector>
+
+#define SKIN_MAX_JOINTS         256             // Joint indices are bytes
+#define SKIN_MAX_WEIGHTS        4
+#define SKIN_GRAIN              4096            // Vertices per job
+
+/////////////////////////////////////////////////////////////////////////////
+// Skeleton
+//
+class Skeleton {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    Skeleton()                                      {}
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // Adds a joint with the given bind pose transform relative to its
+    // parent (-1 for a root).  Returns its index, or -1 if the parent is
+    // invalid or there are already SKIN_MAX_JOINTS.
+    int AddJoint(int parent,const Matrix &bindLocal);
+    void Clear();
+
+    // world[i] = world[parent] * local[i] for every joint
+    void ComputeWorld(Matrix *world,const Matrix *local) const;
+    // palette[i] = world[i] * inverseBind[i] for every joint
+    void ComputePalette(Matrix34 *palette,const Matrix *world) const;
+
+    // Accessors
+    int GetJointCount() const                       {return (int)m_Parents.size();}
+    int GetParent(int i) const                      {return m_Parents[i];}
+    const Matrix &GetBindLocal(int i) const         {return m_BindLocal[i];}
+    const Matrix &GetBindWorld(int i) const         {return m_BindWorld[i];}
+    const Matrix &GetInverseBind(int i) const       {return m_InverseBind[i];}
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    std::vector<int> m_Parents;
+    std::vector<Matrix> m_BindLocal;
+    std::vector<Matrix> m_BindWorld;
+    std::vector<Matrix> m_InverseBind;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// SkinnedMesh
+//
+class SkinnedMesh {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    SkinnedMesh();
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // Copies the bind pose and binds every vertex fully to joint 0.
+    // Returns false if the mesh is empty.
+    bool Create(const Mesh &bindPose);
+    void Free();
+
+    // Sets the joints moving vertex 'v'.  Only the SKIN_MAX_WEIGHTS largest
+    // weights are kept, and they are scaled to add up to 1.
+    void SetInfluences(int v,const int *joints,const float *weights,int count);
+
+    // Skins vertices [begin,end) into the output mesh.  'palette' needs an
+    // entry for every joint used; 'begin' and 'end' must be multiples of 4
+    // (the vertex stride always is).  Ranges may be skinned on different
+    // threads at once.
+    void Skin(const Matrix34 *palette,int begin,int end);
+    void Skin(const Matrix34 *palette)              {Skin(palette,0,GetVertexStride());}
+
+    // Accessors
+    const Mesh &GetBindPose() const                 {return m_BindPose;}
+    const Mesh &GetOutput() const                   {return m_Output;}
+    Mesh &GetOutput()                               {return m_Output;}
+    int GetVertexCount() const                      {return m_BindPose.GetVertexCount();}
+    int GetVertexStride() const                     {return m_BindPose.GetVertexStride();}
+    // One more than the largest joint index any vertex uses
+    int GetJointCount() const                       {return m_JointCount;}
+
+private:
+    // Not copyable
+    SkinnedMesh(const SkinnedMesh &);
+    SkinnedMesh &operator=(const SkinnedMesh &);
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    Mesh m_BindPose;
+    Mesh m_Output;
+    std::vector<unsigned short> m_Weights;  // SKIN_MAX_WEIGHTS half floats per vertex, unused ones 0
+    std::vector<unsigned char> m_Joints;    // SKIN_MAX_WEIGHTS per vertex
+    int m_JointCount;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// SkinJob
+//
+struct SkinJob {
+    SkinnedMesh *Target;
+    const Matrix34 *Palette;
+    int FirstChunk;                 // Filled in by SkinMeshes
+};
+
+// Skins every job's mesh with its palette, in parallel
+void SkinMeshes(SkinJob *jobs,int count);
+
+// Builds a tube of the given length and radius along +y, starting at the
+// origin, with 'joints' joints evenly spaced up its axis (each the child of
+// the one below).  Every vertex is weighted between its two nearest joints.
+void MakeSkinnedCylinder(Skeleton &skel,SkinnedMesh &mesh,int joints,int rings,int sides,
+                         float length,float radius);
+
+#endif
@@ -0,0 +1,430 @@
+/////////////////////////////////////////////////////////////////////////////
+// streaming.cpp
+/////////////////////////////////////
+// Out-of-core scene streaming.
+//
+// The frame thread owns every chunk's State and does all the bookkeeping.
+// The I/O threads only see three queues: chunks to load (nearest first),
+// finished loads to hand back, and evicted meshes to free.  Freeing on the
+// I/O threads keeps the cost of unmapping large files out of the frame.
+/////////////////////////////////////////////////////////////////////////////
+
+#include "streaming.h"
+#include <algorithm>
+
+#define STREAM_PAGE_SIZE    4096
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Print
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Prints the counters to stdout
+/////////////////////////////////////////////////////////////////////////////
+void StreamStats::Print() const
+{
+    printf("streaming: %d/%d wanted resident, %d resident, %d queued, %d loading, %d failed\n",
+           WantedResident,Wanted,Resident,Queued,Loading,Failed);
+    printf("           %.1f MB resident + %.1f MB pending of %.1f MB, %d loads, %d evictions\n",
+           ResidentBytes/1048576.0,PendingBytes/1048576.0,BudgetBytes/1048576.0,
+           LoadsCompleted,Evictions);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           StreamingScene constructor
+// Arguments:      Size of a grid cell in world units, resident memory budget
+//                 in bytes, and the number of I/O threads to start
+// Returns:        none
+/////////////////////////////////////////////////////////////////////////////
+StreamingScene::StreamingScene(float cellSize,size_t budgetBytes,int ioThreads)
+{
+    m_CellSize = cellSize;
+    m_Budget = budgetBytes;
+    for(int i = 0; i < 3; i++) {
+        m_CellLo[i] = 0;
+        m_CellHi[i] = -1;
+    }
+    m_Frame = 0;
+    m_ResidentBytes = m_PendingBytes = 0;
+    m_Wanted = m_WantedResident = 0;
+    m_LoadsCompleted = m_Evictions = 0;
+    m_Quit = false;
+
+    if(ioThreads < 1)
+        ioThreads = 1;
+    for(int i = 0; i < ioThreads; i++)
+        m_Threads.push_back(std::thread(&StreamingScene::IOThread,this));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           StreamingScene destructor
+// Side Effects:   Stops the I/O threads (waiting for any read in progress)
+//                 and frees every chunk
+/////////////////////////////////////////////////////////////////////////////
+StreamingScene::~StreamingScene()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Lock);
+        m_Quit = true;
+    }
+    m_Wake.notify_all();
+    for(size_t i = 0; i < m_Threads.size(); i++)
+        m_Threads[i].join();
+
+    for(size_t i = 0; i < m_Completed.size(); i++)
+        delete m_Completed[i].Data;
+    for(size_t i = 0; i < m_Unloads.size(); i++)
+        delete m_Unloads[i];
+    for(size_t i = 0; i < m_Chunks.size(); i++) {
+        delete m_Chunks[i]->Data;
+        delete m_Chunks[i];
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           CellOf, CellKey
+// Notes:          Grid cell coordinates of a point, and a hash key for a
+//                 cell (21 bits per axis, enough for +-1M cells).
+/////////////////////////////////////////////////////////////////////////////
+void StreamingScene::CellOf(const Point3 &p,int cell[3]) const
+{
+    cell[0] = (int)floorf(p.x/m_CellSize);
+    cell[1] = (int)floorf(p.y/m_CellSize);
+    cell[2] = (int)floorf(p.z/m_CellSize);
+}
+
+long long StreamingScene::CellKey(int cx,int cy,int cz) const
+{
+    const long long mask = (1<<21)-1;
+    return ((cx & mask) << 42) | ((cy & mask) << 21) | (cz & mask);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           AddChunk
+// Arguments:      Binary mesh file and its world space bounds
+// Returns:        The chunk index, or -1 if the file can't be opened
+// Notes:          Only the file size is read here; the mesh itself is loaded
+//                 when the camera comes close enough.
+/////////////////////////////////////////////////////////////////////////////
+int StreamingScene::AddChunk(const char *filename,const Point3 &bmin,const Point3 &bmax)
+{
+    FILE *f = fopen(filename,"rb");
+    if(!f) {
+        printf("StreamingScene: can't open '%s'\n",filename);
+        return -1;
+    }
+    fseek(f,0,SEEK_END);
+    long size = ftell(f);
+    fclose(f);
+
+    StreamChunk *c = new StreamChunk;
+    c->Filename = filename;
+    c->BoundsMin = bmin;
+    c->BoundsMax = bmax;
+    c->Bytes = size > 0 ? (size_t)size : 0;
+    c->State = STREAM_UNLOADED;
+    c->Data = 0;
+    c->LastWanted = 0;
+    c->Distance = 0.0f;
+
+    int index = (int)m_Chunks.size();
+    m_Chunks.push_back(c);
+
+    int cell[3];
+    CellOf(Point3(0.5f*(bmin.x+bmax.x),0.5f*(bmin.y+bmax.y),0.5f*(bmin.z+bmax.z)),cell);
+    m_Cells[CellKey(cell[0],cell[1],cell[2])].push_back(index);
+    for(int i = 0; i < 3; i++) {
+        if(index == 0 || cell[i] < m_CellLo[i]) m_CellLo[i] = cell[i];
+        if(index == 0 || cell[i] > m_CellHi[i]) m_CellHi[i] = cell[i];
+    }
+    return index;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           LoadManifest
+// Arguments:      Name of a manifest file (see streaming.h)
+// Returns:        false if the manifest can't be read or has bad lines
+/////////////////////////////////////////////////////////////////////////////
+bool StreamingScene::LoadManifest(const char *filename)
+{
+    FILE *f = fopen(filename,"r");
+    if(!f) {
+        printf("StreamingScene: can't open '%s'\n",filename);
+        return false;
+    }
+
+    // Chunk paths are relative to the manifest's directory
+    std::string dir(filename);
+    size_t slash = dir.find_last_of("/\\");
+    dir = slash == std::string::npos ? "" : dir.substr(0,slash+1);
+
+    bool ok = true;
+    int lineNum = 0;
+    char line[1024], path[768];
+    while(fgets(line,sizeof(line),f)) {
+        lineNum++;
+        const char *s = line;
+        while(*s == ' ' || *s == '\t') s++;
+        if(*s == '#' || *s == '\n' || *s == '\r' || *s == 0)
+            continue;
+
+        Point3 lo, hi;
+        if(sscanf(s,"chunk %f %f %f %f %f %f %767s",&lo.x,&lo.y,&lo.z,&hi.x,&hi.y,&hi.z,path) != 7) {
+            printf("StreamingScene: '%s' line %d is malformed\n",filename,lineNum);
+            ok = false;
+            continue;
+        }
+        if(AddChunk((dir + path).c_str(),lo,hi) < 0)
+            ok = false;
+    }
+    fclose(f);
+    return ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           EvictFor
+// Arguments:      Bytes that need to fit in the budget
+// Returns:        true if they fit (after evicting if needed)
+// Side Effects:   Evicts resident chunks that were not wanted this frame,
+//                 least recently wanted (then farthest) first.  Their meshes
+//                 are handed to the I/O threads to free.
+// Notes:          Called by Update with m_Lock held.
+/////////////////////////////////////////////////////////////////////////////
+bool StreamingScene::EvictFor(size_t bytes)
+{
+    while(m_ResidentBytes + m_PendingBytes + bytes > m_Budget) {
+        int victim = -1;
+        for(int i = 0; i < (int)m_Resident.size(); i++) {
+            StreamChunk *c = m_Resident[i];
+            if(c->LastWanted == m_Frame)
+                continue;
+            if(victim < 0 || c->LastWanted < m_Resident[victim]->LastWanted ||
+               (c->LastWanted == m_Resident[victim]->LastWanted && c->Distance > m_Resident[victim]->Distance))
+                victim = i;
+        }
+        if(victim < 0)
+            return false;
+
+        StreamChunk *c = m_Resident[victim];
+        m_Resident[victim] = m_Resident.back();
+        m_Resident.pop_back();
+        m_Unloads.push_back(c->Data);
+        c->Data = 0;
+        c->State = STREAM_UNLOADED;
+        m_ResidentBytes -= c->Bytes;
+        m_Evictions++;
+    }
+    return true;
+}
+
+static bool NearerChunk(const StreamChunk *a,const StreamChunk *b)
+{
+    return a->Distance < b->Distance;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Update
+// Arguments:      Camera position and load radius in world units
+// Returns:        none
+// Side Effects:   1. Makes finished loads resident.
+//                 2. Finds the chunks whose bounds are within 'loadRadius'.
+//                 3. Rebuilds the request queue in order of distance,
+//                    dropping requests that are no longer wanted and adding
+//                    new ones while they fit in the budget.
+// Notes:          Only holds m_Lock for queue operations, never for I/O.
+/////////////////////////////////////////////////////////////////////////////
+void StreamingScene::Update(const Point3 &camera,float loadRadius)
+{
+    m_Frame++;
+
+    // Chunks within the load radius, nearest first
+    m_WantedList.clear();
+    int lo[3], hi[3];
+    CellOf(camera - Vector3(loadRadius,loadRadius,loadRadius),lo);
+    CellOf(camera + Vector3(loadRadius,loadRadius,loadRadius),hi);
+    for(int i = 0; i < 3; i++) {
+        if(lo[i] < m_CellLo[i]) lo[i] = m_CellLo[i];
+        if(hi[i] > m_CellHi[i]) hi[i] = m_CellHi[i];
+    }
+    // Chunks can stick out of their cell, so look one cell further
+    for(int cz = lo[2]-1; cz <= hi[2]+1; cz++)
+    for(int cy = lo[1]-1; cy <= hi[1]+1; cy++)
+    for(int cx = lo[0]-1; cx <= hi[0]+1; cx++) {
+        std::unordered_map<long long,std::vector<int> >::const_iterator it = m_Cells.find(CellKey(cx,cy,cz));
+        if(it == m_Cells.end())
+            continue;
+        for(size_t i = 0; i < it->second.size(); i++) {
+            StreamChunk *c = m_Chunks[it->second[i]];
+            // Distance from the camera to the chunk's box
+            float d[3] = {0,0,0};
+            for(int k = 0; k < 3; k++) {
+                float p = ((float*)&camera)[k];
+                float bmin = ((float*)&c->BoundsMin)[k], bmax = ((float*)&c->BoundsMax)[k];
+                d[k] = p < bmin ? bmin-p : (p > bmax ? p-bmax : 0.0f);
+            }
+            float dist = FastMath::Sqrt(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
+            if(dist > loadRadius || c->LastWanted == m_Frame)
+                continue;
+            c->Distance = dist;
+            c->LastWanted = m_Frame;
+            m_WantedList.push_back(c);
+        }
+    }
+    std::sort(m_WantedList.begin(),m_WantedList.end(),NearerChunk);
+
+    std::lock_guard<std::mutex> lock(m_Lock);
+
+    // Pick up finished loads
+    for(size_t i = 0; i < m_Completed.size(); i++) {
+        StreamChunk *c = m_Completed[i].Chunk;
+        m_Pending.erase(std::find(m_Pending.begin(),m_Pending.end(),c));
+        m_PendingBytes -= c->Bytes;
+        if(m_Completed[i].Data) {
+            c->Data = m_Completed[i].Data;
+            c->State = STREAM_RESIDENT;
+            m_Resident.push_back(c);
+            m_ResidentBytes += c->Bytes;
+            m_LoadsCompleted++;
+        }
+        else
+            c->State = STREAM_FAILED;
+    }
+    m_Completed.clear();
+
+    // Anything pending but no longer in the queue has been picked up by an
+    // I/O thread.  Requests still waiting that are no longer wanted are
+    // dropped; the rest are re-queued below in their new order.
+    for(size_t i = 0; i < m_Pending.size(); i++)
+        m_Pending[i]->State = STREAM_LOADING;
+    m_Waiting.assign(m_Requests.begin(),m_Requests.end());
+    m_Requests.clear();
+    for(size_t i = 0; i < m_Waiting.size(); i++) {
+        StreamChunk *c = m_Waiting[i];
+        if(c->LastWanted == m_Frame)
+            c->State = STREAM_QUEUED;
+        else {
+            c->State = STREAM_UNLOADED;
+            m_Pending.erase(std::find(m_Pending.begin(),m_Pending.end(),c));
+            m_PendingBytes -= c->Bytes;
+        }
+    }
+
+    // Queue the wanted chunks nearest first while they fit in the budget
+    m_Wanted = (int)m_WantedList.size();
+    m_WantedResident = 0;
+    bool full = false;
+    for(size_t i = 0; i < m_WantedList.size(); i++) {
+        StreamChunk *c = m_WantedList[i];
+        if(c->State == STREAM_RESIDENT)
+            m_WantedResident++;
+        else if(c->State == STREAM_QUEUED)
+            m_Requests.push_back(c);
+        else if(c->State == STREAM_UNLOADED && !full) {
+            if(!EvictFor(c->Bytes)) {
+                full = true;
+                continue;
+            }
+            c->State = STREAM_QUEUED;
+            m_Pending.push_back(c);
+            m_PendingBytes += c->Bytes;
+            m_Requests.push_back(c);
+        }
+    }
+
+    if(!m_Requests.empty() || !m_Unloads.empty())
+        m_Wake.notify_all();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           IOThread
+// Arguments:      none
+// Returns:        none
+// Notes:          Frees evicted meshes and loads requested chunks until the
+//                 scene is destroyed.  After mapping a chunk every page is
+//                 touched so the frame thread never takes the page faults.
+/////////////////////////////////////////////////////////////////////////////
+void StreamingScene::IOThread()
+{
+    std::unique_lock<std::mutex> lock(m_Lock);
+    for(;;) {
+        while(!m_Quit && m_Requests.empty() && m_Unloads.empty())
+            m_Wake.wait(lock);
+        if(m_Quit)
+            break;
+
+        if(!m_Unloads.empty()) {
+            Mesh *m = m_Unloads.back();
+            m_Unloads.pop_back();
+            lock.unlock();
+            delete m;
+            lock.lock();
+            continue;
+        }
+
+        StreamChunk *c = m_Requests.front();
+        m_Requests.pop_front();
+        std::string filename = c->Filename;
+        lock.unlock();
+
+        Mesh *m = new Mesh;
+        if(m->Load(filename.c_str())) {
+            const volatile char *p = (const char*)m->GetHeader();
+            size_t size = m->GetDataSize();
+            char sum = 0;
+            for(size_t i = 0; i < size; i += STREAM_PAGE_SIZE)
+                sum += p[i];
+            (void)sum;
+        }
+        else {
+            delete m;
+            m = 0;
+        }
+
+        lock.lock();
+        Completion done = {c,m};
+        m_Completed.push_back(done);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Draw
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Draws every resident chunk (chunks are in world space)
+/////////////////////////////////////////////////////////////////////////////
+void StreamingScene::Draw() const
+{
+    for(size_t i = 0; i < m_Resident.size(); i++)
+        m_Resident[i]->Data->Draw(Matrix::IDENTITY);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           GetProgress, GetStats
+// Notes:          Reflect the state as of the last Update
+/////////////////////////////////////////////////////////////////////////////
+float StreamingScene::GetProgress() const
+{
+    return m_Wanted > 0 ? (float)m_WantedResident/m_Wanted : 1.0f;
+}
+
+StreamStats StreamingScene::GetStats() const
+{
+    StreamStats s;
+    memset(&s,0,sizeof(s));
+    s.Chunks = (int)m_Chunks.size();
+    s.Wanted = m_Wanted;
+    s.WantedResident = m_WantedResident;
+    s.Resident = (int)m_Resident.size();
+    for(size_t i = 0; i < m_Pending.size(); i++) {
+        if(m_Pending[i]->State == STREAM_QUEUED) s.Queued++;
+        else s.Loading++;
+    }
+    for(size_t i = 0; i < m_Chunks.size(); i++) {
+        if(m_Chunks[i]->State == STREAM_FAILED) s.Failed++;
+    }
+    s.ResidentBytes = m_ResidentBytes;
+    s.PendingBytes = m_PendingBytes;
+    s.BudgetBytes = m_Budget;
+    s.LoadsCompleted = m_LoadsCompleted;
+    s.Evictions = m_Evictions;
+    return s;
+}
@@ -0,0 +1,178 @@
+/////////////////////////////////////////////////////////////////////////////
+// streaming.h
+//
+/////////////////////////////////////
+// Classes declared:
+//
+// StreamChunk:    One binary mesh file of a streamed scene, in world space,
+//                 with its bounds and residency state.
+//
+// StreamStats:    Residency and progress counters for tuning budgets.
+//
+// StreamingScene: A scene too big to keep in memory.  The world is split
+//                 into a uniform grid of cells and every chunk belongs to
+//                 the cell holding its center.  Each frame Update() asks
+//                 for the chunks in cells near the camera; background I/O
+//                 threads map and page them in, and chunks that haven't been
+//                 wanted recently are evicted, least recently used first,
+//                 to keep resident memory under a budget.
+//
+// Update() and Draw() never wait for I/O.  The only lock they take guards
+// the request and completion queues, and the I/O threads never hold it
+// while reading.  Chunks show up in Draw() on the first frame after they
+// finish loading.
+//
+/////////////////////////////////////
+// Manifest Format:
+//
+// A text file with one chunk per line (paths are relative to the manifest):
+//
+//   # comment
+//   chunk minx miny minz maxx maxy maxz path/to/chunk.mesh
+//
+/////////////////////////////////////
+// Common Operations Supported:
+//
+// StreamingScene s(64.0f,256<<20,2);  // Cell size, byte budget, I/O threads
+// s.LoadManifest("world.stream");
+// s.Update(camera,loadRadius);        // Once per frame, never blocks
+// s.Draw();                           // Draw whatever is resident
+// s.GetStats().Print();
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSE167_STREAMING_H_
+#define CSE167_STREAMING_H_
+
+#include "mesh.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+enum StreamState {
+    STREAM_UNLOADED,
+    STREAM_QUEUED,      // Waiting for an I/O thread
+    STREAM_LOADING,     // Being read by an I/O thread
+    STREAM_RESIDENT,
+    STREAM_FAILED
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// StreamChunk
+//
+struct StreamChunk {
+    std::string Filename;
+    Point3 BoundsMin, BoundsMax;    // World space
+    size_t Bytes;                   // File size, which is what it costs resident
+
+    // Owned by the frame thread
+    StreamState State;
+    Mesh *Data;                     // Set while resident
+    unsigned int LastWanted;        // Last frame it was within the load radius
+    float Distance;                 // From the camera at the last Update
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// StreamStats
+//
+struct StreamStats {
+    void Print() const;
+
+    int Chunks;                     // Chunks in the scene
+    int Wanted;                     // Within the load radius this frame
+    int WantedResident;             // ...and already resident
+    int Resident;
+    int Queued;
+    int Loading;
+    int Failed;
+    size_t ResidentBytes;
+    size_t PendingBytes;            // Queued or loading
+    size_t BudgetBytes;
+    int LoadsCompleted;             // Since the scene was created
+    int Evictions;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// StreamingScene
+//
+class StreamingScene {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    StreamingScene(float cellSize=64.0f,size_t budgetBytes=256<<20,int ioThreads=2);
+    ~StreamingScene();
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // Adds a chunk; returns its index or -1 if the file can't be found.
+    int AddChunk(const char *filename,const Point3 &bmin,const Point3 &bmax);
+    // Adds every chunk listed in a manifest file.  Returns false on errors.
+    bool LoadManifest(const char *filename);
+
+    // Requests chunks within 'loadRadius' of the camera (nearest first),
+    // picks up finished loads and evicts to stay in budget.  Never blocks.
+    void Update(const Point3 &camera,float loadRadius);
+
+    // Draws every resident chunk with OpenGL
+    void Draw() const;
+
+    void SetBudget(size_t bytes)                    {m_Budget=bytes;}
+
+    // Queries
+    int GetChunkCount() const                       {return (int)m_Chunks.size();}
+    const StreamChunk &GetChunk(int i) const        {return *m_Chunks[i];}
+    // Fraction of the wanted chunks that are resident (1 when nothing is wanted)
+    float GetProgress() const;
+    StreamStats GetStats() const;
+
+private:
+    long long CellKey(int cx,int cy,int cz) const;
+    void CellOf(const Point3 &p,int cell[3]) const;
+    bool EvictFor(size_t bytes);
+    void IOThread();
+
+    // Not copyable
+    StreamingScene(const StreamingScene &);
+    StreamingScene &operator=(const StreamingScene &);
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    float m_CellSize;
+    size_t m_Budget;
+    std::vector<StreamChunk*> m_Chunks;
+    std::unordered_map<long long,std::vector<int> > m_Cells;
+    int m_CellLo[3], m_CellHi[3];   // Range of cells that have chunks
+
+    // Frame thread state
+    unsigned int m_Frame;
+    size_t m_ResidentBytes, m_PendingBytes;
+    int m_Wanted, m_WantedResident;
+    int m_LoadsCompleted, m_Evictions;
+    std::vector<StreamChunk*> m_Pending;    // Queued or loading
+    std::vector<StreamChunk*> m_Resident;
+    std::vector<StreamChunk*> m_WantedList; // Scratch for Update
+    std::vector<StreamChunk*> m_Waiting;    // Scratch for Update
+
+    // Shared with the I/O threads, guarded by m_Lock
+    struct Completion {StreamChunk *Chunk; Mesh *Data;};
+    std::mutex m_Lock;
+    std::condition_variable m_Wake;
+    std::deque<StreamChunk*> m_Requests;    // Nearest first
+    std::vector<Completion> m_Completed;
+    std::vector<Mesh*> m_Unloads;   // Evicted meshes for the I/O threads to free
+    bool m_Quit;
+
+    std::vector<std::thread> m_Threads;
+};
+
+#endif
@@ -0,0 +1,316 @@
+/////////////////////////////////////////////////////////////////////////////
+// texture.cpp
+/////////////////////////////////////
+// Texture layouts, mip generation and filtering.
+/////////////////////////////////////////////////////////////////////////////
+
+#include "texture.h"
+#include "simd.h"
+
+static inline bool IsPowerOfTwo(int n)              {return n > 0 && (n & (n-1)) == 0;}
+static inline float Lerp(float a,float b,float t)   {return a + t*(b - a);}
+
+static inline int Log2(int n)
+{
+    int bits = 0;
+    while((1 << bits) < n)
+        bits++;
+    return bits;
+}
+
+// Rounded average of four texels, a byte at a time
+static inline unsigned int Average4(unsigned int a,unsigned int b,unsigned int c,unsigned int d)
+{
+    unsigned int r = 0;
+    for(int s = 0; s < 32; s += 8) {
+        unsigned int sum = ((a >> s) & 0xff) + ((b >> s) & 0xff) + ((c >> s) & 0xff) + ((d >> s) & 0xff) + 2;
+        r |= (sum >> 2) << s;
+    }
+    return r;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Texture constructor/destructor
+/////////////////////////////////////////////////////////////////////////////
+Texture::Texture()
+{
+    m_Levels = 0;
+    m_Layout = TEXTURE_MORTON;
+    m_Alloc = m_Data = 0;
+    m_Size = 0;
+}
+
+Texture::~Texture()
+{
+    Free();
+}
+
+void Texture::Free()
+{
+    delete [] m_Alloc;
+    m_Alloc = m_Data = 0;
+    m_Size = 0;
+    m_Levels = 0;
+    m_Spread.clear();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Create
+// Arguments:      Size, row major texels and the layout to store them in
+// Returns:        false if the size is not usable
+// Side Effects:   Replaces the texture and builds the mip chain
+// Notes:          In Morton order, bit i of x goes to address bit 2i and
+//                 bit i of y to 2i+1 while both have bits; past that the
+//                 longer side's bit i goes to bit m+i, m being the shorter
+//                 side's bit count.
+/////////////////////////////////////////////////////////////////////////////
+bool Texture::Create(int width,int height,const unsigned int *texels,TextureLayout layout)
+{
+    Free();
+    if(!IsPowerOfTwo(width) || !IsPowerOfTwo(height)) {
+        printf("Texture: %dx%d is not a power of two on both sides\n",width,height);
+        return false;
+    }
+    int levels = 1 + Log2(width > height ? width : height);
+    if(levels > TEXTURE_MAX_LEVELS) {
+        printf("Texture: %dx%d is too large\n",width,height);
+        return false;
+    }
+
+    // Room for every level's texels and lookup tables
+    size_t texelCount = 0, spreadCount = 0;
+    for(int l = 0; l < levels; l++) {
+        int w = width >> l > 0 ? width >> l : 1;
+        int h = height >> l > 0 ? height >> l : 1;
+        texelCount += (size_t)w*h;
+        spreadCount += w + h;
+    }
+    m_Alloc = new unsigned int[texelCount + TEXTURE_ALIGN/sizeof(unsigned int)];
+    m_Data = (unsigned int*)(((size_t)m_Alloc + TEXTURE_ALIGN-1) & ~(size_t)(TEXTURE_ALIGN-1));
+    m_Size = texelCount;
+    m_Spread.resize(spreadCount);
+    m_Layout = layout;
+    m_Levels = levels;
+
+    size_t texelOffset = 0, spreadOffset = 0;
+    for(int l = 0; l < levels; l++) {
+        Level &L = m_Level[l];
+        L.Width = width >> l > 0 ? width >> l : 1;
+        L.Height = height >> l > 0 ? height >> l : 1;
+        L.FWidth = (float)L.Width;
+        L.FHeight = (float)L.Height;
+        L.Texels = m_Data + texelOffset;
+        unsigned int *sx = &m_Spread[spreadOffset], *sy = sx + L.Width;
+        L.SpreadX = sx;
+        L.SpreadY = sy;
+        texelOffset += (size_t)L.Width*L.Height;
+        spreadOffset += L.Width + L.Height;
+
+        int xbits = Log2(L.Width), ybits = Log2(L.Height);
+        int common = xbits < ybits ? xbits : ybits;
+        for(int x = 0; x < L.Width; x++) {
+            unsigned int a = 0;
+            if(layout == TEXTURE_LINEAR)
+                a = x;
+            else {
+                for(int i = 0; i < xbits; i++)
+                    if(x & (1 << i))
+                        a |= 1u << (i < common ? 2*i : common + i);
+            }
+            sx[x] = a;
+        }
+        for(int y = 0; y < L.Height; y++) {
+            unsigned int a = 0;
+            if(layout == TEXTURE_LINEAR)
+                a = y*L.Width;
+            else {
+                for(int i = 0; i < ybits; i++)
+                    if(y & (1 << i))
+                        a |= 1u << (i < common ? 2*i+1 : common + i);
+            }
+            sy[y] = a;
+        }
+    }
+
+    for(int y = 0; y < height; y++)
+        for(int x = 0; x < width; x++)
+            SetTexel(0,x,y,texels[y*width + x]);
+
+    // Each level is the 2x2 average of the one above it.  A side already
+    // down to one texel averages that texel with itself.
+    for(int l = 1; l < levels; l++) {
+        const Level &P = m_Level[l-1];
+        const Level &L = m_Level[l];
+        for(int y = 0; y < L.Height; y++) {
+            int y0 = 2*y, y1 = 2*y+1 < P.Height ? 2*y+1 : P.Height-1;
+            for(int x = 0; x < L.Width; x++) {
+                int x0 = 2*x, x1 = 2*x+1 < P.Width ? 2*x+1 : P.Width-1;
+                SetTexel(l,x,y,Average4(GetTexel(l-1,x0,y0),GetTexel(l-1,x1,y0),
+                                        GetTexel(l-1,x0,y1),GetTexel(l-1,x1,y1)));
+            }
+        }
+    }
+    return true;
+}
+
+unsigned int Texture::GetTexel(int level,int x,int y) const
+{
+    const Level &L = m_Level[level];
+    return L.Texels[L.SpreadX[x & (L.Width-1)] | L.SpreadY[y & (L.Height-1)]];
+}
+
+void Texture::SetTexel(int level,int x,int y,unsigned int c)
+{
+    const Level &L = m_Level[level];
+    L.Texels[L.SpreadX[x] | L.SpreadY[y]] = c;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Footprint
+// Arguments:      Level, texture coordinates, and where to put the texels
+//                 and weights
+// Returns:        none
+// Side Effects:   texels[] gets (x0,y0), (x1,y0), (x0,y1), (x1,y1)
+/////////////////////////////////////////////////////////////////////////////
+void Texture::Footprint(int level,float u,float v,unsigned int *texels,float &fx,float &fy) const
+{
+    const Level &L = m_Level[level];
+    float x = u*L.FWidth - 0.5f, y = v*L.FHeight - 0.5f;
+    float xf = floorf(x), yf = floorf(y);
+    fx = x - xf;
+    fy = y - yf;
+    int x0 = (int)xf & (L.Width-1), y0 = (int)yf & (L.Height-1);
+    int x1 = (x0 + 1) & (L.Width-1), y1 = (y0 + 1) & (L.Height-1);
+    unsigned int ax0 = L.SpreadX[x0], ax1 = L.SpreadX[x1];
+    unsigned int ay0 = L.SpreadY[y0], ay1 = L.SpreadY[y1];
+    texels[0] = L.Texels[ax0 | ay0];
+    texels[1] = L.Texels[ax1 | ay0];
+    texels[2] = L.Texels[ax0 | ay1];
+    texels[3] = L.Texels[ax1 | ay1];
+}
+
+// One channel of a bilinear footprint
+static inline float BilerpChannel(const unsigned int *t,int shift,float fx,float fy)
+{
+    float c00 = (float)((t[0] >> shift) & 0xff), c10 = (float)((t[1] >> shift) & 0xff);
+    float c01 = (float)((t[2] >> shift) & 0xff), c11 = (float)((t[3] >> shift) & 0xff);
+    return Lerp(Lerp(c00,c10,fx),Lerp(c01,c11,fx),fy);
+}
+
+unsigned int Texture::SampleBilinear(float u,float v,int level) const
+{
+    unsigned int t[4];
+    float fx, fy;
+    Footprint(level,u,v,t,fx,fy);
+    unsigned int c = 0;
+    for(int s = 0; s < 32; s += 8)
+        c |= (unsigned int)(int)(BilerpChannel(t,s,fx,fy) + 0.5f) << s;
+    return c;
+}
+
+// Splits a level of detail into the two levels and the blend between them
+static inline void SplitLod(float lod,int levels,int &l0,int &l1,float &frac)
+{
+    if(!(lod > 0.0f))
+        lod = 0.0f;
+    if(lod > (float)(levels-1))
+        lod = (float)(levels-1);
+    l0 = (int)lod;
+    frac = lod - (float)l0;
+    l1 = l0 < levels-1 ? l0+1 : l0;
+}
+
+unsigned int Texture::SampleTrilinear(float u,float v,float lod) const
+{
+    int l0, l1;
+    float frac;
+    SplitLod(lod,m_Levels,l0,l1,frac);
+    unsigned int t0[4], t1[4];
+    float fx0, fy0, fx1, fy1;
+    Footprint(l0,u,v,t0,fx0,fy0);
+    Footprint(l1,u,v,t1,fx1,fy1);
+    unsigned int c = 0;
+    for(int s = 0; s < 32; s += 8) {
+        float a = BilerpChannel(t0,s,fx0,fy0);
+        float b = BilerpChannel(t1,s,fx1,fy1);
+        c |= (unsigned int)(int)(Lerp(a,b,frac) + 0.5f) << s;
+    }
+    return c;
+}
+
+#ifdef CSE167_SSE
+// One channel of four pixels' footprints: t[k] holds corner k of each pixel
+static inline __m128 BilerpChannel4(const __m128i *t,int shift,__m128 fx,__m128 fy)
+{
+    __m128i mask = _mm_set1_epi32(0xff);
+    __m128 c00 = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(t[0],shift),mask));
+    __m128 c10 = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(t[1],shift),mask));
+    __m128 c01 = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(t[2],shift),mask));
+    __m128 c11 = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(t[3],shift),mask));
+    __m128 top = _mm_add_ps(c00,_mm_mul_ps(fx,_mm_sub_ps(c10,c00)));
+    __m128 bottom = _mm_add_ps(c01,_mm_mul_ps(fx,_mm_sub_ps(c11,c01)));
+    return _mm_add_ps(top,_mm_mul_ps(fy,_mm_sub_ps(bottom,top)));
+}
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Sample4
+// Arguments:      Four pixels' u, v and level of detail, and where to put
+//                 their colors
+// Returns:        none
+// Notes:          Same results as SampleTrilinear() on each pixel
+/////////////////////////////////////////////////////////////////////////////
+void Texture::Sample4(const float *u,const float *v,const float *lod,unsigned int *out) const
+{
+#ifdef CSE167_SSE
+    CSE167_ALIGN(16) unsigned int t0[4][4], t1[4][4];  // [corner][pixel]
+    CSE167_ALIGN(16) float fx0[4], fy0[4], fx1[4], fy1[4], frac[4];
+    for(int p = 0; p < 4; p++) {
+        int l0, l1;
+        unsigned int t[4];
+        SplitLod(lod[p],m_Levels,l0,l1,frac[p]);
+        Footprint(l0,u[p],v[p],t,fx0[p],fy0[p]);
+        t0[0][p] = t[0]; t0[1][p] = t[1]; t0[2][p] = t[2]; t0[3][p] = t[3];
+        Footprint(l1,u[p],v[p],t,fx1[p],fy1[p]);
+        t1[0][p] = t[0]; t1[1][p] = t[1]; t1[2][p] = t[2]; t1[3][p] = t[3];
+    }
+
+    __m128i a[4], b[4];
+    for(int k = 0; k < 4; k++) {
+        a[k] = _mm_load_si128((const __m128i*)t0[k]);
+        b[k] = _mm_load_si128((const __m128i*)t1[k]);
+    }
+    __m128 vfx0 = _mm_load_ps(fx0), vfy0 = _mm_load_ps(fy0);
+    __m128 vfx1 = _mm_load_ps(fx1), vfy1 = _mm_load_ps(fy1);
+    __m128 vfrac = _mm_load_ps(frac), half = _mm_set1_ps(0.5f);
+    __m128i color = _mm_setzero_si128();
+    for(int s = 0; s < 32; s += 8) {
+        __m128 c0 = BilerpChannel4(a,s,vfx0,vfy0);
+        __m128 c1 = BilerpChannel4(b,s,vfx1,vfy1);
+        __m128 c = _mm_add_ps(c0,_mm_mul_ps(vfrac,_mm_sub_ps(c1,c0)));
+        color = _mm_or_si128(color,_mm_slli_epi32(_mm_cvttps_epi32(_mm_add_ps(c,half)),s));
+    }
+    _mm_storeu_si128((__m128i*)out,color);
+#else
+    for(int p = 0; p < 4; p++)
+        out[p] = SampleTrilinear(u[p],v[p],lod[p]);
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           ComputeLod
+// Arguments:      Squared size of a pixel's footprint, in level 0 texels
+// Returns:        The level of detail, 0.5*log2(rho2)
+// Notes:          log2 is read straight off the float's exponent, with the
+//                 mantissa as a straight line between powers of two.  It is
+//                 never off by more than 0.09, which only shifts the blend
+//                 between two levels slightly.
+/////////////////////////////////////////////////////////////////////////////
+float Texture::ComputeLod(float rho2)
+{
+    if(!(rho2 > 0.0f))
+        return 0.0f;
+    int bits;
+    memcpy(&bits,&rho2,sizeof(bits));
+    return 0.5f*(float)(bits - (127 << 23))*(1.0f/(1 << 23));
+}
@@ -0,0 +1,141 @@
+/////////////////////////////////////////////////////////////////////////////
+// texture.h
+//
+/////////////////////////////////////
+// Classes declared:
+//
+// Texture: An RGBA8 texture with a full mip chain, for the CPU rasterizer.
+//          Texels are packed 32 bit values like the Rasterizer's colors;
+//          each byte is filtered on its own, so the channel order does not
+//          matter.
+//
+//          Each level is stored in one of two layouts:
+//
+//          TEXTURE_LINEAR  row after row, as the texels were given
+//          TEXTURE_MORTON  in Morton (Z) order: the bits of x and y are
+//                          interleaved to make the address, so every
+//                          aligned 4x4 block is 16 consecutive texels (one
+//                          64 byte cache line), every 8x8 block is four of
+//                          those, and so on.  A bilinear footprint, or a
+//                          run of pixels walking the texture in any
+//                          direction, touches far fewer lines than in rows.
+//
+//          Non-square levels interleave as many bits as the smaller side
+//          has and put the longer side's remaining bits on top.  Both
+//          layouts go through the same per-level lookup tables, x and y
+//          each mapped to their part of the address and or'ed, so the
+//          sampling code is the same for both.
+//
+//          Sample4() filters four pixels at once with SSE: the texel
+//          addresses are worked out one pixel at a time (there is no gather
+//          before AVX2), then the texels are spread into one float register
+//          per channel and all the bilinear and trilinear blending is done
+//          four pixels wide.  SampleTrilinear() is the same thing for one
+//          pixel and gives bit for bit the same results.
+//
+// Sizes must be powers of two.  Coordinates wrap (repeat).  Texel centers
+// are at half integers, as in OpenGL.
+//
+/////////////////////////////////////
+// Common Operations Supported:
+//
+// Texture t;
+// t.Create(256,256,rgba);                         // Builds the mip chain
+// unsigned int c = t.SampleBilinear(u,v,0);
+// unsigned int c = t.SampleTrilinear(u,v,lod);
+// t.Sample4(u4,v4,lod4,out4);                     // SSE, 4 pixels
+// float lod = Texture::ComputeLod(rho2);          // From the squared footprint
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSE167_TEXTURE_H_
+#define CSE167_TEXTURE_H_
+
+#include "core.h"
+#include <vector>
+
+#define TEXTURE_ALIGN           64          // Start of the texels, in bytes
+#define TEXTURE_MAX_LEVELS      16          // Up to 32768 texels on a side
+
+enum TextureLayout {
+    TEXTURE_LINEAR,
+    TEXTURE_MORTON
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// Texture
+//
+class Texture {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    Texture();
+    ~Texture();
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // Copies 'texels' (row major, width*height of them) into the chosen
+    // layout and builds the mip chain with a 2x2 box filter.  Returns false
+    // (and prints why) if a size is not a power of two.
+    bool Create(int width,int height,const unsigned int *texels,TextureLayout layout=TEXTURE_MORTON);
+    void Free();
+
+    // Level 'level's texel at (x,y), wrapped
+    unsigned int GetTexel(int level,int x,int y) const;
+
+    // Bilinear filtering of one level
+    unsigned int SampleBilinear(float u,float v,int level) const;
+
+    // Bilinear filtering of the two levels around 'lod', blended.  'lod' is
+    // clamped to the chain; at or below 0 this is level 0 bilinear.
+    unsigned int SampleTrilinear(float u,float v,float lod) const;
+
+    // SampleTrilinear() for four pixels
+    void Sample4(const float *u,const float *v,const float *lod,unsigned int *out) const;
+
+    // The level of detail for a pixel whose footprint is 'rho2' square
+    // level 0 texels: half of an approximate log2
+    static float ComputeLod(float rho2);
+
+    // Accessors
+    bool IsEmpty() const                            {return m_Levels == 0;}
+    int GetWidth(int level=0) const                 {return m_Level[level].Width;}
+    int GetHeight(int level=0) const                {return m_Level[level].Height;}
+    int GetLevelCount() const                       {return m_Levels;}
+    TextureLayout GetLayout() const                 {return m_Layout;}
+    size_t GetDataSize() const                      {return m_Size*sizeof(unsigned int);}
+
+private:
+    struct Level {
+        int Width, Height;
+        float FWidth, FHeight;
+        unsigned int *Texels;
+        const unsigned int *SpreadX;    // x's bits of the address, by x
+        const unsigned int *SpreadY;    // y's bits of the address, by y
+    };
+
+    // The four texels around (u,v) on 'level', and the weights between them
+    void Footprint(int level,float u,float v,unsigned int *texels,float &fx,float &fy) const;
+    void SetTexel(int level,int x,int y,unsigned int c);
+
+    // Not copyable
+    Texture(const Texture &);
+    Texture &operator=(const Texture &);
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    int m_Levels;
+    TextureLayout m_Layout;
+    Level m_Level[TEXTURE_MAX_LEVELS];
+    unsigned int *m_Alloc, *m_Data;             // m_Data is m_Alloc aligned to TEXTURE_ALIGN
+    size_t m_Size;                              // Texels over all levels
+    std::vector<unsigned int> m_Spread;         // Every level's SpreadX and SpreadY
+};
+
+#endif
@@ -0,0 +1,33 @@
+/////////////////////////////////////////////////////////////////////////////
+// timer.cpp
+/////////////////////////////////////////////////////////////////////////////
+
+#include "timer.h"
+#include "core.h"
+
+#ifndef WIN32
+#include <time.h>
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Now
+// Arguments:      none
+// Returns:        Milliseconds from an arbitrary fixed point in time
+// Notes:          Uses the performance counter on Windows and the monotonic
+//                 clock elsewhere, so it never jumps when the date changes.
+/////////////////////////////////////////////////////////////////////////////
+double Timer::Now()
+{
+#ifdef WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER count;
+    if(freq.QuadPart == 0)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return 1000.0*(double)count.QuadPart/(double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return 1000.0*(double)ts.tv_sec + 1e-6*(double)ts.tv_nsec;
+#endif
+}
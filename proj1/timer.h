@@ -0,0 +1,50 @@
+/////////////////////////////////////////////////////////////////////////////
+// timer.h
+//
+/////////////////////////////////////
+// Classes declared:
+//
+// Timer: A high resolution wall clock timer for instrumenting frame stages.
+//
+/////////////////////////////////////
+// Common Operations Supported:
+//
+// Timer t;                // Starts timing
+// t.Start();              // Restarts timing
+// double ms = t.GetMs();  // Milliseconds since the last Start()
+// double now = Timer::Now();  // Milliseconds since some fixed point
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSE167_TIMER_H_
+#define CSE167_TIMER_H_
+
+/////////////////////////////////////////////////////////////////////////////
+// Timer
+//
+class Timer {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    Timer()                                         {Start();}
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    void Start()                                    {m_Start = Now();}
+    double GetMs() const                            {return Now() - m_Start;}
+
+    // Current time in milliseconds from an arbitrary fixed origin
+    static double Now();
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    double m_Start;
+};
+
+#endif
@@ -0,0 +1,119 @@
+/////////////////////////////////////////////////////////////////////////////
+// transformcache.cpp
+/////////////////////////////////////
+// Per object cache of world space points.
+/////////////////////////////////////////////////////////////////////////////
+
+#include "transformcache.h"
+#include "jobs.h"
+#include "timer.h"
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Print
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Prints the counters to stdout
+/////////////////////////////////////////////////////////////////////////////
+void TransformCacheStats::Print() const
+{
+    printf("transform cache: %d hits, %d misses (%.1f%% hit rate), %.3f ms\n",
+           Hits,Misses,100.0f*GetHitRate(),UpdateMs);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           TransformCache constructor
+/////////////////////////////////////////////////////////////////////////////
+TransformCache::TransformCache()
+{
+    m_PointCount = 0;
+    m_Frame = 1;
+    m_Stats.Reset();
+}
+
+void TransformCache::Create(const Point3 *points,int count)
+{
+    m_Local.assign(points,points + count);
+    m_PointCount = count;
+    m_Cached.clear();
+    m_Requested.clear();
+    m_Valid.clear();
+    m_LastFrame.clear();
+    m_Missed.clear();
+    m_Touched.clear();
+    m_World.clear();
+}
+
+int TransformCache::AddSlots(int count)
+{
+    int first = GetSlotCount();
+    int slots = first + count;
+    m_Cached.resize(slots);
+    m_Requested.resize(slots);
+    m_Valid.resize(slots,0);
+    m_LastFrame.resize(slots,0);
+    m_Missed.resize(slots,0);
+    m_World.resize((size_t)slots*m_PointCount*3);
+    return first;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Request
+// Arguments:      Slot and the Matrix its object is drawn with
+// Returns:        none
+// Notes:          If a slot is requested twice in a frame the last Matrix
+//                 wins; callers compare GetMatrix() with theirs to tell.
+/////////////////////////////////////////////////////////////////////////////
+void TransformCache::Request(int slot,const Matrix &world)
+{
+    if(m_LastFrame[slot] != m_Frame) {
+        m_LastFrame[slot] = m_Frame;
+        m_Touched.push_back(slot);
+    }
+    m_Requested[slot] = world;
+}
+
+void TransformCache::UpdateSlot(int slot)
+{
+    const Matrix &world = m_Requested[slot];
+    if(m_Valid[slot] && memcmp(m_Cached[slot].m_m,world.m_m,sizeof(world.m_m)) == 0) {
+        m_Missed[slot] = 0;
+        return;
+    }
+    const float *m = world.m_m;
+    float *out = &m_World[(size_t)slot*m_PointCount*3];
+    for(int i = 0; i < m_PointCount; i++) {
+        const Point3 &p = m_Local[i];
+        *out++ = m[0]*p.x + m[4]*p.y + m[8]*p.z + m[12];
+        *out++ = m[1]*p.x + m[5]*p.y + m[9]*p.z + m[13];
+        *out++ = m[2]*p.x + m[6]*p.y + m[10]*p.z + m[14];
+    }
+    m_Cached[slot] = world;
+    m_Valid[slot] = 1;
+    m_Missed[slot] = 1;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Name:           Update
+// Arguments:      none
+// Returns:        none
+// Side Effects:   Brings this frame's slots up to date on the job pool and
+//                 starts the next frame
+/////////////////////////////////////////////////////////////////////////////
+void TransformCache::Update()
+{
+    Timer timer;
+    int count = (int)m_Touched.size();
+    ParallelFor(count,TRANSFORM_CACHE_GRAIN,[this](int begin,int end,int) {
+        for(int i = begin; i < end; i++)
+            UpdateSlot(m_Touched[i]);
+    });
+
+    m_Stats.Reset();
+    for(int i = 0; i < count; i++)
+        m_Stats.Misses += m_Missed[m_Touched[i]];
+    m_Stats.Hits = count - m_Stats.Misses;
+    m_Stats.UpdateMs = timer.GetMs();
+
+    m_Touched.clear();
+    m_Frame++;
+}
@@ -0,0 +1,115 @@
+/////////////////////////////////////////////////////////////////////////////
+// transformcache.h
+//
+/////////////////////////////////////
+// Classes declared:
+//
+// TransformCache: World space copies of a fixed set of local points (the
+//                 corners of the cube, say) for many objects, kept from
+//                 frame to frame.  Each object has a slot that remembers
+//                 the Matrix its points were last transformed by; when an
+//                 object is drawn with the same Matrix again (bit for bit)
+//                 its points are reused instead of transformed.
+//
+// TransformCacheStats: Hits and misses in the last Update().
+//
+// Objects are requested from the main thread as they are drawn, then
+// Update() retransforms just the requested slots whose Matrix changed, on
+// the job pool.  After that Get() is safe from any thread until the next
+// Request().  Keying by the Matrix itself rather than a version number
+// means callers need not track changes: matrices rebuilt every frame from
+// unchanged inputs still hit.
+//
+/////////////////////////////////////
+// Common Operations Supported:
+//
+// TransformCache tc;
+// tc.Create(corners,8);
+// int first = tc.AddSlots(objects);
+// tc.Request(first+i,world);                      // For each object drawn
+// tc.Update();
+// const float *xyz = tc.Get(first+i);             // 8 world points
+// tc.GetStats().Print();
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef CSE167_TRANSFORMCACHE_H_
+#define CSE167_TRANSFORMCACHE_H_
+
+#include "matrix.h"
+#include <vector>
+
+#define TRANSFORM_CACHE_GRAIN   256         // Slots per job
+
+/////////////////////////////////////////////////////////////////////////////
+// TransformCacheStats
+//
+struct TransformCacheStats {
+    void Reset()                                    {memset(this,0,sizeof(*this));}
+    void Print() const;
+    float GetHitRate() const                        {return Hits + Misses ? (float)Hits/(Hits + Misses) : 0.0f;}
+
+    int Hits;                       // Slots reused
+    int Misses;                     // Slots transformed
+    double UpdateMs;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// TransformCache
+//
+class TransformCache {
+
+////////////////////////////////
+// Constructors/Destructors
+//
+public:
+    TransformCache();
+
+////////////////////////////////
+// Local Procedures
+//
+public:
+    // The local points every slot holds.  Empties the cache.
+    void Create(const Point3 *points,int count);
+
+    // Adds 'count' empty slots and returns the first one's index
+    int AddSlots(int count);
+
+    // The object in 'slot' is drawn at 'world' this frame
+    void Request(int slot,const Matrix &world);
+
+    // Transforms the requested slots whose Matrix changed
+    void Update();
+
+    // The slot's points, x,y,z each, and the Matrix they were made with
+    const float *Get(int slot) const                {return &m_World[(size_t)slot*m_PointCount*3];}
+    const Matrix &GetMatrix(int slot) const         {return m_Cached[slot];}
+
+    // Accessors
+    int GetSlotCount() const                        {return (int)m_Cached.size();}
+    int GetPointCount() const                       {return m_PointCount;}
+    const TransformCacheStats &GetStats() const     {return m_Stats;}
+
+private:
+    void UpdateSlot(int slot);
+
+////////////////////////////////
+// Member Variables
+//
+private:
+    std::vector<Point3> m_Local;
+    int m_PointCount;
+
+    std::vector<Matrix> m_Cached;           // What each slot's points were made with
+    std::vector<Matrix> m_Requested;        // This frame's Matrix
+    std::vector<unsigned char> m_Valid;     // Slot has points
+    std::vector<unsigned int> m_LastFrame;  // Frame the slot was last requested
+    std::vector<unsigned char> m_Missed;    // Set by UpdateSlot
+    std::vector<int> m_Touched;             // Slots requested this frame
+    std::vector<float> m_World;
+    unsigned int m_Frame;
+
+    TransformCacheStats m_Stats;
+};
+
+#endif
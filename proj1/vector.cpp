@@ -82,31 +82,6 @@ void Vector3::Cross(const Vector3 a,const Vector3 b)
 	z = a.x * b.y - a.y * b.x;
 }
 
-/////////////////////////////////////////////////////////////////////////////
-// Name:           Normalize
-// Arguments:      none
-// Returns:        none
-// Side Effects:   Normalizes this vector              
-/////////////////////////////////////////////////////////////////////////////
-void Vector3::Normalize()
-{
-	//float magnitude = Mag();
-	//x = x/magnitude;
-	//y = y/magnitude;
-	//z = z/magnitude;
-	Scale(1.0f/Mag());
-}
-
-/////////////////////////////////////////////////////////////////////////////
-// Name:           Mag
-// Arguments:      none
-// Returns:        The magnitude of this vector
-/////////////////////////////////////////////////////////////////////////////
-float Vector3::Mag() const
-{
-	return sqrtf(MagSq());
-}
-
 /////////////////////////////////////////////////////////////////////////////
 // Name:           MagSq
 // Arguments:      none
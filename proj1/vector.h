@@ -63,6 +63,7 @@
 #define CSE167_VECTOR_H_
 
 #include "core.h"
+#include "mathpolicy.h"
 
 ////////////////////////////////
 // Forward Declarations
@@ -79,8 +80,8 @@ class Vector3 {
 // Constructors/Destructors
 //
 public:
-    Vector3()                                           {x=0.0f; y=0.0f; z=0.0f;}
-    Vector3(float x0,float y0,float z0)                 {x=x0; y=y0; z=z0;}
+    constexpr Vector3() : x(0.0f), y(0.0f), z(0.0f)     {}
+    constexpr Vector3(float x0,float y0,float z0) : x(x0), y(y0), z(z0) {}
 
 ////////////////////////////////
 // Local Procedures
@@ -104,12 +105,15 @@ public:
     // Sets 'this' equal to 'a (cross) b' 
     void Cross(const Vector3 a,const Vector3 b);
 
-    // Normalizes the vector (Mag==1)
-    void Normalize();
+    // Normalizes the vector (Mag==1).  'M' is ExactMath or FastMath (see
+    // mathpolicy.h); the plain version uses the build's MathPolicy.
+    template<class M> void Normalize()                  {Scale(M::Rsqrt(MagSq()));}
+    void Normalize()                                    {Normalize<MathPolicy>();}
     void Negate()                                       {x=-x; y=-y; z=-z;}
 
     // Magnitude of the vector (length)
-    float Mag() const;
+    template<class M> float Mag() const                 {return M::Sqrt(MagSq());}
+    float Mag() const                                   {return Mag<MathPolicy>();}
     // Magnitude squared of the vector
     float MagSq() const;
 
@@ -148,9 +152,9 @@ class Point3 {
 // Constructors/Destructors
 //
 public:
-    Point3()                                            {x=0.0f; y=0.0f; z=0.0f;}
-    Point3(float x0,float y0,float z0)                  {x=x0; y=y0; z=z0;}
-    explicit Point3(const Vector3 &v)                   {x=v.x; y=v.y; z=v.z;}
+    constexpr Point3() : x(0.0f), y(0.0f), z(0.0f)      {}
+    constexpr Point3(float x0,float y0,float z0) : x(x0), y(y0), z(z0) {}
+    constexpr explicit Point3(const Vector3 &v) : x(v.x), y(v.y), z(v.z) {}
 
 ////////////////////////////////
 // Local Procedures
@@ -170,7 +174,8 @@ public:
     void Negate()                                       {x=-x; y=-y; z=-z;}
 
     // Returns the distance between two points
-    float Dist(const Point3 a) const                    {return sqrt((x-a.x)*(x-a.x)+(y-a.y)*(y-a.y)+(z-a.z)*(z-a.z));}
+    template<class M> float Dist(const Point3 a) const  {return M::Sqrt(DistSq(a));}
+    float Dist(const Point3 a) const                    {return Dist<MathPolicy>(a);}
     // Returns the distance squared between two points
     float DistSq(const Point3 a) const                  {return (x-a.x)*(x-a.x)+(y-a.y)*(y-a.y)+(z-a.z)*(z-a.z);}
     // Linearly interpolate between two points
@@ -249,15 +254,25 @@ inline Vector3 operator*(const Vector3 &v, float f)
   return Vector3(v.x*f, v.y*f, v.z*f);
 }
 
-inline Vector3 operator/(const Vector3 &v, float f)
+// Divides every component by 'f' using policy 'M'
+template<class M> inline Vector3 Divide(const Vector3 &v, float f)
+{
+  return Vector3(M::Div(v.x,f), M::Div(v.y,f), M::Div(v.z,f));
+}
+template<> inline Vector3 Divide<FastMath>(const Vector3 &v, float f)
 {
-  f = 1./f;
+  f = FastMath::Rcp(f);
   return Vector3(v.x*f, v.y*f, v.z*f);
 }
 
+inline Vector3 operator/(const Vector3 &v, float f)
+{
+  return Divide<MathPolicy>(v,f);
+}
+
 inline Vector3 operator/(float f, const Vector3 &v)
 {
-  return Vector3(f/v.x, f/v.y, f/v.z);
+  return Vector3(MathPolicy::Div(f,v.x), MathPolicy::Div(f,v.y), MathPolicy::Div(f,v.z));
 }
 
 inline Point3  operator-(const Point3 &p) 